@@ -78,7 +78,7 @@ string JsonNode::AsString() const
 	return (static_cast<const JsonString*>(this))->Value();
 }
 
-int JsonNode::AsNumber() const
+int64_t JsonNode::AsNumber() const
 {
 	CheckType(JSON_NUMBER);
 	return (static_cast<const JsonNumber*>(this))->Value();
@@ -139,6 +139,11 @@ void JsonObject::Set(const string& member, int value)
 	Set(member, new JsonNumber(value));
 }
 
+void JsonObject::Set(const string& member, int64_t value)
+{
+	Set(member, new JsonNumber(value));
+}
+
 void JsonObject::Set(const string& member, bool value)
 {
 	Set(member, new JsonBool(value));
@@ -326,7 +331,7 @@ void JsonString::Serialize(string& result, bool indent, unsigned int indentWidth
 	result.append('"' + Value() + '"');
 }
 
-JsonNumber::JsonNumber(int value)
+JsonNumber::JsonNumber(int64_t value)
 	: JsonNode(JSON_NUMBER),
 	value(value)
 {
@@ -381,7 +386,7 @@ JsonNode* JsonParser::ParseNode()
 	case TOKEN_STRING:
 		return new JsonString(token);
 	case TOKEN_NUMBER:
-		return new JsonNumber(strtol(token.c_str(), NULL, 10));
+		return new JsonNumber(strtoll(token.c_str(), NULL, 10));
 	case TOKEN_TRUE:
 		return new JsonBool(true);
 	case TOKEN_FALSE:
@@ -28,6 +28,7 @@
 #include <iterator>
 #include <iostream>
 
+#include "base/basic_types.h"
 #include "base/lang.h"
 
 enum JsonType {
@@ -71,7 +72,7 @@ public:
 	const JsonArray* AsArray() const;
 
 	std::string AsString() const;
-	int AsNumber() const;
+	int64_t AsNumber() const;
 	bool AsBool() const;
 
 	virtual void Serialize(std::string& result,
@@ -108,6 +109,7 @@ public:
 	void Set(const std::string& member, const char* value);
 	void Set(const std::string& member, const std::string& value);
 	void Set(const std::string& member, int value);
+	void Set(const std::string& member, int64_t value);
 	void Set(const std::string& member, bool value);
 	void Remove(const std::string& member);
 
@@ -191,8 +193,8 @@ private:
 
 class JsonNumber: public JsonNode {
 public:
-	JsonNumber(int value);
-	int Value() const {
+	JsonNumber(int64_t value);
+	int64_t Value() const {
 		return value;
 	}
 	void Serialize(std::string& result,
@@ -201,7 +203,7 @@ public:
 	               unsigned int level = 0);
 
 private:
-	int value;
+	int64_t value;
 };
 
 class JsonBool: public JsonNode {
@@ -472,18 +472,21 @@ void DebugSession::relocateStoppoints(const SymbolTable* newTable, StoppointSet&
 
 	for (Stoppoint::Ptr sp : set) {
 		const AddressRange& origin = sp->getRange();
+		AddressRange range = origin;
 		const Symbol* symbol = symbolTable->Probe(origin.getASID(), origin.getStart(), true);
 		if (symbol != NULL) {
 			std::list<const Symbol*> dest = newTable->Lookup(symbol->getName(), symbol->getType());
 			if (dest.size() == 1) {
 				Word start = dest.front()->getStart() + symbol->Offset(origin.getStart());
 				Word end = start + (origin.getEnd() - origin.getStart());
-				rset.Add(AddressRange(origin.getASID(), start, end),
-				         sp->getAccessMode(), sp->getId(), sp->IsEnabled());
-				continue;
+				range = AddressRange(origin.getASID(), start, end);
 			}
 		}
-		rset.Add(origin, sp->getAccessMode(), sp->getId(), sp->IsEnabled());
+		if (rset.Add(range, sp->getAccessMode(), sp->getId(), sp->IsEnabled())) {
+			Stoppoint* relocated = rset.Get(rset.Size() - 1);
+			relocated->setCondition(sp->getCondition());
+			relocated->setIgnoreCount(sp->getIgnoreCount());
+		}
 	}
 
 	set = rset;
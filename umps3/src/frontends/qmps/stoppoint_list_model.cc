@@ -22,6 +22,7 @@
 
 #include <cassert>
 
+#include <QMessageBox>
 #include <QtDebug>
 
 #include "umps/stoppoint.h"
@@ -132,6 +133,9 @@ const char* const StoppointListModel::headers[StoppointListModel::N_COLUMNS] = {
 	"Type",
 	"ASID",
 	"Location",
+	"Condition",
+	"Ignore",
+	"Hits",
 	"Victims"
 };
 
@@ -224,6 +228,26 @@ QVariant StoppointListModel::data(const QModelIndex& index, int role) const
 			return Appl()->getMonospaceFont();
 		break;
 
+	case COLUMN_CONDITION:
+		if (role == Qt::DisplayRole || role == Qt::EditRole) {
+			if (sp->getCondition())
+				return QString(sp->getCondition()->getText().c_str());
+			return QString();
+		}
+		if (role == Qt::FontRole)
+			return Appl()->getMonospaceFont();
+		break;
+
+	case COLUMN_IGNORE_COUNT:
+		if (role == Qt::DisplayRole || role == Qt::EditRole)
+			return (qulonglong) sp->getIgnoreCount();
+		break;
+
+	case COLUMN_HIT_COUNT:
+		if (role == Qt::DisplayRole)
+			return (qulonglong) sp->getHitCount();
+		break;
+
 	case COLUMN_VICTIMS:
 		if (role == Qt::DisplayRole) {
 			QString cpus;
@@ -263,6 +287,8 @@ Qt::ItemFlags StoppointListModel::flags(const QModelIndex& index) const
 		return QAbstractTableModel::flags(index) | Qt::ItemIsUserCheckable;
 
 	case COLUMN_ACCESS_TYPE:
+	case COLUMN_CONDITION:
+	case COLUMN_IGNORE_COUNT:
 		return QAbstractTableModel::flags(index) | Qt::ItemIsEditable;
 
 	default:
@@ -291,6 +317,37 @@ bool StoppointListModel::setData(const QModelIndex& index, const QVariant& value
 		return true;
 	}
 
+	if (index.column() == COLUMN_CONDITION && role == Qt::EditRole) {
+		Stoppoint* sp = stoppoints->Get(index.row());
+		const std::string text = value.toString().trimmed().toStdString();
+		if (text.empty()) {
+			sp->setCondition(StoppointCondition::Ptr());
+		} else {
+			std::string error;
+			StoppointCondition* condition = StoppointCondition::Compile(text, error);
+			if (condition == NULL) {
+				QMessageBox::warning(
+					Appl()->getApplWindow(),
+					QString("%1: Error").arg(Appl()->applicationName()),
+					QString("<b>Invalid condition:</b> %1").arg(error.c_str()));
+				return false;
+			}
+			sp->setCondition(StoppointCondition::Ptr(condition));
+		}
+		Q_EMIT dataChanged(index, index);
+		return true;
+	}
+
+	if (index.column() == COLUMN_IGNORE_COUNT && role == Qt::EditRole) {
+		bool ok;
+		const qulonglong count = value.toULongLong(&ok);
+		if (!ok)
+			return false;
+		stoppoints->Get(index.row())->setIgnoreCount(count);
+		Q_EMIT dataChanged(index, index);
+		return true;
+	}
+
 	return false;
 }
 
@@ -316,6 +373,11 @@ void StoppointListModel::onEnabledChanged(size_t spIndex)
 
 void StoppointListModel::onMachineRan()
 {
+	// Hits which did not stop the machine are not signaled
+	if (stoppoints->Size() > 0)
+		Q_EMIT dataChanged(index(0, COLUMN_HIT_COUNT),
+		                   index(stoppoints->Size() - 1, COLUMN_HIT_COUNT));
+
 	for (unsigned int i = 0; i < stoppoints->Size(); i++) {
 		if (victims[i]) {
 			victims[i] = 0;
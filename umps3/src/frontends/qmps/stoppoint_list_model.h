@@ -78,6 +78,9 @@ public:
 		COLUMN_ACCESS_TYPE,
 		COLUMN_ASID,
 		COLUMN_ADDRESS_RANGE,
+		COLUMN_CONDITION,
+		COLUMN_IGNORE_COUNT,
+		COLUMN_HIT_COUNT,
 		COLUMN_VICTIMS,
 		N_COLUMNS
 	};
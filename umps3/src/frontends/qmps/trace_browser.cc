@@ -20,6 +20,8 @@
 
 #include "qmps/trace_browser.h"
 
+#include <algorithm>
+#include <cassert>
 #include <cctype>
 #include <boost/bind.hpp>
 
@@ -28,34 +30,43 @@
 #include <QGridLayout>
 #include <QSplitter>
 #include <QHBoxLayout>
+#include <QHeaderView>
 #include <QListView>
 #include <QLabel>
 #include <QComboBox>
 #include <QPalette>
+#include <QPushButton>
 #include <QStackedWidget>
+#include <QTableView>
+#include <QVBoxLayout>
 
 #include "base/lang.h"
 #include "umps/arch.h"
+#include "umps/machine.h"
+#include "umps/trace_buffer.h"
 #include "qmps/application.h"
 #include "qmps/debug_session.h"
 #include "qmps/hex_view.h"
 #include "qmps/trace_browser_priv.h"
+#include "qmps/ui_utils.h"
 
 TraceBrowser::TraceBrowser(QAction* insertTraceAct, QAction* removeTraceAct,
                            QWidget* parent)
 	: QWidget(parent),
 	dbgSession(Appl()->getDebugSession())
 {
+	delegateFactory.push_back(ViewDelegateType("Write Log",
+	                                           &TraceBrowser::createWriteLogView));
 #if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
 	delegateFactory.push_back(ViewDelegateType("Hex Dump (Big-endian)",
 	                                           boost::bind(&TraceBrowser::createHexView,
-	                                                       _1, _2, false)));
+	                                                       _1, false)));
 #endif
 	delegateFactory.push_back(ViewDelegateType("Hex Dump",
 	                                           boost::bind(&TraceBrowser::createHexView,
-	                                                       _1, _2, true)));
+	                                                       _1, true)));
 	delegateFactory.push_back(ViewDelegateType("ASCII",
-	                                           boost::bind(&AsciiView::Create, _1, _2)));
+	                                           &TraceBrowser::createAsciiView));
 
 	QGridLayout* layout = new QGridLayout(this);
 	layout->setContentsMargins(0, 0, 0, 0);
@@ -148,16 +159,14 @@ void TraceBrowser::onSelectionChanged(const QItemSelection& selected)
 		Stoppoint* sp = selectedTracepoint();
 		ViewDelegateMap::iterator it = viewMap.find(sp->getId());
 		if (it == viewMap.end()) {
-			const AddressRange& r = sp->getRange();
 			ViewDelegateInfo info;
 			info.type = kDefaultViewDelegate;
-			info.widget = delegateFactory[kDefaultViewDelegate].ctor(r.getStart(), r.getEnd());
+			info.widget = delegateFactory[kDefaultViewDelegate].ctor(sp);
 			viewMap[sp->getId()] = info;
 			viewStack->setCurrentIndex(viewStack->addWidget(info.widget));
 			delegateTypeCombo->setCurrentIndex(kDefaultViewDelegate);
 		} else if (it->second.widget.isNull()) {
-			const AddressRange& r = sp->getRange();
-			it->second.widget = delegateFactory[it->second.type].ctor(r.getStart(), r.getEnd());
+			it->second.widget = delegateFactory[it->second.type].ctor(sp);
 			viewStack->setCurrentIndex(viewStack->addWidget(it->second.widget));
 			delegateTypeCombo->setCurrentIndex(it->second.type);
 		} else {
@@ -198,9 +207,8 @@ void TraceBrowser::onDelegateTypeChanged(int index)
 	assert(sp != NULL);
 
 	if (viewMap[sp->getId()].type != index) {
-		const AddressRange& r = sp->getRange();
 		delete viewMap[sp->getId()].widget;
-		viewMap[sp->getId()].widget = delegateFactory[index].ctor(r.getStart(), r.getEnd());
+		viewMap[sp->getId()].widget = delegateFactory[index].ctor(sp);
 		viewMap[sp->getId()].type = index;
 		viewStack->setCurrentIndex(viewStack->addWidget(viewMap[sp->getId()].widget));
 	}
@@ -230,13 +238,25 @@ void TraceBrowser::removeTracepoint()
 	}
 }
 
-QWidget* TraceBrowser::createHexView(Word start, Word end, bool nativeOrder)
+QWidget* TraceBrowser::createWriteLogView(const Stoppoint* tracepoint)
 {
-	HexView* hexView = new HexView(start, end);
+	return WriteLogView::Create(debugSession->getMachine()->getTraceBuffer(tracepoint->getId()));
+}
+
+QWidget* TraceBrowser::createHexView(const Stoppoint* tracepoint, bool nativeOrder)
+{
+	const AddressRange& r = tracepoint->getRange();
+	HexView* hexView = new HexView(r.getStart(), r.getEnd());
 	hexView->setReversedByteOrder(!nativeOrder);
 	return hexView;
 }
 
+QWidget* TraceBrowser::createAsciiView(const Stoppoint* tracepoint)
+{
+	const AddressRange& r = tracepoint->getRange();
+	return AsciiView::Create(r.getStart(), r.getEnd());
+}
+
 
 TracepointListModel::TracepointListModel(StoppointSet* spSet, QObject* parent)
 	: BaseStoppointListModel(spSet, parent),
@@ -343,3 +363,216 @@ void AsciiView::Refresh()
 
 	setPlainText(buffer);
 }
+
+
+WriteLogModel::WriteLogModel(const TraceBuffer::Ptr& buffer, QObject* parent)
+	: QAbstractTableModel(parent),
+	buffer(buffer),
+	first(0)
+{
+	setFirst(0);
+}
+
+int WriteLogModel::rowCount(const QModelIndex& parent) const
+{
+	if (!parent.isValid())
+		return (int) records.size();
+	else
+		return 0;
+}
+
+int WriteLogModel::columnCount(const QModelIndex& parent) const
+{
+	if (!parent.isValid())
+		return N_COLUMNS;
+	else
+		return 0;
+}
+
+QVariant WriteLogModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+	if (role != Qt::DisplayRole)
+		return QVariant();
+
+	if (orientation == Qt::Horizontal) {
+		switch (section) {
+		case COLUMN_TOD:
+			return "Time of Day";
+		case COLUMN_CPU:
+			return "CPU";
+		case COLUMN_PC:
+			return "PC";
+		case COLUMN_ADDRESS:
+			return "Address";
+		case COLUMN_OLD_VALUE:
+			return "Old Value";
+		case COLUMN_NEW_VALUE:
+			return "New Value";
+		default:
+			return QVariant();
+		}
+	}
+
+	// Records are numbered by their serial number
+	if (orientation == Qt::Vertical)
+		return (qulonglong) (first + section);
+
+	return QVariant();
+}
+
+QVariant WriteLogModel::data(const QModelIndex& index, int role) const
+{
+	if (!index.isValid() || (size_t) index.row() >= records.size())
+		return QVariant();
+
+	const TraceRecord& r = records[index.row()];
+
+	if (role == Qt::DisplayRole) {
+		switch (index.column()) {
+		case COLUMN_TOD:
+			return (qulonglong) r.tod;
+		case COLUMN_CPU:
+			// Writes from devices and the clock
+			if (r.cpu == TraceRecord::kNoCpu)
+				return "-";
+			return r.cpu;
+		case COLUMN_PC:
+			if (r.cpu == TraceRecord::kNoCpu)
+				return QVariant();
+			return FormatAddress(r.pc);
+		case COLUMN_ADDRESS:
+			return FormatAddress(r.addr);
+		case COLUMN_OLD_VALUE:
+			return QString("0x%1").arg(r.oldValue, 8, 16, QChar('0'));
+		case COLUMN_NEW_VALUE:
+			return QString("0x%1").arg(r.newValue, 8, 16, QChar('0'));
+		default:
+			return QVariant();
+		}
+	}
+
+	if (role == Qt::FontRole)
+		return Appl()->getMonospaceFont();
+
+	return QVariant();
+}
+
+void WriteLogModel::setFirst(uint64_t first)
+{
+	beginResetModel();
+	const uint64_t end = first + kPageSize;
+	this->first = buffer->Read(first, kPageSize, &records);
+	// Past overwritten records, Read() may go on into the next page
+	if (this->first + records.size() > end)
+		records.resize((this->first < end) ? end - this->first : 0);
+	endResetModel();
+}
+
+WriteLogView::WriteLogView(const TraceBuffer::Ptr& buffer)
+	: QWidget(),
+	model(new WriteLogModel(buffer)),
+	following(true)
+{
+	QVBoxLayout* layout = new QVBoxLayout(this);
+	layout->setContentsMargins(0, 0, 0, 0);
+
+	QTableView* table = new QTableView;
+	table->setModel(model.get());
+	table->setSelectionBehavior(QAbstractItemView::SelectRows);
+	table->horizontalHeader()->setStretchLastSection(true);
+	layout->addWidget(table);
+
+	QHBoxLayout* pageLayout = new QHBoxLayout;
+	pageLabel = new QLabel;
+	pageLayout->addWidget(pageLabel, 1);
+	firstButton = new QPushButton("First");
+	connect(firstButton, SIGNAL(clicked()), this, SLOT(showFirstPage()));
+	pageLayout->addWidget(firstButton);
+	previousButton = new QPushButton("Previous");
+	connect(previousButton, SIGNAL(clicked()), this, SLOT(showPreviousPage()));
+	pageLayout->addWidget(previousButton);
+	nextButton = new QPushButton("Next");
+	connect(nextButton, SIGNAL(clicked()), this, SLOT(showNextPage()));
+	pageLayout->addWidget(nextButton);
+	lastButton = new QPushButton("Last");
+	connect(lastButton, SIGNAL(clicked()), this, SLOT(showLastPage()));
+	pageLayout->addWidget(lastButton);
+	layout->addLayout(pageLayout);
+
+	Refresh();
+}
+
+WriteLogView* WriteLogView::Create(const TraceBuffer::Ptr& buffer)
+{
+	assert(buffer);
+	return new WriteLogView(buffer);
+}
+
+void WriteLogView::Refresh()
+{
+	if (following)
+		showPage(latestPage());
+	else
+		showPage(std::max(model->getFirst() / WriteLogModel::kPageSize, oldestPage()));
+}
+
+void WriteLogView::showFirstPage()
+{
+	showPage(oldestPage());
+}
+
+void WriteLogView::showPreviousPage()
+{
+	const uint64_t page = model->getFirst() / WriteLogModel::kPageSize;
+	showPage(std::max(page, oldestPage() + 1) - 1);
+}
+
+void WriteLogView::showNextPage()
+{
+	const uint64_t page = model->getFirst() / WriteLogModel::kPageSize;
+	showPage(std::min(page + 1, latestPage()));
+}
+
+void WriteLogView::showLastPage()
+{
+	showPage(latestPage());
+}
+
+// The oldest page may be partly overwritten already
+uint64_t WriteLogView::oldestPage() const
+{
+	const TraceBuffer* buffer = model->getBuffer();
+	const uint64_t head = buffer->getHead();
+	const uint64_t oldest = (head > buffer->getCapacity()) ? head - buffer->getCapacity() : 0;
+	return oldest / WriteLogModel::kPageSize;
+}
+
+uint64_t WriteLogView::latestPage() const
+{
+	const uint64_t head = model->getBuffer()->getHead();
+	return (head > 0) ? (head - 1) / WriteLogModel::kPageSize : 0;
+}
+
+void WriteLogView::showPage(uint64_t page)
+{
+	model->setFirst(page * WriteLogModel::kPageSize);
+
+	const uint64_t latest = latestPage();
+	following = (page == latest);
+
+	const uint64_t head = model->getBuffer()->getHead();
+	if (model->rowCount() == 0) {
+		pageLabel->setText("No writes logged");
+	} else {
+		pageLabel->setText(QString("Writes %1 to %2 of %3")
+		                   .arg((qulonglong) model->getFirst())
+		                   .arg((qulonglong) (model->getFirst() + model->rowCount() - 1))
+		                   .arg((qulonglong) head));
+	}
+
+	const bool older = page > oldestPage();
+	firstButton->setEnabled(older);
+	previousButton->setEnabled(older);
+	nextButton->setEnabled(page < latest);
+	lastButton->setEnabled(page < latest);
+}
@@ -67,7 +67,7 @@ private:
 		QPointer<QWidget> widget;
 	};
 
-	typedef boost::function<QWidget * (Word, Word)> DelegateFactoryFunc;
+	typedef boost::function<QWidget * (const Stoppoint*)> DelegateFactoryFunc;
 
 	struct ViewDelegateType {
 		ViewDelegateType(const char* name, DelegateFactoryFunc func)
@@ -79,7 +79,9 @@ private:
 
 	Stoppoint* selectedTracepoint() const;
 
-	static QWidget* createHexView(Word start, Word end, bool nativeOrder);
+	static QWidget* createWriteLogView(const Stoppoint* tracepoint);
+	static QWidget* createHexView(const Stoppoint* tracepoint, bool nativeOrder);
+	static QWidget* createAsciiView(const Stoppoint* tracepoint);
 
 	DebugSession* const dbgSession;
 
@@ -24,13 +24,19 @@
 #include <vector>
 #include <sigc++/sigc++.h>
 
+#include <QAbstractTableModel>
 #include <QPlainTextEdit>
+#include <QWidget>
 
+#include "base/lang.h"
 #include "base/trackable_mixin.h"
 #include "umps/types.h"
+#include "umps/trace_buffer.h"
 #include "qmps/stoppoint_list_model.h"
 #include "qmps/memory_view_delegate.h"
 
+class QLabel;
+class QPushButton;
 class Stoppoint;
 class StoppointSet;
 class Processor;
@@ -98,4 +104,77 @@ private:
 	const Word end;
 };
 
+// A page of the write log of a tracepoint: the records with serial
+// numbers from getFirst() on, as many as kPageSize, or fewer if some of
+// them were overwritten or are yet to come
+
+class WriteLogModel: public QAbstractTableModel {
+	Q_OBJECT
+
+public:
+	enum Column {
+		COLUMN_TOD,
+		COLUMN_CPU,
+		COLUMN_PC,
+		COLUMN_ADDRESS,
+		COLUMN_OLD_VALUE,
+		COLUMN_NEW_VALUE,
+		N_COLUMNS
+	};
+
+	static const unsigned int kPageSize = 256;
+
+	WriteLogModel(const TraceBuffer::Ptr& buffer, QObject* parent = 0);
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const;
+	int columnCount(const QModelIndex& parent = QModelIndex()) const;
+
+	QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const;
+
+	const TraceBuffer* getBuffer() const { return buffer.get(); }
+	uint64_t getFirst() const { return first; }
+
+// This method shows the page starting with serial number first
+	void setFirst(uint64_t first);
+
+private:
+	const TraceBuffer::Ptr buffer;
+	uint64_t first;
+	std::vector<TraceRecord> records;
+};
+
+class WriteLogView: public QWidget,
+public MemoryViewDelegate
+{
+	Q_OBJECT
+
+public:
+	static WriteLogView* Create(const TraceBuffer::Ptr& buffer);
+	virtual void Refresh();
+
+private Q_SLOTS:
+	void showFirstPage();
+	void showPreviousPage();
+	void showNextPage();
+	void showLastPage();
+
+private:
+	explicit WriteLogView(const TraceBuffer::Ptr& buffer);
+
+	uint64_t oldestPage() const;
+	uint64_t latestPage() const;
+	void showPage(uint64_t page);
+
+	scoped_ptr<WriteLogModel> model;
+	QLabel* pageLabel;
+	QPushButton* firstButton;
+	QPushButton* previousButton;
+	QPushButton* nextButton;
+	QPushButton* lastButton;
+
+// TRUE if the latest page is shown, and with it every new record
+	bool following;
+};
+
 #endif // QMPS_TRACE_BROWSER_PRIV_H
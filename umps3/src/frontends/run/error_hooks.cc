@@ -0,0 +1,36 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "umps/error.h"
+#include "run/job_farm.h"
+#include "run/runner.h"
+
+// A PANIC ends the run at once: stdio buffers (and with them device
+// log files) are flushed by exit(). On the threads of a job farm it
+// only ends the job being run
+void Panic(const char* message)
+{
+	if (JobFarm::OnJobThread())
+		throw JobPanic(message);
+
+	fprintf(stderr, "PANIC: %s\n", message);
+	exit(RUN_EXIT_PANIC);
+}
@@ -0,0 +1,263 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "run/fork_server.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/device.h"
+#include "umps/error.h"
+#include "umps/machine.h"
+
+ForkServer::ForkServer(Runner* runner, const std::string& outputDir, unsigned int jobs)
+	: runner(runner),
+	outputDir(outputDir),
+	jobs(jobs)
+{}
+
+bool ForkServer::LoadCases(const std::string& fileName, std::string& error)
+{
+	std::ifstream in(fileName.c_str());
+	if (!in) {
+		error = "cannot read test case list `" + fileName + "'";
+		return false;
+	}
+
+	// Input file names are relative to the directory of the list
+	const std::string dir = fileName.substr(0, fileName.rfind('/') + 1);
+
+	std::set<std::string> names;
+	std::string line;
+	for (unsigned int lineNo = 1; std::getline(in, line); lineNo++) {
+		std::istringstream fields(line);
+		TestCase tc;
+		if (!(fields >> tc.name) || tc.name[0] == '#')
+			continue;
+
+		const std::string where = str(boost::format("%s:%u: ") % fileName % lineNo);
+		if (tc.name.find('/') != std::string::npos || !names.insert(tc.name).second) {
+			error = where + "invalid or duplicate test case name `" + tc.name + "'";
+			return false;
+		}
+
+		std::string field;
+		while (fields >> field) {
+			static const char prefix[] = "terminal";
+			const size_t len = sizeof(prefix) - 1;
+			TestCase::Input input;
+			if (field.compare(0, len, prefix) != 0 || field.size() < len + 3 ||
+			    field[len] < '0' || field[len] >= '0' + N_DEV_PER_IL || field[len + 1] != '=')
+			{
+				error = where + "invalid terminal input `" + field + "'";
+				return false;
+			}
+			input.devNo = field[len] - '0';
+			input.fileName = field.substr(len + 2);
+			if (input.fileName[0] != '/')
+				input.fileName = dir + input.fileName;
+			tc.inputs.push_back(input);
+		}
+		cases.push_back(tc);
+	}
+
+	if (cases.empty()) {
+		error = "no test cases in `" + fileName + "'";
+		return false;
+	}
+	return true;
+}
+
+RunExitCode ForkServer::Run(const RunLimits& limits)
+{
+	static const char* const outcome[] = {
+		"halted", "error", "panic", "cycle limit reached", "time limit reached"
+	};
+
+	// Children only inherit the calling thread
+	runner->getMachine()->StopWorkers();
+
+	RunExitCode result = RUN_EXIT_HALT;
+	std::map<pid_t, size_t> running;
+	size_t next = 0;
+
+	while (next < cases.size() || !running.empty()) {
+		if (next < cases.size() && running.size() < jobs) {
+			// Buffered output must not be written by both processes
+			fflush(NULL);
+			pid_t pid = fork();
+			if (pid == 0)
+				runCase(cases[next], limits);
+			if (pid < 0) {
+				printf("%s: cannot fork: %s\n", cases[next].name.c_str(), strerror(errno));
+				result = RUN_EXIT_ERROR;
+			} else {
+				running[pid] = next;
+			}
+			next++;
+			continue;
+		}
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		std::map<pid_t, size_t>::iterator it = running.find(pid);
+		if (it == running.end())
+			continue;
+
+		const char* name = cases[it->second].name.c_str();
+		running.erase(it);
+		if (WIFEXITED(status) && WEXITSTATUS(status) <= RUN_EXIT_TIME_LIMIT) {
+			printf("%s: %s\n", name, outcome[WEXITSTATUS(status)]);
+			if (WEXITSTATUS(status) != RUN_EXIT_HALT)
+				result = RUN_EXIT_ERROR;
+		} else {
+			if (WIFSIGNALED(status))
+				printf("%s: killed by signal %d\n", name, WTERMSIG(status));
+			else
+				printf("%s: exited with status %d\n", name, WEXITSTATUS(status));
+			result = RUN_EXIT_ERROR;
+		}
+		fflush(stdout);
+	}
+
+	return result;
+}
+
+// This method runs a test case in a child process, which exits with the
+// outcome of the run: the machine is used as the fork left it, and the
+// parent never sees its changes
+void ForkServer::runCase(const TestCase& tc, const RunLimits& limits)
+{
+	std::string error;
+	if (!redirectOutput(tc, error) || !copyImages(tc, error) || !feedInput(tc, error)) {
+		fprintf(stderr, "%s: %s\n", tc.name.c_str(), error.c_str());
+		exit(RUN_EXIT_ERROR);
+	}
+
+	// exit() also flushes the device log files
+	exit(runner->Run(limits));
+}
+
+// This method gives every printer and terminal of the machine the log
+// file outputDir/NAME.printerN or outputDir/NAME.terminalN
+bool ForkServer::redirectOutput(const TestCase& tc, std::string& error)
+{
+	static const struct {
+		const char* name;
+		unsigned int il;
+		unsigned int type;
+	} devices[] = {
+		{ "printer", EXT_IL_INDEX(IL_PRINTER), PRNTDEV },
+		{ "terminal", EXT_IL_INDEX(IL_TERMINAL), TERMDEV }
+	};
+
+	Machine* machine = runner->getMachine();
+	for (const auto& d : devices) {
+		for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+			Device* dev = machine->getDevice(d.il, devNo);
+			if (dev->Type() != d.type)
+				continue;
+			const std::string fileName =
+				str(boost::format("%s/%s.%s%u") % outputDir % tc.name % d.name % devNo);
+			try {
+				dev->setLogFile(fileName);
+			} catch (const FileError& e) {
+				error = "cannot create `" + e.fileName + "'";
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// This method gives every disk and flash device of the machine a copy
+// of its image file, outputDir/NAME.diskN or outputDir/NAME.flashN: the
+// image files are left as they were at the fork, and cases never share
+// a file offset
+bool ForkServer::copyImages(const TestCase& tc, std::string& error)
+{
+	static const struct {
+		const char* name;
+		unsigned int il;
+		unsigned int type;
+	} devices[] = {
+		{ "disk", EXT_IL_INDEX(IL_DISK), DISKDEV },
+		{ "flash", EXT_IL_INDEX(IL_FLASH), FLASHDEV }
+	};
+
+	Machine* machine = runner->getMachine();
+	for (const auto& d : devices) {
+		for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+			Device* dev = machine->getDevice(d.il, devNo);
+			if (dev->Type() != d.type)
+				continue;
+			const std::string fileName =
+				str(boost::format("%s/%s.%s%u") % outputDir % tc.name % d.name % devNo);
+			try {
+				dev->setImageFile(fileName);
+			} catch (const FileError& e) {
+				error = str(boost::format("cannot copy the %s%u image: error accessing `%s'") %
+				            d.name % devNo % e.fileName);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// This method types the test case input on terminals, one line at a time
+bool ForkServer::feedInput(const TestCase& tc, std::string& error)
+{
+	Machine* machine = runner->getMachine();
+	for (const TestCase::Input& input : tc.inputs) {
+		Device* dev = machine->getDevice(EXT_IL_INDEX(IL_TERMINAL), input.devNo);
+		if (dev->Type() != TERMDEV) {
+			error = str(boost::format("terminal %u is not installed") % input.devNo);
+			return false;
+		}
+
+		std::ifstream in(input.fileName.c_str());
+		if (!in) {
+			error = "cannot read `" + input.fileName + "'";
+			return false;
+		}
+		std::string line;
+		while (std::getline(in, line))
+			dev->Input(line.c_str());
+	}
+	return true;
+}
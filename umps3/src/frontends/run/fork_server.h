@@ -0,0 +1,83 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RUN_FORK_SERVER_H
+#define RUN_FORK_SERVER_H
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "base/lang.h"
+#include "run/runner.h"
+
+// A TestCase is a run started from a common machine state: it has a
+// name, which also names its output files, and the input to be typed
+// on terminals, taken from files one line at a time.
+
+struct TestCase {
+	struct Input {
+		unsigned int devNo;
+		std::string fileName;
+	};
+
+	std::string name;
+	std::list<Input> inputs;
+};
+
+// A ForkServer runs a list of test cases on a machine which has already
+// been brought to their common starting point, each one in a child
+// process of its own: children share the machine memory with the parent
+// copy-on-write, so that the common part of the runs (typically the
+// boot) is only run once. Each child writes printer and terminal output
+// to its own files, and works on its own copy of disk and flash images.
+
+class ForkServer {
+public:
+	ForkServer(Runner* runner, const std::string& outputDir, unsigned int jobs);
+
+// This method reads the test case list from fileName. Each line holds
+// a case, as a name followed by any number of terminalN=FILE inputs;
+// empty lines and lines starting with `#' are skipped. Relative input
+// file names are made absolute. It returns false, with a description
+// in error, if the list is not valid
+	bool LoadCases(const std::string& fileName, std::string& error);
+
+	size_t getNumCases() const { return cases.size(); }
+
+// This method runs all test cases, up to jobs of them at a time,
+// reporting on standard output how each one ended. It returns
+// RUN_EXIT_HALT if all cases halted, RUN_EXIT_ERROR otherwise
+	RunExitCode Run(const RunLimits& limits);
+
+private:
+	void runCase(const TestCase& tc, const RunLimits& limits);
+	bool redirectOutput(const TestCase& tc, std::string& error);
+	bool copyImages(const TestCase& tc, std::string& error);
+	bool feedInput(const TestCase& tc, std::string& error);
+
+	Runner* const runner;
+	const std::string outputDir;
+	const unsigned int jobs;
+
+	std::vector<TestCase> cases;
+
+	DISABLE_COPY_AND_ASSIGNMENT(ForkServer);
+};
+
+#endif // RUN_FORK_SERVER_H
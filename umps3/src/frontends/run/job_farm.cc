@@ -0,0 +1,200 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "run/job_farm.h"
+
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <boost/format.hpp>
+
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/machine_config.h"
+
+// set on the threads of the pool, for Panic() to tell them apart
+HIDDEN thread_local bool jobThread = false;
+
+JobFarm::JobFarm(const std::string& outputDir, unsigned int threads)
+	: outputDir(outputDir),
+	threads(threads),
+	nextJob(0),
+	allHalted(true)
+{}
+
+bool JobFarm::LoadJobs(const std::string& fileName, std::string& error)
+{
+	std::ifstream in(fileName.c_str());
+	if (!in) {
+		error = "cannot read job manifest `" + fileName + "'";
+		return false;
+	}
+
+	// Configuration file names are relative to the directory of the manifest
+	const std::string dir = fileName.substr(0, fileName.rfind('/') + 1);
+
+	std::set<std::string> names;
+	std::string line;
+	for (unsigned int lineNo = 1; std::getline(in, line); lineNo++) {
+		std::istringstream fields(line);
+		Job job;
+		if (!(fields >> job.name) || job.name[0] == '#')
+			continue;
+
+		const std::string where = str(boost::format("%s:%u: ") % fileName % lineNo);
+		if (job.name.find('/') != std::string::npos || !names.insert(job.name).second) {
+			error = where + "invalid or duplicate job name `" + job.name + "'";
+			return false;
+		}
+		std::string extra;
+		if (!(fields >> job.configFile) || (fields >> extra)) {
+			error = where + "a job needs a name and a configuration file";
+			return false;
+		}
+		if (job.configFile[0] != '/')
+			job.configFile = dir + job.configFile;
+		jobs.push_back(job);
+	}
+
+	if (jobs.empty()) {
+		error = "no jobs in `" + fileName + "'";
+		return false;
+	}
+	return true;
+}
+
+RunExitCode JobFarm::Run(const RunLimits& limits)
+{
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads && i < jobs.size(); i++)
+		pool.push_back(std::thread(&JobFarm::work, this, limits));
+	work(limits);
+	for (std::thread& t : pool)
+		t.join();
+
+	return allHalted ? RUN_EXIT_HALT : RUN_EXIT_ERROR;
+}
+
+bool JobFarm::OnJobThread()
+{
+	return jobThread;
+}
+
+// This method is the body of each thread of the pool (the calling one
+// included): it runs jobs until none is left
+void JobFarm::work(const RunLimits& limits)
+{
+	jobThread = true;
+	size_t i;
+	while ((i = nextJob++) < jobs.size())
+		report(jobs[i], runJob(jobs[i], limits));
+	jobThread = false;
+}
+
+// This method builds the machine of a job and runs it; the machine
+// lives on the stack of the calling thread, and goes away with the
+// run. A PANIC unwinds the thread up to here
+JobFarm::Result JobFarm::runJob(const Job& job, const RunLimits& limits)
+{
+	Result result;
+	result.exitCode = RUN_EXIT_ERROR;
+	result.cycles = 0;
+	result.seconds = 0.0;
+
+	MachineConfig* config = MachineConfig::LoadFromFile(job.configFile, result.error);
+	if (config == NULL)
+		return result;
+	Runner runner(config);
+	setupConfig(job, config);
+
+	try {
+		if (!runner.Init(result.error))
+			return result;
+		result.exitCode = runner.Run(limits);
+	} catch (const JobPanic& e) {
+		result.exitCode = RUN_EXIT_PANIC;
+		result.error = e.what();
+	}
+	result.cycles = runner.getCycles();
+	result.seconds = runner.getSeconds();
+	return result;
+}
+
+// This method adapts a job configuration to the farm: file names become
+// absolute, since all jobs share the current directory; printers and
+// terminals write to outputDir/NAME.printerN and outputDir/NAME.terminalN;
+// processors do not run on threads of their own, as the pool already
+// keeps the host busy
+void JobFarm::setupConfig(const Job& job, MachineConfig* config)
+{
+	const std::string dir = job.configFile.substr(0, job.configFile.rfind('/') + 1);
+
+	for (unsigned int type = 0; type < N_ROM_TYPES; type++) {
+		const std::string& fileName = config->getROM((ROMType) type);
+		if (!fileName.empty() && fileName[0] != '/')
+			config->setROM((ROMType) type, dir + fileName);
+	}
+
+	for (unsigned int il = 0; il < N_EXT_IL; il++) {
+		for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+			const std::string fileName = config->getDeviceFile(il, devNo);
+			const char* name = NULL;
+			switch (config->getDeviceType(il, devNo)) {
+			case PRNTDEV:
+				name = "printer";
+				break;
+			case TERMDEV:
+				name = "terminal";
+				break;
+			}
+			if (name != NULL) {
+				config->setDeviceFile(il, devNo,
+				                      str(boost::format("%s/%s.%s%u")
+				                          % outputDir % job.name % name % devNo));
+			} else if (!fileName.empty() && fileName[0] != '/') {
+				config->setDeviceFile(il, devNo, dir + fileName);
+			}
+		}
+	}
+
+	config->setSMPQuantum(0);
+}
+
+void JobFarm::report(const Job& job, const Result& result)
+{
+	static const char* const outcome[] = {
+		"halted", "error", "panic", "cycle limit reached", "time limit reached"
+	};
+
+	std::lock_guard<std::mutex> lock(reportMutex);
+	if (result.exitCode != RUN_EXIT_HALT)
+		allHalted = false;
+
+	if (result.exitCode == RUN_EXIT_ERROR || result.exitCode == RUN_EXIT_PANIC) {
+		printf("%s: %s: %s\n", job.name.c_str(), outcome[result.exitCode],
+		       result.error.c_str());
+	} else {
+		printf("%s: %s after %llu cycles, %.3f s\n",
+		       job.name.c_str(), outcome[result.exitCode],
+		       (unsigned long long) result.cycles, result.seconds);
+	}
+	fflush(stdout);
+}
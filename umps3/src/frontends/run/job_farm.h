@@ -0,0 +1,103 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RUN_JOB_FARM_H
+#define RUN_JOB_FARM_H
+
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "base/lang.h"
+#include "umps/types.h"
+#include "run/runner.h"
+
+class MachineConfig;
+
+// A Job is a machine configuration to be run from power on, and the
+// name which identifies it in the report and names its output files.
+
+struct Job {
+	std::string name;
+	std::string configFile;
+};
+
+// A PANIC on a job thread only ends that job: Panic() throws this
+// instead of exiting, and the farm catches it.
+
+class JobPanic : public std::runtime_error {
+public:
+	explicit JobPanic(const std::string& what)
+		: std::runtime_error(what) {}
+};
+
+// A JobFarm runs many independent machines in a single process: a pool
+// of host threads takes jobs in order, each thread running one machine
+// at a time, from power on to the end of the run. Each job writes
+// printer and terminal output to its own files, and its outcome is
+// reported as soon as it ends.
+
+class JobFarm {
+public:
+	JobFarm(const std::string& outputDir, unsigned int threads);
+
+// This method reads the job manifest from fileName. Each line holds a
+// job, as a name followed by the machine configuration file, which is
+// relative to the directory of the manifest; empty lines and lines
+// starting with `#' are skipped. It returns false, with a description
+// in error, if the manifest is not valid
+	bool LoadJobs(const std::string& fileName, std::string& error);
+
+	size_t getNumJobs() const { return jobs.size(); }
+
+// This method runs all jobs, reporting on standard output how each one
+// ended. It returns RUN_EXIT_HALT if all jobs halted, RUN_EXIT_ERROR
+// otherwise
+	RunExitCode Run(const RunLimits& limits);
+
+// This method tells whether the calling thread is running a job
+	static bool OnJobThread();
+
+private:
+	struct Result {
+		RunExitCode exitCode;
+		uint64_t cycles;
+		double seconds;
+		std::string error;
+	};
+
+	void work(const RunLimits& limits);
+	Result runJob(const Job& job, const RunLimits& limits);
+	void setupConfig(const Job& job, MachineConfig* config);
+	void report(const Job& job, const Result& result);
+
+	const std::string outputDir;
+	const unsigned int threads;
+
+	std::vector<Job> jobs;
+
+	std::atomic<size_t> nextJob;
+	std::mutex reportMutex;
+	bool allHalted;
+
+	DISABLE_COPY_AND_ASSIGNMENT(JobFarm);
+};
+
+#endif // RUN_JOB_FARM_H
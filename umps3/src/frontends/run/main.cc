@@ -0,0 +1,679 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// umps3-run: runs a machine configuration with no user interface, for
+// batch and regression testing. Device output goes where the
+// configuration says, unless redirected with -o; the exit code tells
+// how the run ended (see run/runner.h).
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <string>
+#include <thread>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <boost/format.hpp>
+
+#include "base/json.h"
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/error.h"
+#include "umps/machine.h"
+#include "umps/machine_config.h"
+#include "umps/instr_trace.h"
+#include "umps/profiler.h"
+#include "umps/stoppoint.h"
+#include "umps/symbol_table.h"
+#include "umps/trace_buffer.h"
+#include "run/fork_server.h"
+#include "run/job_farm.h"
+#include "run/runner.h"
+
+// instructions of each processor kept by default by the instruction trace
+HIDDEN const unsigned int kInstrTraceLength = 1000000;
+
+HIDDEN void showHelp(const char* prgName)
+{
+	fprintf(stderr,
+	        "Usage: %s [OPTION]... CONFIG\n"
+	        "  or:  %s [OPTION]... -M MANIFEST\n"
+	        "Run the uMPS3 machine described by CONFIG until it halts, or all the\n"
+	        "machines listed in MANIFEST.\n\n"
+	        "  -c, --cycles=N          stop after N cycles\n"
+	        "  -t, --time=SECONDS      stop after SECONDS of wall-clock time\n"
+	        "  -o, --output=DEV=FILE   write the output of DEV (printerN or terminalN)\n"
+	        "                          to FILE instead; `-' stands for standard output\n"
+	        "  -r, --restore=FILE      start from the machine snapshot in FILE\n"
+	        "  -s, --save=FILE         save a machine snapshot to FILE when the run ends\n"
+	        "                          (when it reaches the marker, with -C)\n"
+	        "  -C, --cases=FILE        run the test cases listed in FILE, each in a\n"
+	        "                          process forked from the machine at the marker\n"
+	        "  -m, --marker=MARKER     where test cases start: pc:ADDR, symbol:NAME,\n"
+	        "                          cycles:N or instructions:N (default: at power on)\n"
+	        "  -M, --manifest=FILE     run the jobs listed in FILE on a pool of threads\n"
+	        "  -O, --output-dir=DIR    write test case and job output files to DIR\n"
+	        "  -j, --jobs=N            run up to N test cases (default 1) or jobs\n"
+	        "                          (default: one per host processor) at a time\n"
+	        "  -p, --profile=FILE      write a flat profile of the run to FILE, and\n"
+	        "                          its call stacks to FILE.folded\n"
+	        "  -P, --profile-period=N  profile one cycle out of N (default 1)\n"
+	        "  -S, --stats=FILE        write the processor counters to FILE as JSON\n"
+	        "                          when the run ends; `-' stands for standard output\n"
+	        "  -T, --trace=START[-END] log the writes to the words from physical\n"
+	        "                          address START to END (default START)\n"
+	        "  -L, --trace-log=FILE    stream the logged writes to FILE\n"
+	        "  -i, --itrace=FILE       write the last instructions executed by each\n"
+	        "                          processor to FILE when the run ends\n"
+	        "  -I, --itrace-length=N   keep the last N instructions (default %u)\n"
+	        "  -A, --itrace-all        write every instruction to FILE as the run goes\n"
+	        "  -v, --verbose           report cycles run and time spent on exit\n"
+	        "  -h, --help              display this help and exit\n\n"
+	        "Exit status: %d if the machine halted, %d on PANIC, %d if the cycle limit\n"
+	        "was reached, %d if the time limit was reached, %d on any other error.\n"
+	        "With -C or -M, %d if all test cases or jobs halted, %d otherwise.\n",
+	        prgName, prgName, kInstrTraceLength,
+	        RUN_EXIT_HALT, RUN_EXIT_PANIC, RUN_EXIT_CYCLE_LIMIT, RUN_EXIT_TIME_LIMIT,
+	        RUN_EXIT_ERROR, RUN_EXIT_HALT, RUN_EXIT_ERROR);
+}
+
+struct OutputRedirection {
+	unsigned int il;
+	unsigned int devNo;
+	std::string fileName;
+};
+
+// This function makes a file name given on the command line absolute,
+// since the configuration directory becomes the current one before the
+// machine starts
+HIDDEN bool absolutePath(std::string& fileName)
+{
+	if (fileName[0] != '/') {
+		char cwd[FILENAME_MAX];
+		if (getcwd(cwd, sizeof(cwd)) == NULL)
+			return false;
+		fileName = std::string(cwd) + "/" + fileName;
+	}
+	return true;
+}
+
+// This function parses a DEV=FILE redirection
+HIDDEN bool parseOutput(const char* arg, OutputRedirection* out)
+{
+	static const struct {
+		const char* name;
+		unsigned int il;
+	} devices[] = {
+		{ "printer", EXT_IL_INDEX(IL_PRINTER) },
+		{ "terminal", EXT_IL_INDEX(IL_TERMINAL) }
+	};
+
+	const char* sep = strchr(arg, '=');
+	if (sep == NULL || sep[1] == '\0')
+		return false;
+
+	unsigned int i;
+	for (i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+		size_t len = strlen(devices[i].name);
+		if (strncmp(arg, devices[i].name, len) == 0 &&
+		    sep == arg + len + 1 && arg[len] >= '0' && arg[len] < '0' + N_DEV_PER_IL)
+		{
+			out->il = devices[i].il;
+			out->devNo = arg[len] - '0';
+			break;
+		}
+	}
+	if (i == sizeof(devices) / sizeof(devices[0]))
+		return false;
+
+	std::string fileName(sep + 1);
+	if (fileName == "-")
+		fileName = "/dev/stdout";
+	else if (!absolutePath(fileName))
+		return false;
+	out->fileName = fileName;
+	return true;
+}
+
+// The point where the machine is forked to run test cases
+struct ForkMarker {
+	enum Kind {
+		NONE,
+		PC,
+		SYMBOL,
+		CYCLES,
+		INSTRUCTIONS
+	};
+
+	ForkMarker() : kind(NONE), value(0) {}
+
+	Kind kind;
+	uint64_t value;
+	std::string symbol;
+};
+
+HIDDEN bool parseMarker(const char* arg, ForkMarker* marker)
+{
+	char* end;
+	if (strncmp(arg, "pc:", 3) == 0) {
+		marker->kind = ForkMarker::PC;
+		marker->value = strtoul(arg + 3, &end, 0);
+		return arg[3] != '\0' && *end == '\0' && (marker->value & 3) == 0;
+	} else if (strncmp(arg, "cycles:", 7) == 0) {
+		marker->kind = ForkMarker::CYCLES;
+		marker->value = strtoull(arg + 7, &end, 0);
+		return arg[7] != '\0' && *end == '\0' && marker->value > 0;
+	} else if (strncmp(arg, "instructions:", 13) == 0) {
+		marker->kind = ForkMarker::INSTRUCTIONS;
+		marker->value = strtoull(arg + 13, &end, 0);
+		return arg[13] != '\0' && *end == '\0' && marker->value > 0;
+	} else if (strncmp(arg, "symbol:", 7) == 0) {
+		marker->kind = ForkMarker::SYMBOL;
+		marker->symbol = arg + 7;
+		return !marker->symbol.empty();
+	}
+	return false;
+}
+
+// A traced range of physical addresses, both ends included
+struct TracedRange {
+	Word start;
+	Word end;
+};
+
+HIDDEN bool parseRange(const char* arg, TracedRange* range)
+{
+	char* end;
+	range->start = strtoul(arg, &end, 0);
+	if (end == arg)
+		return false;
+	range->end = range->start;
+	if (*end == '-') {
+		const char* endArg = end + 1;
+		range->end = strtoul(endArg, &end, 0);
+		if (end == endArg)
+			return false;
+	}
+	return (*end == '\0' && range->start <= range->end &&
+	        (range->start & 3) == 0 && (range->end & 3) == 0);
+}
+
+// This function brings the machine to the marker; it returns false, with
+// a description in error, if the machine does not get there
+HIDDEN bool runToMarker(Runner& runner, const MachineConfig* config,
+                        const ForkMarker& marker, const RunLimits& limits,
+                        std::string& error)
+{
+	RunExitCode result;
+
+	switch (marker.kind) {
+	case ForkMarker::NONE:
+		return true;
+
+	case ForkMarker::CYCLES: {
+		RunLimits bootLimits = limits;
+		bootLimits.cycles = marker.value;
+		result = runner.Run(bootLimits);
+		if (result == RUN_EXIT_CYCLE_LIMIT)
+			return true;
+		break;
+	}
+
+	case ForkMarker::INSTRUCTIONS: {
+		// Unlike cycles, these do not count the time spent waiting
+		RunPredicates predicates;
+		predicates.instructions = marker.value;
+		if (runner.RunUntil(predicates, limits, &result))
+			return true;
+		break;
+	}
+
+	case ForkMarker::SYMBOL: {
+		RunPredicates predicates;
+		try {
+			SymbolTable stab(config->getSymbolTableASID(),
+			                 config->getROM(ROM_TYPE_STAB).c_str());
+			if (!predicates.AddSymbol(&stab, marker.symbol)) {
+				error = "no function named `" + marker.symbol + "' in the symbol table";
+				return false;
+			}
+		} catch (const Error& e) {
+			error = "cannot load the symbol table `" + config->getROM(ROM_TYPE_STAB) + "'";
+			return false;
+		}
+		if (runner.RunUntil(predicates, limits, &result))
+			return true;
+		break;
+	}
+
+	case ForkMarker::PC:
+		if (runner.RunTo(marker.value, limits, &result))
+			return true;
+		break;
+	}
+
+	static const char* const outcome[] = {
+		"halted", "failed", "stopped with a PANIC",
+		"reached the cycle limit", "reached the time limit"
+	};
+	error = std::string("machine ") + outcome[result] + " before the marker";
+	return false;
+}
+
+// This function writes the profile of the run to fileName (flat) and
+// fileName.folded (call stacks), with function names from the symbol
+// table of the configuration if it can be loaded; it returns false,
+// with a description in error, if it fails
+HIDDEN bool writeProfile(const char* prgName, Machine* machine, const MachineConfig* config,
+                         const std::string& fileName, std::string& error)
+{
+	scoped_ptr<SymbolTable> stab;
+	const std::string& stabFile = config->getROM(ROM_TYPE_STAB);
+	if (!stabFile.empty()) {
+		try {
+			stab.reset(new SymbolTable(config->getSymbolTableASID(), stabFile.c_str()));
+		} catch (const Error& e) {
+			fprintf(stderr, "%s: cannot load the symbol table `%s': profiling by address only\n",
+			        prgName, stabFile.c_str());
+		}
+	}
+
+	const Profiler* profiler = machine->getProfiler();
+	try {
+		profiler->WriteFlat(fileName, stab.get());
+		profiler->WriteFolded(fileName + ".folded", stab.get());
+	} catch (const FileError& e) {
+		error = "cannot write `" + e.fileName + "'";
+		return false;
+	}
+	return true;
+}
+
+// milliseconds between two writes of the trace log
+HIDDEN const unsigned int kTraceInterval = 20;
+
+// This function traces ranges, and streams their logs to fileName thru
+// writer; it returns false, with a description in error, if it fails
+HIDDEN bool startTracing(Runner& runner, const std::list<TracedRange>& ranges,
+                         const std::string& fileName, scoped_ptr<TraceWriter>& writer,
+                         std::string& error)
+{
+	StoppointSet* tracepoints = runner.getTracepoints();
+	for (const TracedRange& r : ranges) {
+		if (!tracepoints->Add(AddressRange(MAXASID, r.start, r.end), AM_WRITE)) {
+			error = str(boost::format("traced range 0x%.8lx-0x%.8lx overlaps another one") %
+			            (unsigned long) r.start % (unsigned long) r.end);
+			return false;
+		}
+	}
+
+	try {
+		writer.reset(new TraceWriter(fileName));
+	} catch (const FileError& e) {
+		error = "cannot create `" + e.fileName + "'";
+		return false;
+	}
+	for (const Stoppoint::Ptr& sp : *tracepoints)
+		writer->Add(runner.getMachine()->getTraceBuffer(sp->getId()));
+	writer->Start(kTraceInterval);
+	return true;
+}
+
+// This function writes the processor counters to fileName; it returns
+// false, with a description in error, if it fails
+HIDDEN bool writeStats(const Machine* machine, const std::string& fileName, std::string& error)
+{
+	scoped_ptr<JsonObject> stats(machine->StatsToJson());
+	std::string buffer;
+	stats->Serialize(buffer, true);
+
+	std::ofstream out(fileName.c_str());
+	out << buffer << std::endl;
+	if (!out) {
+		error = "cannot write `" + fileName + "'";
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	static const struct option options[] = {
+		{ "cycles",  required_argument, NULL, 'c' },
+		{ "time",    required_argument, NULL, 't' },
+		{ "output",  required_argument, NULL, 'o' },
+		{ "restore", required_argument, NULL, 'r' },
+		{ "save",    required_argument, NULL, 's' },
+		{ "cases",   required_argument, NULL, 'C' },
+		{ "marker",  required_argument, NULL, 'm' },
+		{ "output-dir", required_argument, NULL, 'O' },
+		{ "manifest", required_argument, NULL, 'M' },
+		{ "jobs",    required_argument, NULL, 'j' },
+		{ "profile", required_argument, NULL, 'p' },
+		{ "profile-period", required_argument, NULL, 'P' },
+		{ "stats",   required_argument, NULL, 'S' },
+		{ "trace",   required_argument, NULL, 'T' },
+		{ "trace-log", required_argument, NULL, 'L' },
+		{ "itrace",  required_argument, NULL, 'i' },
+		{ "itrace-length", required_argument, NULL, 'I' },
+		{ "itrace-all", no_argument,    NULL, 'A' },
+		{ "verbose", no_argument,       NULL, 'v' },
+		{ "help",    no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	RunLimits limits;
+	std::list<OutputRedirection> outputs;
+	std::string restoreFile, saveFile;
+	std::string casesFile, manifestFile, outputDir(".");
+	std::string profileFile, statsFile, traceFile, itraceFile;
+	std::list<TracedRange> tracedRanges;
+	unsigned long profilePeriod = 1;
+	unsigned long itraceLength = kInstrTraceLength;
+	bool itraceAll = false;
+	ForkMarker marker;
+	unsigned long jobs = 0;
+	bool verbose = false;
+	char* end;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "c:t:o:r:s:C:m:M:O:j:p:P:S:T:L:i:I:Avh", options, NULL)) != -1) {
+		switch (c) {
+		case 'c':
+			limits.cycles = strtoull(optarg, &end, 0);
+			if (*end != '\0' || limits.cycles == 0) {
+				fprintf(stderr, "%s: invalid cycle limit `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		case 't':
+			limits.seconds = strtod(optarg, &end);
+			if (*end != '\0' || limits.seconds <= 0.0) {
+				fprintf(stderr, "%s: invalid time limit `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		case 'o': {
+			OutputRedirection out;
+			if (!parseOutput(optarg, &out)) {
+				fprintf(stderr, "%s: invalid output redirection `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			outputs.push_back(out);
+			break;
+		}
+		case 'r':
+		case 's':
+		case 'C':
+		case 'M':
+		case 'O':
+		case 'p':
+		case 'L':
+		case 'i': {
+			std::string& fileName = (c == 'r') ? restoreFile :
+			                        (c == 's') ? saveFile :
+			                        (c == 'C') ? casesFile :
+			                        (c == 'M') ? manifestFile :
+			                        (c == 'p') ? profileFile :
+			                        (c == 'L') ? traceFile :
+			                        (c == 'i') ? itraceFile : outputDir;
+			fileName = optarg;
+			if (fileName.empty() || !absolutePath(fileName)) {
+				fprintf(stderr, "%s: invalid file name `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		}
+		case 'm':
+			if (!parseMarker(optarg, &marker)) {
+				fprintf(stderr, "%s: invalid marker `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		case 'j':
+			jobs = strtoul(optarg, &end, 0);
+			if (*end != '\0' || jobs == 0) {
+				fprintf(stderr, "%s: invalid number of jobs `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		case 'S':
+			statsFile = optarg;
+			if (statsFile == "-") {
+				statsFile = "/dev/stdout";
+			} else if (statsFile.empty() || !absolutePath(statsFile)) {
+				fprintf(stderr, "%s: invalid file name `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		case 'P':
+			profilePeriod = strtoul(optarg, &end, 0);
+			if (*end != '\0' || profilePeriod == 0 || profilePeriod > UINT_MAX / 2) {
+				fprintf(stderr, "%s: invalid profile period `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		case 'T': {
+			TracedRange range;
+			if (!parseRange(optarg, &range)) {
+				fprintf(stderr, "%s: invalid traced range `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			tracedRanges.push_back(range);
+			break;
+		}
+		case 'I':
+			itraceLength = strtoul(optarg, &end, 0);
+			if (*end != '\0' || itraceLength == 0) {
+				fprintf(stderr, "%s: invalid instruction trace length `%s'\n", argv[0], optarg);
+				return RUN_EXIT_ERROR;
+			}
+			break;
+		case 'A':
+			itraceAll = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'h':
+			showHelp(argv[0]);
+			return RUN_EXIT_HALT;
+		default:
+			showHelp(argv[0]);
+			return RUN_EXIT_ERROR;
+		}
+	}
+
+	if (optind != argc - (manifestFile.empty() ? 1 : 0)) {
+		showHelp(argv[0]);
+		return RUN_EXIT_ERROR;
+	}
+	if (marker.kind != ForkMarker::NONE && casesFile.empty()) {
+		fprintf(stderr, "%s: a marker needs test cases (-C)\n", argv[0]);
+		return RUN_EXIT_ERROR;
+	}
+	if (!manifestFile.empty() && (!outputs.empty() || !restoreFile.empty() ||
+	                              !saveFile.empty() || !casesFile.empty()))
+	{
+		fprintf(stderr, "%s: -M cannot be used with -o, -r, -s or -C\n", argv[0]);
+		return RUN_EXIT_ERROR;
+	}
+	if ((!profileFile.empty() || !statsFile.empty() || !traceFile.empty() || !itraceFile.empty()) &&
+	    (!manifestFile.empty() || !casesFile.empty()))
+	{
+		fprintf(stderr, "%s: -p, -S, -L and -i cannot be used with -M or -C\n", argv[0]);
+		return RUN_EXIT_ERROR;
+	}
+	if (tracedRanges.empty() != traceFile.empty()) {
+		fprintf(stderr, "%s: -T and -L go together\n", argv[0]);
+		return RUN_EXIT_ERROR;
+	}
+	if (itraceAll && itraceFile.empty()) {
+		fprintf(stderr, "%s: -A needs an instruction trace file (-i)\n", argv[0]);
+		return RUN_EXIT_ERROR;
+	}
+	if (!absolutePath(outputDir)) {
+		fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+		return RUN_EXIT_ERROR;
+	}
+
+	std::string error;
+	if (!manifestFile.empty()) {
+		if (jobs == 0)
+			jobs = std::max(std::thread::hardware_concurrency(), 1U);
+		JobFarm farm(outputDir, jobs);
+		if (!farm.LoadJobs(manifestFile, error)) {
+			fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+			return RUN_EXIT_ERROR;
+		}
+		return farm.Run(limits);
+	}
+
+	const std::string configPath(argv[optind]);
+	MachineConfig* config = MachineConfig::LoadFromFile(configPath, error);
+	if (config == NULL) {
+		fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+		return RUN_EXIT_ERROR;
+	}
+	Runner runner(config);
+
+	ForkServer forkServer(&runner, outputDir, jobs ? jobs : 1);
+	if (!casesFile.empty() && !forkServer.LoadCases(casesFile, error)) {
+		fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+		return RUN_EXIT_ERROR;
+	}
+
+	for (const OutputRedirection& out : outputs) {
+		config->setDeviceEnabled(out.il, out.devNo, true);
+		config->setDeviceFile(out.il, out.devNo, out.fileName);
+	}
+
+	// Device and core file names in a configuration are relative to
+	// its directory
+	std::string::size_type slash = configPath.rfind('/');
+	if (slash != std::string::npos) {
+		const std::string dir = (slash == 0) ? "/" : configPath.substr(0, slash);
+		if (chdir(dir.c_str()) != 0) {
+			fprintf(stderr, "%s: %s: %s\n", argv[0], dir.c_str(), strerror(errno));
+			return RUN_EXIT_ERROR;
+		}
+	}
+
+	if (!runner.Init(error)) {
+		fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+		return RUN_EXIT_ERROR;
+	}
+
+	try {
+		if (!restoreFile.empty())
+			runner.getMachine()->RestoreSnapshot(restoreFile);
+	} catch (Error& e) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], restoreFile.c_str(), e.what());
+		return RUN_EXIT_ERROR;
+	}
+
+	if (!profileFile.empty())
+		runner.getMachine()->setProfiling(profilePeriod);
+
+	if (!itraceFile.empty()) {
+		runner.getMachine()->setInstrTracing(itraceLength);
+		try {
+			if (itraceAll)
+				runner.getMachine()->getInstrTrace()->Stream(itraceFile);
+		} catch (const FileError& e) {
+			fprintf(stderr, "%s: cannot write `%s'\n", argv[0], e.fileName.c_str());
+			return RUN_EXIT_ERROR;
+		}
+	}
+
+	scoped_ptr<TraceWriter> traceWriter;
+	if (!traceFile.empty() &&
+	    !startTracing(runner, tracedRanges, traceFile, traceWriter, error))
+	{
+		fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+		return RUN_EXIT_ERROR;
+	}
+
+	RunExitCode result = RUN_EXIT_HALT;
+	if (casesFile.empty()) {
+		result = runner.Run(limits);
+		if (traceWriter) {
+			try {
+				traceWriter->Close();
+			} catch (const FileError& e) {
+				fprintf(stderr, "%s: cannot write `%s'\n", argv[0], e.fileName.c_str());
+				return RUN_EXIT_ERROR;
+			}
+			if (traceWriter->getLost() > 0) {
+				fprintf(stderr, "%s: %llu trace records overwritten before being written out\n",
+				        argv[0], (unsigned long long) traceWriter->getLost());
+			}
+		}
+		if (!itraceFile.empty()) {
+			InstrTrace* itrace = runner.getMachine()->getInstrTrace();
+			try {
+				if (itraceAll)
+					itrace->Close();
+				else
+					itrace->Write(itraceFile);
+			} catch (const FileError& e) {
+				fprintf(stderr, "%s: cannot write `%s'\n", argv[0], e.fileName.c_str());
+				return RUN_EXIT_ERROR;
+			}
+		}
+		if ((!profileFile.empty() &&
+		     !writeProfile(argv[0], runner.getMachine(), config, profileFile, error)) ||
+		    (!statsFile.empty() && !writeStats(runner.getMachine(), statsFile, error)))
+		{
+			fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+			return RUN_EXIT_ERROR;
+		}
+	} else if (!runToMarker(runner, config, marker, limits, error)) {
+		fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+		return RUN_EXIT_ERROR;
+	}
+
+	try {
+		if (!saveFile.empty())
+			runner.getMachine()->SaveSnapshot(saveFile);
+	} catch (Error& e) {
+		fprintf(stderr, "%s: %s: %s\n", argv[0], saveFile.c_str(), e.what());
+		return RUN_EXIT_ERROR;
+	}
+
+	if (verbose) {
+		static const char* const outcome[] = {
+			"halted", NULL, NULL, "cycle limit reached", "time limit reached"
+		};
+		fprintf(stderr, "%s: %s after %llu cycles, %.3f s\n",
+		        argv[0], casesFile.empty() ? outcome[result] : "marker reached",
+		        (unsigned long long) runner.getCycles(), runner.getSeconds());
+	}
+
+	if (!casesFile.empty())
+		result = forkServer.Run(limits);
+
+	return result;
+}
@@ -0,0 +1,126 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "run/runner.h"
+
+#include <chrono>
+#include <list>
+
+#include <boost/format.hpp>
+
+#include "umps/const.h"
+#include "umps/error.h"
+#include "umps/machine.h"
+
+Runner::Runner(MachineConfig* config)
+	: config(config),
+	cycles(0),
+	seconds(0.0)
+{}
+
+Runner::~Runner()
+{}
+
+bool Runner::Init(std::string& error)
+{
+	std::list<std::string> errors;
+	if (!config->Validate(&errors)) {
+		error = "invalid and/or incomplete machine configuration:";
+		for (const std::string& s : errors)
+			error += "\n  " + s;
+		return false;
+	}
+
+	try {
+		machine.reset(new Machine(config.get(), &breakpoints, &suspects, &tracepoints));
+	} catch (const FileError& e) {
+		error = "could not initialize machine: the file `" + e.fileName +
+			"' is nonexistent or inaccessible";
+		return false;
+	} catch (const InvalidCoreFileError& e) {
+		error = "could not initialize machine: the file `" + e.fileName +
+			"' does not appear to be a valid core file";
+		return false;
+	} catch (const CoreFileOverflow& e) {
+		error = "could not initialize machine: the core file does not fit in memory";
+		return false;
+	} catch (const InvalidFileFormatError& e) {
+		error = "could not initialize machine: the file `" + e.fileName +
+			"' has wrong format";
+		return false;
+	} catch (const EthError& e) {
+		error = boost::str(boost::format("could not initialize machine: "
+		                                 "error initializing network device %u") %e.devNo);
+		return false;
+	}
+
+	// No one is watching: idle periods need not take real time
+	machine->setFastForward(true);
+
+	return true;
+}
+
+RunExitCode Runner::Run(const RunLimits& limits)
+{
+	return run(RunPredicates(), limits, NULL);
+}
+
+bool Runner::RunUntil(const RunPredicates& predicates, const RunLimits& limits,
+                      RunExitCode* result, RunUntilResult* reason)
+{
+	RunUntilResult r = RU_HALT;
+	*result = run(predicates, limits, &r);
+	if (reason != NULL)
+		*reason = r;
+	return r != RU_HALT && *result == RUN_EXIT_HALT;
+}
+
+bool Runner::RunTo(Word pc, const RunLimits& limits, RunExitCode* result)
+{
+	RunPredicates predicates;
+	predicates.pcs.insert(pc);
+	return RunUntil(predicates, limits, result);
+}
+
+// This method runs the machine until it halts, one of limits is reached
+// or one of predicates holds; in the last case, the result is
+// RUN_EXIT_HALT and reason tells which predicate it was. Limits are
+// predicates too, which win over the ones they coincide with
+RunExitCode Runner::run(const RunPredicates& predicates, const RunLimits& limits,
+                        RunUntilResult* reason)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	RunPredicates bounded = predicates;
+	if (limits.cycles && (!bounded.cycles || limits.cycles < bounded.cycles))
+		bounded.cycles = limits.cycles;
+	if (limits.seconds > 0.0 && (bounded.seconds <= 0.0 || limits.seconds < bounded.seconds))
+		bounded.seconds = limits.seconds;
+
+	const Clock::time_point start = Clock::now();
+	RunUntilResult r = machine->RunUntil(bounded, &cycles);
+	seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	if (r == RU_CYCLES && bounded.cycles == limits.cycles)
+		return RUN_EXIT_CYCLE_LIMIT;
+	if (r == RU_DEADLINE && bounded.seconds == limits.seconds)
+		return RUN_EXIT_TIME_LIMIT;
+	if (reason != NULL)
+		*reason = r;
+	return RUN_EXIT_HALT;
+}
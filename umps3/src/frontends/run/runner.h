@@ -0,0 +1,103 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef RUN_RUNNER_H
+#define RUN_RUNNER_H
+
+#include <string>
+
+#include "base/lang.h"
+#include "umps/types.h"
+#include "umps/machine.h"
+#include "umps/machine_config.h"
+#include "umps/stoppoint.h"
+
+// Exit codes of umps3-run: a run ends either with the machine halting,
+// a PANIC, or a cycle or wall-clock limit being reached. RUN_EXIT_ERROR
+// covers everything that prevents the machine from starting.
+enum RunExitCode {
+	RUN_EXIT_HALT        = 0,
+	RUN_EXIT_ERROR       = 1,
+	RUN_EXIT_PANIC       = 2,
+	RUN_EXIT_CYCLE_LIMIT = 3,
+	RUN_EXIT_TIME_LIMIT  = 4
+};
+
+// Run limits: zero means no limit
+struct RunLimits {
+	RunLimits() : cycles(0), seconds(0.0) {}
+
+	uint64_t cycles;
+	double seconds;
+};
+
+// A Runner owns a machine configuration and the Machine built from it,
+// and runs the machine flat out, with no user interface, until it halts
+// or a limit is reached.
+
+class Runner {
+public:
+	explicit Runner(MachineConfig* config);
+	~Runner();
+
+// This method validates the configuration and builds the machine; it
+// returns false, with a description in error, if it fails
+	bool Init(std::string& error);
+
+	RunExitCode Run(const RunLimits& limits);
+
+// This method runs the machine like Run() does, but stops as soon as
+// one of predicates holds (see Machine::RunUntil()). It returns TRUE if
+// one did, and which in reason if it is not NULL, and FALSE, with the
+// reason the run ended in result, otherwise
+	bool RunUntil(const RunPredicates& predicates, const RunLimits& limits,
+	              RunExitCode* result, RunUntilResult* reason = NULL);
+
+// This method runs the machine until a processor is about to execute
+// the instruction at virtual address pc, in any address space, like
+// RunUntil() does
+	bool RunTo(Word pc, const RunLimits& limits, RunExitCode* result);
+
+	Machine* getMachine() { return machine.get(); }
+
+// Tracepoints added here log the writes to their range (see Machine)
+	StoppointSet* getTracepoints() { return &tracepoints; }
+
+// cycles run and wall-clock time spent by the last Run()
+	uint64_t getCycles() const { return cycles; }
+	double getSeconds() const { return seconds; }
+
+private:
+	RunExitCode run(const RunPredicates& predicates, const RunLimits& limits,
+	                RunUntilResult* reason);
+
+	scoped_ptr<MachineConfig> config;
+
+	StoppointSet breakpoints;
+	StoppointSet suspects;
+	StoppointSet tracepoints;
+
+	scoped_ptr<Machine> machine;
+
+	uint64_t cycles;
+	double seconds;
+
+	DISABLE_COPY_AND_ASSIGNMENT(Runner);
+};
+
+#endif // RUN_RUNNER_H
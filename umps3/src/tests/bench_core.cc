@@ -0,0 +1,451 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// bench_core: microbenchmarks for the hot paths of the emulator core
+// (instruction execution on each engine, bus accesses, event queue,
+// stoppoint and symbol lookups). Results go to standard output as a JSON document,
+// one entry per benchmark, so that they can be tracked over time:
+//
+//   bench_core [-q]
+//
+// -q runs a tenth of the iterations, for a quick check.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "base/lang.h"
+#include "umps/arch.h"
+#include "umps/blockdev_params.h"
+#include "umps/const.h"
+#include "umps/error.h"
+#include "umps/event.h"
+#include "umps/machine.h"
+#include "umps/machine_config.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+#include "umps/stoppoint.h"
+#include "umps/symbol_table.h"
+#include "umps/systembus.h"
+
+// The library expects the frontend to handle a PANIC
+void Panic(const char* message)
+{
+	fprintf(stderr, "PANIC: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+// Results are accumulated here, so that the compiler cannot drop the
+// benchmarked calls
+HIDDEN volatile Word sink;
+
+HIDDEN unsigned int scale = 10;
+
+struct BenchResult {
+	std::string name;
+	uint64_t ops;
+	double seconds;
+};
+
+HIDDEN std::vector<BenchResult> results;
+
+// This function runs body, which performs ops operations, and records
+// how long it took
+HIDDEN void measure(const std::string& name, uint64_t ops, const std::function<void ()>& body)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const Clock::time_point start = Clock::now();
+	body();
+	BenchResult r;
+	r.name = name;
+	r.ops = ops;
+	r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	results.push_back(r);
+	fprintf(stderr, "%-24s %12.2f ns/op\n", name.c_str(), r.seconds * 1e9 / ops);
+}
+
+HIDDEN void printResults()
+{
+	printf("{\n    \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult& r = results[i];
+		printf("        { \"name\": \"%s\", \"ops\": %llu, \"seconds\": %.6f, "
+		       "\"ns_per_op\": %.3f, \"mops_per_second\": %.3f }%s\n",
+		       r.name.c_str(), (unsigned long long) r.ops, r.seconds,
+		       r.seconds * 1e9 / r.ops, r.ops / r.seconds / 1e6,
+		       (i + 1 < results.size()) ? "," : "");
+	}
+	printf("    ]\n}\n");
+}
+
+
+// MIPS instruction encoding, for the synthetic instruction streams
+
+enum {
+	T0 = 8, T1, T2, T3, T4, T5, T6, T7, S0 = 16
+};
+
+HIDDEN Word rType(Word funct, Word rd, Word rs, Word rt, Word shamt = 0)
+{
+	return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+HIDDEN Word iType(Word op, Word rt, Word rs, Word imm)
+{
+	return (op << 26) | (rs << 21) | (rt << 16) | (imm & IMMMASK);
+}
+
+HIDDEN Word jump(Word target)
+{
+	return (J << 26) | ((target >> WORDSHIFT) & 0x03FFFFFFUL);
+}
+
+// A Bench builds a machine with no core file and no devices, running
+// from tiny ROMs written to a temporary directory, on the given
+// execution engine
+class Bench {
+public:
+	explicit Bench(ExecEngine engine = EXEC_ENGINE_INTERPRETER);
+	~Bench();
+
+	Machine* getMachine() { return machine.get(); }
+	Processor* getProcessor() { return machine->getProcessor(0); }
+	SystemBus* getBus() { return machine->getBus(); }
+
+// This method writes code at addr, followed by a jump back to its start,
+// and resets the processor there
+	void loadLoop(Word addr, const std::vector<Word>& code);
+
+private:
+	void writeROM(const std::string& fileName);
+
+	std::string dir;
+	scoped_ptr<MachineConfig> config;
+	StoppointSet breakpoints, suspects, tracepoints;
+	scoped_ptr<Machine> machine;
+};
+
+Bench::Bench(ExecEngine engine)
+{
+	char tmpl[] = "/tmp/bench_core.XXXXXX";
+	if (mkdtemp(tmpl) == NULL) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+	dir = tmpl;
+
+	writeROM(dir + "/boot.rom.umps");
+	writeROM(dir + "/bios.rom.umps");
+
+	config.reset(MachineConfig::Create(dir + "/config.json"));
+	config->setROM(ROM_TYPE_BOOT, dir + "/boot.rom.umps");
+	config->setROM(ROM_TYPE_BIOS, dir + "/bios.rom.umps");
+	config->setLoadCoreEnabled(false);
+	config->setDeviceEnabled(EXT_IL_INDEX(IL_TERMINAL), 0, false);
+	config->setExecEngine(engine);
+
+	std::list<std::string> errors;
+	if (!config->Validate(&errors)) {
+		fprintf(stderr, "bench_core: invalid configuration: %s\n", errors.front().c_str());
+		exit(EXIT_FAILURE);
+	}
+	machine.reset(new Machine(config.get(), &breakpoints, &suspects, &tracepoints));
+}
+
+Bench::~Bench()
+{
+	machine.reset();
+	config.reset();
+	unlink((dir + "/boot.rom.umps").c_str());
+	unlink((dir + "/bios.rom.umps").c_str());
+	unlink((dir + "/config.json").c_str());
+	rmdir(dir.c_str());
+}
+
+// ROMs just spin: the benchmarks reset the processor where they need
+void Bench::writeROM(const std::string& fileName)
+{
+	const Word rom[] = { BIOSFILEID, 2, iType(BEQ, 0, 0, (Word) -1), NOP };
+
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (file == NULL || fwrite(rom, sizeof(rom), 1, file) != 1 || fclose(file) != 0) {
+		fprintf(stderr, "bench_core: cannot write `%s'\n", fileName.c_str());
+		exit(EXIT_FAILURE);
+	}
+}
+
+void Bench::loadLoop(Word addr, const std::vector<Word>& code)
+{
+	Word a = addr;
+	for (Word w : code) {
+		machine->WriteMemory(a, w);
+		a += WORDLEN;
+	}
+	machine->WriteMemory(a, jump(addr));
+	machine->WriteMemory(a + WORDLEN, NOP);
+	getProcessor()->Reset(addr, RAMBASE + config->getRamSize() * FRAMESIZE * WORDLEN);
+}
+
+
+HIDDEN const Word kCodeBase = RAMBASE + 0x1000;
+HIDDEN const Word kDataBase = RAMBASE + 0x10000;
+
+// Processor::Cycle benchmarks run on each execution engine; names get
+// the engine as a suffix, except for the reference interpreter
+HIDDEN const ExecEngine engines[] = { EXEC_ENGINE_INTERPRETER, EXEC_ENGINE_THREADED };
+
+HIDDEN std::string cycleBenchName(const char* name, ExecEngine engine)
+{
+	return (engine == EXEC_ENGINE_THREADED) ? std::string(name) + "_threaded" : name;
+}
+
+// Processor::Cycle on a stream of ALU instructions
+HIDDEN void benchCycleALU(ExecEngine engine)
+{
+	Bench bench(engine);
+	std::vector<Word> code;
+	for (Word i = 0; i < 16; i++) {
+		const Word d = T0 + (i % 8), s = T0 + ((i + 3) % 8), t = T0 + ((i + 5) % 8);
+		code.push_back(rType(SFN_ADDU, d, s, t));
+		code.push_back(rType(SFN_XOR, s, d, t));
+		code.push_back(rType(SFN_SLL, t, 0, d, i % 31));
+		code.push_back(iType(ADDIU, d, d, i));
+	}
+	bench.loadLoop(kCodeBase, code);
+
+	Processor* cpu = bench.getProcessor();
+	const uint64_t n = 2000000ULL * scale;
+	measure(cycleBenchName("cycle_alu", engine), n, [&] {
+		for (uint64_t i = 0; i < n; i++)
+			cpu->Cycle();
+	});
+	sink = cpu->getGPR(T0);
+}
+
+// Processor::Cycle on a stream of taken and untaken branches, each
+// with a filled delay slot
+HIDDEN void benchCycleBranch(ExecEngine engine)
+{
+	Bench bench(engine);
+	std::vector<Word> code;
+	for (Word i = 0; i < 16; i++) {
+		code.push_back(iType(BEQ, 0, 0, 1));
+		code.push_back(iType(ADDIU, T0, T0, 1));
+		code.push_back(NOP);
+		code.push_back(iType(BNE, 0, 0, 1));
+		code.push_back(iType(ADDIU, T1, T1, 1));
+	}
+	bench.loadLoop(kCodeBase, code);
+
+	Processor* cpu = bench.getProcessor();
+	const uint64_t n = 2000000ULL * scale;
+	measure(cycleBenchName("cycle_branch", engine), n, [&] {
+		for (uint64_t i = 0; i < n; i++)
+			cpu->Cycle();
+	});
+	sink = cpu->getGPR(T0);
+}
+
+// Processor::Cycle on a stream of loads and stores to RAM
+HIDDEN void benchCycleLoadStore(ExecEngine engine)
+{
+	Bench bench(engine);
+	std::vector<Word> code;
+	code.push_back(iType(LUI, S0, 0, kDataBase >> 16));
+	for (Word i = 0; i < 32; i++) {
+		code.push_back(iType(LW, T0 + (i % 4), S0, i * 64));
+		code.push_back(iType(SW, T4 + (i % 4), S0, i * 64 + 4));
+	}
+	bench.loadLoop(kCodeBase, code);
+
+	Processor* cpu = bench.getProcessor();
+	const uint64_t n = 2000000ULL * scale;
+	measure(cycleBenchName("cycle_load_store", engine), n, [&] {
+		for (uint64_t i = 0; i < n; i++)
+			cpu->Cycle();
+	});
+	sink = cpu->getGPR(T0);
+}
+
+// SystemBus data accesses to each memory region
+HIDDEN void benchBus()
+{
+	Bench bench;
+	SystemBus* bus = bench.getBus();
+	Processor* cpu = bench.getProcessor();
+	const uint64_t n = 4000000ULL * scale;
+
+	static const struct {
+		const char* name;
+		Word base;
+		Word span;
+	} regions[] = {
+		{ "bus_read_ram", kDataBase, 0x4000 },
+		{ "bus_read_rom", BIOSBASE, 2 * WORDLEN },
+		{ "bus_read_bus_regs", BUS_REG_TOD_HI, 4 * WORDLEN },
+		{ "bus_read_dev_regs", DEV_REG_START, 0x100 }
+	};
+	for (const auto& r : regions) {
+		measure(r.name, n, [&] {
+			Word data, acc = 0;
+			for (uint64_t i = 0; i < n; i++) {
+				bus->DataRead(r.base + ((i * WORDLEN) % r.span), &data, cpu);
+				acc += data;
+			}
+			sink = acc;
+		});
+	}
+
+	measure("bus_write_ram", n, [&] {
+		for (uint64_t i = 0; i < n; i++)
+			bus->DataWrite(kDataBase + ((i * WORDLEN) % 0x4000), (Word) i, cpu);
+	});
+	measure("bus_write_dev_regs", n, [&] {
+		for (uint64_t i = 0; i < n; i++)
+			bus->DataWrite(DEV_REG_START + ((i * WORDLEN) % 0x100), 0, cpu);
+	});
+}
+
+// EventQueue insertion and dispatch of batches of events with random
+// deadlines, as pending device operations would have
+HIDDEN void benchEventQueue()
+{
+	static const size_t kBatch = 256;
+
+	std::mt19937 rng(42);
+	std::vector<uint64_t> delays(kBatch);
+	for (uint64_t& d : delays)
+		d = 1 + rng() % 100000;
+
+	EventQueue queue;
+	Word fired = 0;
+	const uint64_t rounds = 4000 * scale;
+	measure("event_insert_dispatch", rounds * kBatch, [&] {
+		uint64_t tod = 0;
+		for (uint64_t i = 0; i < rounds; i++) {
+			for (uint64_t d : delays)
+				queue.InsertQ(tod, d, [&fired] { fired++; }, EventTag());
+			while (!queue.IsEmpty()) {
+				tod = queue.nextDeadline();
+				queue.RunHead();
+			}
+		}
+	});
+	sink = fired;
+}
+
+// StoppointSet::Probe on a set of many stoppoints, at random addresses
+// (most of which are misses, as during a run)
+HIDDEN void benchStoppoints()
+{
+	static const Word kPoints = 1024;
+	static const size_t kProbes = 4096;
+
+	StoppointSet set;
+	for (Word i = 0; i < kPoints; i++)
+		set.Add(AddressRange(0, RAMBASE + i * 0x100, RAMBASE + i * 0x100 + 0xF), AM_EXEC);
+
+	std::mt19937 rng(42);
+	std::vector<Word> addrs(kProbes);
+	for (Word& a : addrs)
+		a = RAMBASE + ((rng() % (kPoints * 0x100)) & ~(WORDLEN - 1));
+
+	const uint64_t rounds = 1000 * scale;
+	measure("stoppoint_probe", rounds * kProbes, [&] {
+		Word hits = 0;
+		for (uint64_t i = 0; i < rounds; i++)
+			for (Word a : addrs)
+				hits += (set.Probe(0, a, AM_EXEC, NULL) != NULL);
+		sink = hits;
+	});
+}
+
+// SymbolTable::Probe on a table of many functions and objects, at
+// random addresses
+HIDDEN void benchSymbolTable()
+{
+	static const Word kFunctions = 2048;
+	static const Word kObjects = 1024;
+	static const size_t kProbes = 4096;
+
+	char fileName[] = "/tmp/bench_core.stab.XXXXXX";
+	int fd = mkstemp(fileName);
+	FILE* file = (fd < 0) ? NULL : fdopen(fd, "w");
+	if (file == NULL) {
+		perror("mkstemp");
+		exit(EXIT_FAILURE);
+	}
+	const Word tag = STABFILEID;
+	fwrite(&tag, sizeof(tag), 1, file);
+	fprintf(file, "%.8X %.8X\n", kFunctions, kObjects);
+	for (Word i = 0; i < kFunctions; i++)
+		fprintf(file, "fun%-29u :FUN:0x%.8X:0x%.8X:GLB\n", i, (unsigned int) (RAMBASE + i * 0x80), 0x80);
+	for (Word i = 0; i < kObjects; i++)
+		fprintf(file, "obj%-29u :OBJ:0x%.8X:0x%.8X:GLB\n", i,
+		        (unsigned int) (RAMBASE + 0x100000 + i * 0x20), 0x20);
+	fclose(file);
+
+	SymbolTable stab(0, fileName);
+	unlink(fileName);
+
+	std::mt19937 rng(42);
+	std::vector<Word> addrs(kProbes);
+	for (Word& a : addrs)
+		a = RAMBASE + rng() % (0x100000 + kObjects * 0x20);
+
+	const uint64_t rounds = 500 * scale;
+	measure("symbol_probe", rounds * kProbes, [&] {
+		Word found = 0;
+		for (uint64_t i = 0; i < rounds; i++)
+			for (Word a : addrs)
+				found += (stab.Probe(0, a, true) != NULL);
+		sink = found;
+	});
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 2 && strcmp(argv[1], "-q") == 0) {
+		scale = 1;
+	} else if (argc != 1) {
+		fprintf(stderr, "Usage: %s [-q]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (ExecEngine engine : engines) {
+		benchCycleALU(engine);
+		benchCycleBranch(engine);
+		benchCycleLoadStore(engine);
+	}
+	benchBus();
+	benchEventQueue();
+	benchStoppoints();
+	benchSymbolTable();
+
+	printResults();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,329 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// bench_guest: whole-system benchmark. Boots guest kernels (such as the
+// Phase 1 and Phase 2 test programs) under each combination of the
+// given processor counts, TLB sizes, clock rates and execution engines,
+// and reports as a JSON document, for each run, simulated instructions
+// and cycles per host second, the share of cycles fast-forwarded while
+// idle, and the host time taken to halt:
+//
+//   bench_guest [-c CYCLES] [-p CPUS] [-T TLBSIZES] [-k RATES] [-e ENGINES] WORKLOAD...
+//
+// A WORKLOAD is either a machine configuration (.json) or a kernel core
+// file, which runs on the default configuration. Lists are comma
+// separated; ENGINES are named as in the configuration (interpreter,
+// threaded, jit), and default to the one the workload selects. A run which
+// does not halt within CYCLES cycles (default 2000000000) is reported
+// as such.
+//
+// A guest has halted when the machine is powered off, or when every
+// processor is halted or spinning on a branch to itself: this is what
+// the BIOS HALT and PANIC services end with.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <list>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include "base/lang.h"
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/error.h"
+#include "umps/machine.h"
+#include "umps/machine_config.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+#include "umps/stoppoint.h"
+
+void Panic(const char* message)
+{
+	fprintf(stderr, "PANIC: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+// b . (beq $0, $0, -1)
+HIDDEN const Word kSpinInstr = (BEQ << 26) | IMMMASK;
+
+// cycles run between halt checks
+HIDDEN const unsigned int kBatchCycles = 10000;
+
+struct RunResult {
+	bool halted;
+	uint64_t cycles;
+	uint64_t instructions;
+	uint64_t skippedCycles;
+	double seconds;
+};
+
+HIDDEN bool parseList(const char* arg, std::vector<unsigned int>* list)
+{
+	list->clear();
+	std::istringstream in(arg);
+	std::string item;
+	while (std::getline(in, item, ',')) {
+		char* end;
+		unsigned long v = strtoul(item.c_str(), &end, 0);
+		if (item.empty() || *end != '\0' || v == 0)
+			return false;
+		list->push_back(v);
+	}
+	return !list->empty();
+}
+
+HIDDEN const char* const engineNames[N_EXEC_ENGINES] = {
+	"interpreter",
+	"threaded",
+	"jit"
+};
+
+HIDDEN bool parseEngines(const char* arg, std::vector<ExecEngine>* list)
+{
+	list->clear();
+	std::istringstream in(arg);
+	std::string item;
+	while (std::getline(in, item, ',')) {
+		unsigned int i;
+		for (i = 0; i < N_EXEC_ENGINES && item != engineNames[i]; i++)
+			;
+		if (i == N_EXEC_ENGINES)
+			return false;
+		list->push_back((ExecEngine) i);
+	}
+	return !list->empty();
+}
+
+HIDDEN bool guestHalted(Machine* machine, unsigned int numCpus)
+{
+	if (machine->IsHalted())
+		return true;
+	for (unsigned int i = 0; i < numCpus; i++) {
+		Processor* cpu = machine->getProcessor(i);
+		if (cpu->isHalted() || cpu->getInstruction() == kSpinInstr)
+			continue;
+		// the delay slot of the spinning branch
+		Word prevPC, prevInstr;
+		cpu->getPrevStatus(&prevPC, &prevInstr);
+		if (prevInstr != kSpinInstr || cpu->getPC() != prevPC + WORDLEN)
+			return false;
+	}
+	return true;
+}
+
+// This function builds the workload configuration, with printers and
+// terminals discarding their output; it returns NULL, with a
+// description in error, if it fails
+HIDDEN MachineConfig* loadWorkload(const std::string& workload, const std::string& tmpDir,
+                                   std::string& error)
+{
+	MachineConfig* config;
+	const std::string::size_type dot = workload.rfind('.');
+	if (dot != std::string::npos && workload.substr(dot) == ".json") {
+		config = MachineConfig::LoadFromFile(workload, error);
+		if (config == NULL)
+			return NULL;
+	} else {
+		config = MachineConfig::Create(tmpDir + "/config.json");
+		unlink((tmpDir + "/config.json").c_str());
+		config->setROM(ROM_TYPE_CORE, workload);
+	}
+
+	for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+		if (config->getDeviceType(EXT_IL_INDEX(IL_PRINTER), devNo) == PRNTDEV)
+			config->setDeviceFile(EXT_IL_INDEX(IL_PRINTER), devNo, "/dev/null");
+		if (config->getDeviceType(EXT_IL_INDEX(IL_TERMINAL), devNo) == TERMDEV)
+			config->setDeviceFile(EXT_IL_INDEX(IL_TERMINAL), devNo, "/dev/null");
+	}
+	return config;
+}
+
+// This function boots the machine and runs it until the guest halts or
+// maxCycles is reached
+HIDDEN RunResult run(const MachineConfig* config, uint64_t maxCycles)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	StoppointSet breakpoints, suspects, tracepoints;
+	const Clock::time_point start = Clock::now();
+	Machine machine(config, &breakpoints, &suspects, &tracepoints);
+	machine.setFastForward(true);
+
+	RunResult r;
+	r.cycles = 0;
+	while (!(r.halted = guestHalted(&machine, config->getNumProcessors())) &&
+	       r.cycles < maxCycles)
+	{
+		unsigned int stepped;
+		machine.step((unsigned int) std::min<uint64_t>(kBatchCycles, maxCycles - r.cycles),
+		             &stepped);
+		r.cycles += stepped;
+	}
+	r.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	r.instructions = 0;
+	for (unsigned int i = 0; i < config->getNumProcessors(); i++)
+		r.instructions += machine.getProcessor(i)->getStats().instructions;
+	r.skippedCycles = machine.getSkippedCycles();
+	return r;
+}
+
+int main(int argc, char** argv)
+{
+	uint64_t maxCycles = 2000000000ULL;
+	std::vector<unsigned int> cpus(1, 1);
+	std::vector<unsigned int> tlbSizes(1, (unsigned int) MachineConfig::DEFAULT_TLB_SIZE);
+	std::vector<unsigned int> clockRates(1, (unsigned int) MachineConfig::DEFAULT_CLOCK_RATE);
+	std::vector<ExecEngine> engines;
+	char* end;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:p:T:k:e:")) != -1) {
+		bool valid = true;
+		switch (c) {
+		case 'c':
+			maxCycles = strtoull(optarg, &end, 0);
+			valid = (*end == '\0' && maxCycles > 0);
+			break;
+		case 'p':
+			valid = parseList(optarg, &cpus);
+			break;
+		case 'T':
+			valid = parseList(optarg, &tlbSizes);
+			break;
+		case 'k':
+			valid = parseList(optarg, &clockRates);
+			break;
+		case 'e':
+			valid = parseEngines(optarg, &engines);
+			break;
+		default:
+			valid = false;
+			break;
+		}
+		if (!valid) {
+			fprintf(stderr, "Usage: %s [-c CYCLES] [-p CPUS] [-T TLBSIZES] [-k RATES] [-e ENGINES] WORKLOAD...\n",
+			        argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind == argc) {
+		fprintf(stderr, "Usage: %s [-c CYCLES] [-p CPUS] [-T TLBSIZES] [-k RATES] [-e ENGINES] WORKLOAD...\n",
+		        argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char tmpl[] = "/tmp/bench_guest.XXXXXX";
+	if (mkdtemp(tmpl) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	const std::string tmpDir(tmpl);
+
+	char cwd[FILENAME_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("getcwd");
+		return EXIT_FAILURE;
+	}
+
+	bool first = true;
+	printf("{\n    \"runs\": [");
+	for (int i = optind; i < argc; i++) {
+		std::string workload(argv[i]);
+		if (workload[0] != '/')
+			workload = std::string(cwd) + "/" + workload;
+
+		// File names in a configuration are relative to its directory
+		const std::string dir = workload.substr(0, workload.rfind('/') + 1);
+		if (chdir(dir.c_str()) != 0) {
+			perror(dir.c_str());
+			return EXIT_FAILURE;
+		}
+
+		for (unsigned int numCpus : cpus)
+		for (unsigned int tlbSize : tlbSizes)
+		for (unsigned int clockRate : clockRates)
+		for (size_t e = 0; e < std::max<size_t>(engines.size(), 1); e++) {
+			std::string error;
+			scoped_ptr<MachineConfig> config(loadWorkload(workload, tmpDir, error));
+			if (config.get() == NULL) {
+				fprintf(stderr, "%s: %s\n", argv[0], error.c_str());
+				return EXIT_FAILURE;
+			}
+			config->setNumProcessors(numCpus);
+			config->setTLBSize(tlbSize);
+			config->setClockRate(clockRate);
+			if (!engines.empty())
+				config->setExecEngine(engines[e]);
+
+			std::list<std::string> errors;
+			if (!config->Validate(&errors)) {
+				fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], errors.front().c_str());
+				return EXIT_FAILURE;
+			}
+
+			RunResult r;
+			try {
+				r = run(config.get(), maxCycles);
+			} catch (const Error& e) {
+				fprintf(stderr, "%s: %s: %s\n", argv[0], argv[i], e.what());
+				return EXIT_FAILURE;
+			}
+
+			fprintf(stderr, "%s: %u cpus, tlb %u, %u MHz, %s: %s after %llu cycles, %.3f s\n",
+			        argv[i], config->getNumProcessors(), config->getTLBSize(),
+			        config->getClockRate(), engineNames[config->getExecEngine()],
+			        r.halted ? "halted" : "cycle limit", (unsigned long long) r.cycles, r.seconds);
+
+			printf("%s\n        {\n", first ? "" : ",");
+			printf("            \"workload\": \"%s\",\n", argv[i]);
+			printf("            \"cpus\": %u,\n", config->getNumProcessors());
+			printf("            \"tlb_size\": %u,\n", config->getTLBSize());
+			printf("            \"clock_rate\": %u,\n", config->getClockRate());
+			printf("            \"engine\": \"%s\",\n", engineNames[config->getExecEngine()]);
+			printf("            \"halted\": %s,\n", r.halted ? "true" : "false");
+			printf("            \"cycles\": %llu,\n", (unsigned long long) r.cycles);
+			printf("            \"instructions\": %llu,\n", (unsigned long long) r.instructions);
+			printf("            \"skipped_cycles\": %llu,\n", (unsigned long long) r.skippedCycles);
+			printf("            \"host_seconds\": %.6f,\n", r.seconds);
+			printf("            \"instructions_per_second\": %.0f,\n", r.instructions / r.seconds);
+			printf("            \"cycles_per_second\": %.0f,\n", r.cycles / r.seconds);
+			printf("            \"idle_skip_ratio\": %.6f,\n",
+			       r.cycles ? (double) r.skippedCycles / r.cycles : 0.0);
+			printf("            \"simulated_seconds\": %.6f,\n",
+			       r.cycles / (config->getClockRate() * 1e6));
+			if (r.halted)
+				printf("            \"time_to_halt\": %.6f\n", r.seconds);
+			else
+				printf("            \"time_to_halt\": null\n");
+			printf("        }");
+			first = false;
+		}
+	}
+	printf("\n    ]\n}\n");
+
+	rmdir(tmpDir.c_str());
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,224 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_event_queue: random insertions, cancellations and reschedulings
+// are applied both to an EventQueue and to a sorted list which places
+// events the way the old list-based queue did, and the two must run
+// the events in the same order. Deadlines are drawn from a small range,
+// so that most events tie with others or with the head, and callbacks
+// change the queue themselves while they run.
+
+#include <list>
+#include <random>
+#include <vector>
+
+#include "umps/event.h"
+#include "tests/test_util.h"
+
+HIDDEN const unsigned int kRounds = 200;
+HIDDEN const unsigned int kOpsPerRound = 2000;
+HIDDEN const unsigned int kMaxDelay = 4;
+
+class EventQueueTest {
+public:
+	explicit EventQueueTest(unsigned int seed)
+		: rng(seed), now(0), running(false), runningDeadline(0), nextId(0)
+	{}
+
+	void Run();
+
+private:
+	struct RefEvent {
+		uint64_t deadline;
+		unsigned int id;
+	};
+
+	unsigned int random(unsigned int n) {
+		return std::uniform_int_distribution<unsigned int>(0, n - 1)(rng);
+	}
+
+	void randomOp();
+	void insert();
+	void cancel();
+	void reschedule();
+	void runHead();
+	void fire(unsigned int id);
+
+	void refInsert(uint64_t deadline, unsigned int id);
+	bool refRemove(unsigned int id);
+
+	std::mt19937 rng;
+	EventQueue queue;
+
+	// The old queue: an event due no later than the head goes before
+	// it, any other one after all the events due no later than itself.
+	// The event whose callback is running still counts as the head
+	std::list<RefEvent> ref;
+
+	uint64_t now;
+	bool running;
+	uint64_t runningDeadline;
+
+	unsigned int nextId;
+	std::vector<Event::Handle> handles;
+	std::vector<unsigned int> expected;
+	std::vector<unsigned int> fired;
+};
+
+void EventQueueTest::Run()
+{
+	for (unsigned int i = 0; i < kOpsPerRound; i++) {
+		if (!queue.IsEmpty() && random(3) == 0)
+			runHead();
+		else
+			randomOp();
+	}
+	while (!queue.IsEmpty())
+		runHead();
+
+	CHECK(ref.empty());
+	CHECK(fired == expected);
+}
+
+void EventQueueTest::randomOp()
+{
+	switch (random(4)) {
+	case 0:
+		cancel();
+		break;
+	case 1:
+		reschedule();
+		break;
+	default:
+		insert();
+		break;
+	}
+}
+
+void EventQueueTest::insert()
+{
+	unsigned int id = nextId++;
+	uint64_t delay = random(kMaxDelay + 1);
+
+	handles.resize(nextId);
+	uint64_t deadline = queue.InsertQ(now, delay, [this, id]() { fire(id); },
+	                                  EventTag(), &handles[id]);
+	CHECK(deadline == now + delay);
+	refInsert(deadline, id);
+}
+
+void EventQueueTest::cancel()
+{
+	if (nextId == 0)
+		return;
+
+	// Stale handles (of events that already ran or were cancelled)
+	// must be refused
+	unsigned int id = random(nextId);
+	bool pending = refRemove(id);
+	CHECK(queue.Cancel(handles[id]) == pending);
+}
+
+void EventQueueTest::reschedule()
+{
+	if (nextId == 0)
+		return;
+
+	unsigned int id = random(nextId);
+	uint64_t deadline = now + random(kMaxDelay + 1);
+	bool pending = refRemove(id);
+	CHECK(queue.Reschedule(handles[id], deadline) == pending);
+	if (pending)
+		refInsert(deadline, id);
+}
+
+void EventQueueTest::runHead()
+{
+	if (ref.empty()) {
+		CHECK(!"queue has more events than the reference");
+		queue.RunHead();
+		return;
+	}
+	CHECK(queue.nextDeadline() == ref.front().deadline);
+
+	RefEvent head = ref.front();
+	ref.pop_front();
+	expected.push_back(head.id);
+
+	now = head.deadline;
+	running = true;
+	runningDeadline = head.deadline;
+	queue.RunHead();
+	running = false;
+}
+
+// The callback may insert, cancel or reschedule other events, and even
+// cancel itself, which must have no effect as it already left the queue
+void EventQueueTest::fire(unsigned int id)
+{
+	fired.push_back(id);
+	for (unsigned int n = random(3); n > 0; n--)
+		randomOp();
+	if (random(8) == 0)
+		CHECK(!queue.Cancel(handles[id]));
+}
+
+void EventQueueTest::refInsert(uint64_t deadline, unsigned int id)
+{
+	RefEvent ev = { deadline, id };
+
+	bool first;
+	if (running)
+		first = deadline <= runningDeadline;
+	else
+		first = ref.empty() || deadline <= ref.front().deadline;
+
+	if (first) {
+		ref.push_front(ev);
+	} else {
+		std::list<RefEvent>::iterator it = ref.begin();
+		while (it != ref.end() && it->deadline <= deadline)
+			++it;
+		ref.insert(it, ev);
+	}
+}
+
+bool EventQueueTest::refRemove(unsigned int id)
+{
+	for (std::list<RefEvent>::iterator it = ref.begin(); it != ref.end(); ++it) {
+		if (it->id == id) {
+			ref.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+int main()
+{
+	for (unsigned int seed = 1; seed <= kRounds; seed++) {
+		EventQueueTest test(seed);
+		test.Run();
+		if (testFailures > 0) {
+			fprintf(stderr, "test_event_queue: seed %u\n", seed);
+			break;
+		}
+	}
+
+	return TestExitStatus("test_event_queue");
+}
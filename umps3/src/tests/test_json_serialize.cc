@@ -17,6 +17,7 @@
  */
 
 #include <iostream>
+#include <sstream>
 
 #include "base/json.h"
 
@@ -26,6 +27,8 @@ int main(int argc, char** argv)
 
 	object.Set("favorite-drink", "Pan-Galactic Gargle Blaster");
 	object.Set("favorite-number", 42);
+	// Wider than an int, as cycle counters get
+	object.Set("cycles", (int64_t) 5000000000LL);
 	JsonArray* array = new JsonArray;
 	object.Set("friends", array);
 	array->Add(new JsonString("Ford Prefect"));
@@ -47,5 +50,18 @@ int main(int argc, char** argv)
 	object.Serialize(buffer, true);
 	std::cout << buffer;
 
+	// Numbers must survive a round trip whole
+	std::istringstream stream(buffer);
+	JsonParser parser;
+	JsonNode* root = parser.Parse(stream);
+	const JsonObject* parsed = root->AsObject();
+	bool ok = (parsed->Get("favorite-number")->AsNumber() == 42 &&
+	           parsed->Get("cycles")->AsNumber() == 5000000000LL);
+	delete root;
+	if (!ok) {
+		std::cerr << "64-bit numbers were not preserved\n";
+		return 1;
+	}
+
 	return 0;
 }
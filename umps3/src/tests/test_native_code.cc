@@ -0,0 +1,337 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_native_code: random guest loops run on a machine with the jit
+// engine and on one with the interpreter, which must be in the same
+// state after the same number of cycles. Loop bodies mix the ALU
+// instructions, loads and stores, delayed loads, branches and calls
+// native code handles with instructions it leaves to the interpreter,
+// device register reads, and stores which rewrite an instruction of
+// the loop while it runs; cycles are stepped in chunks of varying
+// size, so that native code is also cut short by the cycles budget.
+
+#include <random>
+#include <vector>
+
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+#include "umps/systembus.h"
+#include "tests/test_util.h"
+
+HIDDEN const unsigned int kPrograms = 40;
+HIDDEN const unsigned int kChunks = 60;
+HIDDEN const unsigned int kLoopCount = 100;
+HIDDEN const Word kDataWords = 64;
+
+// Registers the generated code keeps for itself: the others are free
+// for random instructions to write
+HIDDEN const Word CODE = 19;
+HIDDEN const Word PATCH = 20;
+HIDDEN const Word BUS = 21;
+HIDDEN const Word COUNT = 22;
+HIDDEN const Word DATA = 23;
+HIDDEN const Word K0 = 26;
+HIDDEN const Word K1 = 27;
+HIDDEN const Word SUB = 30;
+HIDDEN const Word RA = 31;
+
+class NativeCodeTest {
+public:
+	explicit NativeCodeTest(unsigned int seed)
+		: rng(seed)
+	{}
+
+	void Run();
+
+private:
+	Word random(Word n) {
+		return std::uniform_int_distribution<Word>(0, n - 1)(rng);
+	}
+	Word randomWord() {
+		return std::uniform_int_distribution<Word>(0, MAXWORDVAL)(rng);
+	}
+
+	Word here() const { return TestMachine::kCodeBase + code.size() * WORDLEN; }
+
+	Word dest();
+	Word source();
+	Word alu();
+	void emitItem();
+	void emitBranch();
+	void emitLoop();
+
+	std::vector<uint64_t> state(TestMachine& tm);
+
+	std::mt19937 rng;
+	std::vector<Word> code;
+	std::vector<size_t> calls;
+	Word patchSlot;
+};
+
+Word NativeCodeTest::dest()
+{
+	static const Word regs[] = {
+		1, 2, 3, 4, 5, 6, 7, T0, T1, T2, T3, T4, T5, T6, T7, S0, S1, S2, 24, 25
+	};
+	return regs[random(sizeof(regs) / sizeof(regs[0]))];
+}
+
+// Sources are mostly registers random instructions write, so that
+// results feed each other
+Word NativeCodeTest::source()
+{
+	return random(4) ? dest() : random(CPUREGNUM - 2);
+}
+
+Word NativeCodeTest::alu()
+{
+	static const Word rtypes[] = {
+		SFN_ADDU, SFN_SUBU, SFN_AND, SFN_OR, SFN_XOR, SFN_NOR, SFN_SLT, SFN_SLTU,
+		SFN_SLLV, SFN_SRLV, SFN_SRAV
+	};
+	static const Word shifts[] = { SFN_SLL, SFN_SRL, SFN_SRA };
+	static const Word itypes[] = { ADDIU, ANDI, ORI, XORI, SLTI, SLTIU };
+
+	switch (random(9)) {
+	case 0:
+	case 1:
+	case 2:
+		return RType(rtypes[random(sizeof(rtypes) / sizeof(rtypes[0]))],
+		             dest(), source(), source());
+	case 3:
+		return RType(shifts[random(3)], dest(), 0, source(), random(32));
+	case 4:
+		return RType(random(2) ? SFN_MFHI : SFN_MFLO, dest(), 0, 0);
+	case 5:
+		// a write to $0 is a no-op
+		return IType(ADDIU, 0, source(), random(0x10000));
+	case 6:
+		return IType(LUI, dest(), 0, random(0x10000));
+	default:
+		return IType(itypes[random(sizeof(itypes) / sizeof(itypes[0]))],
+		             dest(), source(), random(0x10000));
+	}
+}
+
+// Conditional branches skip a few instructions forward; their delay
+// slot is mostly an ALU instruction, which native code needs to take
+// the branch itself
+void NativeCodeTest::emitBranch()
+{
+	static const Word regimm[] = { BLTZ, BGEZ, BLTZAL, BGEZAL };
+	const Word skip = 1 + random(3);
+
+	switch (random(4)) {
+	case 0:
+		code.push_back(IType(BEQ, source(), source(), skip + 1));
+		break;
+	case 1:
+		code.push_back(IType(BNE, source(), source(), skip + 1));
+		break;
+	case 2:
+		code.push_back(IType(random(2) ? BLEZ : BGTZ, 0, source(), skip + 1));
+		break;
+	default:
+		code.push_back(IType(BGL, regimm[random(4)], source(), skip + 1));
+		break;
+	}
+	code.push_back(random(4) ? alu() : IType(LW, dest(), DATA, random(kDataWords) * WORDLEN));
+	for (Word i = 0; i < skip; i++)
+		code.push_back(alu());
+}
+
+void NativeCodeTest::emitItem()
+{
+	const Word offset = random(kDataWords) * WORDLEN;
+
+	switch (random(16)) {
+	case 0:
+	case 1:
+		// a delayed load, whose target the next instruction reads
+		code.push_back(IType(LW, dest(), DATA, offset));
+		code.push_back(alu());
+		break;
+	case 2:
+		code.push_back(IType(LW, dest(), DATA, offset));
+		break;
+	case 3:
+	case 4:
+		code.push_back(IType(SW, source(), DATA, offset));
+		break;
+	case 5:
+	case 6:
+		emitBranch();
+		break;
+	case 7:
+		calls.push_back(code.size());
+		code.push_back(0);
+		code.push_back(alu());
+		break;
+	case 8:
+		code.push_back(RType(SFN_JALR, RA, SUB, 0));
+		code.push_back(alu());
+		break;
+	case 9:
+		// left to the interpreter
+		code.push_back(RType(random(2) ? SFN_MULTU : SFN_DIVU, 0, source(), source()));
+		break;
+	case 10:
+		// a device register, out of native code reach
+		code.push_back(IType(LW, dest(), BUS, BUS_REG_TOD_LO - BUS_REG_RAM_BASE));
+		break;
+	default:
+		code.push_back(alu());
+		break;
+	}
+}
+
+// The loop stores to an ADDIU of its own, a few instructions ahead of
+// the store, on every iteration; the immediate changes on the last one
+// only, so that the loop still gets hot
+void NativeCodeTest::emitLoop()
+{
+	const Word loop = here();
+	const unsigned int items = 4 + random(40);
+	const unsigned int patchAt = random(items);
+
+	for (unsigned int i = 0; i < items; i++) {
+		if (i == patchAt) {
+			code.push_back(IType(ADDIU, K0, COUNT, -1));
+			code.push_back(IType(BNE, 0, K0, 3));
+			code.push_back(alu());
+			code.push_back(IType(ADDIU, K1, K1, 1));
+			code.push_back(IType(ANDI, K1, K1, 0xFF));
+			code.push_back(RType(SFN_OR, K0, K1, PATCH));
+			code.push_back(IType(SW, K0, CODE, here() + 3 * WORDLEN - TestMachine::kCodeBase));
+			code.push_back(alu());
+			code.push_back(alu());
+			patchSlot = here();
+			code.push_back(IType(ADDIU, T0, T0, 0));
+		}
+		emitItem();
+	}
+	code.push_back(IType(ADDIU, COUNT, COUNT, -1));
+	code.push_back(IType(BNE, 0, COUNT, (loop - here() - WORDLEN) / WORDLEN));
+	code.push_back(alu());
+}
+
+std::vector<uint64_t> NativeCodeTest::state(TestMachine& tm)
+{
+	std::vector<uint64_t> s;
+	Processor* cpu = tm.getProcessor();
+	s.push_back(tm.getMachine()->getBus()->getToD());
+	s.push_back(cpu->getStats().instructions);
+	s.push_back(cpu->getPC());
+	for (unsigned int r = 0; r < CPUREGNUM; r++)
+		s.push_back((Word) cpu->getGPR(r));
+	for (unsigned int r = 0; r < CP0REGNUM; r++)
+		s.push_back(cpu->getCP0Reg(r));
+	for (Word i = 0; i < kDataWords; i++) {
+		Word data = 0;
+		CHECK(!tm.getMachine()->ReadMemory(TestMachine::kDataBase + i * WORDLEN, &data));
+		s.push_back(data);
+	}
+	Word patch = 0;
+	CHECK(!tm.getMachine()->ReadMemory(patchSlot, &patch));
+	s.push_back(patch);
+	return s;
+}
+
+void NativeCodeTest::Run()
+{
+	const Word base = TestMachine::kCodeBase;
+
+	code.push_back(IType(LUI, DATA, 0, TestMachine::kDataBase >> 16));
+	code.push_back(IType(ORI, DATA, DATA, TestMachine::kDataBase));
+	code.push_back(IType(LUI, CODE, 0, base >> 16));
+	code.push_back(IType(ORI, CODE, CODE, base));
+	code.push_back(IType(LUI, BUS, 0, BUS_REG_RAM_BASE >> 16));
+	code.push_back(IType(LUI, PATCH, 0, IType(ADDIU, T0, T0, 0) >> 16));
+	for (Word r = 1; r < CODE; r++) {
+		code.push_back(IType(LUI, r, 0, random(0x10000)));
+		code.push_back(IType(ORI, r, r, random(0x10000)));
+	}
+	const size_t subAt = code.size();
+	code.push_back(0);
+	code.push_back(0);
+	const Word outer = here();
+	code.push_back(IType(ADDIU, COUNT, 0, kLoopCount));
+	emitLoop();
+	code.push_back(Jump(outer));
+	code.push_back(NOP);
+
+	// the subroutine calls go to
+	const Word sub = here();
+	code[subAt] = IType(LUI, SUB, 0, sub >> 16);
+	code[subAt + 1] = IType(ORI, SUB, SUB, sub);
+	for (unsigned int i = random(4); i > 0; i--)
+		code.push_back(alu());
+	code.push_back(RType(SFN_JR, 0, RA, 0));
+	code.push_back(alu());
+	for (size_t at : calls)
+		code[at] = (JAL << 26) | ((sub >> WORDSHIFT) & 0x03FFFFFFUL);
+
+	std::vector<Word> data;
+	for (Word i = 0; i < kDataWords; i++)
+		data.push_back(random(4) ? randomWord() : random(4));
+
+	TestMachine interp(1, 0, EXEC_ENGINE_INTERPRETER);
+	TestMachine jit(1, 0, EXEC_ENGINE_JIT);
+	TestMachine* machines[] = { &interp, &jit };
+	for (TestMachine* tm : machines) {
+		tm->Load(base, code);
+		tm->Load(TestMachine::kDataBase, data);
+		tm->Start(0, base);
+	}
+
+	for (unsigned int i = 0; i < kChunks; i++) {
+		const unsigned int cycles = random(3) ? 1 + random(5000) : 1 + random(8);
+		for (TestMachine* tm : machines)
+			tm->getMachine()->step(cycles);
+		if (state(interp) != state(jit)) {
+			fprintf(stderr, "engines differ after chunk %u, at pc 0x%08x and 0x%08x\n", i,
+			        interp.getProcessor()->getPC(), jit.getProcessor()->getPC());
+			testFailures++;
+			return;
+		}
+	}
+
+	// no exception took the guest out of its code
+	const Word pc = interp.getProcessor()->getPC();
+	CHECK(base <= pc && pc < here());
+
+	// the loop did run all along
+	CHECK(interp.getProcessor()->getStats().instructions > kChunks * 1000);
+}
+
+int main()
+{
+	for (unsigned int seed = 1; seed <= kPrograms; seed++) {
+		NativeCodeTest test(seed);
+		test.Run();
+		if (testFailures > 0) {
+			fprintf(stderr, "test_native_code: seed %u\n", seed);
+			break;
+		}
+	}
+
+	return TestExitStatus("test_native_code");
+}
@@ -0,0 +1,252 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_run_until: Machine::RunUntil() must stop on each kind of
+// predicate at the right point: before the instruction at a PC, on an
+// exception by its architectural code, within one instruction per
+// processor past the instruction budget, and on terminal output which
+// spans several characters. When predicates on two processors hold in
+// the same cycle, the one on the processor cycled first wins.
+
+#include <vector>
+
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+#include "tests/test_util.h"
+
+// CAUSE.ExcCode values
+HIDDEN const unsigned int kExcCodeAdES = 5;
+HIDDEN const unsigned int kExcCodeSys = 8;
+
+// A run of NOPs, then the instruction last
+HIDDEN std::vector<Word> straight(unsigned int nops, Word last)
+{
+	std::vector<Word> code(nops, NOP);
+	code.push_back(last);
+	code.push_back(kSpinInstr);
+	code.push_back(NOP);
+	return code;
+}
+
+HIDDEN const Word kSyscall = RType(SFN_SYSCALL, 0, 0, 0);
+
+HIDDEN void testPC()
+{
+	TestMachine tm;
+	tm.Load(TestMachine::kCodeBase, straight(6, kSyscall));
+	tm.Start(0, TestMachine::kCodeBase);
+
+	const Word target = TestMachine::kCodeBase + 6 * WORDLEN;
+	RunPredicates p;
+	p.pcs.insert(target);
+	CHECK(tm.getMachine()->RunUntil(p) == RU_PC);
+
+	// the instruction is next, and has not been run
+	Processor* cpu = tm.getProcessor();
+	CHECK(cpu->getPC() == target);
+	CHECK(cpu->getStats().exceptions[SYSEXCEPTION] == 0);
+	CHECK(cpu->getStats().instructions == 6);
+}
+
+// Exceptions are told by CAUSE.ExcCode, not by the emulator's own
+// exception numbers: 8 is a syscall, not an address error on store
+HIDDEN void testException()
+{
+	{
+		TestMachine tm;
+		tm.Load(TestMachine::kCodeBase, straight(3, kSyscall));
+		tm.Start(0, TestMachine::kCodeBase);
+
+		RunPredicates p;
+		p.excCodes.insert(kExcCodeSys);
+		p.cycles = 1000;
+		CHECK(tm.getMachine()->RunUntil(p) == RU_EXCEPTION);
+		CHECK(tm.getProcessor()->getStats().exceptions[SYSEXCEPTION] == 1);
+		CHECK(tm.getProcessor()->getStats().instructions == 3);
+	}
+
+	// sw $0, 1($0) is misaligned
+	const Word misaligned = IType(SW, 0, 0, 1);
+	{
+		TestMachine tm;
+		tm.Load(TestMachine::kCodeBase, straight(3, misaligned));
+		tm.Start(0, TestMachine::kCodeBase);
+
+		RunPredicates p;
+		p.excCodes.insert(kExcCodeSys);
+		p.cycles = 1000;
+		CHECK(tm.getMachine()->RunUntil(p) == RU_CYCLES);
+		CHECK(tm.getProcessor()->getStats().exceptions[ADESEXCEPTION] == 1);
+	}
+	{
+		TestMachine tm;
+		tm.Load(TestMachine::kCodeBase, straight(3, misaligned));
+		tm.Start(0, TestMachine::kCodeBase);
+
+		RunPredicates p;
+		p.excCodes.insert(kExcCodeAdES);
+		p.cycles = 1000;
+		CHECK(tm.getMachine()->RunUntil(p) == RU_EXCEPTION);
+		CHECK(tm.getProcessor()->getStats().exceptions[ADESEXCEPTION] == 1);
+	}
+}
+
+// Every processor completes one instruction a cycle at most, so the
+// budget is overrun by less than one instruction per processor
+HIDDEN void testInstructionBudget()
+{
+	static const unsigned int kCpus = 3;
+	static const uint64_t budgets[] = { 1, 2, 3, 4, 7, 1000, 12345 };
+
+	for (uint64_t budget : budgets) {
+		TestMachine tm(kCpus);
+		tm.Load(TestMachine::kCodeBase, straight(0, NOP));
+		for (unsigned int i = 0; i < kCpus; i++)
+			tm.Start(i, TestMachine::kCodeBase);
+
+		RunPredicates p;
+		p.instructions = budget;
+		uint64_t cycles;
+		CHECK(tm.getMachine()->RunUntil(p, &cycles) == RU_INSTRUCTIONS);
+		const uint64_t done = tm.getMachine()->getTotalStats().instructions;
+		if (done < budget || done >= budget + kCpus) {
+			fprintf(stderr, "budget %llu: %llu instructions run\n",
+			        (unsigned long long) budget, (unsigned long long) done);
+			testFailures++;
+		}
+		CHECK(cycles * kCpus >= done);
+	}
+}
+
+// Processor 0 and 1 run the same code, which one of them ends with a
+// syscall: the syscall, and the fetch of the instruction after the one
+// in the same place on the other processor, fall in the same cycle
+HIDDEN RunUntilResult runBoth(unsigned int sysCpu, bool pc, bool exception, uint64_t* cycles)
+{
+	static const unsigned int kNops = 5;
+	const Word sysCode = TestMachine::kCodeBase;
+	const Word nopCode = TestMachine::kCodeBase + 0x100;
+
+	TestMachine tm(2);
+	tm.Load(sysCode, straight(kNops, kSyscall));
+	tm.Load(nopCode, straight(kNops, NOP));
+	tm.Start(sysCpu, sysCode);
+	tm.Start(1 - sysCpu, nopCode);
+
+	RunPredicates p;
+	if (pc)
+		p.pcs.insert(nopCode + (kNops + 1) * WORDLEN);
+	if (exception)
+		p.excCodes.insert(kExcCodeSys);
+	p.cycles = 1000;
+	return tm.getMachine()->RunUntil(p, cycles);
+}
+
+HIDDEN void testFirstWins()
+{
+	for (unsigned int sysCpu = 0; sysCpu < 2; sysCpu++) {
+		uint64_t pcCycles, excCycles, bothCycles;
+		CHECK(runBoth(sysCpu, true, false, &pcCycles) == RU_PC);
+		CHECK(runBoth(sysCpu, false, true, &excCycles) == RU_EXCEPTION);
+
+		// both hold in the same cycle...
+		CHECK(pcCycles == excCycles);
+
+		// ...and the processor cycled first tells which one is seen
+		const RunUntilResult expected = (sysCpu == 0) ? RU_EXCEPTION : RU_PC;
+		CHECK(runBoth(sysCpu, true, true, &bothCycles) == expected);
+		CHECK(bothCycles == pcCycles);
+	}
+}
+
+// The guest transmits text on terminal 0, one character at a time, and
+// counts in s0 the characters transmitted
+HIDDEN std::vector<Word> transmit(const char* text)
+{
+	const Word base = DEV_REG_ADDR(IL_TERMINAL, 0);
+	// TRANSTATUS and TRANCOMMAND register offsets, BUSY status and
+	// TRANSMITCHAR command
+	const Word status = 2 * WORDLEN;
+	const Word command = 3 * WORDLEN;
+	const Word busy = 3;
+	const Word transmitChar = 2;
+
+	std::vector<Word> code = {
+		IType(LUI, T0, 0, base >> 16),
+		IType(ORI, T0, T0, base)
+	};
+	for (const char* c = text; *c != '\0'; c++) {
+		code.push_back(IType(ADDIU, T1, 0, ((Word) *c << 8) | transmitChar));
+		code.push_back(IType(SW, T1, T0, command));
+		// poll: wait while the terminal is busy
+		code.push_back(IType(LW, T2, T0, status));
+		code.push_back(NOP);
+		code.push_back(IType(ANDI, T2, T2, 0xFF));
+		code.push_back(IType(ADDIU, T2, T2, -busy));
+		code.push_back(IType(BEQ, 0, T2, -5));
+		code.push_back(NOP);
+		code.push_back(IType(ADDIU, S0, S0, 1));
+	}
+	code.push_back(kSpinInstr);
+	code.push_back(NOP);
+	return code;
+}
+
+HIDDEN void testOutput()
+{
+	{
+		TestMachine tm(1, 0, EXEC_ENGINE_INTERPRETER, true);
+		tm.Load(TestMachine::kCodeBase, transmit("xaaby"));
+		tm.Start(0, TestMachine::kCodeBase);
+
+		RunPredicates p;
+		p.output = "ab";
+		p.cycles = 1000000;
+		CHECK(tm.getMachine()->RunUntil(p) == RU_OUTPUT);
+
+		// the run stops as soon as the b is out: x and both a were
+		// transmitted before
+		CHECK(tm.getProcessor()->getGPR(S0) == 3);
+	}
+	{
+		// the characters must come in order
+		TestMachine tm(1, 0, EXEC_ENGINE_INTERPRETER, true);
+		tm.Load(TestMachine::kCodeBase, transmit("xaaby"));
+		tm.Start(0, TestMachine::kCodeBase);
+
+		RunPredicates p;
+		p.output = "ba";
+		p.cycles = 1000000;
+		CHECK(tm.getMachine()->RunUntil(p) == RU_CYCLES);
+		CHECK(tm.getProcessor()->getGPR(S0) == 5);
+	}
+}
+
+int main()
+{
+	testPC();
+	testException();
+	testInstructionBudget();
+	testFirstWins();
+	testOutput();
+
+	return TestExitStatus("test_run_until");
+}
@@ -0,0 +1,102 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_smp_timer: every processor of a parallel SMP machine rewrites
+// its local timer and toggles STATUS.TE in a loop, so that the host
+// threads schedule and cancel timer events on the shared event queue
+// all the time. Then each processor arms its timer once more, and must
+// see it underflow on time.
+
+#include <vector>
+
+#include "umps/arch.h"
+#include "umps/cp0.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+#include "tests/test_util.h"
+
+HIDDEN const unsigned int kCpus = 8;
+HIDDEN const Word kQuantum = 100;
+HIDDEN const unsigned int kStressCycles = 2000000;
+
+HIDDEN const Word kCheckBase = TestMachine::kCodeBase + 0x1000;
+HIDDEN const Word kCheckTimer = 500;
+
+// timer reprogramming loop; t2 holds STATUS.TE
+HIDDEN std::vector<Word> stressCode()
+{
+	const Word loop = TestMachine::kCodeBase + 2 * WORDLEN;
+	return {
+		IType(LUI, T2, 0, STATUS_TE >> 16),
+		IType(ADDIU, T0, 0, 50),
+		// loop:
+		Mtc0(T0, CP0_Timer),
+		Mfc0(T1, CP0_Status),
+		NOP,
+		RType(SFN_XOR, T1, T1, T2),
+		Mtc0(T1, CP0_Status),
+		IType(ADDIU, T0, T0, 37),
+		IType(ANDI, T0, T0, 0x3FF),
+		Jump(loop),
+		NOP
+	};
+}
+
+// the timer is armed with interrupts masked, and the processor spins
+HIDDEN std::vector<Word> checkCode()
+{
+	return {
+		IType(ADDIU, T0, 0, kCheckTimer),
+		Mtc0(T0, CP0_Timer),
+		IType(LUI, T1, 0, (STATUSRESET | STATUS_TE) >> 16),
+		Mtc0(T1, CP0_Status),
+		kSpinInstr,
+		NOP
+	};
+}
+
+int main()
+{
+	TestMachine tm(kCpus, kQuantum);
+	Machine* machine = tm.getMachine();
+
+	tm.Load(TestMachine::kCodeBase, stressCode());
+	tm.Load(kCheckBase, checkCode());
+	for (unsigned int i = 0; i < kCpus; i++)
+		tm.Start(i, TestMachine::kCodeBase);
+
+	unsigned int stepped;
+	machine->step(kStressCycles, &stepped);
+	CHECK(stepped == kStressCycles);
+	for (unsigned int i = 0; i < kCpus; i++)
+		CHECK(tm.getProcessor(i)->getStats().instructions > kStressCycles / 2);
+
+	for (unsigned int i = 0; i < kCpus; i++)
+		tm.Start(i, kCheckBase);
+
+	// Short of the underflow, with a quantum to spare
+	machine->step(kCheckTimer - kQuantum);
+	for (unsigned int i = 0; i < kCpus; i++)
+		CHECK(!(tm.getProcessor(i)->getCP0Reg(CAUSE) & CAUSE_IP(IL_CPUTIMER)));
+	machine->step(3 * kQuantum);
+	for (unsigned int i = 0; i < kCpus; i++)
+		CHECK(tm.getProcessor(i)->getCP0Reg(CAUSE) & CAUSE_IP(IL_CPUTIMER));
+
+	return TestExitStatus("test_smp_timer");
+}
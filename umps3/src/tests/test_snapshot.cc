@@ -0,0 +1,208 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_snapshot: a machine is saved to a snapshot in the middle of a
+// run, while its processors keep rearming their local timers, and the
+// snapshot is restored into a fresh machine; after the same number of
+// cycles both machines must be in the same state. Then truncated,
+// corrupted and mismatched snapshots must be refused.
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/cp0.h"
+#include "umps/error.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+#include "umps/systembus.h"
+#include "tests/test_util.h"
+
+HIDDEN const unsigned int kCpus = 2;
+HIDDEN const unsigned int kSaveCycles = 12345;
+HIDDEN const unsigned int kRunCycles = 50000;
+
+HIDDEN const Word SP = 29;
+
+// Each processor counts loop iterations in t0, and every 8 of them
+// arms its timer with a varying value, which may or may not underflow
+// before the next one; the timer and the cause register are read back
+// on every iteration and folded into t4 and t7, which are also stored
+// on the stack
+HIDDEN std::vector<Word> timerCode()
+{
+	const Word base = TestMachine::kCodeBase;
+	const Word loop = base + 3 * WORDLEN;
+	return {
+		IType(LUI, T2, 0, STATUS_TE >> 16),
+		Mtc0(T2, CP0_Status),
+		IType(ADDIU, T0, 0, 0),
+		// loop:
+		IType(ADDIU, T0, T0, 1),
+		IType(ANDI, T1, T0, 0x7),
+		IType(BNE, 0, T1, 4),
+		NOP,
+		IType(ANDI, T6, T0, 0x7F),
+		IType(ADDIU, T6, T6, 40),
+		Mtc0(T6, CP0_Timer),
+		// skip:
+		Mfc0(T3, CP0_Timer),
+		RType(SFN_ADDU, T4, T4, T3),
+		Mfc0(T5, CP0_Cause),
+		RType(SFN_ADDU, T4, T4, T5),
+		RType(SFN_OR, T7, T7, T5),
+		IType(SW, T4, SP, -4),
+		IType(SW, T7, SP, -8),
+		Jump(loop),
+		NOP
+	};
+}
+
+// This function returns the state of tm which the guest code can tell
+// or depends on
+HIDDEN std::vector<uint64_t> machineState(TestMachine& tm)
+{
+	std::vector<uint64_t> state;
+	state.push_back(tm.getMachine()->getBus()->getToD());
+	for (unsigned int i = 0; i < kCpus; i++) {
+		Processor* cpu = tm.getProcessor(i);
+		state.push_back(cpu->getPC());
+		for (unsigned int r = 0; r < CPUREGNUM; r++)
+			state.push_back((Word) cpu->getGPR(r));
+		for (unsigned int r = 0; r < CP0REGNUM; r++)
+			state.push_back(cpu->getCP0Reg(r));
+
+		Word sp = cpu->getGPR(SP);
+		for (Word addr = sp - 2 * WORDLEN; addr < sp; addr += WORDLEN) {
+			Word data = 0;
+			CHECK(!tm.getMachine()->ReadMemory(addr, &data));
+			state.push_back(data);
+		}
+	}
+	return state;
+}
+
+// This function returns TRUE if restoring fileName into tm throws
+// InvalidFileFormatError
+HIDDEN bool refused(TestMachine& tm, const std::string& fileName)
+{
+	try {
+		tm.getMachine()->RestoreSnapshot(fileName);
+	} catch (const InvalidFileFormatError& e) {
+		return true;
+	}
+	return false;
+}
+
+HIDDEN std::string readFile(const std::string& fileName)
+{
+	std::string data;
+	FILE* file = fopen(fileName.c_str(), "r");
+	if (file == NULL)
+		return data;
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+		data.append(buf, n);
+	fclose(file);
+	return data;
+}
+
+HIDDEN void writeFile(const std::string& fileName, const std::string& data)
+{
+	FILE* file = fopen(fileName.c_str(), "w");
+	CHECK(file != NULL);
+	if (file != NULL) {
+		CHECK(fwrite(data.data(), 1, data.size(), file) == data.size());
+		fclose(file);
+	}
+}
+
+int main()
+{
+	char tmpl[] = "/tmp/umps_snapshot.XXXXXX";
+	if (mkdtemp(tmpl) == NULL) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+	const std::string dir = tmpl;
+	const std::string snapshot = dir + "/machine.snap";
+	const std::string broken = dir + "/broken.snap";
+
+	std::vector<uint64_t> expected;
+	{
+		TestMachine tm(kCpus);
+		tm.Load(TestMachine::kCodeBase, timerCode());
+		for (unsigned int i = 0; i < kCpus; i++)
+			tm.Start(i, TestMachine::kCodeBase);
+
+		// The second processor is restarted later, so that the two
+		// timers are out of step
+		tm.getMachine()->step(kSaveCycles / 3);
+		tm.Start(1, TestMachine::kCodeBase);
+		tm.getMachine()->step(kSaveCycles - kSaveCycles / 3);
+		tm.getMachine()->SaveSnapshot(snapshot);
+
+		tm.getMachine()->step(kRunCycles);
+		expected = machineState(tm);
+
+		// The timers did underflow, and the guest saw it
+		for (unsigned int i = 0; i < kCpus; i++)
+			CHECK(tm.getProcessor(i)->getGPR(T7) & CAUSE_IP(IL_CPUTIMER));
+	}
+
+	{
+		TestMachine tm(kCpus);
+		tm.getMachine()->RestoreSnapshot(snapshot);
+		tm.getMachine()->step(kRunCycles);
+		CHECK(machineState(tm) == expected);
+	}
+
+	{
+		TestMachine tm(kCpus);
+		const std::string data = readFile(snapshot);
+		CHECK(data.size() > 64);
+
+		writeFile(broken, data.substr(0, data.size() / 2));
+		CHECK(refused(tm, broken));
+		writeFile(broken, data.substr(0, data.size() - 1));
+		CHECK(refused(tm, broken));
+		writeFile(broken, "");
+		CHECK(refused(tm, broken));
+		writeFile(broken, "not a snapshot" + data.substr(14));
+		CHECK(refused(tm, broken));
+	}
+
+	{
+		// Snapshots only go back into a machine with the same processors,
+		// RAM and TLB
+		TestMachine tm(kCpus + 1);
+		CHECK(refused(tm, snapshot));
+	}
+
+	unlink(snapshot.c_str());
+	unlink(broken.c_str());
+	rmdir(dir.c_str());
+
+	return TestExitStatus("test_snapshot");
+}
@@ -0,0 +1,205 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_stoppoint_condition: stoppoint conditions are compiled from
+// valid and invalid text, and evaluated against the registers of a
+// test machine processor and the memory of its bus; then ignore counts
+// and conditions decide which accesses fire a stoppoint.
+
+#include <string>
+
+#include "umps/const.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+#include "umps/stoppoint.h"
+#include "umps/systembus.h"
+#include "tests/test_util.h"
+
+HIDDEN const Word kWord = TestMachine::kDataBase;
+
+// This function returns TRUE if text compiles and holds for an access
+// by cpu
+HIDDEN bool holds(const std::string& text, const Processor* cpu, const SystemBus* bus)
+{
+	std::string error;
+	scoped_ptr<StoppointCondition> condition(StoppointCondition::Compile(text, error));
+	if (!condition) {
+		fprintf(stderr, "`%s' does not compile: %s\n", text.c_str(), error.c_str());
+		testFailures++;
+		return false;
+	}
+	CHECK(condition->getText() == text);
+	return condition->Eval(cpu, bus);
+}
+
+HIDDEN bool compiles(const std::string& text)
+{
+	std::string error;
+	scoped_ptr<StoppointCondition> condition(StoppointCondition::Compile(text, error));
+	if (!condition && error.empty()) {
+		fprintf(stderr, "`%s' does not compile, with no error\n", text.c_str());
+		testFailures++;
+	}
+	return condition.get() != NULL;
+}
+
+HIDDEN void testSyntax()
+{
+	const char* const valid[] = {
+		"a0 == 1",
+		"  a0==1  ",
+		"$a0 != 0x10 && [0x20001000] & 0xff >= 7 && cpu < 2",
+		"[0x20001000]&0xff!=0",
+		"t0 <= -1",
+		"Status > 0 && pc == 0x20001000 && asid == 0"
+	};
+	for (const char* text : valid)
+		CHECK(compiles(text));
+
+	const char* const invalid[] = {
+		"",
+		"a0",
+		"a0 ==",
+		"a0 == x",
+		"a0 = 1",
+		"a0 == 1 &&",
+		"a0 == 1 b0 == 2",
+		"a0 == 1 || a1 == 2",
+		"a0 & == 1",
+		"a0 == 0x100000000",
+		"a0 == 1x",
+		"foo == 1",
+		"$32 == 1",
+		"$Status == 1",
+		"[0x20001002] == 0",
+		"[0x20001000 == 0",
+		"[a0] == 0"
+	};
+	for (const char* text : invalid)
+		CHECK(!compiles(text));
+}
+
+HIDDEN void testOperands(TestMachine& tm)
+{
+	Processor* cpu = tm.getProcessor(1);
+	SystemBus* bus = tm.getMachine()->getBus();
+
+	cpu->setGPR(4, 3);
+	cpu->setGPR(8, -1);
+	cpu->setGPR(CPUREGNUM - 2, 0x1234);
+	cpu->setGPR(CPUREGNUM - 1, 0x5678);
+	cpu->setCP0Reg(ENTRYHI, 5 << ASIDOFFS);
+
+	// GPRs by name, with or without $, by number, and in any case
+	CHECK(holds("a0 == 3", cpu, bus));
+	CHECK(holds("$a0 == 3", cpu, bus));
+	CHECK(holds("$4 == 3", cpu, bus));
+	CHECK(holds("A0 == 3", cpu, bus));
+	CHECK(!holds("a0 == 4", cpu, bus));
+	CHECK(holds("zero == 0 && $zero == 0 && $0 == 0", cpu, bus));
+	CHECK(holds("hi == 0x1234 && LO == 0x5678", cpu, bus));
+
+	// Comparisons are unsigned
+	CHECK(holds("t0 == 0xffffffff && t0 == -1", cpu, bus));
+	CHECK(holds("t0 > 3", cpu, bus));
+	CHECK(!holds("t0 < 3", cpu, bus));
+	CHECK(holds("a0 >= 3 && a0 <= 3 && a0 != 2", cpu, bus));
+
+	// CP0 registers by name, pc, asid and processor number
+	CHECK(holds("entryhi == 0x140 && asid == 5", cpu, bus));
+	CHECK(holds("pc == " + std::to_string(cpu->getPC()), cpu, bus));
+	CHECK(holds("cpu == 1", cpu, bus));
+	CHECK(!holds("cpu == 0", cpu, bus));
+
+	// The mask applies before the comparison, and && binds loosest
+	tm.getMachine()->WriteMemory(kWord, 0x100);
+	const std::string word = "[" + std::to_string(kWord) + "]";
+	CHECK(!holds(word + " & 0xff != 0", cpu, bus));
+	CHECK(holds(word + " != 0", cpu, bus));
+	CHECK(holds(word + " & 0x100 != 0 && a0 == 3", cpu, bus));
+	tm.getMachine()->WriteMemory(kWord, 0x101);
+	CHECK(holds(word + " & 0xff != 0", cpu, bus));
+	CHECK(holds(word + " & 0xff == 1&&a0==3", cpu, bus));
+
+	// Device accesses only satisfy memory comparisons, and memory
+	// outside RAM and ROM none
+	CHECK(holds(word + " == 0x101", NULL, bus));
+	CHECK(!holds("a0 == 3", NULL, bus));
+	CHECK(!holds(word + " == 0x101", cpu, NULL));
+	CHECK(!holds("[0x08000000] == 0 && a0 == 3", cpu, bus));
+}
+
+HIDDEN void testHits(TestMachine& tm)
+{
+	Processor* cpu = tm.getProcessor(0);
+	SystemBus* bus = tm.getMachine()->getBus();
+	StoppointSet* set = tm.getBreakpoints();
+
+	const Word addr = TestMachine::kCodeBase;
+	CHECK(set->Add(AddressRange(0, addr, addr + 0xff), AM_EXEC));
+	Stoppoint* p = set->Get(0);
+
+	// The first two hits are ignored
+	p->setIgnoreCount(2);
+	CHECK(set->Probe(0, addr, AM_EXEC, cpu, bus) == NULL);
+	CHECK(set->Probe(0, addr + 4, AM_EXEC, cpu, bus) == NULL);
+	CHECK(p->getHitCount() == 2);
+	CHECK(set->Probe(0, addr + 8, AM_EXEC, cpu, bus) == p);
+	CHECK(set->Probe(0, addr, AM_EXEC, cpu, bus) == p);
+	CHECK(p->getHitCount() == 4);
+
+	// Accesses which do not match count no hit
+	CHECK(set->Probe(0, addr, AM_READ, cpu, bus) == NULL);
+	CHECK(set->Probe(1, addr, AM_EXEC, cpu, bus) == NULL);
+	CHECK(set->Probe(0, addr + 0x100, AM_EXEC, cpu, bus) == NULL);
+	CHECK(p->getHitCount() == 4);
+
+	// Nor do the ones for which the condition does not hold; these are
+	// not counted towards the ignore count either
+	std::string error;
+	p->setCondition(StoppointCondition::Ptr(StoppointCondition::Compile("a1 == 7", error)));
+	p->ResetHitCount();
+	p->setIgnoreCount(1);
+	cpu->setGPR(5, 0);
+	CHECK(set->Probe(0, addr, AM_EXEC, cpu, bus) == NULL);
+	CHECK(set->Probe(0, addr, AM_EXEC, cpu, bus) == NULL);
+	CHECK(p->getHitCount() == 0);
+	cpu->setGPR(5, 7);
+	CHECK(set->Probe(0, addr, AM_EXEC, cpu, bus) == NULL);
+	CHECK(set->Probe(0, addr, AM_EXEC, cpu, bus) == p);
+	CHECK(p->getHitCount() == 2);
+
+	// Disabled stoppoints never fire
+	set->SetEnabled(0, false);
+	CHECK(set->Probe(0, addr, AM_EXEC, cpu, bus) == NULL);
+	CHECK(p->getHitCount() == 2);
+}
+
+int main()
+{
+	TestMachine tm(2);
+	for (unsigned int i = 0; i < 2; i++)
+		tm.Start(i, TestMachine::kCodeBase);
+
+	testSyntax();
+	testOperands(tm);
+	testHits(tm);
+
+	return TestExitStatus("test_stoppoint_condition");
+}
@@ -0,0 +1,197 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_stoppoint_index: stoppoints with random ranges are added to and
+// removed from a StoppointSet, and StoppointSet::Probe() must find the
+// same stoppoint as a linear scan of the set. Ranges are drawn so that
+// many of them overlap (and must be refused), share addresses across
+// ASIDs, cross page and region boundaries, and reach the top of the
+// address space; probed addresses are mostly at the edges of ranges.
+
+#include <random>
+#include <vector>
+
+#include "umps/const.h"
+#include "umps/stoppoint.h"
+#include "tests/test_util.h"
+
+HIDDEN const unsigned int kRounds = 20;
+HIDDEN const unsigned int kOpsPerRound = 300;
+HIDDEN const unsigned int kProbesPerOp = 20;
+HIDDEN const Word kASIDs = 4;
+
+class StoppointIndexTest {
+public:
+	explicit StoppointIndexTest(unsigned int seed)
+		: rng(seed)
+	{}
+
+	void Run();
+
+private:
+	Word random(Word n) {
+		return std::uniform_int_distribution<Word>(0, n - 1)(rng);
+	}
+	Word randomWord() {
+		return std::uniform_int_distribution<Word>(0, MAXWORDVAL)(rng);
+	}
+
+	Word randomASID();
+	Word randomAddress();
+	AccessMode randomMode();
+
+	void add();
+	void remove();
+	void probe();
+
+	std::mt19937 rng;
+	StoppointSet set;
+};
+
+void StoppointIndexTest::Run()
+{
+	for (unsigned int i = 0; i < kOpsPerRound; i++) {
+		switch (random(8)) {
+		case 0:
+			remove();
+			break;
+		case 1:
+			if (!set.IsEmpty())
+				set.SetEnabled(random(set.Size()), random(2));
+			break;
+		default:
+			add();
+			break;
+		}
+		for (unsigned int j = 0; j < kProbesPerOp; j++)
+			probe();
+	}
+}
+
+// Most stoppoints are in the first ASIDs, some in the last one, so that
+// probes also come from ASIDs above any stoppoint
+Word StoppointIndexTest::randomASID()
+{
+	return random(8) ? random(kASIDs) : MAXASID - 1;
+}
+
+// Addresses cluster around a few spots, the top of the address space
+// among them, and at the edges of existing stoppoints
+Word StoppointIndexTest::randomAddress()
+{
+	static const Word spots[] = {
+		0, RAMBASE, RAMBASE + 0x3FF000, RAMBASE + 0x400000, 0xFFFFF000
+	};
+
+	if (!set.IsEmpty() && random(2)) {
+		const AddressRange& r = set.Get(random(set.Size()))->getRange();
+		switch (random(4)) {
+		case 0:
+			return r.getStart() - 1;
+		case 1:
+			return r.getStart();
+		case 2:
+			return r.getEnd();
+		default:
+			return r.getEnd() + 1;
+		}
+	}
+
+	if (random(8) == 0)
+		return randomWord();
+	return spots[random(sizeof(spots) / sizeof(spots[0]))] + random(0x2000) - 0x1000;
+}
+
+AccessMode StoppointIndexTest::randomMode()
+{
+	static const AccessMode modes[] = { AM_EXEC, AM_READ, AM_WRITE, AM_READ_WRITE };
+	return modes[random(sizeof(modes) / sizeof(modes[0]))];
+}
+
+void StoppointIndexTest::add()
+{
+	Word start = randomAddress();
+	Word length;
+	switch (random(8)) {
+	case 0:
+		length = 0x400000 + random(0x400000);
+		break;
+	case 1:
+		length = MAXWORDVAL - start;
+		break;
+	case 2:
+	case 3:
+		length = random(0x2000);
+		break;
+	default:
+		length = random(16);
+		break;
+	}
+	if (length > MAXWORDVAL - start)
+		length = MAXWORDVAL - start;
+
+	AddressRange range(randomASID(), start, start + length);
+	const bool free = set.CanInsert(range);
+	const size_t size = set.Size();
+	CHECK(set.Add(range, randomMode()) == free);
+	CHECK(set.Size() == size + (free ? 1 : 0));
+}
+
+void StoppointIndexTest::remove()
+{
+	if (!set.IsEmpty())
+		set.Remove(random(set.Size()));
+}
+
+void StoppointIndexTest::probe()
+{
+	const Word asid = random(16) ? randomASID() : random(MAXASID);
+	const Word addr = randomAddress();
+	const AccessMode mode = randomMode();
+
+	Stoppoint* expected = NULL;
+	for (size_t i = 0; i < set.Size(); i++) {
+		Stoppoint* p = set.Get(i);
+		if (p->Matches(asid, addr, mode)) {
+			CHECK(expected == NULL);
+			expected = p;
+		}
+	}
+
+	Stoppoint* found = set.Probe(asid, addr, mode, NULL);
+	if (found != expected) {
+		fprintf(stderr, "probe of 0x%02x:0x%08x found %s, expected %s\n", asid, addr,
+		        found ? found->ToString().c_str() : "none",
+		        expected ? expected->ToString().c_str() : "none");
+		testFailures++;
+	}
+}
+
+int main()
+{
+	for (unsigned int seed = 1; seed <= kRounds; seed++) {
+		StoppointIndexTest test(seed);
+		test.Run();
+		if (testFailures > 0) {
+			fprintf(stderr, "test_stoppoint_index: seed %u\n", seed);
+			break;
+		}
+	}
+
+	return TestExitStatus("test_stoppoint_index");
+}
@@ -0,0 +1,117 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// test_trace_buffer: a producer thread logs records to a small
+// TraceBuffer, so that the ring wraps around all the time, while the
+// main thread reads them back concurrently. Every field of a record is
+// a function of its serial number, so that the reader can tell a torn
+// or overwritten record from a good one; records may be dropped, but
+// those returned must be intact and in order.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "umps/trace_buffer.h"
+#include "tests/test_util.h"
+
+HIDDEN const uint64_t kRecords = 1000000;
+HIDDEN const size_t kCapacity = 64;
+HIDDEN const Word kStart = 0x20010000;
+HIDDEN const Word kWords = 4;
+
+HIDDEN Word addrOf(uint64_t serial)
+{
+	return kStart + (serial % kWords) * WORDLEN;
+}
+
+HIDDEN Word valueOf(uint64_t serial)
+{
+	return (Word) (serial * 2654435761U) ^ (Word) (serial >> 7);
+}
+
+// The producer lets the reader in now and then, so that the two also
+// take turns on a single host processor
+HIDDEN void produce(TraceBuffer* buffer)
+{
+	for (uint64_t serial = 0; serial < kRecords; serial++) {
+		buffer->Record(serial, serial % 8, ~(Word) serial, addrOf(serial), valueOf(serial));
+		if (serial % 256 == 255)
+			std::this_thread::yield();
+	}
+}
+
+// This function returns TRUE if r is the record with the given serial
+// number
+HIDDEN bool intact(const TraceRecord& r, uint64_t serial)
+{
+	const Word oldValue = (serial >= kWords) ? valueOf(serial - kWords) : 0;
+	return (r.tod == serial &&
+	        r.cpu == serial % 8 &&
+	        r.pc == ~(Word) serial &&
+	        r.addr == addrOf(serial) &&
+	        r.oldValue == oldValue &&
+	        r.newValue == valueOf(serial));
+}
+
+int main()
+{
+	TraceBuffer buffer(0, kStart, kStart + (kWords - 1) * WORDLEN, kCapacity);
+	CHECK(buffer.getCapacity() == kCapacity);
+
+	std::atomic<bool> done(false);
+	std::thread producer([&buffer, &done]() {
+		produce(&buffer);
+		done.store(true);
+	});
+
+	std::vector<TraceRecord> records;
+	uint64_t next = 0;
+	uint64_t read = 0;
+	uint64_t lost = 0;
+	size_t maxCount = 1;
+	for (;;) {
+		const bool finished = done.load();
+		const uint64_t first = buffer.Read(next, maxCount, &records);
+		CHECK(first >= next);
+		for (size_t i = 0; i < records.size(); i++) {
+			if (!intact(records[i], first + i)) {
+				fprintf(stderr, "record %llu is not intact\n",
+				        (unsigned long long) (first + i));
+				testFailures++;
+				break;
+			}
+		}
+		lost += first - next;
+		read += records.size();
+		next = first + records.size();
+		if (testFailures > 0 || (finished && next == buffer.getHead()))
+			break;
+		if (records.empty())
+			std::this_thread::yield();
+		maxCount = maxCount % kCapacity + 1;
+	}
+	producer.join();
+
+	// What was not read was dropped, and the newest records were read
+	CHECK(read + lost == kRecords);
+	CHECK(next == kRecords);
+	CHECK(read >= kCapacity);
+
+	return TestExitStatus("test_trace_buffer");
+}
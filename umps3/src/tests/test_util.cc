@@ -0,0 +1,147 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "tests/test_util.h"
+
+#include <cstdlib>
+#include <list>
+
+#include <unistd.h>
+
+#include "umps/blockdev_params.h"
+#include "umps/const.h"
+#include "umps/machine.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+
+// The library expects the frontend to handle a PANIC
+void Panic(const char* message)
+{
+	fprintf(stderr, "PANIC: %s\n", message);
+	exit(EXIT_FAILURE);
+}
+
+unsigned int testFailures = 0;
+
+int TestExitStatus(const char* testName)
+{
+	if (testFailures > 0) {
+		fprintf(stderr, "%s: %u check(s) failed\n", testName, testFailures);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+const Word kSpinInstr = (BEQ << 26) | IMMMASK;
+
+Word RType(Word funct, Word rd, Word rs, Word rt, Word shamt)
+{
+	return (rs << 21) | (rt << 16) | (rd << 11) | (shamt << 6) | funct;
+}
+
+Word IType(Word op, Word rt, Word rs, Word imm)
+{
+	return (op << 26) | (rs << 21) | (rt << 16) | (imm & IMMMASK);
+}
+
+Word Jump(Word target)
+{
+	return (J << 26) | ((target >> WORDSHIFT) & 0x03FFFFFFUL);
+}
+
+Word Mfc0(Word rt, Word cp0Reg)
+{
+	return (COP0SEL << 26) | (MFC0 << 21) | (rt << 16) | (cp0Reg << 11);
+}
+
+Word Mtc0(Word rt, Word cp0Reg)
+{
+	return (COP0SEL << 26) | (MTC0 << 21) | (rt << 16) | (cp0Reg << 11);
+}
+
+TestMachine::TestMachine(unsigned int numCpus, Word smpQuantum, ExecEngine engine,
+                         bool terminal)
+{
+	char tmpl[] = "/tmp/umps_test.XXXXXX";
+	if (mkdtemp(tmpl) == NULL) {
+		perror("mkdtemp");
+		exit(EXIT_FAILURE);
+	}
+	dir = tmpl;
+
+	writeROM(dir + "/boot.rom.umps");
+	writeROM(dir + "/bios.rom.umps");
+
+	config.reset(MachineConfig::Create(dir + "/config.json"));
+	config->setROM(ROM_TYPE_BOOT, dir + "/boot.rom.umps");
+	config->setROM(ROM_TYPE_BIOS, dir + "/bios.rom.umps");
+	config->setLoadCoreEnabled(false);
+	config->setDeviceFile(EXT_IL_INDEX(IL_TERMINAL), 0, dir + "/term0.umps");
+	config->setDeviceEnabled(EXT_IL_INDEX(IL_TERMINAL), 0, terminal);
+	config->setNumProcessors(numCpus);
+	config->setSMPQuantum(smpQuantum);
+	config->setExecEngine(engine);
+
+	std::list<std::string> errors;
+	if (!config->Validate(&errors)) {
+		fprintf(stderr, "invalid test machine configuration: %s\n", errors.front().c_str());
+		exit(EXIT_FAILURE);
+	}
+	machine.reset(new Machine(config.get(), &breakpoints, &suspects, &tracepoints));
+}
+
+TestMachine::~TestMachine()
+{
+	machine.reset();
+	config.reset();
+	unlink((dir + "/boot.rom.umps").c_str());
+	unlink((dir + "/bios.rom.umps").c_str());
+	unlink((dir + "/config.json").c_str());
+	unlink((dir + "/term0.umps").c_str());
+	rmdir(dir.c_str());
+}
+
+Processor* TestMachine::getProcessor(unsigned int cpuId)
+{
+	return machine->getProcessor(cpuId);
+}
+
+void TestMachine::writeROM(const std::string& fileName)
+{
+	const Word rom[] = { BIOSFILEID, 2, kSpinInstr, NOP };
+
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (file == NULL || fwrite(rom, sizeof(rom), 1, file) != 1 || fclose(file) != 0) {
+		fprintf(stderr, "cannot write `%s'\n", fileName.c_str());
+		exit(EXIT_FAILURE);
+	}
+}
+
+void TestMachine::Load(Word addr, const std::vector<Word>& code)
+{
+	for (Word w : code) {
+		machine->WriteMemory(addr, w);
+		addr += WORDLEN;
+	}
+}
+
+void TestMachine::Start(unsigned int cpuId, Word pc)
+{
+	const Word ramTop = RAMBASE + config->getRamSize() * FRAMESIZE * WORDLEN;
+	machine->getProcessor(cpuId)->Reset(pc, ramTop - cpuId * FRAMESIZE * WORDLEN);
+}
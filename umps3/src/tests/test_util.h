@@ -0,0 +1,104 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef TESTS_TEST_UTIL_H
+#define TESTS_TEST_UTIL_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base/lang.h"
+#include "umps/arch.h"
+#include "umps/types.h"
+#include "umps/machine_config.h"
+#include "umps/stoppoint.h"
+
+class Machine;
+class Processor;
+
+// Checks report the failed condition and go on, so that a run shows
+// every failure; TestExitStatus() tells whether there was any
+extern unsigned int testFailures;
+
+#define CHECK(cond)                                                     \
+	do {                                                                \
+		if (!(cond)) {                                                  \
+			fprintf(stderr, "%s:%d: check failed: %s\n",               \
+			        __FILE__, __LINE__, #cond);                         \
+			testFailures++;                                             \
+		}                                                               \
+	} while (0)
+
+int TestExitStatus(const char* testName);
+
+// MIPS instruction encoding, for guest code
+enum {
+	T0 = 8, T1, T2, T3, T4, T5, T6, T7, S0 = 16, S1, S2, S3
+};
+
+Word RType(Word funct, Word rd, Word rs, Word rt, Word shamt = 0);
+Word IType(Word op, Word rt, Word rs, Word imm);
+Word Jump(Word target);
+Word Mfc0(Word rt, Word cp0Reg);
+Word Mtc0(Word rt, Word cp0Reg);
+
+// b . (beq $0, $0, -1)
+extern const Word kSpinInstr;
+
+// A TestMachine is a machine with no core file and no devices, whose
+// ROMs just spin, written to a temporary directory: tests load guest
+// code into RAM and start processors on it.
+class TestMachine {
+public:
+	static const Word kCodeBase = RAMBASE + 0x1000;
+	static const Word kDataBase = RAMBASE + 0x10000;
+
+// If smpQuantum is not zero, the processors run in parallel (see
+// MachineConfig::setSMPQuantum()). If terminal is true, terminal 0 is
+// installed, and writes to a file in the temporary directory
+	explicit TestMachine(unsigned int numCpus = 1, Word smpQuantum = 0,
+	                     ExecEngine engine = EXEC_ENGINE_INTERPRETER,
+	                     bool terminal = false);
+	~TestMachine();
+
+	Machine* getMachine() { return machine.get(); }
+	Processor* getProcessor(unsigned int cpuId = 0);
+	const MachineConfig* getConfig() const { return config.get(); }
+
+	StoppointSet* getBreakpoints() { return &breakpoints; }
+
+// This method writes code to RAM at addr
+	void Load(Word addr, const std::vector<Word>& code);
+
+// This method resets processor cpuId to run from pc, with a stack of
+// its own
+	void Start(unsigned int cpuId, Word pc);
+
+private:
+	void writeROM(const std::string& fileName);
+
+	std::string dir;
+	scoped_ptr<MachineConfig> config;
+	StoppointSet breakpoints, suspects, tracepoints;
+	scoped_ptr<Machine> machine;
+
+	DISABLE_COPY_AND_ASSIGNMENT(TestMachine);
+};
+
+#endif // TESTS_TEST_UTIL_H
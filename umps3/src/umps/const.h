@@ -63,6 +63,9 @@
 // KB per frame
 #define FRAMEKB 4
 
+// log2 of the page frame size in bytes
+#define FRAMESHIFT  12
+
 // block device size in words
 #define BLOCKSIZE   FRAMESIZE
 
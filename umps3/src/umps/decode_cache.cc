@@ -0,0 +1,38 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "umps/decode_cache.h"
+
+DecodeCache::DecodeCache()
+	: entries(new DecodedInstr[kSize]),
+	epochs(new uint32_t[kPageEpochs])
+{
+	for (unsigned int i = 0; i < kPageEpochs; i++)
+		epochs[i] = 0;
+	Flush();
+}
+
+// This method drops all cached instructions and makes all blocks
+// built so far stale
+void DecodeCache::Flush()
+{
+	for (unsigned int i = 0; i < kSize; i++)
+		entries[i].paddr = kInvalidTag;
+	for (unsigned int i = 0; i < kPageEpochs; i++)
+		epochs[i]++;
+}
@@ -0,0 +1,159 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_DECODE_CACHE_H
+#define UMPS_DECODE_CACHE_H
+
+#include "base/lang.h"
+#include "umps/types.h"
+#include "umps/const.h"
+
+class Processor;
+
+// A DecodedInstr holds an instruction word together with the fields
+// extracted from it and the Processor method which executes it, so
+// that the decoding work is done once per instruction instead of once
+// per execution. Decoding itself is done by Processor::Decode().
+
+struct DecodedInstr {
+	typedef bool (Processor::*Handler)(const DecodedInstr* di);
+
+// physical address the instruction was fetched from (cache tag)
+	Word paddr;
+
+// raw instruction word
+	Word instr;
+
+// instruction execution method
+	Handler handler;
+
+// register and shift amount fields
+	unsigned int rs;
+	unsigned int rt;
+	unsigned int rd;
+	unsigned int shamt;
+
+// immediate operand, already sign- or zero-extended as the
+// instruction requires
+	SWord imm;
+};
+
+
+// A BasicBlock is a straight-line run of decoded instructions, taken
+// from consecutive physical addresses inside a single page frame. It is
+// used by the threaded execution engine to fetch instructions without
+// translating and looking up each PC. The instructions themselves stay
+// in the DecodeCache, where consecutive addresses of a page frame always
+// occupy consecutive entries; the block holds a copy of the page epoch
+// it was built at, so that it becomes stale as soon as any of those
+// entries is invalidated or reused.
+
+struct BasicBlock {
+	static const unsigned int kMaxLength = 64;
+
+// physical address of the first instruction
+	Word paddr;
+
+// DecodeCache page epoch at build time
+	uint32_t epoch;
+
+// number of valid instructions in instrs[]
+	unsigned int length;
+
+// DecodeCache entry of the first instruction
+	const DecodedInstr* instrs;
+};
+
+
+// This class implements a direct-mapped cache of decoded instructions,
+// indexed by physical address and shared by all processors of a
+// machine. SystemBus fills it on instruction fetches and invalidates
+// the matching entry on every write to memory, so self-modifying and
+// DMA-loaded code are always seen correctly.
+// Each page frame also has an epoch, which BasicBlock users check: it
+// advances whenever a cached instruction of the page is invalidated or
+// evicted, so that a write to any instruction held in a block makes
+// the block stale, while writes to plain data leave blocks alone.
+
+class DecodeCache {
+public:
+// number of cache entries (must be a power of two, and a multiple of
+// FRAMESIZE so that no page frame wraps around the end of the cache)
+	static const unsigned int kSize = 1U << 14;
+
+	DecodeCache();
+
+// This method returns the entry where the instruction at physical
+// address paddr is to be cached, evicting its current content
+	DecodedInstr* Refill(Word paddr) {
+		DecodedInstr* di = slot(paddr);
+		if (di->paddr != kInvalidTag && di->paddr != paddr)
+			epochs[pageIndex(di->paddr)]++;
+		return di;
+	}
+
+// This method returns the cached decoded form of the instruction at
+// physical address paddr, or NULL if it is not cached
+	DecodedInstr* Lookup(Word paddr) {
+		DecodedInstr* di = slot(paddr);
+		return (di->paddr == paddr) ? di : NULL;
+	}
+
+// This method drops the cached instruction at physical address
+// paddr, if any, and advances the epoch of its page frame
+	void Invalidate(Word paddr) {
+		DecodedInstr* di = slot(paddr);
+		if (di->paddr == paddr) {
+			di->paddr = kInvalidTag;
+			epochs[pageIndex(paddr)]++;
+		}
+	}
+
+// This method returns the current epoch of the page frame containing
+// physical address paddr
+	uint32_t PageEpoch(Word paddr) const {
+		return epochs[pageIndex(paddr)];
+	}
+
+// This method drops all cached instructions and makes all blocks
+// built so far stale
+	void Flush();
+
+private:
+// tag for unused entries: it can never match an aligned address
+	static const Word kInvalidTag = 0xFFFFFFFFUL;
+
+// number of page epoch counters (must be a power of two); this is
+// enough for RAM and the BIOS data page to never share a counter
+	static const unsigned int kPageEpochs = 1U << 16;
+
+	DecodedInstr* slot(Word paddr) {
+		return &entries[(paddr >> 2) & (kSize - 1)];
+	}
+
+	static unsigned int pageIndex(Word paddr) {
+		return (paddr / (FRAMESIZE * WORDLEN)) & (kPageEpochs - 1);
+	}
+
+	scoped_array<DecodedInstr> entries;
+	scoped_array<uint32_t> epochs;
+
+	DISABLE_COPY_AND_ASSIGNMENT(DecodeCache);
+};
+
+#endif // UMPS_DECODE_CACHE_H
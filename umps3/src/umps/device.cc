@@ -36,7 +36,6 @@
 #include <string.h>
 #include <errno.h>
 
-#include <boost/bind.hpp>
 
 #include <umps/const.h>
 #include "umps/types.h"
@@ -53,6 +52,7 @@
 #include "umps/error.h"
 #include "umps/vde_network.h"
 #include "umps/machine.h"
+#include "umps/snapshot.h"
 
 
 // last operation result description
@@ -65,7 +65,7 @@ HIDDEN const char* const opResult[2] = {
 // static buffers definition and costants
 #define SMALLBUFSIZE    32
 #define STRBUFSIZE 256
-HIDDEN char strbuf[STRBUFSIZE];
+HIDDEN thread_local char strbuf[STRBUFSIZE];
 
 
 // common device register definitions
@@ -197,6 +197,13 @@ HIDDEN char strbuf[STRBUFSIZE];
 // has been successful or not
 HIDDEN const char * isSuccess(unsigned int devType, Word regVal);
 
+// These functions save and restore Block contents and device status
+// descriptions in snapshots
+HIDDEN void saveBlock(SnapshotWriter& writer, Block* blk);
+HIDDEN void restoreBlock(SnapshotReader& reader, Block* blk);
+HIDDEN void restoreStatus(SnapshotReader& reader, char* buf, size_t size);
+HIDDEN FILE* copyImage(const std::string& imageName, const std::string& fileName);
+
 
 /****************************************************************************/
 /* Definitions to be exported.                                              */
@@ -313,6 +320,20 @@ void Device::Input(const char * inputstr)
 	Panic("Input directed to a non-Terminal device in Device::Input()");
 }
 
+// This method makes a printer or terminal write to a new log file: not
+// operational for all other devices (NULLDEV included)
+void Device::setLogFile(const std::string& fileName)
+{
+	Panic("Log file set for a non-Printer/Terminal device in Device::setLogFile()");
+}
+
+// This method makes a disk or flash device work on a copy of its image
+// file: not operational for all other devices (NULLDEV included)
+void Device::setImageFile(const std::string& fileName)
+{
+	Panic("Image file set for a non-Disk/Flash device in Device::setImageFile()");
+}
+
 bool Device::isBusy() const
 {
 	return reg[STATUS] == BUSY;
@@ -320,7 +341,28 @@ bool Device::isBusy() const
 
 uint64_t Device::scheduleIOEvent(uint64_t delay)
 {
-	return bus->scheduleEvent(delay, boost::bind(&Device::CompleteDevOp, this));
+	return bus->scheduleEvent(delay, EventTag(EventTag::DEVICE_COMPLETION, intL, devNum));
+}
+
+// This method saves the state common to all devices; the device type is
+// saved too, so that a snapshot is only restored on the same devices
+void Device::SaveState(SnapshotWriter& writer) const
+{
+	writer.Section("DEV ");
+	writer.U32(dType);
+	writer.Words(reg, DEVREGLEN);
+	writer.U64(complTime);
+	writer.Bool(isWorking);
+}
+
+void Device::RestoreState(SnapshotReader& reader)
+{
+	reader.Section("DEV ");
+	if (reader.U32() != dType)
+		reader.Fail("Snapshot devices do not match machine configuration");
+	reader.Words(reg, DEVREGLEN);
+	complTime = reader.U64();
+	setCondition(reader.Bool());
 }
 
 /****************************************************************************/
@@ -468,6 +510,29 @@ unsigned int PrinterDevice::CompleteDevOp()
 	return STATUS;
 }
 
+void PrinterDevice::setLogFile(const std::string& fileName)
+{
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (file == NULL)
+		throw FileError(fileName);
+
+	fclose(prntFile);
+	prntFile = file;
+}
+
+void PrinterDevice::SaveState(SnapshotWriter& writer) const
+{
+	Device::SaveState(writer);
+	writer.String(statStr);
+}
+
+void PrinterDevice::RestoreState(SnapshotReader& reader)
+{
+	Device::RestoreState(reader);
+	restoreStatus(reader, statStr, sizeof(statStr));
+	SignalStatusChanged.emit(getDevSStr());
+}
+
 
 // TerminalDevice class allows to emulate serial "dumb" terminal (see
 // performance figures shown before). TerminalDevice may be split up into
@@ -637,8 +702,8 @@ void TerminalDevice::WriteDevReg(unsigned int regnum, Word data)
 
 const char* TerminalDevice::getDevSStr()
 {
-	sprintf(strbuf, "%s\n%s", recvStatStr, tranStatStr);
-	return strbuf;
+	sprintf(statStr, "%s\n%s", recvStatStr, tranStatStr);
+	return statStr;
 }
 
 const char* TerminalDevice::getTXStatus() const
@@ -816,6 +881,52 @@ void TerminalDevice::Input(const char* inputstr)
 }
 
 
+void TerminalDevice::setLogFile(const std::string& fileName)
+{
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (file == NULL)
+		throw FileError(fileName);
+
+	fclose(termFile);
+	termFile = file;
+	setvbuf(termFile, (char *) NULL, _IONBF, 0);
+}
+
+// This method saves the terminal state, including the input not yet
+// received
+void TerminalDevice::SaveState(SnapshotWriter& writer) const
+{
+	Device::SaveState(writer);
+	writer.String(recvStatStr);
+	writer.String(tranStatStr);
+	writer.U64(recvCTime);
+	writer.U64(tranCTime);
+	writer.Bool(recvIntPend);
+	writer.Bool(tranIntPend);
+	writer.String(recvBuf != NULL ? &recvBuf[recvBp] : "");
+}
+
+void TerminalDevice::RestoreState(SnapshotReader& reader)
+{
+	Device::RestoreState(reader);
+	restoreStatus(reader, recvStatStr, sizeof(recvStatStr));
+	restoreStatus(reader, tranStatStr, sizeof(tranStatStr));
+	recvCTime = reader.U64();
+	tranCTime = reader.U64();
+	recvIntPend = reader.Bool();
+	tranIntPend = reader.Bool();
+
+	std::string input = reader.String();
+	delete recvBuf;
+	recvBuf = NULL;
+	recvBp = 0;
+	if (!input.empty()) {
+		recvBuf = new char[input.size() + 1];
+		strcpy(recvBuf, input.c_str());
+	}
+	SignalStatusChanged.emit(getDevSStr());
+}
+
 // DiskDevice class allows to emulate a disk drive: each 4096 byte sector it
 // contains is identified by (cyl, head, sect) set of disk coordinates;
 // (geometry and performance figures are loaded from disk image file).
@@ -868,6 +979,13 @@ DiskDevice::DiskDevice(SystemBus* bus, const MachineConfig* cfg,
 	cylBuf = headBuf = sectBuf = MAXWORDVAL;
 }
 
+void DiskDevice::setImageFile(const std::string& fileName)
+{
+	FILE* file = copyImage(config->getDeviceFile(intL, devNum), fileName);
+	fclose(diskFile);
+	diskFile = file;
+}
+
 DiskDevice::~DiskDevice()
 {
 	delete diskBuf;
@@ -1157,6 +1275,29 @@ unsigned int DiskDevice::CompleteDevOp()
 	return STATUS;
 }
 
+void DiskDevice::SaveState(SnapshotWriter& writer) const
+{
+	Device::SaveState(writer);
+	writer.String(statStr);
+	saveBlock(writer, diskBuf);
+	writer.U32(cylBuf);
+	writer.U32(headBuf);
+	writer.U32(sectBuf);
+	writer.U32(currCyl);
+}
+
+void DiskDevice::RestoreState(SnapshotReader& reader)
+{
+	Device::RestoreState(reader);
+	restoreStatus(reader, statStr, sizeof(statStr));
+	restoreBlock(reader, diskBuf);
+	cylBuf = reader.U32();
+	headBuf = reader.U32();
+	sectBuf = reader.U32();
+	currCyl = reader.U32();
+	SignalStatusChanged.emit(getDevSStr());
+}
+
 
 // FlashDevice class allows to emulate a flash drive: each 4096 byte block
 // is identified by one flash device coordinate;
@@ -1206,6 +1347,13 @@ FlashDevice::FlashDevice(SystemBus* bus, const MachineConfig* cfg,
 	blockBuf = MAXWORDVAL;
 }
 
+void FlashDevice::setImageFile(const std::string& fileName)
+{
+	FILE* file = copyImage(config->getDeviceFile(intL, devNum), fileName);
+	fclose(flashFile);
+	flashFile = file;
+}
+
 FlashDevice::~FlashDevice()
 {
 	delete flashBuf;
@@ -1412,6 +1560,23 @@ unsigned int FlashDevice::CompleteDevOp()
 	return STATUS;
 }
 
+void FlashDevice::SaveState(SnapshotWriter& writer) const
+{
+	Device::SaveState(writer);
+	writer.String(statStr);
+	saveBlock(writer, flashBuf);
+	writer.U32(blockBuf);
+}
+
+void FlashDevice::RestoreState(SnapshotReader& reader)
+{
+	Device::RestoreState(reader);
+	restoreStatus(reader, statStr, sizeof(statStr));
+	restoreBlock(reader, flashBuf);
+	blockBuf = reader.U32();
+	SignalStatusChanged.emit(getDevSStr());
+}
+
 /****************************************************************************/
 /* Definitions strictly local to the module.                                */
 /****************************************************************************/
@@ -1447,6 +1612,30 @@ HIDDEN const char * isSuccess(unsigned int devType, Word regVal)
 	return(result);
 }
 
+HIDDEN void saveBlock(SnapshotWriter& writer, Block* blk)
+{
+	Word buf[BLOCKSIZE];
+	for (unsigned int i = 0; i < BLOCKSIZE; i++)
+		buf[i] = blk->getWord(i);
+	writer.Words(buf, BLOCKSIZE);
+}
+
+HIDDEN void restoreBlock(SnapshotReader& reader, Block* blk)
+{
+	Word buf[BLOCKSIZE];
+	reader.Words(buf, BLOCKSIZE);
+	for (unsigned int i = 0; i < BLOCKSIZE; i++)
+		blk->setWord(i, buf[i]);
+}
+
+HIDDEN void restoreStatus(SnapshotReader& reader, char* buf, size_t size)
+{
+	std::string status = reader.String();
+	if (status.size() >= size)
+		reader.Fail("Invalid device status in snapshot");
+	strcpy(buf, status.c_str());
+}
+
 
 // EthDevice class allows to emulate an ethernet interface
 
@@ -1704,3 +1893,54 @@ bool EthDevice::isBusy() const
 {
 	return (reg[STATUS] & READPENDINGMASK) == BUSY;
 }
+
+// This method saves the interface state; packets still held by the
+// network are not part of it
+void EthDevice::SaveState(SnapshotWriter& writer) const
+{
+	Device::SaveState(writer);
+	writer.String(statStr);
+	saveBlock(writer, readbuf);
+	saveBlock(writer, writebuf);
+	writer.Bool(polling);
+}
+
+void EthDevice::RestoreState(SnapshotReader& reader)
+{
+	Device::RestoreState(reader);
+	restoreStatus(reader, statStr, sizeof(statStr));
+	restoreBlock(reader, readbuf);
+	restoreBlock(reader, writebuf);
+	polling = reader.Bool();
+	SignalStatusChanged.emit(getDevSStr());
+}
+
+// This function copies the image file imageName to a new file
+// fileName, and returns the copy open for update. The image is read
+// thru a file description of its own, as the one the device holds may
+// be shared with other processes after a fork
+HIDDEN FILE* copyImage(const std::string& imageName, const std::string& fileName)
+{
+	FILE* image = fopen(imageName.c_str(), "r");
+	if (image == NULL)
+		throw FileError(imageName);
+	FILE* copy = fopen(fileName.c_str(), "w+");
+	if (copy == NULL) {
+		fclose(image);
+		throw FileError(fileName);
+	}
+
+	char buf[BLOCKSIZE * WORDLEN];
+	size_t n;
+	bool failed = false;
+	while (!failed && (n = fread(buf, 1, sizeof(buf), image)) > 0)
+		failed = (fwrite(buf, 1, n, copy) != n);
+	failed = failed || ferror(image) || fflush(copy) == EOF;
+	fclose(image);
+	if (failed) {
+		fclose(copy);
+		throw FileError(fileName);
+	}
+	rewind(copy);
+	return copy;
+}
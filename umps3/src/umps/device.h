@@ -49,6 +49,8 @@ class DiskParams;
 class FlashParams;
 class netinterface;
 class MachineConfig;
+class SnapshotWriter;
+class SnapshotReader;
 
 // Device class defines the interface to all device types, and represents
 // the "uninstalled device" (NULLDEV) itself. Device objects are created and
@@ -103,6 +105,18 @@ public:
 // devices (NULLDEV included) and produces a panic message
 	virtual void Input(const char* inputstr);
 
+// This method makes a printer or terminal write its output to a new log
+// file from now on; it throws FileError if the file cannot be created.
+// Not operational for all other devices (NULLDEV included): it produces
+// a panic message
+	virtual void setLogFile(const std::string& fileName);
+
+// This method makes a disk or flash device work on a copy of its image
+// file from now on, written to fileName; it throws FileError if the
+// copy cannot be made. Not operational for all other devices (NULLDEV
+// included): it produces a panic message
+	virtual void setImageFile(const std::string& fileName);
+
 // This method returns the current value for device register field
 // indexed by regnum
 	Word ReadDevReg(unsigned int regnum);
@@ -123,6 +137,12 @@ public:
 		return isWorking;
 	}
 
+// These methods save the device state to a snapshot and restore it:
+// registers, operation in progress and internal buffers, but not the
+// contents of image or log files
+	virtual void SaveState(SnapshotWriter& writer) const;
+	virtual void RestoreState(SnapshotReader& reader);
+
 	sigc::signal<void, const char*> SignalStatusChanged;
 	sigc::signal<void, bool> SignalConditionChanged;
 
@@ -170,6 +190,9 @@ public:
 	virtual void WriteDevReg(unsigned int regnum, Word data);
 	virtual unsigned int CompleteDevOp();
 	virtual const char* getDevSStr();
+	virtual void setLogFile(const std::string& fileName);
+	virtual void SaveState(SnapshotWriter& writer) const;
+	virtual void RestoreState(SnapshotReader& reader);
 
 private:
 	const MachineConfig* const config;
@@ -212,6 +235,9 @@ public:
 	virtual std::string getCTimeInfo() const;
 
 	virtual void Input(const char * inputstr);
+	virtual void setLogFile(const std::string& fileName);
+	virtual void SaveState(SnapshotWriter& writer) const;
+	virtual void RestoreState(SnapshotReader& reader);
 
 	sigc::signal<void, char> SignalTransmitted;
 
@@ -231,6 +257,9 @@ private:
 // static buffer for transmitter
 	char tranStatStr[TERMBUFSIZE];
 
+// static buffer for the whole device status
+	char statStr[2 * TERMBUFSIZE];
+
 // Completion time for current receiver operation (if any)
 	uint64_t recvCTime;
 
@@ -272,6 +301,9 @@ public:
 	virtual void WriteDevReg(unsigned int regnum, Word data);
 	virtual unsigned int CompleteDevOp();
 	virtual const char * getDevSStr();
+	virtual void setImageFile(const std::string& fileName);
+	virtual void SaveState(SnapshotWriter& writer) const;
+	virtual void RestoreState(SnapshotReader& reader);
 
 private:
 	const MachineConfig* const config;
@@ -324,6 +356,9 @@ public:
 	virtual void WriteDevReg(unsigned int regnum, Word data);
 	virtual unsigned int CompleteDevOp();
 	virtual const char * getDevSStr();
+	virtual void setImageFile(const std::string& fileName);
+	virtual void SaveState(SnapshotWriter& writer) const;
+	virtual void RestoreState(SnapshotReader& reader);
 
 private:
 	const MachineConfig* const config;
@@ -359,6 +394,8 @@ public:
 	virtual void WriteDevReg(unsigned int regnum, Word data);
 	virtual unsigned int CompleteDevOp();
 	virtual const char* getDevSStr();
+	virtual void SaveState(SnapshotWriter& writer) const;
+	virtual void RestoreState(SnapshotReader& reader);
 
 protected:
 	virtual bool isBusy() const;
@@ -266,7 +266,7 @@ HIDDEN const char* const cp0IName[] = {
 
 // static string buffer size and definition
 #define STRBUFSIZE  64
-HIDDEN char strbuf[STRBUFSIZE];
+HIDDEN thread_local char strbuf[STRBUFSIZE];
 
 
 // utility functions for instruction decoding
@@ -31,125 +31,253 @@
 #include "umps/event.h"
 
 #include <cassert>
-#include <stdio.h>
-#include <stdlib.h>
 
 #include "umps/const.h"
-#include "umps/utility.h"
-#include "umps/time_stamp.h"
+#include "umps/error.h"
+#include "umps/snapshot.h"
 
 
-Event::Event(uint64_t ts, Word inc, Callback callback)
-	: deadline(ts + inc),
-	callback(callback),
-	next(NULL)
+// This method creates a new (empty) queue
+EventQueue::EventQueue()
+	: firstSeq(0),
+	lastSeq(0),
+	running(false),
+	runningDeadline(0)
 {
 }
 
-// This method links an Event to its successor in a structure
-void Event::AddBefore(Event * ev)
+uint64_t EventQueue::nextDeadline() const
 {
-	next = ev;
+	assert(!IsEmpty());
+	return pool[heap[0]].deadline;
 }
 
-// This method inserts an Event after another, linking the former to the
-// successor of the latter
-void Event::InsAfter(Event * ev)
+// This method inserts a new event, happening at tod + delay, in the
+// EventQueue, taking its Event object from the pool
+uint64_t EventQueue::InsertQ(uint64_t tod, uint64_t delay, Event::Callback callback,
+                             const EventTag& tag, Event::Handle* handle)
 {
-	next = ev->next;
-	ev->next = this;
+	uint32_t index = allocate();
+
+	Event* ev = &pool[index];
+	ev->deadline = tod + delay;
+	ev->seq = nextSeq(ev->deadline);
+	ev->callback = callback;
+	ev->tag = tag;
+	enqueue(index);
+
+	if (handle != NULL)
+		*handle = ((Event::Handle) ev->generation << 32) | index;
+	return ev->deadline;
 }
 
-// This method returns the pointer to the successor of an Event
-Event *Event::Next()
+// This method removes a pending event from the queue and gives its
+// Event object back to the pool
+bool EventQueue::Cancel(Event::Handle handle)
 {
-	return (next);
+	Event* ev = lookup(handle);
+	if (ev == NULL)
+		return false;
+
+	uint32_t index = ev - &pool[0];
+	dequeue(index);
+	ev->callback.reset();
+	freeList.push_back(index);
+	return true;
 }
 
+// This method moves a pending event to a new deadline
+bool EventQueue::Reschedule(Event::Handle handle, uint64_t deadline)
+{
+	Event* ev = lookup(handle);
+	if (ev == NULL)
+		return false;
 
-// This method creates a new (empty) queue
-EventQueue::EventQueue()
+	uint32_t index = ev - &pool[0];
+	dequeue(index);
+	ev->deadline = deadline;
+	ev->seq = nextSeq(deadline);
+	enqueue(index);
+	return true;
+}
+
+// This method removes the head of a (not empty) queue and runs its
+// callback. The head is removed first, so that the callback may freely
+// insert or cancel events
+void EventQueue::RunHead()
+{
+	assert(!IsEmpty());
+
+	uint32_t index = heap[0];
+	dequeue(index);
+	freeList.push_back(index);
+
+	Event::Callback callback;
+	callback = pool[index].callback;
+	pool[index].callback.reset();
+
+	running = true;
+	runningDeadline = pool[index].deadline;
+	callback();
+	running = false;
+}
+
+// This method saves the queue to a snapshot: the sequence counters and
+// the deadline, sequence number and tag of each pending event
+void EventQueue::SaveState(SnapshotWriter& writer) const
 {
-	head = NULL;
-	lastIns = NULL;
+	writer.Section("EVTQ");
+	writer.U64(firstSeq);
+	writer.U64(lastSeq);
+	writer.U32(heap.size());
+	for (uint32_t index : heap) {
+		const Event& ev = pool[index];
+		if (ev.tag.kind == EventTag::NONE)
+			throw Error("Pending event cannot be saved to a snapshot");
+		writer.U64(ev.deadline);
+		writer.U64(ev.seq);
+		writer.U32(ev.tag.kind);
+		writer.Words(ev.tag.args, 3);
+	}
 }
 
-// This method deletes the queue and its associated structures
-EventQueue::~EventQueue()
+// This method replaces the queue contents with the events saved in a
+// snapshot. Pending events go back to the pool first, so that handles
+// given out for them never match the restored ones
+void EventQueue::RestoreState(SnapshotReader& reader, const CallbackFactory& factory)
 {
-	Event *p, *q;
+	for (uint32_t index : heap) {
+		pool[index].heapIndex = kNotQueued;
+		pool[index].callback.reset();
+		freeList.push_back(index);
+	}
+	heap.clear();
 
-	p = head;
-	q = NULL;
-	while (p != NULL) {
-		q = p->Next();
-		delete p;
-		p = q;
+	reader.Section("EVTQ");
+	firstSeq = reader.U64();
+	lastSeq = reader.U64();
+	uint32_t count = reader.U32();
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t index = allocate();
+		Event* ev = &pool[index];
+		ev->deadline = reader.U64();
+		ev->seq = reader.U64();
+		ev->tag.kind = (EventTag::Kind) reader.Check(reader.U32(), EventTag::IPI_DELIVERY + 1);
+		reader.Words(ev->tag.args, 3);
+		if (ev->tag.kind == EventTag::NONE)
+			reader.Fail("Invalid event in snapshot");
+		ev->callback = factory(ev->tag, ((Event::Handle) ev->generation << 32) | index);
+		enqueue(index);
 	}
 }
 
-uint64_t EventQueue::nextDeadline() const
+// This method takes an unused Event object from the pool, growing it if
+// needed, and returns its index
+uint32_t EventQueue::allocate()
 {
-	assert(!IsEmpty());
-	return head->getDeadline();
+	uint32_t index;
+	if (freeList.empty()) {
+		index = pool.size();
+		pool.push_back(Event());
+		pool[index].generation = 0;
+	} else {
+		index = freeList.back();
+		freeList.pop_back();
+	}
+	pool[index].generation++;
+	return index;
 }
 
-Event::Callback EventQueue::nextCallback() const
+// This method returns the pending event identified by handle, or NULL
+// if it has already happened or has been cancelled
+Event* EventQueue::lookup(Event::Handle handle)
 {
-	assert(!IsEmpty());
-	return head->getCallback();
+	uint32_t index = (uint32_t) handle;
+	if (index >= pool.size())
+		return NULL;
+
+	Event* ev = &pool[index];
+	if (ev->heapIndex == kNotQueued || ev->generation != (uint32_t) (handle >> 32))
+		return NULL;
+	return ev;
+}
+
+// This method returns the sequence number of a new event with the given
+// deadline: it goes before all pending events if it is due no later
+// than any of them, after those with the same deadline otherwise
+int64_t EventQueue::nextSeq(uint64_t deadline)
+{
+	bool first;
+	if (running)
+		first = deadline <= runningDeadline;
+	else
+		first = IsEmpty() || deadline <= nextDeadline();
+
+	return first ? --firstSeq : ++lastSeq;
 }
 
-// This method creates a new Event object and inserts it in the
-// EventQueue; EventQueue is sorted on ascending time order
+// This method returns TRUE if the event in pool entry a is due before
+// the one in entry b
+bool EventQueue::before(uint32_t a, uint32_t b) const
+{
+	const Event& ea = pool[a];
+	const Event& eb = pool[b];
+	return ea.deadline < eb.deadline || (ea.deadline == eb.deadline && ea.seq < eb.seq);
+}
 
-uint64_t EventQueue::InsertQ(uint64_t tod, Word delay, Event::Callback callback)
+void EventQueue::place(size_t pos, uint32_t index)
 {
-	Event *ins, *p, *q;
+	heap[pos] = index;
+	pool[index].heapIndex = pos;
+}
 
-	ins = new Event(tod, delay, callback);
-	if (IsEmpty()) {
-		head = ins;
-	} else if (ins->getDeadline() <= head->getDeadline()) {
-		// "ins" has to happen before that at the head of the queue;
-		// should be put before it
-		ins->AddBefore(head);
-		head = ins;
-	} else {
-		// should find place in queue: check lastIns to shorten search time
-		if (lastIns != NULL && !(ins->getDeadline() <= lastIns->getDeadline()))
-			// can start from lastIns
-			p = lastIns;
-		else
-			// must start from the head
-			p = head;
-
-		q = p;
-		while (p != NULL && p->getDeadline() <= ins->getDeadline()) {
-			q = p;
-			p = p->Next();
-		}
-		// place found: insert after q and before p
-		ins->InsAfter(q);
+void EventQueue::siftUp(size_t pos)
+{
+	uint32_t index = heap[pos];
+	while (pos > 0) {
+		size_t parent = (pos - 1) / 2;
+		if (!before(index, heap[parent]))
+			break;
+		place(pos, heap[parent]);
+		pos = parent;
 	}
-	lastIns = ins;
-	return ins->getDeadline();
+	place(pos, index);
 }
 
-// This method removes the head of a (not empty) queue and sets it to the
-// following Event
-void EventQueue::RemoveHead()
+void EventQueue::siftDown(size_t pos)
 {
-	Event *p;
+	uint32_t index = heap[pos];
+	size_t size = heap.size();
+	for (;;) {
+		size_t child = 2 * pos + 1;
+		if (child >= size)
+			break;
+		if (child + 1 < size && before(heap[child + 1], heap[child]))
+			child++;
+		if (!before(heap[child], index))
+			break;
+		place(pos, heap[child]);
+		pos = child;
+	}
+	place(pos, index);
+}
 
-	if (!IsEmpty()) {
-		p = head;
-		head = head->Next();
+void EventQueue::enqueue(uint32_t index)
+{
+	heap.push_back(index);
+	siftUp(heap.size() - 1);
+}
 
-		if (p == lastIns)
-			// reposition lastIns to the new head
-			lastIns = head;
+void EventQueue::dequeue(uint32_t index)
+{
+	size_t pos = pool[index].heapIndex;
+	uint32_t last = heap.back();
+	heap.pop_back();
+	pool[index].heapIndex = kNotQueued;
 
-		delete p;
+	if (pos < heap.size()) {
+		place(pos, last);
+		siftUp(pos);
+		siftDown(pool[last].heapIndex);
 	}
 }
@@ -21,86 +21,286 @@
 #ifndef UMPS_EVENT_H
 #define UMPS_EVENT_H
 
-#include <boost/function.hpp>
+#include <functional>
+#include <new>
+#include <vector>
 
 #include "umps/types.h"
 
+class SnapshotWriter;
+class SnapshotReader;
+
+// An EventCallback holds the action to be taken when an event happens:
+// any copyable object which can be called with no arguments. Objects up
+// to kInlineSize bytes, such as the boost::bind() results used by
+// devices and controllers, are stored in place, so that scheduling an
+// event does not allocate memory; larger ones are copied to the heap
+
+class EventCallback {
+public:
+	EventCallback()
+		: ops(NULL)
+	{}
+
+	template<typename F>
+	EventCallback(const F& f)
+		: ops(&Ops<F>::table)
+	{
+		Ops<F>::create(&storage, f);
+	}
+
+	EventCallback(const EventCallback& other)
+		: ops(other.ops)
+	{
+		if (ops != NULL)
+			ops->copy(&storage, &other.storage);
+	}
+
+	~EventCallback() {
+		reset();
+	}
+
+	EventCallback& operator=(const EventCallback& other) {
+		if (this != &other) {
+			reset();
+			ops = other.ops;
+			if (ops != NULL)
+				ops->copy(&storage, &other.storage);
+		}
+		return *this;
+	}
+
+	void operator()() {
+		ops->invoke(&storage);
+	}
+
+	bool empty() const {
+		return ops == NULL;
+	}
+
+	void reset() {
+		if (ops != NULL) {
+			ops->destroy(&storage);
+			ops = NULL;
+		}
+	}
+
+private:
+	static const size_t kInlineSize = 48;
+
+	union Storage {
+		void* heap;
+		uint64_t align;
+		unsigned char bytes[kInlineSize];
+	};
+
+	struct OpsTable {
+		void (*invoke)(Storage* s);
+		void (*copy)(Storage* dst, const Storage* src);
+		void (*destroy)(Storage* s);
+	};
+
+	template<typename F, bool Inline = (sizeof(F) <= kInlineSize)>
+	struct Ops {
+		static void create(Storage* s, const F& f) {
+			new (s->bytes) F(f);
+		}
+		static void invoke(Storage* s) {
+			(*reinterpret_cast<F*>(s->bytes))();
+		}
+		static void copy(Storage* dst, const Storage* src) {
+			create(dst, *reinterpret_cast<const F*>(src->bytes));
+		}
+		static void destroy(Storage* s) {
+			reinterpret_cast<F*>(s->bytes)->~F();
+		}
+		static const OpsTable table;
+	};
+
+	template<typename F>
+	struct Ops<F, false> {
+		static void create(Storage* s, const F& f) {
+			s->heap = new F(f);
+		}
+		static void invoke(Storage* s) {
+			(*static_cast<F*>(s->heap))();
+		}
+		static void copy(Storage* dst, const Storage* src) {
+			create(dst, *static_cast<const F*>(src->heap));
+		}
+		static void destroy(Storage* s) {
+			delete static_cast<F*>(s->heap);
+		}
+		static const OpsTable table;
+	};
+
+	Storage storage;
+	const OpsTable* ops;
+};
+
+template<typename F, bool Inline>
+const EventCallback::OpsTable EventCallback::Ops<F, Inline>::table = {
+	&EventCallback::Ops<F, Inline>::invoke,
+	&EventCallback::Ops<F, Inline>::copy,
+	&EventCallback::Ops<F, Inline>::destroy
+};
+
+template<typename F>
+const EventCallback::OpsTable EventCallback::Ops<F, false>::table = {
+	&EventCallback::Ops<F, false>::invoke,
+	&EventCallback::Ops<F, false>::copy,
+	&EventCallback::Ops<F, false>::destroy
+};
+
+
+// An EventTag tells what an event does in terms of machine objects
+// (processor numbers, device coordinates) instead of pointers, so that
+// pending events can be saved to a machine snapshot and their callbacks
+// rebuilt when it is restored
+
+struct EventTag {
+	enum Kind {
+		NONE,
+		DEVICE_COMPLETION,    // device (args[0], args[1]) completes an operation
+		CPU_RESET,            // processor args[0] restarts at PC args[1], SP args[2]
+		CPU_HALT,             // processor args[0] halts
+		CPU_TIMER_UNDERFLOW,  // processor args[0] local timer underflows
+		CPU_TIMER_CLEAR,      // processor args[0] local timer interrupt is cleared
+		MACHINE_HALT,         // the machine powers off
+		IPI_DELIVERY          // IPI from processor args[0], with outbox value args[1]
+	};
+
+	explicit EventTag(Kind kind = NONE, Word arg0 = 0, Word arg1 = 0, Word arg2 = 0)
+		: kind(kind)
+	{
+		args[0] = arg0;
+		args[1] = arg1;
+		args[2] = arg2;
+	}
+
+	Kind kind;
+	Word args[3];
+};
+
+
 // Event class is used to keep track of the external events of the
 // system: device operations and interrupt generation.
-// Every object contains a device number saying what device will complete
-// its operation and generate a interrupt, a TimeStamp saying when it
-// will happen, and a pointer to the next event in a structure, if needed
-// (set to NULL otherwise)
+// Every object contains the action to be taken and a TimeStamp saying
+// when it will happen; Event objects live in the EventQueue pool, and
+// are referred to from outside by Handle values
 
 class Event {
 public:
-	typedef boost::function<void ()> Callback;
+	typedef EventCallback Callback;
 
-	Event(uint64_t ts, Word inc, Callback callback);
+// Handles identify a scheduled event until it happens or is cancelled;
+// a stale handle is never mistaken for a later event
+	typedef uint64_t Handle;
+	static const Handle kNoHandle = 0;
 
 	uint64_t getDeadline() const {
 		return deadline;
 	}
-	Callback getCallback() const {
-		return callback;
-	}
-
-// This method links an Event to its successor in a structure
-	void AddBefore(Event* ev);
-
-// This method inserts an Event after another, linking the former to the
-// successor of the latter
-	void InsAfter(Event* ev);
 
-// This method returns the pointer to the successor of an Event
-	Event *Next();
+	const EventTag& getTag() const {
+		return tag;
+	}
 
 private:
-// Event verification time
+	friend class EventQueue;
+
+// Event verification time, and tie-breaking sequence number among
+// events with the same deadline
 	uint64_t deadline;
+	int64_t seq;
 
-// Event handler
+// Event handler, and its description
 	Callback callback;
+	EventTag tag;
 
-	Event *next;
+// position in the queue heap (kNotQueued for unused pool entries), and
+// number of times the pool entry has been used
+	uint32_t heapIndex;
+	uint32_t generation;
 };
 
 
-// This class implements a NULL-terminated sorted queue of Event objects,
-// used to schedule the device events in the system.
-// An object contains a pointer to the head of the queue, and a pointer to
-// the last inserted Event (to speed up insertion).
-// The queue is sorted on ascending timestamp order
+// This class implements the time-ordered queue of Event objects used to
+// schedule the device events in the system. Events are kept in a pool
+// which is reused as they happen, and ordered by a binary heap of pool
+// indexes, so that both insertion and cancellation take O(log n) time
+// and no memory is allocated once the pool has grown to the peak
+// number of pending events.
+// Events with the same deadline happen in a fixed order: an event which
+// is due no later than all the others goes before them, any other one
+// goes after the events already queued for the same time
 
 class EventQueue {
 public:
 // This method creates a new (empty) queue
 	EventQueue();
 
-	~EventQueue();
-
 // This method returns TRUE if the queue is empty, FALSE otherwise
 	bool IsEmpty() const {
-		return head == NULL;
+		return heap.empty();
 	}
 
 	uint64_t nextDeadline() const;
-	Event::Callback nextCallback() const;
 
-// This method creates a new Event object and inserts it in the
-// EventQueue; EventQueue is sorted on ascending time order
-	uint64_t InsertQ(uint64_t tod, Word delay, Event::Callback callback);
+// This method inserts a new event, happening at tod + delay, in the
+// EventQueue; it returns the event deadline, and its handle thru handle
+// pointer if not NULL
+	uint64_t InsertQ(uint64_t tod, uint64_t delay, Event::Callback callback,
+	                 const EventTag& tag, Event::Handle* handle = NULL);
 
-// This method removes the head of a (not empty) queue and sets it to the
-// following Event
-	void RemoveHead();
+// This method removes a pending event from the queue. It returns TRUE
+// if the event was pending, FALSE otherwise
+	bool Cancel(Event::Handle handle);
+
+// This method moves a pending event to a new deadline, as if it had
+// been cancelled and inserted again. It returns TRUE if the event was
+// pending, FALSE otherwise
+	bool Reschedule(Event::Handle handle, uint64_t deadline);
+
+// This method removes the head of a (not empty) queue and runs its
+// callback
+	void RunHead();
+
+// These methods save the pending events to a snapshot and replace the
+// queue contents with the ones saved. Callbacks are not saved: when
+// restoring, the factory builds each one from the event tag, and gets
+// the handle of the event too. SaveState() throws Error if an event
+// has no tag
+	typedef std::function<Event::Callback (const EventTag&, Event::Handle)> CallbackFactory;
+	void SaveState(SnapshotWriter& writer) const;
+	void RestoreState(SnapshotReader& reader, const CallbackFactory& factory);
 
 private:
-// head of the queue
-	Event* head;
+	static const uint32_t kNotQueued = 0xFFFFFFFFU;
+
+	Event* lookup(Event::Handle handle);
+	uint32_t allocate();
+	int64_t nextSeq(uint64_t deadline);
+	bool before(uint32_t a, uint32_t b) const;
+	void place(size_t pos, uint32_t index);
+	void siftUp(size_t pos);
+	void siftDown(size_t pos);
+	void enqueue(uint32_t index);
+	void dequeue(uint32_t index);
+
+	std::vector<Event> pool;
+	std::vector<uint32_t> freeList;
+	std::vector<uint32_t> heap;
+
+// sequence numbers for events going before and after the others with
+// the same deadline
+	int64_t firstSeq;
+	int64_t lastSeq;
 
-// last Event inserted
-	Event* lastIns;
+// deadline of the event whose callback is running, which still counts
+// as queued when ordering new events
+	bool running;
+	uint64_t runningDeadline;
 };
 
 #endif // UMPS_EVENT_H
@@ -0,0 +1,464 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the InstrTrace class, which records the
+ * instructions executed by the processors into trace files, and the
+ * InstrTraceReader class, which reads them back.
+ *
+ ****************************************************************************/
+
+#include "umps/instr_trace.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <mutex>
+
+#include "umps/const.h"
+#include "umps/error.h"
+
+HIDDEN const char kMagic[8] = { 'u', 'M', 'P', 'S', '3', 'I', 'T', 'R' };
+
+// bytes taken by a block header: processor, first serial number, number
+// of instructions and size of the data
+HIDDEN const size_t kBlockHeaderSize = 20;
+
+// most bytes an encoded instruction can take
+HIDDEN const size_t kMaxEntrySize = 1 + 5 + 4 + 1 + 1 + 5 + 5;
+
+HIDDEN const uint64_t kNoFlush = std::numeric_limits<uint64_t>::max();
+
+// Flags leading each encoded instruction
+enum {
+	EF_PC        = 1 << 0,
+	EF_INSTR     = 1 << 1,
+	EF_ASID      = 1 << 2,
+	EF_DEST      = 1 << 3,
+	EF_MEMORY    = 1 << 4,
+	EF_EXCEPTION = 1 << 5
+};
+
+// The state shared by the encoder and the decoder of a block, from
+// which fields are predicted
+class InstrTraceCodec {
+public:
+	static const unsigned int kCacheSize = 1024;
+
+	InstrTraceCodec() { Reset(); }
+
+	void Reset() {
+		memset(&prev, 0, sizeof(prev));
+		memset(regs, 0, sizeof(regs));
+		memset(cachePc, 0, sizeof(cachePc));
+		memset(cacheInstr, 0, sizeof(cacheInstr));
+	}
+
+	void Encode(const InstrTraceEntry& e, uint8_t*& p);
+	bool Decode(const uint8_t*& p, const uint8_t* end, InstrTraceEntry* e);
+
+private:
+	static unsigned int slot(Word pc) { return (pc >> 2) & (kCacheSize - 1); }
+
+	InstrTraceEntry prev;
+	Word regs[32];
+	Word cachePc[kCacheSize];
+	Word cacheInstr[kCacheSize];
+};
+
+HIDDEN inline Word zigZag(Word value)
+{
+	return (value << 1) ^ (Word) ((SWord) value >> 31);
+}
+
+HIDDEN inline Word unZigZag(Word value)
+{
+	return (value >> 1) ^ (Word) -(SWord) (value & 1);
+}
+
+HIDDEN inline void putVarint(uint8_t*& p, Word value)
+{
+	while (value >= 0x80) {
+		*p++ = (uint8_t) (value | 0x80);
+		value >>= 7;
+	}
+	*p++ = (uint8_t) value;
+}
+
+HIDDEN inline bool getVarint(const uint8_t*& p, const uint8_t* end, Word* value)
+{
+	Word v = 0;
+	for (unsigned int shift = 0; shift < 35; shift += 7) {
+		if (p == end)
+			return false;
+		const uint8_t b = *p++;
+		v |= (Word) (b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			*value = v;
+			return true;
+		}
+	}
+	return false;
+}
+
+HIDDEN uint8_t* putU32(uint8_t* p, uint32_t value)
+{
+	for (unsigned int i = 0; i < 4; i++)
+		*p++ = value >> (8 * i);
+	return p;
+}
+
+HIDDEN uint32_t getU32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+void InstrTraceCodec::Encode(const InstrTraceEntry& e, uint8_t*& p)
+{
+	uint8_t* flags = p++;
+	*flags = 0;
+
+	if (e.pc != prev.pc + WORDLEN) {
+		*flags |= EF_PC;
+		putVarint(p, zigZag(e.pc - (prev.pc + WORDLEN)));
+	}
+	const unsigned int s = slot(e.pc);
+	if (cachePc[s] != e.pc || cacheInstr[s] != e.instr) {
+		*flags |= EF_INSTR;
+		p = putU32(p, e.instr);
+		cachePc[s] = e.pc;
+		cacheInstr[s] = e.instr;
+	}
+	if (e.asid != prev.asid) {
+		*flags |= EF_ASID;
+		*p++ = e.asid;
+	}
+	if (e.destReg != 0) {
+		*flags |= EF_DEST;
+		*p++ = e.destReg;
+		putVarint(p, zigZag(e.destValue - regs[e.destReg]));
+		regs[e.destReg] = e.destValue;
+	}
+	if (e.flags & InstrTraceEntry::ITE_MEMORY) {
+		*flags |= EF_MEMORY;
+		putVarint(p, zigZag(e.memAddr - prev.memAddr));
+	}
+	if (e.flags & InstrTraceEntry::ITE_EXCEPTION)
+		*flags |= EF_EXCEPTION;
+
+	const Word memAddr = (e.flags & InstrTraceEntry::ITE_MEMORY) ? e.memAddr : prev.memAddr;
+	prev = e;
+	prev.memAddr = memAddr;
+}
+
+bool InstrTraceCodec::Decode(const uint8_t*& p, const uint8_t* end, InstrTraceEntry* e)
+{
+	Word value;
+
+	if (p == end)
+		return false;
+	const uint8_t flags = *p++;
+	if (flags & ~(EF_PC | EF_INSTR | EF_ASID | EF_DEST | EF_MEMORY | EF_EXCEPTION))
+		return false;
+
+	e->pc = prev.pc + WORDLEN;
+	if (flags & EF_PC) {
+		if (!getVarint(p, end, &value))
+			return false;
+		e->pc += unZigZag(value);
+	}
+	const unsigned int s = slot(e->pc);
+	if (flags & EF_INSTR) {
+		if (end - p < 4)
+			return false;
+		cachePc[s] = e->pc;
+		cacheInstr[s] = getU32(p);
+		p += 4;
+	}
+	e->instr = cacheInstr[s];
+	e->asid = prev.asid;
+	if (flags & EF_ASID) {
+		if (p == end)
+			return false;
+		e->asid = *p++;
+	}
+	e->destReg = 0;
+	e->destValue = 0;
+	if (flags & EF_DEST) {
+		if (p == end || *p == 0 || *p >= 32)
+			return false;
+		e->destReg = *p++;
+		if (!getVarint(p, end, &value))
+			return false;
+		e->destValue = regs[e->destReg] += unZigZag(value);
+	}
+	e->flags = 0;
+	e->memAddr = 0;
+	if (flags & EF_MEMORY) {
+		if (!getVarint(p, end, &value))
+			return false;
+		e->memAddr = prev.memAddr + unZigZag(value);
+		e->flags |= InstrTraceEntry::ITE_MEMORY;
+	}
+	if (flags & EF_EXCEPTION)
+		e->flags |= InstrTraceEntry::ITE_EXCEPTION;
+
+	const Word memAddr = (flags & EF_MEMORY) ? e->memAddr : prev.memAddr;
+	prev = *e;
+	prev.memAddr = memAddr;
+	return true;
+}
+
+
+// An InstrTraceFile is a trace file being written; blocks are encoded
+// by the threads running the processors, and written out one at a time
+class InstrTraceFile {
+public:
+	explicit InstrTraceFile(const std::string& fileName);
+	~InstrTraceFile();
+
+	void PutBlock(unsigned int cpu, uint64_t first,
+	              const InstrTraceEntry* entries, unsigned int count);
+	void Close();
+
+private:
+	const std::string fileName;
+	FILE* file;
+	bool failed;
+	std::mutex mutex;
+
+	DISABLE_COPY_AND_ASSIGNMENT(InstrTraceFile);
+};
+
+InstrTraceFile::InstrTraceFile(const std::string& fileName)
+	: fileName(fileName),
+	failed(false)
+{
+	if ((file = fopen(fileName.c_str(), "wb")) == NULL)
+		throw FileError(fileName);
+
+	uint8_t version[4];
+	putU32(version, InstrTrace::kVersion);
+	if (fwrite(kMagic, 1, sizeof(kMagic), file) != sizeof(kMagic) ||
+	    fwrite(version, 1, sizeof(version), file) != sizeof(version))
+		failed = true;
+}
+
+InstrTraceFile::~InstrTraceFile()
+{
+	if (file != NULL)
+		fclose(file);
+}
+
+void InstrTraceFile::PutBlock(unsigned int cpu, uint64_t first,
+                              const InstrTraceEntry* entries, unsigned int count)
+{
+	assert(count <= CpuInstrTrace::kBlockEntries);
+
+	std::vector<uint8_t> data(kBlockHeaderSize + count * kMaxEntrySize);
+	InstrTraceCodec codec;
+	uint8_t* p = &data[kBlockHeaderSize];
+	for (unsigned int i = 0; i < count; i++)
+		codec.Encode(entries[i], p);
+
+	const size_t size = p - &data[0];
+	p = putU32(&data[0], cpu);
+	p = putU32(p, (uint32_t) first);
+	p = putU32(p, (uint32_t) (first >> 32));
+	p = putU32(p, count);
+	putU32(p, size - kBlockHeaderSize);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!failed && fwrite(&data[0], 1, size, file) != size)
+		failed = true;
+}
+
+void InstrTraceFile::Close()
+{
+	const bool error = failed || ferror(file);
+	const bool closeError = fclose(file) != 0;
+	file = NULL;
+	if (error || closeError)
+		throw FileError(fileName);
+}
+
+
+CpuInstrTrace::CpuInstrTrace(unsigned int cpuId, size_t length)
+	: cpuId(cpuId),
+	index(0),
+	count(0),
+	stream(NULL),
+	written(0),
+	flushAt(kNoFlush)
+{
+	// Whole blocks, so that a block never wraps around the ring
+	const size_t blocks = std::max<size_t>(1, (length + kBlockEntries - 1) / kBlockEntries);
+	entries.resize(blocks * kBlockEntries);
+}
+
+// This method is called when the block of instructions being streamed
+// is full, before the ring can overwrite any of them
+void CpuInstrTrace::flush()
+{
+	write(stream, written);
+	written = count;
+	flushAt = count + kBlockEntries;
+}
+
+// This method writes the instructions from serial number first on, in
+// blocks which do not cross the end of the ring
+void CpuInstrTrace::write(InstrTraceFile* file, uint64_t first) const
+{
+	while (first < count) {
+		const size_t i = first % entries.size();
+		const unsigned int n = (unsigned int) std::min<uint64_t>(
+			std::min<size_t>(kBlockEntries - i % kBlockEntries, entries.size() - i),
+			count - first);
+		file->PutBlock(cpuId, first, &entries[i], n);
+		first += n;
+	}
+}
+
+
+InstrTrace::InstrTrace(unsigned int numCpus, size_t length)
+{
+	for (unsigned int i = 0; i < numCpus; i++)
+		cpus.push_back(new CpuInstrTrace(i, length));
+}
+
+InstrTrace::~InstrTrace()
+{
+	for (CpuInstrTrace* cpu : cpus)
+		delete cpu;
+}
+
+void InstrTrace::Stream(const std::string& fileName)
+{
+	assert(!stream);
+
+	stream.reset(new InstrTraceFile(fileName));
+	for (CpuInstrTrace* cpu : cpus) {
+		cpu->stream = stream.get();
+		cpu->written = cpu->count;
+		// blocks line up with the ring from the first one flushed on
+		cpu->flushAt = (cpu->count / CpuInstrTrace::kBlockEntries + 1) * CpuInstrTrace::kBlockEntries;
+	}
+}
+
+void InstrTrace::Close()
+{
+	if (!stream)
+		return;
+
+	for (CpuInstrTrace* cpu : cpus) {
+		cpu->write(stream.get(), cpu->written);
+		cpu->stream = NULL;
+		cpu->flushAt = kNoFlush;
+	}
+	scoped_ptr<InstrTraceFile> file;
+	file.swap(stream);
+	file->Close();
+}
+
+void InstrTrace::Write(const std::string& fileName) const
+{
+	InstrTraceFile file(fileName);
+	for (const CpuInstrTrace* cpu : cpus) {
+		const uint64_t held = std::min<uint64_t>(cpu->count, cpu->entries.size());
+		cpu->write(&file, cpu->count - held);
+	}
+	file.Close();
+}
+
+
+InstrTraceReader::InstrTraceReader(const std::string& fileName)
+	: fileName(fileName),
+	pos(0),
+	blockCpu(0),
+	serial(0),
+	left(0),
+	codec(new InstrTraceCodec)
+{
+	if ((file = fopen(fileName.c_str(), "rb")) == NULL)
+		throw FileError(fileName);
+
+	uint8_t header[sizeof(kMagic) + 4];
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+	    memcmp(header, kMagic, sizeof(kMagic)) != 0)
+	{
+		fclose(file);
+		throw InvalidFileFormatError(fileName, "Instruction trace file expected");
+	}
+	if (getU32(header + sizeof(kMagic)) != InstrTrace::kVersion) {
+		fclose(file);
+		throw InvalidFileFormatError(fileName, "Unsupported instruction trace version");
+	}
+}
+
+InstrTraceReader::~InstrTraceReader()
+{
+	fclose(file);
+}
+
+bool InstrTraceReader::Next(InstrTraceEntry* entry, unsigned int* cpu, uint64_t* serial)
+{
+	while (left == 0)
+		if (!readBlock())
+			return false;
+
+	const uint8_t* p = block.data() + pos;
+	if (!codec->Decode(p, block.data() + block.size(), entry))
+		throw InvalidFileFormatError(fileName, "Damaged instruction trace");
+	pos = p - block.data();
+	left--;
+	if (left == 0 && pos != block.size())
+		throw InvalidFileFormatError(fileName, "Damaged instruction trace");
+
+	*cpu = blockCpu;
+	*serial = this->serial++;
+	return true;
+}
+
+// This method reads the next block into memory; it returns false at the
+// end of the file
+bool InstrTraceReader::readBlock()
+{
+	uint8_t header[kBlockHeaderSize];
+	const size_t n = fread(header, 1, sizeof(header), file);
+	if (n == 0 && feof(file))
+		return false;
+	if (n != sizeof(header))
+		throw InvalidFileFormatError(fileName, "Truncated instruction trace");
+
+	blockCpu = getU32(header);
+	serial = getU32(header + 4) | ((uint64_t) getU32(header + 8) << 32);
+	left = getU32(header + 12);
+	const uint32_t size = getU32(header + 16);
+	if (left > CpuInstrTrace::kBlockEntries || size > left * kMaxEntrySize)
+		throw InvalidFileFormatError(fileName, "Damaged instruction trace");
+
+	block.resize(size);
+	if (size > 0 && fread(block.data(), 1, size, file) != size)
+		throw InvalidFileFormatError(fileName, "Truncated instruction trace");
+	pos = 0;
+	codec->Reset();
+	return true;
+}
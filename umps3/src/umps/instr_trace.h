@@ -0,0 +1,185 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_INSTR_TRACE_H
+#define UMPS_INSTR_TRACE_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "base/lang.h"
+#include "umps/types.h"
+
+// An instruction executed by a processor: its virtual address, word and
+// address space, the register it wrote with the value written (the
+// value being loaded, for loads, which complete an instruction later)
+// and the virtual address of the memory word it accessed, if any. An
+// instruction which raised an exception wrote no register.
+
+struct InstrTraceEntry {
+	enum {
+		ITE_MEMORY    = 1 << 0,
+		ITE_EXCEPTION = 1 << 1
+	};
+
+	Word pc;
+	Word instr;
+	Word destValue;
+	Word memAddr;
+	uint8_t asid;
+	// 0 if no register was written
+	uint8_t destReg;
+	uint8_t flags;
+};
+
+class InstrTraceFile;
+class InstrTraceCodec;
+
+// A CpuInstrTrace keeps the latest instructions executed by a single
+// processor in a ring. It is only touched by the thread running the
+// processor, which fills in the entries returned by Append(), so it
+// needs no locking.
+//
+// When streaming, the instructions are also written out in blocks of
+// kBlockEntries as soon as a block is full, and no instruction is
+// overwritten before it is written.
+
+class CpuInstrTrace {
+public:
+	static const unsigned int kBlockEntries = 4096;
+
+	InstrTraceEntry* Append() {
+		if (count == flushAt)
+			flush();
+		InstrTraceEntry* e = &entries[index];
+		if (++index == entries.size())
+			index = 0;
+		count++;
+		return e;
+	}
+
+// This method returns the number of instructions recorded so far
+	uint64_t getCount() const { return count; }
+
+private:
+	friend class InstrTrace;
+
+	CpuInstrTrace(unsigned int cpuId, size_t length);
+
+	void flush();
+	void write(InstrTraceFile* file, uint64_t first) const;
+
+	const unsigned int cpuId;
+	std::vector<InstrTraceEntry> entries;
+	size_t index;
+	uint64_t count;
+
+// where instructions are streamed to, if anywhere, the first of them
+// not written yet, and the count at which the next block is full
+	InstrTraceFile* stream;
+	uint64_t written;
+	uint64_t flushAt;
+
+	DISABLE_COPY_AND_ASSIGNMENT(CpuInstrTrace);
+};
+
+// An InstrTrace records the instructions executed by all processors of
+// a machine, keeping at least the latest length of each, and saves them
+// to a trace file, which can be read back with InstrTraceReader.
+//
+// Trace files start with an eight byte magic string and a format
+// version (a 32 bit word); then come blocks of up to kBlockEntries
+// instructions, each from a single processor. A block header holds the
+// processor number, the serial number of its first instruction (the
+// count of instructions recorded before it on that processor), the
+// number of instructions and the size of the data which follows.
+// Instructions are delta-encoded against the previous one in the block:
+// a byte of flags tells which fields cannot be predicted (the PC when it
+// is not the next one, the instruction word when it is not the one last
+// seen at that PC, the ASID when it changes) and which are present, and
+// only those follow: register values and memory addresses as
+// variable-length differences from the last value of the register and
+// the last address. Blocks can be decoded independently. All values are
+// little-endian.
+
+class InstrTrace {
+public:
+	static const Word kVersion = 1;
+
+	InstrTrace(unsigned int numCpus, size_t length);
+	~InstrTrace();
+
+	CpuInstrTrace* getCpuTrace(unsigned int cpuId) { return cpus[cpuId]; }
+
+// This method starts writing every instruction recorded from now on
+// to fileName, as the ring fills up; it throws FileError
+	void Stream(const std::string& fileName);
+
+// This method writes the rest of the streamed instructions and closes
+// the file; it throws FileError if any write failed
+	void Close();
+
+// This method writes the instructions held in the rings, oldest first,
+// to fileName; it throws FileError
+	void Write(const std::string& fileName) const;
+
+private:
+	std::vector<CpuInstrTrace*> cpus;
+	scoped_ptr<InstrTraceFile> stream;
+
+	DISABLE_COPY_AND_ASSIGNMENT(InstrTrace);
+};
+
+// An InstrTraceReader reads back a trace file, an instruction at a
+// time, in the order they were written: blocks from different
+// processors may be interleaved.
+
+class InstrTraceReader {
+public:
+// This method opens the file and checks its header; it throws FileError
+// if the file cannot be opened, and InvalidFileFormatError if it is not
+// a trace file
+	explicit InstrTraceReader(const std::string& fileName);
+	~InstrTraceReader();
+
+// This method reads the next instruction into entry, with the number of
+// the processor which executed it and its serial number on that
+// processor. It returns false at the end of the file, and throws
+// InvalidFileFormatError if the file is damaged or truncated
+	bool Next(InstrTraceEntry* entry, unsigned int* cpu, uint64_t* serial);
+
+private:
+	bool readBlock();
+
+	const std::string fileName;
+	FILE* file;
+
+	std::vector<uint8_t> block;
+	size_t pos;
+	unsigned int blockCpu;
+	uint64_t serial;
+	unsigned int left;
+
+	scoped_ptr<InstrTraceCodec> codec;
+
+	DISABLE_COPY_AND_ASSIGNMENT(InstrTraceReader);
+};
+
+#endif // UMPS_INSTR_TRACE_H
@@ -20,33 +20,62 @@
 
 #include "umps/machine.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdlib>
 
+#include "base/json.h"
 #include "base/lang.h"
 
 #include "umps/types.h"
 #include "umps/const.h"
+#include "umps/device.h"
 #include "umps/processor.h"
+#include "umps/instr_trace.h"
+#include "umps/profiler.h"
 #include "umps/machine_config.h"
 #include "umps/stoppoint.h"
+#include "umps/symbol_table.h"
 #include "umps/systembus.h"
+#include "umps/snapshot.h"
+#include "umps/trace_buffer.h"
 
 Machine::Machine(const MachineConfig* config,
                  StoppointSet* breakpoints,
                  StoppointSet* suspects,
                  StoppointSet* tracepoints)
 	: stopMask(0),
+	stoppointsArmed(false),
+	fastForward(false),
+	skippedCycles(0),
+	statsSince(0),
+	activeCpus(0),
 	config(config),
 	halted(false),
 	breakpoints(breakpoints),
 	suspects(suspects),
-	tracepoints(tracepoints)
+	tracepoints(tracepoints),
+	until(NULL),
+	untilArmed(false),
+	untilFired(false),
+	untilResult(RU_HALT),
+	quantumSerial(0),
+	quantumCycles(0),
+	workersBusy(0),
+	workersExit(false)
 {
 	assert(config->Validate(NULL));
 
 	bus.reset(new SystemBus(config, this));
 
+	updateStoppointsArmed();
+	breakpoints->SignalStoppointInserted.connect(sigc::mem_fun(this, &Machine::updateStoppointsArmed));
+	suspects->SignalStoppointInserted.connect(sigc::mem_fun(this, &Machine::updateStoppointsArmed));
+	tracepoints->SignalStoppointInserted.connect(sigc::mem_fun(this, &Machine::updateStoppointsArmed));
+	tracepoints->SignalStoppointInserted.connect(sigc::mem_fun(this, &Machine::updateTraceBuffers));
+	tracepoints->SignalStoppointRemoved.connect(sigc::hide(sigc::mem_fun(this, &Machine::updateTraceBuffers)));
+
 	for (unsigned int i = 0; i < config->getNumProcessors(); i++) {
 		Processor* cpu = new Processor(config, i, this, bus.get());
 		cpu->SignalException.connect(
@@ -60,10 +89,14 @@ Machine::Machine(const MachineConfig* config,
 	}
 
 	cpus[0]->Reset(MCTL_DEFAULT_BOOT_PC, MCTL_DEFAULT_BOOT_SP);
+
+	updateTraceBuffers();
 }
 
 Machine::~Machine()
 {
+	StopWorkers();
+
 	for (Processor* p : cpus)
 		delete p;
 }
@@ -74,11 +107,55 @@ void Machine::step(unsigned int steps, unsigned int* stepped, bool* stopped)
 	for (Processor* cpu : cpus)
 		pd[cpu->Id()].stopCause = 0;
 
+	// stoppoints may have been removed since the last step
+	updateStoppointsArmed();
+
 	unsigned int i;
-	for (i = 0; !halted && i < steps && !stopRequested && !pauseRequested; ++i) {
-		bus->ClockTick();
-		for (CpuVector::iterator it = cpus.begin(); it != cpus.end(); ++it)
-			(*it)->Cycle();
+	if (config->isParallelSMP() && stopMask == 0 && !stoppointsArmed && !untilArmed) {
+		stepParallel(steps, &i);
+	} else {
+		// Lockstep simulation: deterministic, and the only mode where
+		// stop conditions are honoured at the exact instruction
+		bool idleCheck = fastForward;
+		unsigned int id;
+		for (i = 0; !halted && i < steps && !stopRequested; ++i) {
+			if (pauseRequested) {
+				if (!fastForward)
+					break;
+				pauseRequested = false;
+				idleCheck = true;
+			}
+			if (idleCheck) {
+				unsigned int skipped;
+				idleCheck = skipIdle(steps - i, &skipped);
+				if (skipped > 0) {
+					i += skipped - 1;
+					continue;
+				}
+			}
+			// A processor running alone may run native code, as long
+			// as nothing but itself can change the machine state
+			const uint32_t active = activeCpus;
+			if (config->getExecEngine() == EXEC_ENGINE_JIT && !stoppointsArmed &&
+			    active != 0 && (active & (active - 1)) == 0)
+			{
+				unsigned int cycles = (unsigned int) std::min<uint64_t>(steps - i, bus->QuietCycles());
+				unsigned int ran = cycles ? cpus[__builtin_ctz(active)]->RunNative(cycles) : 0;
+				if (ran > 0) {
+					bus->Skip(ran);
+					i += ran - 1;
+					continue;
+				}
+			}
+			bus->ClockTick();
+			// Only running processors are cycled, in ID order; the mask
+			// is read again after each cycle, as a processor may wake up
+			// a higher numbered one
+			for (uint32_t m = activeCpus; m != 0; m = activeCpus & ~((2U << id) - 1)) {
+				id = __builtin_ctz(m);
+				cpus[id]->Cycle();
+			}
+		}
 	}
 	if (stepped)
 		*stepped = i;
@@ -86,11 +163,228 @@ void Machine::step(unsigned int steps, unsigned int* stepped, bool* stopped)
 		*stopped = stopRequested;
 }
 
+// This method runs the machine for steps cycles, with each processor on
+// its own host thread. Time advances in quanta of getSMPQuantum()
+// cycles: the bus clock and device events are run for a whole quantum
+// first, then all processors run the quantum concurrently. Device
+// register accesses are serialized by SystemBus, and interrupts raised
+// for another processor reach it at the end of the quantum.
+void Machine::stepParallel(unsigned int steps, unsigned int* stepped)
+{
+	if (workers.empty())
+		startWorkers();
+	SystemBus::BindThreadToCpu(0);
+
+	const unsigned int quantum = config->getSMPQuantum();
+	unsigned int i = 0;
+	while (!halted && i < steps && !stopRequested) {
+		if (pauseRequested) {
+			if (!fastForward)
+				break;
+			pauseRequested = false;
+		}
+		if (fastForward) {
+			unsigned int skipped;
+			skipIdle(steps - i, &skipped);
+			if (skipped > 0) {
+				i += skipped;
+				continue;
+			}
+		}
+
+		unsigned int n = std::min(quantum, steps - i);
+		unsigned int t;
+		for (t = 0; t < n && !halted; t++)
+			bus->ClockTick();
+		n = t;
+
+		bus->setParallel(true);
+		{
+			std::lock_guard<std::mutex> lock(workMutex);
+			quantumCycles = n;
+			workersBusy = workers.size();
+			quantumSerial++;
+		}
+		workReady.notify_all();
+
+		// A processor which is not running at the start of a quantum
+		// stays so until its end
+		Processor* cpu = cpus[0];
+		for (t = 0; t < n && cpu->isRunning(); t++)
+			cpu->Cycle();
+
+		{
+			std::unique_lock<std::mutex> lock(workMutex);
+			workDone.wait(lock, [this] { return workersBusy == 0; });
+		}
+		bus->setParallel(false);
+
+		i += n;
+	}
+	*stepped = i;
+}
+
+// This method stops the parallel SMP worker threads; step() starts them
+// again when it needs them
+void Machine::StopWorkers()
+{
+	{
+		std::lock_guard<std::mutex> lock(workMutex);
+		workersExit = true;
+	}
+	workReady.notify_all();
+	for (std::thread& t : workers)
+		t.join();
+	workers.clear();
+	workersExit = false;
+}
+
+void Machine::startWorkers()
+{
+	for (unsigned int id = 1; id < cpus.size(); id++)
+		workers.push_back(std::thread(&Machine::runWorker, this, id, quantumSerial));
+}
+
+// This method is the body of a worker thread, started when the quantum
+// serial number was serial
+void Machine::runWorker(unsigned int cpuId, uint64_t serial)
+{
+	Processor* cpu = cpus[cpuId];
+
+	SystemBus::BindThreadToCpu(cpuId);
+
+	for (;;) {
+		unsigned int n;
+		{
+			std::unique_lock<std::mutex> lock(workMutex);
+			workReady.wait(lock, [&] { return workersExit || quantumSerial != serial; });
+			if (workersExit)
+				return;
+			serial = quantumSerial;
+			n = quantumCycles;
+		}
+
+		for (unsigned int t = 0; t < n && cpu->isRunning(); t++)
+			cpu->Cycle();
+
+		std::lock_guard<std::mutex> lock(workMutex);
+		if (--workersBusy == 0)
+			workDone.notify_one();
+	}
+}
+
 void Machine::step(bool* stopped)
 {
 	step(1, NULL, stopped);
 }
 
+bool RunPredicates::AddSymbol(const SymbolTable* stab, const std::string& name)
+{
+	std::list<const Symbol*> symbols = stab->Lookup(name.c_str(), Symbol::TYPE_FUNCTION);
+	for (const Symbol* symbol : symbols)
+		pcs.insert(symbol->getStart());
+	return !symbols.empty();
+}
+
+// The predicates which can only be checked as they happen are probed by
+// the stoppoint hooks and the processor and terminal signals, which stop
+// the step in progress; the others are checked between steps, which
+// are cut short so as not to overrun the budgets
+RunUntilResult Machine::RunUntil(const RunPredicates& predicates, uint64_t* cycles)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const Clock::time_point start = Clock::now();
+	const uint64_t firstInstr = getTotalStats().instructions;
+
+	until = &predicates;
+	untilArmed = (!predicates.pcs.empty() || predicates.cpuHalted || predicates.cpuIdle ||
+	              !predicates.excCodes.empty() || !predicates.output.empty());
+	untilFired = false;
+	untilOutput.clear();
+
+	// A terminal which is not installed never transmits anything
+	sigc::connection output;
+	if (!predicates.output.empty()) {
+		assert(predicates.terminal < DEVPERINT);
+		Device* device = getDevice(TERMINT, predicates.terminal);
+		if (device->Type() == TERMDEV) {
+			output = static_cast<TerminalDevice*>(device)->SignalTransmitted.connect(
+				sigc::mem_fun(this, &Machine::onUntilOutput));
+		}
+	}
+
+	RunUntilResult result = RU_HALT;
+	uint64_t ran = 0;
+	while (!halted) {
+		unsigned int steps = kUntilSliceCycles;
+
+		if (predicates.cycles) {
+			if (ran >= predicates.cycles) {
+				result = RU_CYCLES;
+				break;
+			}
+			steps = (unsigned int) std::min<uint64_t>(steps, predicates.cycles - ran);
+		}
+		if (predicates.instructions) {
+			const uint64_t done = getTotalStats().instructions - firstInstr;
+			if (done >= predicates.instructions) {
+				result = RU_INSTRUCTIONS;
+				break;
+			}
+			// Each processor completes one instruction a cycle at most
+			const uint64_t left = (predicates.instructions - done) / cpus.size();
+			steps = (unsigned int) std::min<uint64_t>(steps, std::max<uint64_t>(left, 1));
+		}
+		if (predicates.seconds > 0.0 &&
+		    std::chrono::duration<double>(Clock::now() - start).count() >= predicates.seconds)
+		{
+			result = RU_DEADLINE;
+			break;
+		}
+
+		unsigned int stepped;
+		bool stopped;
+		step(steps, &stepped, &stopped);
+		ran += stepped;
+		if (stopped) {
+			result = untilFired ? untilResult : RU_STOPPED;
+			break;
+		}
+	}
+
+	output.disconnect();
+	until = NULL;
+	untilArmed = false;
+	updateStoppointsArmed();
+
+	if (cycles != NULL)
+		*cycles = ran;
+	return result;
+}
+
+void Machine::onUntilOutput(char c)
+{
+	const std::string& pattern = until->output;
+
+	untilOutput.push_back(c);
+	if (untilOutput.size() > pattern.size())
+		untilOutput.erase(0, untilOutput.size() - pattern.size());
+	if (untilOutput == pattern)
+		untilHeld(RU_OUTPUT);
+}
+
+// This method stops the step in progress on behalf of RunUntil(); when
+// several predicates hold at once, the first one wins
+void Machine::untilHeld(RunUntilResult result)
+{
+	if (!untilFired) {
+		untilFired = true;
+		untilResult = result;
+	}
+	stopRequested = true;
+}
+
 uint32_t Machine::idleCycles() const
 {
 	uint32_t c;
@@ -107,13 +401,50 @@ uint32_t Machine::idleCycles() const
 	return c;
 }
 
+// Processors need no work while skipping: their local timers are
+// driven by the bus clock
 void Machine::skip(uint32_t cycles)
 {
 	bus->Skip(cycles);
-	for (Processor* cpu : cpus) {
-		if (!cpu->isHalted())
-			cpu->Skip(cycles);
+}
+
+// This method jumps over the cycles (at most maxCycles) for which
+// every processor is waiting or halted and no device event or timer
+// expires, storing their number in skipped. It returns false if some
+// processor is running, i.e. if there is no point in trying again
+// before one goes idle.
+bool Machine::skipIdle(unsigned int maxCycles, unsigned int* skipped)
+{
+	*skipped = 0;
+	if (activeCpus != 0)
+		return false;
+
+	uint32_t c = std::min((uint32_t) maxCycles, bus->IdleCycles());
+	if (c > 0) {
+		skip(c);
+		skippedCycles += c;
 	}
+	*skipped = c;
+	return true;
+}
+
+void Machine::setFastForward(bool setting)
+{
+	fastForward = setting;
+}
+
+void Machine::setProfiling(unsigned int period)
+{
+	profiler.reset(period > 0 ? new Profiler(cpus.size(), period) : NULL);
+	for (Processor* cpu : cpus)
+		cpu->setProfile(profiler ? profiler->getCpuProfile(cpu->Id()) : NULL);
+}
+
+void Machine::setInstrTracing(size_t length)
+{
+	instrTrace.reset(length > 0 ? new InstrTrace(cpus.size(), length) : NULL);
+	for (Processor* cpu : cpus)
+		cpu->setInstrTrace(instrTrace ? instrTrace->getCpuTrace(cpu->Id()) : NULL);
 }
 
 void Machine::Halt()
@@ -121,6 +452,87 @@ void Machine::Halt()
 	halted = true;
 }
 
+// This method saves the machine state: a header describing the machine
+// configuration, then processors and bus
+void Machine::SaveSnapshot(const std::string& fileName) const
+{
+	SnapshotWriter writer(fileName);
+
+	writer.Section("MACH");
+	writer.U32(config->getNumProcessors());
+	writer.U32(config->getRamSize());
+	writer.U32(config->getTLBSize());
+	writer.Bool(halted);
+
+	for (Processor* cpu : cpus)
+		cpu->SaveState(writer);
+	bus->SaveState(writer);
+
+	writer.Close();
+}
+
+void Machine::RestoreSnapshot(const std::string& fileName)
+{
+	SnapshotReader reader(fileName);
+
+	reader.Section("MACH");
+	if (reader.U32() != config->getNumProcessors() ||
+	    reader.U32() != config->getRamSize() ||
+	    reader.U32() != config->getTLBSize())
+	{
+		reader.Fail("Snapshot does not match machine configuration");
+	}
+	halted = reader.Bool();
+
+	for (Processor* cpu : cpus)
+		cpu->RestoreState(reader);
+	bus->RestoreState(reader);
+
+	for (unsigned int i = 0; i < config->getNumProcessors(); i++)
+		pd[i].stopCause = 0;
+
+	for (TraceBufferMap::value_type& tb : traceBuffers)
+		loadTraceValues(tb.second.get());
+
+	ResetStats();
+}
+
+ProcessorStats Machine::getStats(unsigned int cpuId) const
+{
+	return cpus[cpuId]->getStats();
+}
+
+ProcessorStats Machine::getTotalStats() const
+{
+	ProcessorStats total;
+	for (const Processor* cpu : cpus)
+		total += cpu->getStats();
+	return total;
+}
+
+void Machine::ResetStats()
+{
+	for (Processor* cpu : cpus)
+		cpu->ResetStats();
+	skippedCycles = 0;
+	statsSince = bus->getToD();
+}
+
+JsonObject* Machine::StatsToJson() const
+{
+	JsonObject* root = new JsonObject;
+	root->Set("cycles", new JsonNumber(bus->getToD() - statsSince));
+	root->Set("skipped-cycles", new JsonNumber(skippedCycles));
+	root->Set("total", getTotalStats().ToJson());
+
+	JsonArray* cpuArray = new JsonArray;
+	for (const Processor* cpu : cpus)
+		cpuArray->Add(cpu->getStats().ToJson());
+	root->Set("cpus", cpuArray);
+
+	return root;
+}
+
 void Machine::onCpuException(unsigned int excCode, Processor* cpu)
 {
 	bool utlbExc = (excCode == UTLBLEXCEPTION || excCode == UTLBSEXCEPTION);
@@ -132,17 +544,32 @@ void Machine::onCpuException(unsigned int excCode, Processor* cpu)
 		pd[cpu->getId()].stopCause |= SC_EXCEPTION;
 		stopRequested = true;
 	}
+
+	if (untilArmed && until->excCodes.count(Processor::CauseExcCode(excCode)))
+		untilHeld(RU_EXCEPTION);
 }
 
 void Machine::onCpuStatusChanged(const Processor* cpu)
 {
+	if (cpu->isRunning())
+		activeCpus |= 1U << cpu->getId();
+	else
+		activeCpus &= ~(1U << cpu->getId());
+
 	// Whenever a cpu goes to sleep, give the client a chance to
 	// detect idle machine states.
 	if (cpu->isIdle())
 		pauseRequested = true;
+
+	if (untilArmed) {
+		if (cpu->isHalted() && until->cpuHalted)
+			untilHeld(RU_CPU_HALTED);
+		else if (cpu->isIdle() && until->cpuIdle)
+			untilHeld(RU_CPU_IDLE);
+	}
 }
 
-void Machine::HandleBusAccess(Word pAddr, Word access, Processor* cpu)
+void Machine::probeBusAccess(Word pAddr, Word access, Processor* cpu)
 {
 	// Check for breakpoints and suspects
 	switch (access) {
@@ -151,7 +578,7 @@ void Machine::HandleBusAccess(Word pAddr, Word access, Processor* cpu)
 		if (stopMask & SC_SUSPECT) {
 			Stoppoint* suspect = suspects->Probe(MAXASID, pAddr,
 			                                     (access == READ) ? AM_READ : AM_WRITE,
-			                                     cpu);
+			                                     cpu, bus.get());
 			if (suspect != NULL) {
 				pd[cpu->getId()].stopCause |= SC_SUSPECT;
 				pd[cpu->getId()].suspectId = suspect->getId();
@@ -162,7 +589,7 @@ void Machine::HandleBusAccess(Word pAddr, Word access, Processor* cpu)
 
 	case EXEC:
 		if (stopMask & SC_BREAKPOINT) {
-			Stoppoint* breakpoint = breakpoints->Probe(MAXASID, pAddr, AM_EXEC, cpu);
+			Stoppoint* breakpoint = breakpoints->Probe(MAXASID, pAddr, AM_EXEC, cpu, bus.get());
 			if (breakpoint != NULL) {
 				pd[cpu->getId()].stopCause |= SC_BREAKPOINT;
 				pd[cpu->getId()].breakpointId = breakpoint->getId();
@@ -179,11 +606,28 @@ void Machine::HandleBusAccess(Word pAddr, Word access, Processor* cpu)
 	// Check for traced ranges
 	if (access == WRITE) {
 		Stoppoint* tracepoint = tracepoints->Probe(MAXASID, pAddr, AM_WRITE, cpu);
-		(void) tracepoint;
+		if (tracepoint != NULL)
+			traceWrite(tracepoint, pAddr, cpu);
 	}
 }
 
-void Machine::HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu)
+// This method logs a write to pAddr, which has just been done, to the
+// buffer of tracepoint
+void Machine::traceWrite(const Stoppoint* tracepoint, Word pAddr, const Processor* cpu)
+{
+	TraceBufferMap::const_iterator it = traceBuffers.find(tracepoint->getId());
+	if (it == traceBuffers.end())
+		return;
+
+	Word value;
+	bus->WatchRead(pAddr, &value);
+	if (cpu != NULL)
+		it->second->Record(bus->getToD(), cpu->Id(), cpu->getPC(), pAddr, value);
+	else
+		it->second->Record(bus->getToD(), TraceRecord::kNoCpu, 0, pAddr, value);
+}
+
+void Machine::probeVMAccess(Word asid, Word vaddr, Word access, Processor* cpu)
 {
 	switch (access) {
 	case READ:
@@ -191,7 +635,7 @@ void Machine::HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu)
 		if (stopMask & SC_SUSPECT) {
 			Stoppoint* suspect = suspects->Probe(asid, vaddr,
 			                                     (access == READ) ? AM_READ : AM_WRITE,
-			                                     cpu);
+			                                     cpu, bus.get());
 			if (suspect != NULL) {
 				pd[cpu->Id()].stopCause |= SC_SUSPECT;
 				pd[cpu->Id()].suspectId = suspect->getId();
@@ -202,13 +646,15 @@ void Machine::HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu)
 
 	case EXEC:
 		if (stopMask & SC_BREAKPOINT) {
-			Stoppoint* breakpoint = breakpoints->Probe(asid, vaddr, AM_EXEC, cpu);
+			Stoppoint* breakpoint = breakpoints->Probe(asid, vaddr, AM_EXEC, cpu, bus.get());
 			if (breakpoint != NULL) {
 				pd[cpu->Id()].stopCause |= SC_BREAKPOINT;
 				pd[cpu->Id()].breakpointId = breakpoint->getId();
 				stopRequested = true;
 			}
 		}
+		if (untilArmed && until->pcs.count(vaddr))
+			untilHeld(RU_PC);
 		break;
 
 	default:
@@ -235,6 +681,18 @@ SystemBus* Machine::getBus()
 void Machine::setStopMask(unsigned int mask)
 {
 	stopMask = mask;
+	updateStoppointsArmed();
+}
+
+// This method decides whether memory accesses have to be checked
+// against the stoppoint sets at all
+void Machine::updateStoppointsArmed()
+{
+	stoppointsArmed = (((stopMask & SC_BREAKPOINT) && !breakpoints->IsEmpty()) ||
+	                   ((stopMask & SC_SUSPECT) && !suspects->IsEmpty()) ||
+	                   !tracepoints->IsEmpty() ||
+	                   (untilArmed && !until->pcs.empty()));
+	bus->setWatchClock(stoppointsArmed);
 }
 
 unsigned int Machine::getStopMask() const
@@ -267,5 +725,54 @@ bool Machine::ReadMemory(Word physAddr, Word* data)
 
 bool Machine::WriteMemory(Word paddr, Word data)
 {
-	return bus->WatchWrite(paddr, data);
+	if (bus->WatchWrite(paddr, data))
+		return true;
+
+	// Not a write to log, but the next one must see it as the old value
+	Stoppoint* tracepoint = tracepoints->Find(MAXASID, paddr);
+	if (tracepoint != NULL) {
+		TraceBufferMap::const_iterator it = traceBuffers.find(tracepoint->getId());
+		if (it != traceBuffers.end())
+			it->second->setValue(paddr, data);
+	}
+	return false;
+}
+
+shared_ptr<TraceBuffer> Machine::getTraceBuffer(unsigned int id) const
+{
+	TraceBufferMap::const_iterator it = traceBuffers.find(id);
+	return (it != traceBuffers.end()) ? it->second : shared_ptr<TraceBuffer>();
+}
+
+// This method gives every tracepoint a buffer, keeping those which
+// tracepoints already had, and drops the buffers of removed ones
+void Machine::updateTraceBuffers()
+{
+	TraceBufferMap buffers;
+	for (const Stoppoint::Ptr& sp : *tracepoints) {
+		const AddressRange& r = sp->getRange();
+		TraceBufferMap::const_iterator it = traceBuffers.find(sp->getId());
+		if (it != traceBuffers.end() &&
+		    it->second->getStart() == r.getStart() && it->second->getEnd() == r.getEnd())
+		{
+			buffers[sp->getId()] = it->second;
+		} else {
+			shared_ptr<TraceBuffer> buffer(new TraceBuffer(sp->getId(), r.getStart(), r.getEnd()));
+			loadTraceValues(buffer.get());
+			buffers[sp->getId()] = buffer;
+		}
+	}
+	traceBuffers.swap(buffers);
+}
+
+// This method reads the current value of every word traced by buffer
+void Machine::loadTraceValues(TraceBuffer* buffer)
+{
+	for (Word addr = buffer->getStart(); ; addr += WORDLEN) {
+		Word value;
+		bus->WatchRead(addr, &value);
+		buffer->setValue(addr, value);
+		if (buffer->getEnd() - addr < WORDLEN)
+			break;
+	}
 }
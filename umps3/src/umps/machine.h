@@ -21,8 +21,17 @@
 #ifndef UMPS_MACHINE_H
 #define UMPS_MACHINE_H
 
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include <sigc++/sigc++.h>
+
 #include "base/lang.h"
 #include "umps/machine_config.h"
 
@@ -35,12 +44,68 @@ enum StopCause {
 	SC_UTLB_USER    = 1 << 5
 };
 
+// What ended a Machine::RunUntil() call: the machine halting, a
+// stoppoint or exception enabled by the stop mask, or one of the
+// predicates
+enum RunUntilResult {
+	RU_HALT,
+	RU_STOPPED,
+	RU_PC,
+	RU_INSTRUCTIONS,
+	RU_CYCLES,
+	RU_CPU_HALTED,
+	RU_CPU_IDLE,
+	RU_EXCEPTION,
+	RU_OUTPUT,
+	RU_DEADLINE
+};
+
+class SymbolTable;
+
+// The predicates a Machine::RunUntil() call stops on; the default ones
+// never hold. Addresses in pcs are virtual and match in every address
+// space, as soon as a processor is about to execute the instruction
+// there; budgets and the deadline count from the start of the call;
+// excCodes are CAUSE.ExcCode values, as the architecture numbers
+// exceptions (8 is a syscall); output is a byte sequence transmitted by
+// terminal number terminal.
+struct RunPredicates {
+	RunPredicates()
+		: instructions(0),
+		cycles(0),
+		cpuHalted(false),
+		cpuIdle(false),
+		terminal(0),
+		seconds(0.0)
+	{}
+
+// This method adds the start of every function named name in stab to
+// pcs; it returns false if there is none
+	bool AddSymbol(const SymbolTable* stab, const std::string& name);
+
+	std::set<Word> pcs;
+	uint64_t instructions;
+	uint64_t cycles;
+	bool cpuHalted;
+	bool cpuIdle;
+	std::set<unsigned int> excCodes;
+	unsigned int terminal;
+	std::string output;
+	double seconds;
+};
+
 class Processor;
 class SystemBus;
 class Device;
 class StoppointSet;
+class Profiler;
+class InstrTrace;
+class TraceBuffer;
+class Stoppoint;
+class JsonObject;
+struct ProcessorStats;
 
-class Machine {
+class Machine : public sigc::trackable {
 public:
 	Machine(const MachineConfig* config,
 	        StoppointSet* breakpoints,
@@ -54,11 +119,73 @@ public:
 	uint32_t idleCycles() const;
 	void skip(uint32_t cycles);
 
+// This method runs the machine until it halts, stops (see
+// setStopMask()) or one of predicates holds, and returns which it was;
+// if cycles is not NULL, it is set to the number of cycles run. The
+// predicates on the processors and the terminal are checked as they
+// happen, which runs the machine in lockstep; budgets and the deadline
+// are checked every kUntilSliceCycles cycles at most, and the
+// instruction budget may be exceeded by less than one instruction per
+// processor
+	RunUntilResult RunUntil(const RunPredicates& predicates, uint64_t* cycles = NULL);
+
+// This method returns the number of cycles fast-forwarded over while
+// all processors were idle, since power on or the last ResetStats()
+	uint64_t getSkippedCycles() const { return skippedCycles; }
+
+// These methods return the counters of processor cpuId, and their sum
+// over all processors, since power on or the last ResetStats(). Counts
+// for an interval are the difference of two readings. A restored
+// snapshot resets them
+	ProcessorStats getStats(unsigned int cpuId) const;
+	ProcessorStats getTotalStats() const;
+	void ResetStats();
+
+// This method returns all counters, with the cycles run and skipped, as
+// a JSON object owned by the caller
+	JsonObject* StatsToJson() const;
+
+// When fast-forward is on, step() jumps straight to the next device
+// event or timer expiry whenever all processors are waiting or halted,
+// instead of pausing as soon as a processor goes idle
+	void setFastForward(bool setting);
+	bool getFastForward() const { return fastForward; }
+
+// This method turns profiling on, with a new profile where one cycle
+// out of period is sampled (see Profiler), or off if period is zero
+	void setProfiling(unsigned int period);
+	Profiler* getProfiler() { return profiler.get(); }
+
+// This method turns instruction tracing on, with a new trace which holds
+// the latest length instructions of each processor (see InstrTrace), or
+// off if length is zero
+	void setInstrTracing(size_t length);
+	InstrTrace* getInstrTrace() { return instrTrace.get(); }
+
+// This method stops the host threads which run processors in parallel
+// SMP mode, until the next step(). Since fork() only duplicates the
+// calling thread, it must be called before forking a process which goes
+// on running the machine
+	void StopWorkers();
+
 	void Halt();
 	bool IsHalted() const {
 		return halted;
 	}
 
+// These methods save the whole machine state to a snapshot file, and
+// restore it into a machine built from the same configuration; device
+// image and log files are not part of it. They throw FileError or
+// InvalidFileFormatError, and a machine a snapshot could not be fully
+// restored into must not be run
+	void SaveSnapshot(const std::string& fileName) const;
+	void RestoreSnapshot(const std::string& fileName);
+
+// Tracepoints log the writes to their range, each to a TraceBuffer of
+// its own, made when the tracepoint is inserted. This method returns
+// the buffer of tracepoint id, or an empty pointer if there is none
+	shared_ptr<TraceBuffer> getTraceBuffer(unsigned int id) const;
+
 	Processor* getProcessor(unsigned int cpuId);
 	Device* getDevice(unsigned int line, unsigned int devNo);
 	SystemBus* getBus();
@@ -73,8 +200,18 @@ public:
 	bool ReadMemory(Word physAddr, Word* data);
 	bool WriteMemory(Word paddr, Word data);
 
-	void HandleBusAccess(Word pAddr, Word access, Processor* cpu);
-	void HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu);
+// These methods notify Machine of every physical and virtual memory
+// access, for stoppoint handling. They are called on every fetch, load
+// and store (once the value is written): when no stoppoint can be hit
+// they cost a single test
+	void HandleBusAccess(Word pAddr, Word access, Processor* cpu) {
+		if (stoppointsArmed)
+			probeBusAccess(pAddr, access, cpu);
+	}
+	void HandleVMAccess(Word asid, Word vaddr, Word access, Processor* cpu) {
+		if (stoppointsArmed)
+			probeVMAccess(asid, vaddr, access, cpu);
+	}
 
 private:
 	struct ProcessorData {
@@ -83,11 +220,45 @@ private:
 		unsigned int suspectId;
 	};
 
+// cycles run between two checks of the RunUntil() budgets
+	static const unsigned int kUntilSliceCycles = 100000;
+
 	void onCpuStatusChanged(const Processor* cpu);
 	void onCpuException(unsigned int, Processor* cpu);
+	void onUntilOutput(char c);
+	void untilHeld(RunUntilResult result);
+
+	bool skipIdle(unsigned int maxCycles, unsigned int* skipped);
+	void stepParallel(unsigned int steps, unsigned int* stepped);
+	void startWorkers();
+	void runWorker(unsigned int cpuId, uint64_t serial);
+
+	void probeBusAccess(Word pAddr, Word access, Processor* cpu);
+	void probeVMAccess(Word asid, Word vaddr, Word access, Processor* cpu);
+	void updateStoppointsArmed();
+
+	void updateTraceBuffers();
+	void loadTraceValues(TraceBuffer* buffer);
+	void traceWrite(const Stoppoint* tracepoint, Word pAddr, const Processor* cpu);
 
 	unsigned int stopMask;
 
+// TRUE if some memory access may hit a stoppoint: breakpoints or
+// suspects enabled by stopMask, or any tracepoint
+	bool stoppointsArmed;
+
+	bool fastForward;
+	uint64_t skippedCycles;
+
+// time of day of the last ResetStats()
+	uint64_t statsSince;
+
+	scoped_ptr<Profiler> profiler;
+	scoped_ptr<InstrTrace> instrTrace;
+
+// set of running processors, by ID
+	std::atomic<uint32_t> activeCpus;
+
 	const MachineConfig* const config;
 
 	scoped_ptr<SystemBus> bus;
@@ -97,13 +268,39 @@ private:
 
 	ProcessorData pd[MachineConfig::MAX_CPUS];
 
-	bool halted;
-	bool stopRequested;
-	bool pauseRequested;
+	std::atomic<bool> halted;
+	std::atomic<bool> stopRequested;
+	std::atomic<bool> pauseRequested;
 
 	StoppointSet* breakpoints;
 	StoppointSet* suspects;
 	StoppointSet* tracepoints;
+
+	typedef std::map<unsigned int, shared_ptr<TraceBuffer>> TraceBufferMap;
+	TraceBufferMap traceBuffers;
+
+// predicates of the RunUntil() call in progress, if any: untilArmed
+// tells whether some are checked during steps, untilResult is the first
+// which held, and untilOutput the latest bytes transmitted by the
+// watched terminal
+	const RunPredicates* until;
+	bool untilArmed;
+	bool untilFired;
+	RunUntilResult untilResult;
+	std::string untilOutput;
+
+// Parallel SMP worker threads, one for each processor but the first
+// (which runs on the calling thread), and their handshake: workers run
+// quantumCycles cycles whenever quantumSerial advances, then signal
+// workDone when workersBusy drops to zero
+	std::vector<std::thread> workers;
+	std::mutex workMutex;
+	std::condition_variable workReady;
+	std::condition_variable workDone;
+	uint64_t quantumSerial;
+	unsigned int quantumCycles;
+	unsigned int workersBusy;
+	bool workersExit;
 };
 
 #endif // UMPS_MACHINE_H
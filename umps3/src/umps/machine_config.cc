@@ -55,6 +55,12 @@ const char* const MachineConfig::deviceKeyPrefix[N_EXT_IL] = {
 	"terminal"
 };
 
+const char* const MachineConfig::execEngineName[N_EXEC_ENGINES] = {
+	"interpreter",
+	"threaded",
+	"jit"
+};
+
 MachineConfig* MachineConfig::LoadFromFile(const std::string& fileName, std::string& error)
 {
 	std::ifstream inputStream(fileName.c_str());
@@ -91,6 +97,14 @@ MachineConfig* MachineConfig::LoadFromFile(const std::string& fileName, std::str
 			config->setTLBFloorAddress(stoul((root->Get("tlb-floor-address")->AsString()).erase(0, 2), 0, 16));
 		if (root->HasMember("num-ram-frames"))
 			config->setRamSize(root->Get("num-ram-frames")->AsNumber());
+		if (root->HasMember("execution-engine")) {
+			const std::string& engine = root->Get("execution-engine")->AsString();
+			for (unsigned int i = 0; i < N_EXEC_ENGINES; i++)
+				if (engine == execEngineName[i])
+					config->setExecEngine((ExecEngine) i);
+		}
+		if (root->HasMember("smp-quantum"))
+			config->setSMPQuantum(root->Get("smp-quantum")->AsNumber());
 
 		if (root->HasMember("boot")) {
 			JsonObject* bootOpt = root->Get("boot")->AsObject();
@@ -159,6 +173,8 @@ void MachineConfig::Save()
 	root->Set("tlb-size", (int) getTLBSize());
 	root->Set("tlb-floor-address", IntToHexString(getTLBFloorAddress()));
 	root->Set("num-ram-frames", (int) getRamSize());
+	root->Set("execution-engine", execEngineName[getExecEngine()]);
+	root->Set("smp-quantum", (int) getSMPQuantum());
 
 	JsonObject* bootOpt = new JsonObject;
 	bootOpt->Set("load-core-file", isLoadCoreEnabled());
@@ -240,6 +256,11 @@ void MachineConfig::setClockRate(unsigned int value)
 	clockRate = bumpProperty(MIN_CLOCK_RATE, value, MAX_CLOCK_RATE);
 }
 
+void MachineConfig::setSMPQuantum(Word cycles)
+{
+	smpQuantum = bumpProperty((Word) 0, cycles, MAX_SMP_QUANTUM);
+}
+
 void MachineConfig::setTLBSize(Word size)
 {
 	tlbSize = bumpProperty(MIN_TLB, size, MAX_TLB);
@@ -331,6 +352,8 @@ void MachineConfig::resetToFactorySettings()
 	setTLBSize(DEFAULT_TLB_SIZE);
 	setTLBFloorAddress(DEFAULT_TLB_FLOOR_ADDRESS);
 	setRamSize(DEFAUlT_RAM_SIZE);
+	setExecEngine(EXEC_ENGINE_INTERPRETER);
+	setSMPQuantum(0);
 
 	std::string dataDir = PACKAGE_DATA_DIR;
 
@@ -40,6 +40,13 @@ enum ROMType {
 	N_ROM_TYPES
 };
 
+enum ExecEngine {
+	EXEC_ENGINE_INTERPRETER,
+	EXEC_ENGINE_THREADED,
+	EXEC_ENGINE_JIT,
+	N_EXEC_ENGINES
+};
+
 class MachineConfig {
 public:
 	static const Word MIN_RAM = 8;
@@ -64,6 +71,8 @@ public:
 	static const Word MIN_ASID = 0;
 	static const Word MAX_ASID = 64;
 
+	static const Word MAX_SMP_QUANTUM = 1000000;
+
 	static MachineConfig* LoadFromFile(const std::string& fileName, std::string& error);
 	static MachineConfig* Create(const std::string& fileName);
 
@@ -107,6 +116,24 @@ public:
 		return tlbFloorAddress;
 	}
 
+	void setExecEngine(ExecEngine engine) {
+		execEngine = engine;
+	}
+	ExecEngine getExecEngine() const {
+		return execEngine;
+	}
+
+	// A nonzero SMP quantum makes each processor run on its own host
+	// thread, all of them synchronizing every quantum cycles; zero
+	// selects the deterministic lockstep simulation
+	void setSMPQuantum(Word cycles);
+	Word getSMPQuantum() const {
+		return smpQuantum;
+	}
+	bool isParallelSMP() const {
+		return smpQuantum != 0 && cpus > 1;
+	}
+
 	void setROM(ROMType type, const std::string& fileName);
 	const std::string& getROM(ROMType type) const;
 
@@ -138,6 +165,8 @@ private:
 	unsigned int clockRate;
 	Word tlbSize;
 	Word tlbFloorAddress;
+	ExecEngine execEngine;
+	Word smpQuantum;
 
 	std::string romFiles[N_ROM_TYPES];
 	Word symbolTableASID;
@@ -147,6 +176,7 @@ private:
 	scoped_array<uint8_t> macId[N_DEV_PER_IL];
 
 	static const char* const deviceKeyPrefix[N_EXT_IL];
+	static const char* const execEngineName[N_EXEC_ENGINES];
 };
 
 #endif // UMPS_MACHINE_CONFIG_H
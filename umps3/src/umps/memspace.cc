@@ -30,6 +30,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include <boost/format.hpp>
 
@@ -37,6 +40,7 @@
 #include "umps/const.h"
 #include "umps/blockdev_params.h"
 #include "umps/error.h"
+#include "umps/snapshot.h"
 
 // This method creates a RamSpace object of a given size (in words) and
 // fills it with core file contents if needed
@@ -73,13 +77,41 @@ RamSpace::RamSpace(Word size_, const char* fName)
 	}
 }
 
-bool RamSpace::CompareAndSet(Word index, Word oldval, Word newval)
+// This method saves RAM contents as a list of (page frame number,
+// contents) pairs, for the frames which are not all zeroes
+void RamSpace::SaveState(SnapshotWriter& writer) const
+{
+	writer.Section("RAM ");
+	writer.U32(size);
+
+	const Word frames = (size + FRAMESIZE - 1) / FRAMESIZE;
+	for (Word frame = 0; frame < frames; frame++) {
+		const Word* page = &ram[frame * FRAMESIZE];
+		const Word length = std::min(size - frame * FRAMESIZE, (Word) FRAMESIZE);
+		Word i = 0;
+		while (i < length && page[i] == 0)
+			i++;
+		if (i < length) {
+			writer.U32(frame);
+			writer.Words(page, length);
+		}
+	}
+	writer.U32(MAXWORDVAL);
+}
+
+// This method clears RAM and loads the page frames saved by SaveState()
+void RamSpace::RestoreState(SnapshotReader& reader)
 {
-	if (ram[index] == oldval) {
-		ram[index] = newval;
-		return true;
-	} else {
-		return false;
+	reader.Section("RAM ");
+	if (reader.U32() != size)
+		reader.Fail("Snapshot RAM size does not match machine configuration");
+
+	memset(ram.get(), 0, size * WORDLEN);
+	const Word frames = (size + FRAMESIZE - 1) / FRAMESIZE;
+	for (Word frame = reader.U32(); frame != MAXWORDVAL; frame = reader.U32()) {
+		reader.Check(frame, frames);
+		reader.Words(&ram[frame * FRAMESIZE],
+		             std::min(size - frame * FRAMESIZE, (Word) FRAMESIZE));
 	}
 }
 
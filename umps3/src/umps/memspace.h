@@ -24,6 +24,9 @@
 #include "base/lang.h"
 #include "umps/types.h"
 
+class SnapshotWriter;
+class SnapshotReader;
+
 // This class implements the RAM device. Any object allows reads and
 // writes with random access to word-sized items using appropriate
 // methods. Contents may be loaded from file at creation. SystemBus
@@ -47,13 +50,22 @@ public:
 		ram[index] = data;
 	}
 
-	bool CompareAndSet(Word index, Word oldval, Word newval);
+// This method returns the host memory location holding the Word at
+// index, for direct access by SystemBus
+	Word* HostPtr(Word index) {
+		return &ram[index];
+	}
 
 // This method returns RamSpace size in bytes
 	Word Size() const {
 		return size << 2;
 	}
 
+// These methods save RAM contents to a snapshot and load them back;
+// page frames holding only zeroes are left out of the file
+	void SaveState(SnapshotWriter& writer) const;
+	void RestoreState(SnapshotReader& reader);
+
 private:
 	scoped_array<Word> ram;
 
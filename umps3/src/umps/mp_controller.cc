@@ -20,14 +20,13 @@
 
 #include "umps/mp_controller.h"
 
-#include <boost/bind.hpp>
-
 #include "base/lang.h"
 #include "umps/machine_config.h"
 #include "umps/machine.h"
 #include "umps/processor.h"
 #include "umps/systembus.h"
 #include "umps/arch.h"
+#include "umps/snapshot.h"
 
 MPController::MPController(const MachineConfig* config, Machine* machine)
 	: config(config),
@@ -67,8 +66,7 @@ void MPController::Write(Word addr, Word data, const Processor* cpu)
 		cpuId = data & MCTL_RESET_CPU_CPUID_MASK;
 		if (cpuId < config->getNumProcessors())
 			machine->getBus()->scheduleEvent(kCpuResetDelay * config->getClockRate(),
-			                                 boost::bind(&Processor::Reset, machine->getProcessor(cpuId),
-			                                             bootPC, bootSP));
+			                                 EventTag(EventTag::CPU_RESET, cpuId, bootPC, bootSP));
 		break;
 
 	case MCTL_BOOT_PC:
@@ -83,16 +81,30 @@ void MPController::Write(Word addr, Word data, const Processor* cpu)
 		cpuId = data & MCTL_RESET_CPU_CPUID_MASK;
 		if (cpuId < config->getNumProcessors())
 			machine->getBus()->scheduleEvent(kCpuHaltDelay * config->getClockRate(),
-			                                 boost::bind(&Processor::Halt, machine->getProcessor(cpuId)));
+			                                 EventTag(EventTag::CPU_HALT, cpuId));
 		break;
 
 	case MCTL_POWER:
 		if (data == 0x0FF)
 			machine->getBus()->scheduleEvent(kPoweroffDelay * config->getClockRate(),
-			                                 boost::bind(&Machine::Halt, machine));
+			                                 EventTag(EventTag::MACHINE_HALT));
 		break;
 
 	default:
 		break;
 	}
 }
+
+void MPController::SaveState(SnapshotWriter& writer) const
+{
+	writer.Section("MPC ");
+	writer.U32(bootPC);
+	writer.U32(bootSP);
+}
+
+void MPController::RestoreState(SnapshotReader& reader)
+{
+	reader.Section("MPC ");
+	bootPC = reader.U32();
+	bootSP = reader.U32();
+}
@@ -25,6 +25,8 @@ class MachineConfig;
 class Machine;
 class SystemBus;
 class Processor;
+class SnapshotWriter;
+class SnapshotReader;
 
 class MPController {
 public:
@@ -33,6 +35,9 @@ MPController(const MachineConfig* config, Machine* machine);
 Word Read(Word addr, const Processor* cpu) const;
 void Write(Word addr, Word data, const Processor* cpu);
 
+void SaveState(SnapshotWriter& writer) const;
+void RestoreState(SnapshotReader& reader);
+
 private:
 static const unsigned int kCpuResetDelay = 50;
 static const unsigned int kCpuHaltDelay = 50;
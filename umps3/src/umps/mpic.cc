@@ -21,11 +21,11 @@
 #include "umps/mpic.h"
 
 #include <cassert>
-#include <boost/bind.hpp>
 
 #include "umps/machine_config.h"
 #include "umps/systembus.h"
 #include "umps/processor.h"
+#include "umps/snapshot.h"
 
 InterruptController::InterruptController(const MachineConfig* config, SystemBus* bus)
 	: config(config),
@@ -170,7 +170,7 @@ void InterruptController::Write(Word addr, Word data, const Processor* cpu)
 
 		case CPUCTL_OUTBOX:
 			bus->scheduleEvent(kIpiLatency * config->getClockRate(),
-			                   boost::bind(&InterruptController::deliverIPI, this, cpu->Id(), data));
+			                   EventTag(EventTag::IPI_DELIVERY, cpu->Id(), data));
 			break;
 
 		case CPUCTL_TPR:
@@ -191,7 +191,7 @@ void InterruptController::Write(Word addr, Word data, const Processor* cpu)
 	}
 }
 
-void InterruptController::deliverIPI(unsigned int origin, Word outbox)
+void InterruptController::DeliverIPI(unsigned int origin, Word outbox)
 {
 	Word recipients = CPUCTL_OUTBOX_GET_RECIP(outbox);
 
@@ -215,3 +215,57 @@ void InterruptController::deliverIPI(unsigned int origin, Word outbox)
 		}
 	}
 }
+
+void InterruptController::SaveState(SnapshotWriter& writer) const
+{
+	writer.Section("PIC ");
+	writer.U32(arbiter);
+	for (unsigned int il = 0; il <= N_EXT_IL; il++) {
+		for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+			const Source& s = sources[il][devNo];
+			writer.U32(s.lastTarget);
+			writer.U32(s.route.destination);
+			writer.U32(s.route.policy);
+		}
+	}
+
+	for (const CpuData& cd : cpuData) {
+		writer.U32(cd.ipMask);
+		writer.Words(cd.idb, N_EXT_IL);
+		writer.U32(cd.taskPriority);
+		writer.Words(cd.biosReserved, 2);
+		writer.U32(cd.ipiInbox.size());
+		for (const IpiMessage& ipi : cd.ipiInbox) {
+			writer.U8(ipi.origin);
+			writer.U8(ipi.msg);
+		}
+	}
+}
+
+void InterruptController::RestoreState(SnapshotReader& reader)
+{
+	reader.Section("PIC ");
+	arbiter = reader.Check(reader.U32(), cpuData.size());
+	for (unsigned int il = 0; il <= N_EXT_IL; il++) {
+		for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+			Source& s = sources[il][devNo];
+			s.lastTarget = reader.U32();
+			s.route.destination = reader.U32();
+			s.route.policy = reader.U32();
+		}
+	}
+
+	for (CpuData& cd : cpuData) {
+		cd.ipMask = reader.U32();
+		reader.Words(cd.idb, N_EXT_IL);
+		cd.taskPriority = reader.U32();
+		reader.Words(cd.biosReserved, 2);
+		cd.ipiInbox.clear();
+		for (uint32_t n = reader.Check(reader.U32(), cpuData.size() + 1); n > 0; n--) {
+			IpiMessage ipi;
+			ipi.origin = reader.U8();
+			ipi.msg = reader.U8();
+			cd.ipiInbox.push_back(ipi);
+		}
+	}
+}
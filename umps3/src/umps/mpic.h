@@ -29,6 +29,8 @@
 
 class SystemBus;
 class Processor;
+class SnapshotWriter;
+class SnapshotReader;
 
 class InterruptController {
 public:
@@ -46,6 +48,13 @@ Word GetIP(Word cpuId) const {
 	return cpuData[cpuId].ipMask << CAUSE_IP_BIT(0);
 }
 
+// This method delivers an IPI sent thru the outbox of processor origin
+// (see the IPI_DELIVERY event)
+void DeliverIPI(unsigned int origin, Word outbox);
+
+void SaveState(SnapshotWriter& writer) const;
+void RestoreState(SnapshotReader& reader);
+
 private:
 static const unsigned int kBaseIL = 2;
 static const unsigned int kSharedILBase = 1;
@@ -93,8 +102,6 @@ struct CpuData {
 	Word biosReserved[2];
 };
 
-void deliverIPI(unsigned int origin, Word outbox);
-
 const MachineConfig* const config;
 SystemBus* const bus;
 
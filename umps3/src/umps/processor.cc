@@ -27,14 +27,20 @@
  * MIPS processor features are too complex to be fully descripted
  * here: refer to external documentation.
  *
- * This module also contains TLBEntry class definition: it is used to
+ * This module also contains TLB class definition: it is used to
  * streamline TLB build and handling in Processor.
  */
 
 #include "umps/processor.h"
 
+#include <algorithm>
 #include <cassert>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "base/json.h"
 #include "umps/const.h"
 #include "umps/cp0.h"
 #include "umps/processor_defs.h"
@@ -44,6 +50,10 @@
 #include "umps/machine_config.h"
 #include "umps/error.h"
 #include "umps/disassemble.h"
+#include "umps/instr_trace.h"
+#include "umps/profiler.h"
+#include "umps/snapshot.h"
+#include "umps/translator.h"
 
 
 // Names of exceptions
@@ -89,111 +99,203 @@ HIDDEN const Word excCode[] = {
 };
 
 
-// Each TLBEntry object represents a single entry in the TLB contained in
-// the CP0 coprocessor part of a real MIPS processor.
-// Each one is a 64-bit field split in two parts (HI and LO), with special
+ProcessorStats::ProcessorStats()
+	: instructions(0),
+	idleCycles(0),
+	waits(0)
+{
+	std::fill(exceptions, exceptions + kNumExcCauses, 0);
+	std::fill(interrupts, interrupts + N_INTERRUPT_LINES, 0);
+}
+
+ProcessorStats& ProcessorStats::operator+=(const ProcessorStats& other)
+{
+	instructions += other.instructions;
+	idleCycles += other.idleCycles;
+	waits += other.waits;
+	for (unsigned int i = 0; i < kNumExcCauses; i++)
+		exceptions[i] += other.exceptions[i];
+	for (unsigned int i = 0; i < N_INTERRUPT_LINES; i++)
+		interrupts[i] += other.interrupts[i];
+	return *this;
+}
+
+ProcessorStats& ProcessorStats::operator-=(const ProcessorStats& other)
+{
+	instructions -= other.instructions;
+	idleCycles -= other.idleCycles;
+	waits -= other.waits;
+	for (unsigned int i = 0; i < kNumExcCauses; i++)
+		exceptions[i] -= other.exceptions[i];
+	for (unsigned int i = 0; i < N_INTERRUPT_LINES; i++)
+		interrupts[i] -= other.interrupts[i];
+	return *this;
+}
+
+JsonObject* ProcessorStats::ToJson() const
+{
+	JsonObject* root = new JsonObject;
+	root->Set("instructions", new JsonNumber(instructions));
+	root->Set("idle-cycles", new JsonNumber(idleCycles));
+	root->Set("waits", new JsonNumber(waits));
+
+	JsonObject* excObject = new JsonObject;
+	for (unsigned int i = INTEXCEPTION; i < kNumExcCauses; i++)
+		excObject->Set(excName[i], new JsonNumber(exceptions[i]));
+	root->Set("exceptions", excObject);
+
+	JsonArray* intArray = new JsonArray;
+	for (unsigned int i = 0; i < N_INTERRUPT_LINES; i++)
+		intArray->Add(new JsonNumber(interrupts[i]));
+	root->Set("interrupts", intArray);
+
+	return root;
+}
+
+
+// A TLB object holds the TLB contained in the CP0 coprocessor part of a
+// real MIPS processor.
+// Each entry is a 64-bit field split in two parts (HI and LO), with special
 // fields and control bits (see external documentation for more details).
+// Entries are kept as separate arrays rather than as an array of
+// structures: besides the HI and LO parts, each entry has a match mask
+// which selects the HI bits a probe has to compare (VPN, plus ASID when
+// the G bit is off), so that probing compares several entries at once
+// with SSE2 when available.
 
-class TLBEntry {
+class TLB {
 public:
-// This method builds an entry and sets its initial contents
-TLBEntry(Word entHI = 0, Word entLO = 0);
+// This method builds a TLB with size zero-filled entries
+TLB(size_t size);
 
-// This method returns the HI 32-bit part of the entry
-Word getHI() const {
-	return tlbHI;
+// This method returns the HI 32-bit part of entry i
+Word getHI(unsigned int i) const {
+	return tlbHI[i];
 }
 
-// This method returns the LO 32-bit part of the entry
-Word getLO() const {
-	return tlbLO;
+// This method returns the LO 32-bit part of entry i
+Word getLO(unsigned int i) const {
+	return tlbLO[i];
 }
 
-// This method sets the entry HI part (leaving the zero-filled
+// This method sets the HI part of entry i (leaving the zero-filled
 // field untouched)
-void setHI(Word entHI);
-
-// This method sets the entry LO part (leaving the zero-filled field
-// untouched)
-void setLO(Word entLO);
-
-// This method compares the entry contents with the VPN part of a
-// virtual address and returns TRUE if a match is found, FALSE
-// otherwise
-bool VPNMatch(Word vaddr);
+void setHI(unsigned int i, Word entHI);
 
-// This method compares the entry contents with the ASID field in a
-// CP0 special register and returns TRUE if a match is found, FALSE
-// otherwise
-bool ASIDMatch(Word cpreg);
+// This method sets the LO part of entry i (leaving the zero-filled
+// field untouched)
+void setLO(unsigned int i, Word entLO);
 
 // the following methods return the bit value for the corresponding
-// access control bit
-bool IsG();
-bool IsV();
-bool IsD();
+// access control bit of entry i
+bool IsV(unsigned int i) const;
+bool IsD(unsigned int i) const;
+
+// This method looks for the _highest_ entry matching the VPN part of
+// vaddr and the ASID field of entHI, as MIPS specifications require.
+// It returns TRUE and the entry index thru index pointer if a match is
+// found, FALSE otherwise
+bool Probe(Word entHI, Word vaddr, unsigned int* index) const;
 
 private:
-// contains the VPN + ASID fields, and a zero-filled field
-Word tlbHI;
+// entries are allocated in groups of kProbeWidth, as compared by a
+// single probe step
+static const size_t kProbeWidth = 4;
+
+size_t size;
+
+// VPN + ASID fields, and a zero-filled field
+scoped_array<Word> tlbHI;
 
-// contains the PFN field, some access control bits and a
-// zero-filled field
-Word tlbLO;
+// PFN field, some access control bits and a zero-filled field
+scoped_array<Word> tlbLO;
+
+// bits of tlbHI to be compared by Probe()
+scoped_array<Word> matchMask;
 };
 
-// This method builds an entry and sets its initial contents
-TLBEntry::TLBEntry(Word entHI, Word entLO)
+// This method builds a TLB with size zero-filled entries
+TLB::TLB(size_t size)
+	: size(size)
 {
-	tlbHI = entHI;
-	tlbLO = entLO;
-}
+	size_t allocSize = (size + kProbeWidth - 1) & ~(kProbeWidth - 1);
 
-// This method sets the entry HI part (leaving the zero-filled field untouched)
-void TLBEntry::setHI(Word entHI)
-{
-	tlbHI = (entHI & (VPNMASK | ASIDMASK));
-}
+	tlbHI.reset(new Word[allocSize]);
+	tlbLO.reset(new Word[allocSize]);
+	matchMask.reset(new Word[allocSize]);
+	for (size_t i = 0; i < allocSize; i++) {
+		tlbHI[i] = 0;
+		tlbLO[i] = 0;
+		matchMask[i] = VPNMASK | ASIDMASK;
+	}
 
-// This method sets the entry LO part (leaving the zero-filled field untouched)
-void TLBEntry::setLO(Word entLO)
-{
-	tlbLO = (entLO & ENTRYLOMASK);
+	// padding entries have a bit set which no probe ever has, so they
+	// never match
+	for (size_t i = size; i < allocSize; i++) {
+		tlbHI[i] = 1UL;
+		matchMask[i] = MAXWORDVAL;
+	}
 }
 
-// This method compares the entry contents with the VPN part of a virtual
-// address and returns TRUE if a match is found, FALSE otherwise
-bool TLBEntry::VPNMatch(Word vaddr)
+// This method sets the HI part of entry i (leaving the zero-filled field
+// untouched)
+void TLB::setHI(unsigned int i, Word entHI)
 {
-	return VPN(tlbHI) == VPN(vaddr);
+	tlbHI[i] = (entHI & (VPNMASK | ASIDMASK));
 }
 
-// This method compares the entry contents with the ASID field in a CP0
-// special register and returns TRUE if a match is found, FALSE otherwise
-bool TLBEntry::ASIDMatch(Word cpreg)
+// This method sets the LO part of entry i (leaving the zero-filled field
+// untouched); global entries match any ASID
+void TLB::setLO(unsigned int i, Word entLO)
 {
-	return ASID(tlbHI) == ASID(cpreg);
+	tlbLO[i] = (entLO & ENTRYLOMASK);
+	matchMask[i] = BitVal(tlbLO[i], GBITPOS) ? VPNMASK : (VPNMASK | ASIDMASK);
 }
 
-// This method returns the value of G (Global) access control bit in an
-// entry LO part
-bool TLBEntry::IsG()
+// This method returns the value of V (Valid) access control bit in entry
+// i LO part
+bool TLB::IsV(unsigned int i) const
 {
-	return BitVal(tlbLO, GBITPOS);
+	return BitVal(tlbLO[i], VBITPOS);
 }
 
-// This method returns the value of V (Valid) access control bit in an
-// entry LO part
-bool TLBEntry::IsV()
+// This method returns the value of D (Dirty) access control bit in entry
+// i LO part
+bool TLB::IsD(unsigned int i) const
 {
-	return BitVal(tlbLO, VBITPOS);
+	return BitVal(tlbLO[i], DBITPOS);
 }
 
-// This method returns the value of D (Dirty) access control bit in an
-// entry LO part
-bool TLBEntry::IsD()
+// This method looks for the _highest_ entry matching the VPN part of
+// vaddr and the ASID field of entHI: groups of entries are scanned from
+// the top, so that the scan stops at the first group with a match
+bool TLB::Probe(Word entHI, Word vaddr, unsigned int* index) const
 {
-	return BitVal(tlbLO, DBITPOS);
+	Word key = VPN(vaddr) | ASID(entHI);
+
+#ifdef __SSE2__
+	__m128i k = _mm_set1_epi32((int) key);
+	for (size_t base = (size + kProbeWidth - 1) & ~(kProbeWidth - 1); base > 0; ) {
+		base -= kProbeWidth;
+		__m128i hi = _mm_loadu_si128((const __m128i*) &tlbHI[base]);
+		__m128i mask = _mm_loadu_si128((const __m128i*) &matchMask[base]);
+		__m128i diff = _mm_and_si128(_mm_xor_si128(hi, k), mask);
+		int match = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(diff, _mm_setzero_si128())));
+		if (match != 0) {
+			*index = base + (31 - __builtin_clz(match));
+			return true;
+		}
+	}
+	return false;
+#else
+	for (size_t i = size; i > 0; i--) {
+		if (((tlbHI[i - 1] ^ key) & matchMask[i - 1]) == 0) {
+			*index = i - 1;
+			return true;
+		}
+	}
+	return false;
+#endif
 }
 
 
@@ -202,10 +304,29 @@ Processor::Processor(const MachineConfig* config, Word cpuId, Machine* machine,
 	machine(machine),
 	bus(bus),
 	status(PS_HALTED),
+	timerCounting(false),
+	timerZero(0),
+	timerEvent(Event::kNoHandle),
 	tlbSize(config->getTLBSize()),
-	tlb(new TLBEntry[tlbSize]),
-	tlbFloorAddress(config->getTLBFloorAddress())
-{
+	tlb(new TLB(tlbSize)),
+	tlbFloorAddress(config->getTLBFloorAddress()),
+	idleSince(0),
+	profile(NULL),
+	itrace(NULL)
+{
+	currDI = &currDecoded;
+	decodeCache = bus->getDecodeCache();
+	// the jit engine is the threaded one, with native code for its hot
+	// blocks where the host allows it
+	const ExecEngine engine = config->getExecEngine();
+	if (engine != EXEC_ENGINE_INTERPRETER && decodeCache != NULL)
+		blockCache.reset(new BasicBlock[kBlockCacheSize]);
+	for (unsigned int i = 0; blockCache && i < kBlockCacheSize; i++)
+		blockCache[i].paddr = MAXWORDVAL;
+	if (engine == EXEC_ENGINE_JIT && blockCache && Translator::IsAvailable())
+		translator.reset(new Translator);
+	currBlock = NULL;
+	flushMicroTLBs();
 }
 
 Processor::~Processor() {
@@ -214,6 +335,10 @@ Processor::~Processor() {
 void Processor::setStatus(ProcessorStatus newStatus)
 {
 	if (status != newStatus) {
+		if (status == PS_IDLE)
+			stats.idleCycles += bus->getToD() - idleSince;
+		else if (newStatus == PS_IDLE)
+			idleSince = bus->getToD();
 		status = newStatus;
 		StatusChanged.emit();
 	}
@@ -248,7 +373,9 @@ void Processor::Reset(Word pc, Word sp)
 	prevPhysPC = MAXWORDVAL;
 	prevInstr = NOP;
 
-	// clears CP0 registers and then sets them
+	// clears CP0 registers and then sets them; the timer is stopped
+	bus->cancelEvent(timerEvent);
+	timerCounting = false;
 	for (i = 0; i < CP0REGNUM; i++)
 		cpreg[i] = 0UL;
 
@@ -256,12 +383,14 @@ void Processor::Reset(Word pc, Word sp)
 	cpreg[RANDOM] =  ((tlbSize - 1UL) << RNDIDXOFFS) - RANDOMSTEP;
 	cpreg[STATUS] = STATUSRESET;
 	cpreg[PRID] = id;
+	flushMicroTLBs();
 
 	currPC = pc;
+	currBlock = NULL;
 
 	// maps PC to physical address space and fetches first instruction
 	// mapVirtual and SystemBus cannot signal TRUE on this call
-	if (mapVirtual(currPC, &currPhysPC, EXEC) || bus->InstrRead(currPhysPC, &currInstr, this))
+	if (mapVirtual(currPC, &currPhysPC, EXEC) || fetchInstr())
 		Panic("Illegal memory access in Processor::Reset");
 
 	// sets values for following PCs
@@ -274,6 +403,7 @@ void Processor::Reset(Word pc, Word sp)
 void Processor::Halt()
 {
 	setStatus(PS_HALTED);
+	updateTimer();
 }
 
 // This method makes Processor execute a single instruction.
@@ -297,22 +427,29 @@ void Processor::Cycle()
 	if (isHalted())
 		return;
 
-	// Update internal timer
-	if (cpreg[STATUS] & STATUS_TE) {
-		if (cpreg[CP0REG_TIMER] == 0)
-			AssertIRQ(IL_CPUTIMER);
-		cpreg[CP0REG_TIMER]--;
-	} else {
-		DeassertIRQ(IL_CPUTIMER);
-	}
-
-	// In low-power state, only the per-cpu timer keeps running
+	// In low-power state, only the per-cpu timer keeps running (see
+	// updateTimer())
 	if (isIdle())
 		return;
 
-	// Instruction decode & exec
-	if (execInstr(currInstr))
+	// another processor may have reused the entries of the current
+	// block since it was fetched from
+	if (currBlock != NULL && currBlock->epoch != decodeCache->PageEpoch(currBlock->paddr))
+		leaveBlock();
+
+	// Instruction exec (decoding was done at fetch time); the base
+	// register of a memory access may be its destination too, so the
+	// tracer needs it read beforehand
+	const Word base = (itrace != NULL) ? gpr[currDI->rs] : 0;
+	const bool raised = (this->*currDI->handler)(currDI);
+	if (profile != NULL)
+		profileInstr(raised);
+	if (itrace != NULL)
+		traceInstr(raised, base);
+	if (raised)
 		handleExc();
+	else
+		stats.instructions++;
 
 	// Check if we entered sleep mode as a result of the last
 	// instruction; if so, we effectively stall the pipeline.
@@ -338,33 +475,42 @@ void Processor::Cycle()
 	if (checkForInt())
 		handleExc();
 
-	// processor cycle fetch part
+	fetchNext();
+}
+
+// This method is the processor cycle fetch part: the threaded engine
+// goes on with the current block as long as execution is sequential,
+// and chains to another block when a branch stays inside the same page
+inline void Processor::fetchNext()
+{
+	if (currBlock != NULL) {
+		if (fetchFromBlock() || chainBlock())
+			return;
+		currBlock = NULL;
+	}
+
 	if (mapVirtual(currPC, &currPhysPC, EXEC)) {
 		// TLB or Address exception caused: current instruction is nullified
-		currInstr = NOP;
+		nullifyInstr();
 		handleExc();
-	} else if (bus->InstrRead(currPhysPC, &currInstr, this)) {
+	} else if (fetchInstr()) {
 		// IBE exception caused: current instruction is nullified
-		currInstr = NOP;
+		nullifyInstr();
 		handleExc();
 	}
 }
 
+// This method returns how many cycles the processor may be left alone
+// for: the local timer underflow is a bus event, so a waiting or halted
+// processor has nothing to do until some interrupt wakes it up
 uint32_t Processor::IdleCycles() const
 {
-	if (isHalted())
-		return (uint32_t) -1;
-	else if (isIdle())
-		return (cpreg[STATUS] & STATUS_TE) ? cpreg[CP0REG_TIMER] : (uint32_t) -1;
-	else
-		return 0;
+	return isRunning() ? 0 : (uint32_t) -1;
 }
 
-void Processor::Skip(uint32_t cycles)
+Word Processor::CauseExcCode(unsigned int exc)
 {
-	assert(isIdle() && cycles <= IdleCycles());
-	if (cpreg[STATUS] & STATUS_TE)
-		cpreg[CP0REG_TIMER] -= cycles;
+	return excCode[exc];
 }
 
 // This method allows SystemBus and Processor itself to signal Processor
@@ -433,6 +579,20 @@ void Processor::getPrevStatus(Word * pc, Word * instr)
 	*instr = prevInstr;
 }
 
+ProcessorStats Processor::getStats() const
+{
+	ProcessorStats result = stats;
+	if (isIdle())
+		result.idleCycles += bus->getToD() - idleSince;
+	return result;
+}
+
+void Processor::ResetStats()
+{
+	stats = ProcessorStats();
+	idleSince = bus->getToD();
+}
+
 // This method allows to get a human-readable mnemonic expression for the last
 // exception happened (thanks to excName[] array)
 const char* Processor::getExcCauseStr()
@@ -475,32 +635,34 @@ Word Processor::getSuccPC()
 
 // This method allows to get the value of the general purpose register
 // indexed by num (HI and LO are the last ones in the array)
-SWord Processor::getGPR(unsigned int num)
+SWord Processor::getGPR(unsigned int num) const
 {
 	return(gpr[num]);
 }
 
 // This method allows to get the value of the CP0 special register indexed
 // by num. num coding itself is internal (see h/processor.h for mapping)
-Word Processor::getCP0Reg(unsigned int num)
+Word Processor::getCP0Reg(unsigned int num) const
 {
+	if (num == CP0REG_TIMER)
+		return getTimer();
 	return(cpreg[num]);
 }
 
 void Processor::getTLB(unsigned int index, Word* hi, Word* lo) const
 {
-	*hi = tlb[index].getHI();
-	*lo = tlb[index].getLO();
+	*hi = tlb->getHI(index);
+	*lo = tlb->getLO(index);
 }
 
 Word Processor::getTLBHi(unsigned int index) const
 {
-	return tlb[index].getHI();
+	return tlb->getHI(index);
 }
 
 Word Processor::getTLBLo(unsigned int index) const
 {
-	return tlb[index].getLO();
+	return tlb->getLO(index);
 }
 
 // This method allows to modify the current value of a general purpose
@@ -516,8 +678,17 @@ void Processor::setGPR(unsigned int num, SWord val)
 // register. num coding itself is internal (see h/processor.h for mapping)
 void Processor::setCP0Reg(unsigned int num, Word val)
 {
-	if (num < CP0REGNUM)
+	if (num == CP0REG_TIMER) {
+		setTimer(val);
+	} else if (num < CP0REGNUM) {
 		cpreg[num] = val;
+		if (num == STATUS)
+			updateTimer();
+	}
+
+	// address translation may have changed
+	flushMicroTLBs();
+	leaveBlock();
 }
 
 // This method allows to modify the current value of nextPC to force sudden
@@ -539,8 +710,10 @@ void Processor::setSuccPC(Word spc)
 void Processor::setTLB(unsigned int index, Word hi, Word lo)
 {
 	if (index < tlbSize) {
-		tlb[index].setHI(hi);
-		tlb[index].setLO(lo);
+		tlb->setHI(index, hi);
+		tlb->setLO(index, lo);
+		flushMicroTLBs();
+		leaveBlock();
 		SignalTLBChanged(index);
 	} else {
 		Panic("Unknown TLB entry in Processor::setTLB()");
@@ -550,17 +723,104 @@ void Processor::setTLB(unsigned int index, Word hi, Word lo)
 void Processor::setTLBHi(unsigned int index, Word value)
 {
 	assert(index < tlbSize);
-	tlb[index].setHI(value);
+	tlb->setHI(index, value);
+	flushMicroTLBs();
+	leaveBlock();
 	SignalTLBChanged(index);
 }
 
 void Processor::setTLBLo(unsigned int index, Word value)
 {
 	assert(index < tlbSize);
-	tlb[index].setLO(value);
+	tlb->setLO(index, value);
+	flushMicroTLBs();
+	leaveBlock();
 	SignalTLBChanged(index);
 }
 
+// This method saves the processor state: registers, pipeline (PCs and
+// the instruction about to be executed), pending load, CP0 and TLB
+void Processor::SaveState(SnapshotWriter& writer) const
+{
+	writer.Section("CPU ");
+	writer.U32(status);
+	writer.U32(excCause);
+	writer.U32(copENum);
+	writer.Bool(isBranchD);
+	writer.U32(loadPending);
+	writer.U32(loadReg);
+	writer.U32(loadVal);
+	for (unsigned int i = 0; i < kNumCPURegisters; i++)
+		writer.U32(gpr[i]);
+
+	writer.U32(currInstr);
+	writer.U32(prevPC);
+	writer.U32(prevPhysPC);
+	writer.U32(prevInstr);
+	writer.U32(currPC);
+	writer.U32(currPhysPC);
+	writer.U32(nextPC);
+	writer.U32(succPC);
+
+	writer.Words(cpreg, CP0REGNUM);
+	writer.Bool(timerCounting);
+	writer.U64(timerZero);
+
+	writer.U32(tlbSize);
+	for (unsigned int i = 0; i < tlbSize; i++) {
+		writer.U32(tlb->getHI(i));
+		writer.U32(tlb->getLO(i));
+	}
+}
+
+// This method restores the state saved by SaveState(); the current
+// instruction is decoded again, and translation and block caches start
+// afresh
+void Processor::RestoreState(SnapshotReader& reader)
+{
+	reader.Section("CPU ");
+	ProcessorStatus newStatus = (ProcessorStatus) reader.Check(reader.U32(), PS_IDLE + 1);
+	excCause = reader.U32();
+	copENum = reader.U32();
+	isBranchD = reader.Bool();
+	loadPending = (LoadTargetType) reader.Check(reader.U32(), LOAD_TARGET_NONE + 1);
+	loadReg = reader.Check(reader.U32(), kNumCPURegisters);
+	loadVal = reader.U32();
+	for (unsigned int i = 0; i < kNumCPURegisters; i++)
+		gpr[i] = reader.U32();
+
+	currInstr = reader.U32();
+	prevPC = reader.U32();
+	prevPhysPC = reader.U32();
+	prevInstr = reader.U32();
+	currPC = reader.U32();
+	currPhysPC = reader.U32();
+	nextPC = reader.U32();
+	succPC = reader.U32();
+
+	reader.Words(cpreg, CP0REGNUM);
+	timerCounting = reader.Bool();
+	timerZero = reader.U64();
+	timerEvent = Event::kNoHandle;
+
+	if (reader.U32() != tlbSize)
+		reader.Fail("Snapshot TLB size does not match machine configuration");
+	for (unsigned int i = 0; i < tlbSize; i++) {
+		tlb->setHI(i, reader.U32());
+		tlb->setLO(i, reader.U32());
+	}
+	flushMicroTLBs();
+
+	Decode(&currDecoded, currInstr);
+	currDecoded.paddr = currPhysPC;
+	currDI = &currDecoded;
+	currBlock = NULL;
+
+	setStatus(newStatus);
+	for (unsigned int i = 0; i < tlbSize; i++)
+		SignalTLBChanged(i);
+}
+
 
 //
 // Processor private methods start here
@@ -576,6 +836,110 @@ void Processor::randomRegTick()
 		cpreg[RANDOM] =  ((tlbSize - 1UL) << RNDIDXOFFS);
 }
 
+// This method advances CP0 RANDOM register by ticks clock ticks at
+// once. With a power of two TLB size, RANDOM index goes round from
+// tlbSize - 1 down to 1 after the first tick, which is computed
+// directly; otherwise RANDOM takes at most tlbSize values, so after as
+// many ticks it is surely going round its cycle, whose whole turns are
+// skipped
+void Processor::randomRegTicks(uint64_t ticks)
+{
+	if (ticks == 0)
+		return;
+	if ((tlbSize & (tlbSize - 1)) == 0) {
+		randomRegTick();
+		const Word top = tlbSize - 1;
+		const Word index = cpreg[RANDOM] >> RNDIDXOFFS;
+		const Word steps = (Word) ((ticks - 1) % top);
+		cpreg[RANDOM] = (((index - 1 + top - steps) % top) + 1) << RNDIDXOFFS;
+		return;
+	}
+
+	const uint64_t warmup = std::min<uint64_t>(ticks, tlbSize);
+	for (uint64_t i = 0; i < warmup; i++)
+		randomRegTick();
+	ticks -= warmup;
+	if (ticks == 0)
+		return;
+
+	const Word start = cpreg[RANDOM];
+	uint64_t period = 0;
+	do {
+		randomRegTick();
+		period++;
+	} while (cpreg[RANDOM] != start);
+	for (ticks %= period; ticks > 0; ticks--)
+		randomRegTick();
+}
+
+// This method returns the current local timer reading. The timer is
+// decremented at the start of each cycle while it counts, so during
+// cycle T it reads timerZero - T
+Word Processor::getTimer() const
+{
+	if (timerCounting)
+		return (Word) (timerZero - bus->getToD());
+	else
+		return cpreg[CP0REG_TIMER];
+}
+
+void Processor::setTimer(Word value)
+{
+	cpreg[CP0REG_TIMER] = value;
+	if (timerCounting) {
+		timerZero = bus->getToD() + value;
+		scheduleTimerUnderflow();
+	}
+}
+
+// This method starts or stops the local timer when STATUS.TE or the
+// processor status change. When TE is cleared the CPU timer interrupt
+// line is deasserted at the start of the next cycle, as the timer
+// would have done on a cycle by cycle basis
+void Processor::updateTimer()
+{
+	const bool counting = (cpreg[STATUS] & STATUS_TE) && !isHalted();
+	if (counting == timerCounting)
+		return;
+
+	timerCounting = counting;
+	const uint64_t now = bus->getToD();
+	if (counting) {
+		timerZero = now + cpreg[CP0REG_TIMER];
+		scheduleTimerUnderflow();
+	} else {
+		bus->cancelEvent(timerEvent);
+		if (isHalted()) {
+			// processors are halted by device events, which run before
+			// the processor cycle of the same clock tick: the timer
+			// counted last in the previous cycle
+			cpreg[CP0REG_TIMER] = (Word) (timerZero - (now - 1));
+		} else {
+			cpreg[CP0REG_TIMER] = (Word) (timerZero - now);
+			bus->scheduleEvent(1, EventTag(EventTag::CPU_TIMER_CLEAR, id), &timerEvent);
+		}
+	}
+}
+
+// This method schedules the next local timer underflow, i.e. the
+// first cycle starting with a zero timer reading
+void Processor::scheduleTimerUnderflow()
+{
+	bus->cancelEvent(timerEvent);
+	bus->scheduleEvent(timerZero + 1 - bus->getToD(),
+	                   EventTag(EventTag::CPU_TIMER_UNDERFLOW, id),
+	                   &timerEvent);
+}
+
+void Processor::TimerUnderflow()
+{
+	AssertIRQ(IL_CPUTIMER);
+
+	// the timer wraps around and goes on counting
+	timerZero += UINT64_C(1) << 32;
+	scheduleTimerUnderflow();
+}
+
 // This method pushes the KU/IE bit stacks in CP0 STATUS register to start
 // exception handling
 void Processor::pushKUIEStack()
@@ -634,8 +998,10 @@ bool Processor::checkForInt()
  */
 void Processor::suspend()
 {
-	if (!(cpreg[CAUSE] & CAUSE_IP_MASK))
+	if (!(cpreg[CAUSE] & CAUSE_IP_MASK)) {
+		stats.waits++;
 		setStatus(PS_IDLE);
+	}
 }
 
 // This method sets the appropriate CP0 registers at exception
@@ -647,6 +1013,19 @@ void Processor::handleExc()
 	// prepares for exception handling (a small bubble...).
 	completeLoad();
 
+	// execution leaves the current block, if any
+	currBlock = NULL;
+
+	stats.exceptions[excCause]++;
+	if (excCause == INTEXCEPTION) {
+		for (unsigned int il = 0; il < N_INTERRUPT_LINES; il++)
+			if (cpreg[CAUSE] & cpreg[STATUS] & CAUSE_IP(il))
+				stats.interrupts[il]++;
+	}
+
+	if (profile != NULL)
+		profile->Exception();
+
 	// set the excCode into CAUSE reg
 	cpreg[CAUSE] = IM(cpreg[CAUSE]) | (excCode[excCause] << CAUSE_EXCCODE_BIT);
 
@@ -697,15 +1076,132 @@ void Processor::handleExc()
 	}
 }
 
+// This method records the cycle spent on the current instruction into
+// the profile and, once it has completed, follows calls and returns.
+// Code below the TLB floor address is in all address spaces. Jump
+// targets are in succPC, since the branch delay slot is still to come
+void Processor::profileInstr(bool raised)
+{
+	const Word asid = ENTRYHI_GET_ASID(cpreg[ENTRYHI]);
+	profile->Cycle(currPC < tlbFloorAddress ? MAXASID : asid, currPC, currPhysPC, !raised);
+	if (raised)
+		return;
+
+	const Word instr = currInstr;
+	bool call = false;
+	if (OpType(instr) == REGTYPE) {
+		if (FUNCT(instr) == SFN_JALR) {
+			call = true;
+		} else if (FUNCT(instr) == SFN_JR && RS(instr) == 31) {
+			profile->Return(succPC);
+			return;
+		}
+	} else if (OPCODE(instr) == JAL) {
+		call = true;
+	} else if (OPCODE(instr) == BGL && (RT(instr) == BLTZAL || RT(instr) == BGEZAL)) {
+		// only taken branches are calls
+		call = (succPC != nextPC + WORDLEN);
+	}
+
+	if (call)
+		profile->Call(succPC < tlbFloorAddress ? MAXASID : asid, succPC, currPC + 2 * WORDLEN);
+}
+
+// This function returns the general purpose register written by instr
+// (other than by a delayed load), or 0 if none is
+HIDDEN unsigned int destRegister(Word instr)
+{
+	switch (OpType(instr)) {
+	case REGTYPE:
+		switch (FUNCT(instr)) {
+		case SFN_BREAK:
+		case SFN_SYSCALL:
+		case SFN_JR:
+		case SFN_MULT:
+		case SFN_MULTU:
+		case SFN_DIV:
+		case SFN_DIVU:
+		case SFN_MTHI:
+		case SFN_MTLO:
+			return 0;
+		default:
+			return RD(instr);
+		}
+
+	case IMMTYPE:
+		return RT(instr);
+
+	case BRANCHTYPE:
+		if (OPCODE(instr) == JAL ||
+		    (OPCODE(instr) == BGL && (RT(instr) == BLTZAL || RT(instr) == BGEZAL)))
+			return LINKREG;
+		return 0;
+
+	default:
+		return 0;
+	}
+}
+
+// This method records the instruction just executed into the
+// instruction trace, with the effective address it accessed, computed
+// from the value base of its base register before execution, and the
+// register it wrote, unless it raised an exception
+void Processor::traceInstr(bool raised, Word base)
+{
+	InstrTraceEntry* e = itrace->Append();
+	const Word instr = currInstr;
+	const unsigned int type = OpType(instr);
+
+	e->pc = currPC;
+	e->instr = instr;
+	e->asid = ENTRYHI_GET_ASID(cpreg[ENTRYHI]);
+	e->flags = raised ? InstrTraceEntry::ITE_EXCEPTION : 0;
+	e->destReg = 0;
+	e->destValue = 0;
+	e->memAddr = 0;
+
+	if (type == LOADTYPE || type == STORETYPE || type == LOADCOPTYPE || type == STORECOPTYPE) {
+		e->flags |= InstrTraceEntry::ITE_MEMORY;
+		e->memAddr = base + SignExtImm(instr);
+	} else if (type == REGTYPE && FUNCT(instr) == SFN_CAS) {
+		e->flags |= InstrTraceEntry::ITE_MEMORY;
+		e->memAddr = base;
+	}
+	if (raised)
+		return;
+
+	// loads (and MFC0) only write their register at the next cycle
+	if ((type == LOADTYPE || type == COPTYPE) && loadPending == LOAD_TARGET_GPREG) {
+		e->destReg = loadReg;
+		e->destValue = (Word) loadVal;
+	} else {
+		e->destReg = destRegister(instr);
+		e->destValue = (Word) gpr[e->destReg];
+	}
+	if (e->destReg == 0)
+		e->destValue = 0;
+}
+
 // This method zeroes out the TLB
 void Processor::zapTLB()
 {
 	// Leave out the first entry ([0])
 	for (size_t i = 1; i < tlbSize; ++i) {
-		tlb[i].setHI(0);
-		tlb[i].setLO(0);
+		tlb->setHI(i, 0);
+		tlb->setLO(i, 0);
 		SignalTLBChanged(i);
 	}
+	flushMicroTLBs();
+}
+
+// This method drops all the translations cached in the micro-TLBs
+void Processor::flushMicroTLBs()
+{
+	// the low bits of a valid tag are always zero
+	for (unsigned int i = 0; i < kMicroTLBSize; i++) {
+		itlb[i].tag = MAXWORDVAL;
+		dtlb[i].tag = MAXWORDVAL;
+	}
 }
 
 // This method allows to handle the delayed load slot: it provides to load
@@ -738,12 +1234,14 @@ void Processor::completeLoad()
 			break;
 
 		case CP0REG_TIMER:
-			cpreg[CP0REG_TIMER] = (Word) loadVal;
+			setTimer((Word) loadVal);
 			DeassertIRQ(IL_CPUTIMER);
 			break;
 
 		case ENTRYHI:
 			// loadable parts are VPN and ASID fields
+			if (ASID(cpreg[ENTRYHI]) != ASID((Word) loadVal))
+				flushMicroTLBs();
 			cpreg[ENTRYHI] = ((Word) loadVal) & (VPNMASK | ASIDMASK);
 			break;
 
@@ -751,6 +1249,7 @@ void Processor::completeLoad()
 			// loadable parts are CU0 bit, TE bit, BEV bit in DS, IM mask and
 			// KUIE bit stack
 			cpreg[STATUS] = ((Word) loadVal) & STATUSMASK;
+			updateTimer();
 			break;
 
 		case EPC:
@@ -807,12 +1306,23 @@ bool Processor::mapVirtual(Word vaddr, Word * paddr, Word accType)
 	// The access is in user mode to user space, or in kernel mode
 	// to KSEG0 or KUSEG spaces.
 
+	// recent translations are looked up in the micro-TLBs first
+	Word tag = VPN(vaddr) | ASID(cpreg[ENTRYHI]);
+	MicroTLBEntry* mte = (accType == EXEC) ? itlb : dtlb;
+	mte += (vaddr / (FRAMESIZE * WORDLEN)) & (kMicroTLBSize - 1);
+	if (mte->tag == tag && (accType != WRITE || BitVal(mte->entryLo, DBITPOS))) {
+		*paddr = PHADDR(vaddr, mte->entryLo);
+		return false;
+	}
+
 	unsigned int index;
 	if (probeTLB(&index, cpreg[ENTRYHI], vaddr)) {
-		if (tlb[index].IsV()) {
-			if (accType != WRITE || tlb[index].IsD()) {
+		if (tlb->IsV(index)) {
+			if (accType != WRITE || tlb->IsD(index)) {
 				// All OK
-				*paddr = PHADDR(vaddr, tlb[index].getLO());
+				*paddr = PHADDR(vaddr, tlb->getLO(index));
+				mte->tag = tag;
+				mte->entryLo = tlb->getLO(index);
 				return false;
 			} else {
 				// write operation on frame with D bit set to 0
@@ -854,6 +1364,290 @@ void Processor::setTLBRegs(Word vaddr)
 	cpreg[ENTRYHI] = VPN(vaddr) | ASID(cpreg[ENTRYHI]);
 }
 
+// This method fetches the instruction at currPhysPC thru the decoded
+// instructions cache, and sets both its raw and decoded forms. It
+// returns TRUE if an IBE exception was caused, FALSE otherwise
+bool Processor::fetchInstr()
+{
+	if (bus->InstrFetch(currPhysPC, &currDecoded, this))
+		return true;
+
+	currInstr = currDecoded.instr;
+	currDI = &currDecoded;
+	if (blockCache)
+		enterBlock();
+	return false;
+}
+
+// This method replaces the current instruction with a NOP, when its
+// fetch caused an exception
+void Processor::nullifyInstr()
+{
+	currInstr = NOP;
+	Decode(&currDecoded, NOP);
+	currDI = &currDecoded;
+	currBlock = NULL;
+}
+
+// This method makes the threaded engine enter the block starting at the
+// instruction just fetched, building it if it is not cached or is
+// stale. The following instructions of the block will be fetched by
+// fetchFromBlock() as long as execution proceeds sequentially
+void Processor::enterBlock()
+{
+	currBlock = NULL;
+
+	// a CP0 register load may still change address translation before
+	// the next fetch: stick to the full fetch path for now
+	if (loadPending == LOAD_TARGET_CPREG)
+		return;
+
+	const BasicBlock* blk = lookupBlock(currPhysPC);
+
+	// single-instruction blocks are not worth the bookkeeping
+	if (blk->length > 1) {
+		currBlock = blk;
+		blockIndex = 0;
+		blockVAddr = currPC;
+		currDI = blk->instrs;
+	}
+}
+
+// This method fetches the instruction at currPC from the current block,
+// if it is the next one in it and the block is not stale. Translation
+// is not needed since the block lies in the same page as its first
+// instruction, and nothing in the block can change the TLB or the
+// processor mode; Watch is notified as for a full fetch. It returns
+// TRUE if the instruction was fetched, FALSE otherwise
+bool Processor::fetchFromBlock()
+{
+	unsigned int next = blockIndex + 1;
+
+	if (next >= currBlock->length ||
+	    currPC != blockVAddr + next * WORDLEN ||
+	    currBlock->epoch != decodeCache->PageEpoch(currBlock->paddr))
+		return false;
+
+	currPhysPC = currBlock->paddr + next * WORDLEN;
+	machine->HandleVMAccess(ENTRYHI_GET_ASID(cpreg[ENTRYHI]), currPC, EXEC, this);
+	machine->HandleBusAccess(currPhysPC, EXEC, this);
+
+	blockIndex = next;
+	currDI = currBlock->instrs + next;
+	currInstr = currDI->instr;
+	return true;
+}
+
+// This method fetches the instruction at currPC by entering another
+// block, when currPC lies in the same virtual page as the current
+// block: the page was already translated when the current block was
+// entered, and nothing executed since then can have changed the
+// translation. This links together the blocks of loops and of short
+// forward branches, so that they run without full fetches. It returns
+// TRUE if the instruction was fetched, FALSE otherwise
+bool Processor::chainBlock()
+{
+	if (BADADDR(currPC) || VPN(currPC) != VPN(blockVAddr) || loadPending == LOAD_TARGET_CPREG)
+		return false;
+
+	Word paddr = (currBlock->paddr & VPNMASK) | (currPC & OFFSETMASK);
+	const BasicBlock* blk = lookupBlock(paddr);
+	if (blk->length == 0)
+		return false;
+
+	currPhysPC = paddr;
+	machine->HandleVMAccess(ENTRYHI_GET_ASID(cpreg[ENTRYHI]), currPC, EXEC, this);
+	machine->HandleBusAccess(currPhysPC, EXEC, this);
+
+	currBlock = blk;
+	blockIndex = 0;
+	blockVAddr = currPC;
+	currDI = blk->instrs;
+	currInstr = currDI->instr;
+	return true;
+}
+
+// This method makes the current instruction independent of the current
+// block, whose DecodeCache entries may be reused before it is executed:
+// it is decoded again from its latched raw form
+void Processor::leaveBlock()
+{
+	if (currBlock != NULL) {
+		Decode(&currDecoded, currInstr);
+		currDecoded.paddr = currPhysPC;
+		currDI = &currDecoded;
+		currBlock = NULL;
+	}
+}
+
+// This method returns the cached block starting at physical address
+// paddr, (re)building it if it is missing or stale
+const BasicBlock* Processor::lookupBlock(Word paddr)
+{
+	BasicBlock* blk = &blockCache[(paddr >> WORDSHIFT) & (kBlockCacheSize - 1)];
+	if (blk->paddr != paddr || blk->epoch != decodeCache->PageEpoch(paddr))
+		buildBlock(blk, paddr);
+	return blk;
+}
+
+// This method fills blk with the run of instructions starting at
+// physical address paddr, making sure all of them are in the decoded
+// instructions cache. The run stops at the end of the page frame and
+// before the first instruction which is not handled by a dedicated
+// handler (see Decode()): those may change address translation or
+// processor mode, so they are always fetched thru the full path
+void Processor::buildBlock(BasicBlock* blk, Word paddr)
+{
+	Word pageEnd = (paddr & VPNMASK) + FRAMESIZE * WORDLEN;
+
+	blk->paddr = paddr;
+	blk->length = 0;
+	blk->instrs = NULL;
+
+	while (blk->length < BasicBlock::kMaxLength && paddr < pageEnd) {
+		const DecodedInstr* di = bus->PeekInstr(paddr);
+		if (di == NULL || di->handler == &Processor::execGeneric)
+			break;
+		if (blk->length == 0)
+			blk->instrs = di;
+		blk->length++;
+		paddr += WORDLEN;
+	}
+
+	// filling the run may have evicted entries of this same page
+	blk->epoch = decodeCache->PageEpoch(blk->paddr);
+}
+
+// This method runs native code from the current instruction on, which
+// must start a block, for at most cycles cycles; see RunNative(). Each
+// pass ends at a branch or at the first instruction which is not
+// translated, and passes go on from block to block as long as they stay
+// in the page the current block is in, whose translation cannot change
+// meanwhile, and the blocks reached are hot. Afterwards, the processor
+// is left as Cycle() would have: the last instruction completed is the
+// previous one, and the next one is fetched thru the full path, so that
+// anything native code could not do is left to the interpreter
+unsigned int Processor::runNative(unsigned int cycles)
+{
+	// native code only starts on ordinary, sequential execution: no
+	// delayed load, branch delay slot or interrupt may be pending, and
+	// nothing may want to see each instruction
+	if (!isRunning() || loadPending != LOAD_TARGET_NONE || isBranchD ||
+	    nextPC != currPC + WORDLEN || succPC != nextPC + WORDLEN ||
+	    profile != NULL || itrace != NULL ||
+	    ((cpreg[STATUS] & STATUS_IEc) && (cpreg[CAUSE] & cpreg[STATUS] & CAUSE_IP_MASK)))
+	{
+		return 0;
+	}
+
+	// another processor may have written to the current block since it
+	// was fetched from
+	if (currBlock->epoch != decodeCache->PageEpoch(currBlock->paddr))
+		return 0;
+
+	const Word pageVAddr = VPN(currPC);
+	const Word pagePAddr = currPhysPC & VPNMASK;
+
+	NativeFrame frame;
+	frame.cpu = this;
+	frame.lastPC = prevPC;
+	frame.lastInstr = prevInstr;
+
+	const BasicBlock* blk = currBlock;
+	Word entry = currPC;
+	Word vaddr = currPC;
+	unsigned int ran = 0;
+	for (;;) {
+		unsigned int length;
+		Translator::NativeCode code = translator->Lookup(blk, entry, &length);
+		if (code == NULL || length > cycles - ran)
+			break;
+
+		frame.budget = cycles - ran;
+		vaddr = code(gpr, &frame);
+		const unsigned int pass = cycles - ran - frame.budget;
+		ran += pass;
+
+		// an instruction native code could not complete, or a branch
+		// out of the page, is left to the full fetch path
+		if (pass == 0 || BADADDR(vaddr) || VPN(vaddr) != pageVAddr)
+			break;
+		blk = lookupBlock(pagePAddr | (vaddr & OFFSETMASK));
+		entry = vaddr;
+		if (blk->length == 0)
+			break;
+	}
+	if (ran == 0)
+		return 0;
+
+	prevPC = frame.lastPC;
+	prevPhysPC = pagePAddr | (frame.lastPC & OFFSETMASK);
+	prevInstr = frame.lastInstr;
+	randomRegTicks(ran);
+	stats.instructions += ran;
+
+	currPC = vaddr;
+	nextPC = currPC + WORDLEN;
+	succPC = nextPC + WORDLEN;
+	isBranchD = false;
+
+	// the last block looked up becomes the current one, as the first
+	// one may have been evicted from the blocks cache meanwhile
+	currBlock = blk;
+	blockIndex = 0;
+	blockVAddr = entry;
+	fetchNext();
+	return ran;
+}
+
+// This method returns the host location of the RAM word at virtual
+// address vaddr, and its physical address thru paddr, if native code may
+// access it directly. It has no side effects: NULL is returned for all
+// accesses which mapVirtual() would not translate thru KSEG0 or the data
+// micro-TLB alone, exceptions included, and for all those which do not
+// reach RAM
+Word* Processor::nativeDataWord(Word vaddr, Word accType, Word* paddr)
+{
+	if (BADADDR(vaddr) || (InUserMode() && (INBOUNDS(vaddr, KSEG0BASE, KUSEGBASE))))
+		return NULL;
+
+	if (INBOUNDS(vaddr, KSEG0BASE, tlbFloorAddress)) {
+		*paddr = vaddr;
+	} else {
+		Word tag = VPN(vaddr) | ASID(cpreg[ENTRYHI]);
+		const MicroTLBEntry* mte = dtlb + ((vaddr / (FRAMESIZE * WORDLEN)) & (kMicroTLBSize - 1));
+		if (mte->tag != tag || (accType == WRITE && !BitVal(mte->entryLo, DBITPOS)))
+			return NULL;
+		*paddr = PHADDR(vaddr, mte->entryLo);
+	}
+
+	return bus->HostWord(*paddr);
+}
+
+// This method makes the data read of a LW for native code: the word
+// read is returned in the low half of the result, and the high half is
+// set if the LW has to be executed thru the full path instead
+uint64_t Processor::nativeLoad(NativeFrame* frame, Word vaddr)
+{
+	Word paddr;
+	const Word* word = frame->cpu->nativeDataWord(vaddr, READ, &paddr);
+	return (word != NULL) ? *word : UINT64_C(1) << 32;
+}
+
+// This method makes the data write of a SW for native code, and keeps
+// the decoded instructions cache coherent as SystemBus::DataWrite() does;
+// see NativeStoreResult
+unsigned int Processor::nativeStore(NativeFrame* frame, Word vaddr, Word data)
+{
+	Word paddr;
+	Word* word = frame->cpu->nativeDataWord(vaddr, WRITE, &paddr);
+	if (word == NULL)
+		return NATIVE_STORE_REFUSED;
+
+	*word = data;
+	return frame->cpu->bus->CodeWritten(paddr) ? NATIVE_STORE_CODE_WRITTEN : NATIVE_STORE_DONE;
+}
+
 // This method make Processor execute a single MIPS instruction, emulating
 // pipeline constraints and load delay slots (see external doc).
 bool Processor::execInstr(Word instr)
@@ -934,19 +1728,23 @@ bool Processor::execInstr(Word instr)
 						break;
 
 					case TLBR:
-						cpreg[ENTRYHI] = tlb[RNDIDX(cpreg[INDEX])].getHI();
-						cpreg[ENTRYLO] = tlb[RNDIDX(cpreg[INDEX])].getLO();
+						if (ASID(cpreg[ENTRYHI]) != ASID(tlb->getHI(RNDIDX(cpreg[INDEX]))))
+							flushMicroTLBs();
+						cpreg[ENTRYHI] = tlb->getHI(RNDIDX(cpreg[INDEX]));
+						cpreg[ENTRYLO] = tlb->getLO(RNDIDX(cpreg[INDEX]));
 						break;
 
 					case TLBWI:
-						tlb[RNDIDX(cpreg[INDEX])].setHI(cpreg[ENTRYHI]);
-						tlb[RNDIDX(cpreg[INDEX])].setLO(cpreg[ENTRYLO]);
+						tlb->setHI(RNDIDX(cpreg[INDEX]), cpreg[ENTRYHI]);
+						tlb->setLO(RNDIDX(cpreg[INDEX]), cpreg[ENTRYLO]);
+						flushMicroTLBs();
 						SignalTLBChanged(RNDIDX(cpreg[INDEX]));
 						break;
 
 					case TLBWR:
-						tlb[RNDIDX(cpreg[RANDOM])].setHI(cpreg[ENTRYHI]);
-						tlb[RNDIDX(cpreg[RANDOM])].setLO(cpreg[ENTRYLO]);
+						tlb->setHI(RNDIDX(cpreg[RANDOM]), cpreg[ENTRYHI]);
+						tlb->setLO(RNDIDX(cpreg[RANDOM]), cpreg[ENTRYLO]);
+						flushMicroTLBs();
 						SignalTLBChanged(RNDIDX(cpreg[INDEX]));
 						break;
 
@@ -999,7 +1797,7 @@ bool Processor::execInstr(Word instr)
 				// valid instruction has SHAMT and FUNCT fields
 				// set to 0, and refers to a valid CP0 register
 				if (ValidCP0Reg(RD(instr), &cp0Num) && !SHAMT(instr) && !FUNCT(instr)) {
-					setLoad(LOAD_TARGET_GPREG, RT(instr), (SWord) cpreg[cp0Num]);
+					setLoad(LOAD_TARGET_GPREG, RT(instr), (SWord) getCP0Reg(cp0Num));
 				} else {
 					// invalid instruction format or CP0 reg
 					SignalExc(CPUEXCEPTION, 0);
@@ -1104,16 +1902,7 @@ bool Processor::cp0Usable()
 // entry that matches
 bool Processor::probeTLB(unsigned int* index, Word asid, Word vpn)
 {
-	bool found = false;
-
-	for (unsigned int i = 0; i < tlbSize; i++) {
-		if (tlb[i].VPNMatch(vpn) && (tlb[i].IsG() || tlb[i].ASIDMatch(asid))) {
-			found = true;
-			*index = i;
-		}
-	}
-
-	return found;
+	return tlb->Probe(asid, vpn, index);
 }
 
 // This method sets delayed load handling variables when needed by
@@ -1819,3 +2608,525 @@ bool Processor::execStoreInstr(Word instr)
 	}
 	return(error);
 }
+
+
+//
+// Decoded instruction execution
+//
+
+
+// This method decodes instr into di, extracting its fields and
+// selecting the method which executes it. Only the frequently executed
+// and well-formed instructions get a dedicated handler: everything
+// else (coprocessor, multiply/divide, traps, sub-word memory accesses,
+// ill-formed encodings) is executed by execInstr(), which stays the
+// reference implementation of the instruction set.
+// Instructions without side effects which target r0 are mapped to
+// execNop()
+void Processor::Decode(DecodedInstr* di, Word instr)
+{
+	DecodedInstr::Handler pure = NULL;
+
+	di->instr = instr;
+	di->rs = RS(instr);
+	di->rt = RT(instr);
+	di->rd = RD(instr);
+	di->shamt = SHAMT(instr);
+	di->imm = SignExtImm(instr);
+	di->handler = &Processor::execGeneric;
+
+	switch (OpType(instr)) {
+	case REGTYPE:
+		if (InvalidRegInstr(instr))
+			break;
+
+		switch (FUNCT(instr)) {
+		case SFN_ADD:
+			di->handler = &Processor::execAdd;
+			break;
+		case SFN_ADDU:
+			pure = &Processor::execAddu;
+			break;
+		case SFN_SUB:
+			di->handler = &Processor::execSub;
+			break;
+		case SFN_SUBU:
+			pure = &Processor::execSubu;
+			break;
+		case SFN_AND:
+			pure = &Processor::execAnd;
+			break;
+		case SFN_OR:
+			pure = &Processor::execOr;
+			break;
+		case SFN_XOR:
+			pure = &Processor::execXor;
+			break;
+		case SFN_NOR:
+			pure = &Processor::execNor;
+			break;
+		case SFN_SLT:
+			pure = &Processor::execSlt;
+			break;
+		case SFN_SLTU:
+			pure = &Processor::execSltu;
+			break;
+		case SFN_SLL:
+			pure = &Processor::execSll;
+			break;
+		case SFN_SRL:
+			pure = &Processor::execSrl;
+			break;
+		case SFN_SRA:
+			pure = &Processor::execSra;
+			break;
+		case SFN_SLLV:
+			pure = &Processor::execSllv;
+			break;
+		case SFN_SRLV:
+			pure = &Processor::execSrlv;
+			break;
+		case SFN_SRAV:
+			pure = &Processor::execSrav;
+			break;
+		case SFN_MFHI:
+			pure = &Processor::execMfhi;
+			break;
+		case SFN_MFLO:
+			pure = &Processor::execMflo;
+			break;
+		case SFN_JR:
+			di->handler = &Processor::execJr;
+			break;
+		case SFN_JALR:
+			di->handler = &Processor::execJalr;
+			break;
+		default:
+			break;
+		}
+		if (pure != NULL)
+			di->handler = di->rd ? pure : &Processor::execNop;
+		break;
+
+	case IMMTYPE:
+		switch (OPCODE(instr)) {
+		case ADDI:
+			di->handler = &Processor::execAddi;
+			break;
+		case ADDIU:
+			pure = &Processor::execAddiu;
+			break;
+		case ANDI:
+			di->imm = ZEXTIMM(instr);
+			pure = &Processor::execAndi;
+			break;
+		case ORI:
+			di->imm = ZEXTIMM(instr);
+			pure = &Processor::execOri;
+			break;
+		case XORI:
+			di->imm = ZEXTIMM(instr);
+			pure = &Processor::execXori;
+			break;
+		case SLTI:
+			pure = &Processor::execSlti;
+			break;
+		case SLTIU:
+			pure = &Processor::execSltiu;
+			break;
+		case LUI:
+			if (!RS(instr)) {
+				di->imm = ZEXTIMM(instr) << HWORDLEN;
+				pure = &Processor::execLui;
+			}
+			break;
+		default:
+			break;
+		}
+		if (pure != NULL)
+			di->handler = di->rt ? pure : &Processor::execNop;
+		break;
+
+	case BRANCHTYPE:
+		switch (OPCODE(instr)) {
+		case BEQ:
+			di->handler = &Processor::execBeq;
+			break;
+		case BNE:
+			di->handler = &Processor::execBne;
+			break;
+		case BLEZ:
+			if (!RT(instr))
+				di->handler = &Processor::execBlez;
+			break;
+		case BGTZ:
+			if (!RT(instr))
+				di->handler = &Processor::execBgtz;
+			break;
+		case BGL:
+			switch (RT(instr)) {
+			case BLTZ:
+				di->handler = &Processor::execBltz;
+				break;
+			case BGEZ:
+				di->handler = &Processor::execBgez;
+				break;
+			case BLTZAL:
+				di->handler = &Processor::execBltzal;
+				break;
+			case BGEZAL:
+				di->handler = &Processor::execBgezal;
+				break;
+			default:
+				break;
+			}
+			break;
+		case J:
+			di->handler = &Processor::execJ;
+			break;
+		case JAL:
+			di->handler = &Processor::execJal;
+			break;
+		default:
+			break;
+		}
+		break;
+
+	case LOADTYPE:
+		if (OPCODE(instr) == LW)
+			di->handler = &Processor::execLw;
+		break;
+
+	case STORETYPE:
+		if (OPCODE(instr) == SW)
+			di->handler = &Processor::execSw;
+		break;
+
+	default:
+		break;
+	}
+}
+
+// This method completes a non-branch instruction whose result res
+// must be moved to the (non-zero) target register reg: as in
+// execInstr(), the delayed load is completed before the result is
+// written
+bool Processor::retireResult(unsigned int reg, Word res)
+{
+	completeLoad();
+	gpr[reg] = (SWord) res;
+	isBranchD = false;
+	return false;
+}
+
+// This method completes a branch-type instruction: the following
+// instruction is in a branch delay slot
+bool Processor::retireBranch()
+{
+	completeLoad();
+	isBranchD = true;
+	return false;
+}
+
+bool Processor::execGeneric(const DecodedInstr* di)
+{
+	return execInstr(di->instr);
+}
+
+bool Processor::execNop(const DecodedInstr* di)
+{
+	UNUSED_ARG(di);
+	completeLoad();
+	isBranchD = false;
+	return false;
+}
+
+bool Processor::execAdd(const DecodedInstr* di)
+{
+	Word res;
+	bool error = SignAdd(&res, gpr[di->rs], gpr[di->rt]);
+
+	if (error)
+		SignalExc(OVEXCEPTION);
+
+	completeLoad();
+
+	if (!error) {
+		if (di->rd)
+			gpr[di->rd] = (SWord) res;
+		isBranchD = false;
+	}
+	return error;
+}
+
+bool Processor::execAddu(const DecodedInstr* di)
+{
+	return retireResult(di->rd, (Word) gpr[di->rs] + (Word) gpr[di->rt]);
+}
+
+bool Processor::execSub(const DecodedInstr* di)
+{
+	Word res;
+	bool error = SignSub(&res, gpr[di->rs], gpr[di->rt]);
+
+	if (error)
+		SignalExc(OVEXCEPTION);
+
+	completeLoad();
+
+	if (!error) {
+		if (di->rd)
+			gpr[di->rd] = (SWord) res;
+		isBranchD = false;
+	}
+	return error;
+}
+
+bool Processor::execSubu(const DecodedInstr* di)
+{
+	return retireResult(di->rd, (Word) gpr[di->rs] - (Word) gpr[di->rt]);
+}
+
+bool Processor::execAnd(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[di->rs] & gpr[di->rt]);
+}
+
+bool Processor::execOr(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[di->rs] | gpr[di->rt]);
+}
+
+bool Processor::execXor(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[di->rs] ^ gpr[di->rt]);
+}
+
+bool Processor::execNor(const DecodedInstr* di)
+{
+	return retireResult(di->rd, ~(gpr[di->rs] | gpr[di->rt]));
+}
+
+bool Processor::execSlt(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[di->rs] < gpr[di->rt] ? 1UL : 0UL);
+}
+
+bool Processor::execSltu(const DecodedInstr* di)
+{
+	return retireResult(di->rd, (Word) gpr[di->rs] < (Word) gpr[di->rt] ? 1UL : 0UL);
+}
+
+bool Processor::execSll(const DecodedInstr* di)
+{
+	return retireResult(di->rd, ((Word) gpr[di->rt]) << di->shamt);
+}
+
+bool Processor::execSrl(const DecodedInstr* di)
+{
+	return retireResult(di->rd, ((Word) gpr[di->rt]) >> di->shamt);
+}
+
+bool Processor::execSra(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[di->rt] >> di->shamt);
+}
+
+bool Processor::execSllv(const DecodedInstr* di)
+{
+	return retireResult(di->rd, ((Word) gpr[di->rt]) << REGSHAMT(gpr[di->rs]));
+}
+
+bool Processor::execSrlv(const DecodedInstr* di)
+{
+	return retireResult(di->rd, ((Word) gpr[di->rt]) >> REGSHAMT(gpr[di->rs]));
+}
+
+bool Processor::execSrav(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[di->rt] >> REGSHAMT(gpr[di->rs]));
+}
+
+bool Processor::execMfhi(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[HI]);
+}
+
+bool Processor::execMflo(const DecodedInstr* di)
+{
+	return retireResult(di->rd, gpr[LO]);
+}
+
+bool Processor::execJr(const DecodedInstr* di)
+{
+	succPC = gpr[di->rs];
+	return retireBranch();
+}
+
+bool Processor::execJalr(const DecodedInstr* di)
+{
+	succPC = gpr[di->rs];
+	completeLoad();
+	if (di->rd)
+		gpr[di->rd] = currPC + (2 * WORDLEN);
+	isBranchD = true;
+	return false;
+}
+
+bool Processor::execAddi(const DecodedInstr* di)
+{
+	Word res;
+	bool error = SignAdd(&res, gpr[di->rs], di->imm);
+
+	if (error)
+		SignalExc(OVEXCEPTION);
+
+	completeLoad();
+
+	if (!error) {
+		if (di->rt)
+			gpr[di->rt] = (SWord) res;
+		isBranchD = false;
+	}
+	return error;
+}
+
+bool Processor::execAddiu(const DecodedInstr* di)
+{
+	return retireResult(di->rt, (Word) gpr[di->rs] + (Word) di->imm);
+}
+
+bool Processor::execAndi(const DecodedInstr* di)
+{
+	return retireResult(di->rt, gpr[di->rs] & di->imm);
+}
+
+bool Processor::execOri(const DecodedInstr* di)
+{
+	return retireResult(di->rt, gpr[di->rs] | di->imm);
+}
+
+bool Processor::execXori(const DecodedInstr* di)
+{
+	return retireResult(di->rt, gpr[di->rs] ^ di->imm);
+}
+
+bool Processor::execSlti(const DecodedInstr* di)
+{
+	return retireResult(di->rt, gpr[di->rs] < di->imm ? 1UL : 0UL);
+}
+
+bool Processor::execSltiu(const DecodedInstr* di)
+{
+	return retireResult(di->rt, (Word) gpr[di->rs] < (Word) di->imm ? 1UL : 0UL);
+}
+
+bool Processor::execLui(const DecodedInstr* di)
+{
+	return retireResult(di->rt, di->imm);
+}
+
+bool Processor::execBeq(const DecodedInstr* di)
+{
+	if (gpr[di->rs] == gpr[di->rt])
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execBne(const DecodedInstr* di)
+{
+	if (gpr[di->rs] != gpr[di->rt])
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execBlez(const DecodedInstr* di)
+{
+	if (gpr[di->rs] <= 0)
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execBgtz(const DecodedInstr* di)
+{
+	if (gpr[di->rs] > 0)
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execBltz(const DecodedInstr* di)
+{
+	if (SIGNBIT(gpr[di->rs]))
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execBgez(const DecodedInstr* di)
+{
+	if (!SIGNBIT(gpr[di->rs]))
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execBltzal(const DecodedInstr* di)
+{
+	// the link register is written before the test, as execBranchInstr() does
+	gpr[LINKREG] = currPC + (2 * WORDLEN);
+	if (SIGNBIT(gpr[di->rs]))
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execBgezal(const DecodedInstr* di)
+{
+	gpr[LINKREG] = currPC + (2 * WORDLEN);
+	if (!SIGNBIT(gpr[di->rs]))
+		succPC = nextPC + ((Word) di->imm << WORDSHIFT);
+	return retireBranch();
+}
+
+bool Processor::execJ(const DecodedInstr* di)
+{
+	succPC = JUMPTO(nextPC, di->instr);
+	return retireBranch();
+}
+
+bool Processor::execJal(const DecodedInstr* di)
+{
+	gpr[LINKREG] = currPC + (2 * WORDLEN);
+	succPC = JUMPTO(nextPC, di->instr);
+	return retireBranch();
+}
+
+bool Processor::execLw(const DecodedInstr* di)
+{
+	Word paddr, temp;
+
+	// delayed load is completed _before_ istruction execution since
+	// instruction itself produces a delayed load
+	completeLoad();
+
+	Word vaddr = gpr[di->rs] + di->imm;
+	if (mapVirtual(vaddr, &paddr, READ) || bus->DataRead(paddr, &temp, this))
+		// exception signaled: rt not loadable
+		return true;
+
+	setLoad(LOAD_TARGET_GPREG, di->rt, (SWord) temp);
+	isBranchD = false;
+	return false;
+}
+
+bool Processor::execSw(const DecodedInstr* di)
+{
+	Word paddr;
+
+	completeLoad();
+
+	Word vaddr = gpr[di->rs] + di->imm;
+	if (mapVirtual(vaddr, &paddr, WRITE) || bus->DataWrite(paddr, (Word) gpr[di->rt], this))
+		// address or bus exception signaled
+		return true;
+
+	isBranchD = false;
+	return false;
+}
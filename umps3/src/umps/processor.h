@@ -25,13 +25,23 @@
 #include <sigc++/sigc++.h>
 
 #include "base/lang.h"
+#include "umps/arch.h"
 #include "umps/types.h"
 #include "umps/const.h"
+#include "umps/decode_cache.h"
+#include "umps/event.h"
 
 class MachineConfig;
 class Machine;
 class SystemBus;
-class TLBEntry;
+class TLB;
+class SnapshotWriter;
+class SnapshotReader;
+class CpuProfile;
+class CpuInstrTrace;
+class JsonObject;
+class Translator;
+struct NativeFrame;
 
 enum ProcessorStatus {
 	PS_HALTED,
@@ -39,6 +49,36 @@ enum ProcessorStatus {
 	PS_IDLE
 };
 
+// Counters of the work done by a processor since power on, or since
+// they were last reset. The difference of two readings gives the
+// counts for the time in between
+struct ProcessorStats {
+	static const unsigned int kNumExcCauses = OVEXCEPTION + 1;
+
+	ProcessorStats();
+
+	ProcessorStats& operator+=(const ProcessorStats& other);
+	ProcessorStats& operator-=(const ProcessorStats& other);
+
+// This method returns the counters as a JSON object; the caller owns it
+	JsonObject* ToJson() const;
+
+	// instructions completed without raising an exception
+	uint64_t instructions;
+	// cycles spent waiting for an interrupt
+	uint64_t idleCycles;
+	// WAIT instructions which put the processor in low-power state
+	uint64_t waits;
+	// exceptions by cause (see const.h), interrupts included
+	uint64_t exceptions[kNumExcCauses];
+	// interrupts taken, by line; an interrupt counts for every line
+	// pending and enabled when it is taken
+	uint64_t interrupts[N_INTERRUPT_LINES];
+};
+
+inline ProcessorStats operator+(ProcessorStats a, const ProcessorStats& b) { return a += b; }
+inline ProcessorStats operator-(ProcessorStats a, const ProcessorStats& b) { return a -= b; }
+
 class Processor {
 public:
 // Register file size:
@@ -80,9 +120,41 @@ void Halt();
 // execution happens
 void Cycle();
 
+// This method makes Processor run up to cycles instructions thru
+// native code (see Translator), if the jit engine is used and the
+// current instruction starts a hot block; each cycle completes one
+// instruction. It returns the number of cycles run, and leaves the bus
+// clock to the caller, which must make sure that no bus event falls
+// within them and that no stoppoint is armed
+unsigned int RunNative(unsigned int cycles) {
+	return (translator.get() != NULL && currBlock != NULL && blockIndex == 0) ? runNative(cycles) : 0;
+}
+
 uint32_t IdleCycles() const;
 
-void Skip(uint32_t cycles);
+// These methods return the processor counters, and reset them
+ProcessorStats getStats() const;
+void ResetStats();
+
+// This method makes Processor record its cycles into profile, or stop
+// recording them if profile is NULL
+void setProfile(CpuProfile* profile) {
+	this->profile = profile;
+}
+
+// This method makes Processor record the instructions it executes into
+// trace, or stop recording them if trace is NULL
+void setInstrTrace(CpuInstrTrace* trace) {
+	itrace = trace;
+}
+
+// This method decodes instr into di, extracting its fields and
+// selecting the Processor method which executes it
+static void Decode(DecodedInstr* di, Word instr);
+
+// This method returns the CAUSE.ExcCode value exception cause exc (see
+// const.h) is reported with
+static Word CauseExcCode(unsigned int exc);
 
 // This method allows SystemBus and Processor itself to signal
 // Processor when an exception happens. SystemBus signal IBE/DBE
@@ -92,6 +164,18 @@ void SignalExc(unsigned int exc, Word cpuNum = 0UL);
 void AssertIRQ(unsigned int il);
 void DeassertIRQ(unsigned int il);
 
+// These methods are used by SystemBus to carry out and to restore the
+// local timer events scheduled by the processor
+void TimerUnderflow();
+void RestoreTimerEvent(Event::Handle handle) {
+	timerEvent = handle;
+}
+
+// These methods save the processor state to a snapshot and restore it.
+// Pending timer events are saved and restored by SystemBus
+void SaveState(SnapshotWriter& writer) const;
+void RestoreState(SnapshotReader& reader);
+
 // The following methods allow inspection of Processor internal
 // status. Name & parameters are self-explanatory: remember that
 // all addresses are _virtual_ when not marked Phys/P/phys (for
@@ -117,8 +201,8 @@ Word getNextPC(void);
 Word getSuccPC(void);
 Word getPrevPPC(void);
 Word getCurrPPC(void);
-SWord getGPR(unsigned int num);
-Word getCP0Reg(unsigned int num);
+SWord getGPR(unsigned int num) const;
+Word getCP0Reg(unsigned int num) const;
 void getTLB(unsigned int index, Word * hi, Word * lo) const;
 Word getTLBHi(unsigned int index) const;
 Word getTLBLo(unsigned int index) const;
@@ -144,6 +228,9 @@ sigc::signal<void, unsigned int> SignalException;
 sigc::signal<void, unsigned int> SignalTLBChanged;
 
 private:
+// Translator tells instructions apart by their handlers, and native
+// code calls nativeLoad() and nativeStore()
+friend class Translator;
 
 enum MultiplierPorts {
 	HI = 32,
@@ -188,8 +275,25 @@ SWord loadVal;
 // general purpose registers, together with HI and LO registers
 SWord gpr[kNumCPURegisters];
 
-// instruction to be executed
+// instruction to be executed, in raw and in decoded form; currDI
+// points either to currDecoded or to the DecodeCache entry of the
+// current block
 Word currInstr;
+DecodedInstr currDecoded;
+const DecodedInstr* currDI;
+
+// threaded execution engine state: blocks cache (empty when the
+// reference interpreter is used), current block, position inside it
+// and virtual address it was entered at
+static const unsigned int kBlockCacheSize = 4096;
+const DecodeCache* decodeCache;
+scoped_array<BasicBlock> blockCache;
+const BasicBlock* currBlock;
+unsigned int blockIndex;
+Word blockVAddr;
+
+// native code tier (NULL unless the jit engine is used)
+scoped_ptr<Translator> translator;
 
 // previous virtual and physical addresses for PC, and previous
 // instruction executed; for book-keeping purposes and for handling
@@ -212,17 +316,69 @@ Word succPC;
 // CP0 components: special registers and the TLB
 Word cpreg[CP0REGNUM];
 
+// local timer: while it counts (STATUS.TE set and processor not halted)
+// cpreg[CP0REG_TIMER] is stale, and the timer reading is derived from
+// the bus clock thru timerZero, the clock time at which it reads zero.
+// Its underflow is a scheduled bus event, so the timer costs nothing
+// on ordinary cycles
+bool timerCounting;
+uint64_t timerZero;
+Event::Handle timerEvent;
+
 size_t tlbSize;
-scoped_array<TLBEntry> tlb;
+scoped_ptr<TLB> tlb;
+
+// micro-TLBs: small direct-mapped caches of the last successful TLB
+// translations, split for instruction fetches and data accesses and
+// tagged by VPN and ASID (as in ENTRYHI). They are flushed whenever the
+// TLB or the current ASID changes
+struct MicroTLBEntry {
+	Word tag;
+	Word entryLo;
+};
+static const unsigned int kMicroTLBSize = 8;
+MicroTLBEntry itlb[kMicroTLBSize];
+MicroTLBEntry dtlb[kMicroTLBSize];
 
 Word tlbFloorAddress;
 
+ProcessorStats stats;
+// time of day the processor last entered low-power state at
+uint64_t idleSince;
+
+// where cycles are recorded when profiling, NULL otherwise
+CpuProfile* profile;
+
+// where instructions are recorded when tracing, NULL otherwise
+CpuInstrTrace* itrace;
+
 // private methods
 void setStatus(ProcessorStatus newStatus);
 
+Word getTimer() const;
+void setTimer(Word value);
+void updateTimer();
+void scheduleTimerUnderflow();
+
 void handleExc();
+void profileInstr(bool raised);
+void traceInstr(bool raised, Word base);
 void zapTLB(void);
-
+void flushMicroTLBs();
+
+bool fetchInstr();
+void fetchNext();
+void nullifyInstr();
+void enterBlock();
+bool fetchFromBlock();
+bool chainBlock();
+void leaveBlock();
+const BasicBlock* lookupBlock(Word paddr);
+void buildBlock(BasicBlock* blk, Word paddr);
+unsigned int runNative(unsigned int cycles);
+Word* nativeDataWord(Word vaddr, Word accType, Word* paddr);
+static uint64_t nativeLoad(NativeFrame* frame, Word vaddr);
+static unsigned int nativeStore(NativeFrame* frame, Word vaddr, Word data);
 bool execInstr(Word instr);
 bool execRegInstr(Word * res, Word instr, bool * isBD);
 bool execImmInstr(Word * res, Word instr);
@@ -232,11 +388,59 @@ bool execStoreInstr(Word instr);
 bool execLoadCopInstr(Word instr);
 bool execStoreCopInstr(Word instr);
 
+// Decoded instruction handlers: see Decode() for the mapping between
+// instructions and handlers
+bool retireResult(unsigned int reg, Word res);
+bool retireBranch();
+bool execGeneric(const DecodedInstr* di);
+bool execNop(const DecodedInstr* di);
+bool execAdd(const DecodedInstr* di);
+bool execAddu(const DecodedInstr* di);
+bool execSub(const DecodedInstr* di);
+bool execSubu(const DecodedInstr* di);
+bool execAnd(const DecodedInstr* di);
+bool execOr(const DecodedInstr* di);
+bool execXor(const DecodedInstr* di);
+bool execNor(const DecodedInstr* di);
+bool execSlt(const DecodedInstr* di);
+bool execSltu(const DecodedInstr* di);
+bool execSll(const DecodedInstr* di);
+bool execSrl(const DecodedInstr* di);
+bool execSra(const DecodedInstr* di);
+bool execSllv(const DecodedInstr* di);
+bool execSrlv(const DecodedInstr* di);
+bool execSrav(const DecodedInstr* di);
+bool execMfhi(const DecodedInstr* di);
+bool execMflo(const DecodedInstr* di);
+bool execJr(const DecodedInstr* di);
+bool execJalr(const DecodedInstr* di);
+bool execAddi(const DecodedInstr* di);
+bool execAddiu(const DecodedInstr* di);
+bool execAndi(const DecodedInstr* di);
+bool execOri(const DecodedInstr* di);
+bool execXori(const DecodedInstr* di);
+bool execSlti(const DecodedInstr* di);
+bool execSltiu(const DecodedInstr* di);
+bool execLui(const DecodedInstr* di);
+bool execBeq(const DecodedInstr* di);
+bool execBne(const DecodedInstr* di);
+bool execBlez(const DecodedInstr* di);
+bool execBgtz(const DecodedInstr* di);
+bool execBltz(const DecodedInstr* di);
+bool execBgez(const DecodedInstr* di);
+bool execBltzal(const DecodedInstr* di);
+bool execBgezal(const DecodedInstr* di);
+bool execJ(const DecodedInstr* di);
+bool execJal(const DecodedInstr* di);
+bool execLw(const DecodedInstr* di);
+bool execSw(const DecodedInstr* di);
+
 bool mapVirtual(Word vaddr, Word * paddr, Word accType);
 bool probeTLB(unsigned int * index, Word asid, Word vpn);
 void completeLoad(void);
 
 void randomRegTick(void);
+void randomRegTicks(uint64_t ticks);
 
 void pushKUIEStack(void);
 void popKUIEStack(void);
@@ -0,0 +1,328 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the CpuProfile class, which records the cycles
+ * spent by a processor, and the Profiler class, which exports the
+ * profiles of a whole machine.
+ *
+ ****************************************************************************/
+
+#include "umps/profiler.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include <boost/format.hpp>
+
+#include "umps/arch.h"
+#include "umps/const.h"
+#include "umps/error.h"
+#include "umps/symbol_table.h"
+
+CpuProfile::CpuProfile(unsigned int period)
+	: period(period),
+	countdown(1),
+	seed(0x2545f491),
+	frame(&root),
+	untracked(0),
+	jump(JUMP_NONE)
+{
+	root.parent = NULL;
+	root.asid = MAXASID;
+	root.entry = 0;
+}
+
+void CpuProfile::followJump()
+{
+	if (jump == JUMP_CALL)
+		call(jumpASID, jumpTarget, jumpReturn);
+	else
+		ret(jumpTarget);
+	jump = JUMP_NONE;
+}
+
+void CpuProfile::call(Word asid, Word target, Word returnAddr)
+{
+	if (returns.size() == kMaxDepth) {
+		untracked++;
+		return;
+	}
+
+	Frame*& callee = frame->callees[key(asid, target)];
+	if (callee == NULL) {
+		frames.push_back(Frame());
+		callee = &frames.back();
+		callee->parent = frame;
+		callee->asid = asid;
+		callee->entry = target;
+	}
+	frame = callee;
+	returns.push_back(returnAddr);
+}
+
+// This method goes back to the caller of the innermost call which
+// returns to target: frames in between were left without a return (by
+// longjmp() or the like). Returns which match no call are ignored
+void CpuProfile::ret(Word target)
+{
+	if (untracked > 0) {
+		untracked--;
+		return;
+	}
+
+	for (size_t depth = returns.size(); depth > 0; depth--) {
+		if (returns[depth - 1] == target) {
+			while (returns.size() >= depth) {
+				returns.pop_back();
+				frame = frame->parent;
+			}
+			return;
+		}
+	}
+}
+
+void CpuProfile::sample(Word asid, Word pc, Word physPC, bool retired)
+{
+	PCCounts& counts = frame->pcs[key(asid, pc)];
+	counts.physPC = physPC;
+	counts.cycles++;
+	if (retired)
+		counts.instructions++;
+
+	if (period > 1) {
+		// xorshift32: the next sample is from 1 to 2 * period - 1
+		// cycles away, period on average
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		countdown = 1 + seed % (2 * period - 1);
+	} else {
+		countdown = 1;
+	}
+}
+
+Profiler::Profiler(unsigned int numCpus, unsigned int period)
+	: period(std::max(period, 1U))
+{
+	for (unsigned int i = 0; i < numCpus; i++)
+		cpus.push_back(new CpuProfile(this->period));
+}
+
+Profiler::~Profiler()
+{
+	for (CpuProfile* cpu : cpus)
+		delete cpu;
+}
+
+struct Totals {
+	Totals() : cycles(0), instructions(0) {}
+
+	uint64_t cycles;
+	uint64_t instructions;
+};
+
+// This function returns the name of the function containing addr, in
+// address space asid; ROM code is named after the ROM, and addresses
+// which are not in the symbol table after fallback, or after
+// themselves if fallback is NULL
+HIDDEN std::string functionName(const SymbolTable* symbols, Word asid, Word addr,
+                                const char* fallback)
+{
+	if (addr < KSEG0_BOOT_BASE)
+		return "ExecROM";
+	if (addr < RAM_BASE)
+		return "BootROM";
+
+	SWord offset;
+	const char* name = (symbols != NULL) ? symbols->Probe(asid, addr, false, &offset) : NULL;
+	if (name != NULL)
+		return name;
+	if (fallback != NULL)
+		return fallback;
+	return str(boost::format("0x%.8lx") % (unsigned long) addr);
+}
+
+// This function returns addr as an offset into its function or ROM,
+// or an empty string if it is in no known function
+HIDDEN std::string location(const SymbolTable* symbols, Word asid, Word addr)
+{
+	const char* name = NULL;
+	SWord offset = 0;
+	if (addr < KSEG0_BOOT_BASE) {
+		name = "ExecROM";
+		offset = addr - KSEG0_BASE;
+	} else if (addr < RAM_BASE) {
+		name = "BootROM";
+		offset = addr - KSEG0_BOOT_BASE;
+	} else if (symbols != NULL) {
+		name = symbols->Probe(asid, addr, false, &offset);
+	}
+	if (name == NULL)
+		return "";
+	return str(boost::format("%s+0x%lx") % name % (unsigned long) offset);
+}
+
+HIDDEN std::string asidName(Word asid)
+{
+	return (asid == MAXASID) ? std::string("any") : str(boost::format("%lu") % (unsigned long) asid);
+}
+
+template<typename T>
+HIDDEN std::vector<std::pair<T, Totals>> byCycles(const std::map<T, Totals>& m)
+{
+	std::vector<std::pair<T, Totals>> v(m.begin(), m.end());
+	std::stable_sort(v.begin(), v.end(),
+	                 [](const std::pair<T, Totals>& a, const std::pair<T, Totals>& b) {
+		                 return a.second.cycles > b.second.cycles;
+	                 });
+	return v;
+}
+
+void Profiler::WriteFlat(const std::string& fileName, const SymbolTable* symbols) const
+{
+	// cycles by ASID and PC, then by ASID and function, and by ASID
+	std::map<uint64_t, CpuProfile::PCCounts> pcs;
+	for (const CpuProfile* cpu : cpus) {
+		std::vector<const CpuProfile::Frame*> frames(1, &cpu->root);
+		for (const CpuProfile::Frame& f : cpu->frames)
+			frames.push_back(&f);
+		for (const CpuProfile::Frame* f : frames) {
+			for (const auto& p : f->pcs) {
+				CpuProfile::PCCounts& c = pcs[p.first];
+				c.physPC = p.second.physPC;
+				c.cycles += p.second.cycles;
+				c.instructions += p.second.instructions;
+			}
+		}
+	}
+
+	Totals total;
+	std::map<Word, Totals> asids;
+	std::map<std::pair<Word, std::string>, Totals> functions;
+	std::map<uint64_t, Totals> pcTotals;
+	for (const auto& p : pcs) {
+		const Word asid = p.first >> 32;
+		const Word pc = (Word) p.first;
+		Totals t;
+		t.cycles = p.second.cycles * period;
+		t.instructions = p.second.instructions * period;
+
+		Totals* sums[] = {
+			&total,
+			&asids[asid],
+			&functions[std::make_pair(asid, functionName(symbols, asid, pc, "[unknown]"))],
+			&pcTotals[p.first]
+		};
+		for (Totals* s : sums) {
+			s->cycles += t.cycles;
+			s->instructions += t.instructions;
+		}
+	}
+
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (file == NULL)
+		throw FileError(fileName);
+
+	const double percent = total.cycles ? 100.0 / total.cycles : 0.0;
+
+	fprintf(file, "# %llu cycles, %llu instructions, sampling period %u\n",
+	        (unsigned long long) total.cycles, (unsigned long long) total.instructions, period);
+
+	fprintf(file, "\n# address spaces\n#%15s %7s %15s  %s\n",
+	        "cycles", "%", "instructions", "asid");
+	for (const auto& a : byCycles(asids)) {
+		fprintf(file, "%16llu %7.2f %15llu  %s\n",
+		        (unsigned long long) a.second.cycles, a.second.cycles * percent,
+		        (unsigned long long) a.second.instructions, asidName(a.first).c_str());
+	}
+
+	fprintf(file, "\n# functions\n#%15s %7s %15s  %-4s  %s\n",
+	        "cycles", "%", "instructions", "asid", "function");
+	for (const auto& f : byCycles(functions)) {
+		fprintf(file, "%16llu %7.2f %15llu  %-4s  %s\n",
+		        (unsigned long long) f.second.cycles, f.second.cycles * percent,
+		        (unsigned long long) f.second.instructions,
+		        asidName(f.first.first).c_str(), f.first.second.c_str());
+	}
+
+	fprintf(file, "\n# PCs\n#%15s %7s %15s  %-4s  %-10s  %-10s  %s\n",
+	        "cycles", "%", "instructions", "asid", "pc", "physical", "location");
+	for (const auto& p : byCycles(pcTotals)) {
+		const Word asid = p.first >> 32;
+		const Word pc = (Word) p.first;
+		fprintf(file, "%16llu %7.2f %15llu  %-4s  0x%.8lx  0x%.8lx  %s\n",
+		        (unsigned long long) p.second.cycles, p.second.cycles * percent,
+		        (unsigned long long) p.second.instructions, asidName(asid).c_str(),
+		        (unsigned long) pc, (unsigned long) pcs[p.first].physPC,
+		        location(symbols, asid, pc).c_str());
+	}
+
+	const bool failed = ferror(file);
+	if (fclose(file) != 0 || failed)
+		throw FileError(fileName);
+}
+
+void Profiler::WriteFolded(const std::string& fileName, const SymbolTable* symbols) const
+{
+	std::map<std::string, uint64_t> stacks;
+	for (const CpuProfile* cpu : cpus)
+		foldFrame(&cpu->root, "", "", symbols, stacks);
+
+	FILE* file = fopen(fileName.c_str(), "w");
+	if (file == NULL)
+		throw FileError(fileName);
+
+	for (const auto& s : stacks)
+		fprintf(file, "%s %llu\n", s.first.c_str(), (unsigned long long) s.second);
+
+	const bool failed = ferror(file);
+	if (fclose(file) != 0 || failed)
+		throw FileError(fileName);
+}
+
+// This method adds the cycles spent in frame f and in its callees to
+// stacks, keyed by folded stack; path is the folded stack of f, and
+// name the name of its function
+void Profiler::foldFrame(const CpuProfile::Frame* f,
+                         const std::string& path, const std::string& name,
+                         const SymbolTable* symbols,
+                         std::map<std::string, uint64_t>& stacks) const
+{
+	// The PCs charged to a frame may lie outside of its function, after
+	// a jump to another one (a tail call, say); those charged to the
+	// root frame have no known caller at all
+	for (const auto& p : f->pcs) {
+		const std::string leaf = functionName(symbols, p.first >> 32, (Word) p.first, "[unknown]");
+		std::string stack = path;
+		if (leaf != name)
+			stack += (stack.empty() ? "" : ";") + leaf;
+		stacks[stack] += p.second.cycles * period;
+	}
+
+	for (const auto& c : f->callees) {
+		const CpuProfile::Frame* callee = c.second;
+		const std::string calleeName = functionName(symbols, callee->asid, callee->entry, NULL);
+		foldFrame(callee, path.empty() ? calleeName : path + ";" + calleeName, calleeName,
+		          symbols, stacks);
+	}
+}
@@ -0,0 +1,179 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_PROFILER_H
+#define UMPS_PROFILER_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/lang.h"
+#include "umps/types.h"
+
+class SymbolTable;
+
+// A CpuProfile records where a single processor spends its cycles: it
+// is only touched by the thread running the processor, so it needs no
+// locking. Besides counting cycles and executed instructions for each
+// PC, it follows calls (JAL, JALR, BLTZAL, BGEZAL) and returns (JR $ra)
+// to keep a shadow call stack, and charges each cycle to the stack it
+// was spent in.
+//
+// Exceptions empty the stack, since handlers need not return to where
+// they were entered from; calls nested more than kMaxDepth deep are not
+// followed.
+//
+// Only sampled cycles are recorded: with a period N, one cycle out of
+// N on average, at random intervals so that samples cannot fall in step
+// with a loop.
+
+class CpuProfile {
+public:
+	static const unsigned int kMaxDepth = 256;
+
+	explicit CpuProfile(unsigned int period);
+
+// This method accounts a cycle spent at virtual address pc (physical
+// address physPC) in address space asid; retired tells whether the
+// instruction completed or raised an exception
+	void Cycle(Word asid, Word pc, Word physPC, bool retired) {
+		if (--countdown == 0)
+			sample(asid, pc, physPC, retired);
+		if (jump != JUMP_NONE)
+			followJump();
+	}
+
+// These methods tell of a call to target in address space asid, which
+// returns to returnAddr, and of a return to target. Both take effect
+// after the next cycle, which runs the branch delay slot
+	void Call(Word asid, Word target, Word returnAddr) {
+		jump = JUMP_CALL;
+		jumpASID = asid;
+		jumpTarget = target;
+		jumpReturn = returnAddr;
+	}
+	void Return(Word target) {
+		jump = JUMP_RETURN;
+		jumpTarget = target;
+	}
+
+	void Exception() {
+		frame = &root;
+		returns.clear();
+		untracked = 0;
+		jump = JUMP_NONE;
+	}
+
+private:
+	friend class Profiler;
+
+	struct PCCounts {
+		PCCounts() : physPC(0), cycles(0), instructions(0) {}
+
+		Word physPC;
+		uint64_t cycles;
+		uint64_t instructions;
+	};
+
+// A node of the call tree: a function, identified by ASID and entry
+// point, as called from the chain of its parents
+	struct Frame {
+		Frame* parent;
+		Word asid;
+		Word entry;
+
+		std::unordered_map<uint64_t, Frame*> callees;
+
+		// cycles spent in this frame, by ASID and PC
+		std::unordered_map<uint64_t, PCCounts> pcs;
+	};
+
+	static uint64_t key(Word asid, Word addr) {
+		return ((uint64_t) asid << 32) | addr;
+	}
+
+	void sample(Word asid, Word pc, Word physPC, bool retired);
+	void followJump();
+	void call(Word asid, Word target, Word returnAddr);
+	void ret(Word target);
+
+	const unsigned int period;
+	unsigned int countdown;
+	uint32_t seed;
+
+// the call tree, the current frame, and the return addresses of the
+// calls which led to it
+	Frame root;
+	Frame* frame;
+	std::list<Frame> frames;
+	std::vector<Word> returns;
+	unsigned int untracked;
+
+// the call or return in the branch delay slot of which the processor is
+	enum {
+		JUMP_NONE,
+		JUMP_CALL,
+		JUMP_RETURN
+	} jump;
+	Word jumpASID;
+	Word jumpTarget;
+	Word jumpReturn;
+
+	DISABLE_COPY_AND_ASSIGNMENT(CpuProfile);
+};
+
+// A Profiler gathers the profiles of all processors of a machine, and
+// exports them as a flat profile (by address space, by function and by
+// PC) and as folded call stacks, one per line with their cycle count,
+// as taken by flame graph tools. Sampled counts are scaled up by the
+// sampling period.
+//
+// PCs below the TLB floor address are not mapped, and belong to every
+// address space: they are recorded with ASID MAXASID, as in kernel
+// symbol tables.
+
+class Profiler {
+public:
+	Profiler(unsigned int numCpus, unsigned int period);
+	~Profiler();
+
+	unsigned int getPeriod() const { return period; }
+
+	CpuProfile* getCpuProfile(unsigned int cpuId) { return cpus[cpuId]; }
+
+// These methods write the profiles to fileName, resolving addresses to
+// functions through symbols if not NULL. They throw FileError
+	void WriteFlat(const std::string& fileName, const SymbolTable* symbols) const;
+	void WriteFolded(const std::string& fileName, const SymbolTable* symbols) const;
+
+private:
+	void foldFrame(const CpuProfile::Frame* f,
+	               const std::string& path, const std::string& name,
+	               const SymbolTable* symbols,
+	               std::map<std::string, uint64_t>& stacks) const;
+
+	const unsigned int period;
+	std::vector<CpuProfile*> cpus;
+
+	DISABLE_COPY_AND_ASSIGNMENT(Profiler);
+};
+
+#endif // UMPS_PROFILER_H
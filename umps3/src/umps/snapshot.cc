@@ -0,0 +1,240 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the SnapshotWriter and SnapshotReader classes,
+ * which handle the on-disk format of machine snapshots: the machine
+ * components themselves decide what goes in their sections.
+ *
+ ****************************************************************************/
+
+#include "umps/snapshot.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <boost/format.hpp>
+
+#include "umps/const.h"
+#include "umps/error.h"
+
+HIDDEN const char kMagic[8] = { 'u', 'M', 'P', 'S', '3', 'S', 'N', 'P' };
+
+// words are moved in blocks of this size when they need byte swapping
+HIDDEN const size_t kSwapChunk = 1024;
+
+HIDDEN inline Word toLittleEndian(Word w)
+{
+#ifdef WORDS_BIGENDIAN
+	return __builtin_bswap32(w);
+#else
+	return w;
+#endif
+}
+
+
+SnapshotWriter::SnapshotWriter(const std::string& fileName)
+	: fileName(fileName),
+	failed(false)
+{
+	if ((file = fopen(fileName.c_str(), "wb")) == NULL)
+		throw FileError(fileName);
+
+	put(kMagic, sizeof(kMagic));
+	U32(kVersion);
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+	if (file != NULL)
+		fclose(file);
+}
+
+void SnapshotWriter::Section(const char* tag)
+{
+	put(tag, 4);
+}
+
+void SnapshotWriter::U8(uint8_t value)
+{
+	put(&value, 1);
+}
+
+void SnapshotWriter::U32(uint32_t value)
+{
+	uint8_t b[4];
+	for (unsigned int i = 0; i < 4; i++)
+		b[i] = value >> (8 * i);
+	put(b, sizeof(b));
+}
+
+void SnapshotWriter::U64(uint64_t value)
+{
+	U32((uint32_t) value);
+	U32((uint32_t) (value >> 32));
+}
+
+// This method writes count words at once: on little-endian hosts they
+// go straight from memory to the file
+void SnapshotWriter::Words(const Word* data, size_t count)
+{
+#ifdef WORDS_BIGENDIAN
+	Word buf[kSwapChunk];
+	while (count > 0) {
+		size_t n = std::min(count, kSwapChunk);
+		for (size_t i = 0; i < n; i++)
+			buf[i] = toLittleEndian(data[i]);
+		put(buf, n * WORDLEN);
+		data += n;
+		count -= n;
+	}
+#else
+	put(data, count * WORDLEN);
+#endif
+}
+
+void SnapshotWriter::Bytes(const void* data, size_t size)
+{
+	put(data, size);
+}
+
+void SnapshotWriter::String(const std::string& s)
+{
+	U32(s.size());
+	put(s.data(), s.size());
+}
+
+void SnapshotWriter::Close()
+{
+	if (fclose(file) != 0)
+		failed = true;
+	file = NULL;
+	if (failed)
+		throw FileError(fileName);
+}
+
+void SnapshotWriter::put(const void* data, size_t size)
+{
+	if (!failed && size > 0 && fwrite(data, size, 1, file) != 1)
+		failed = true;
+}
+
+
+SnapshotReader::SnapshotReader(const std::string& fileName)
+	: fileName(fileName)
+{
+	if ((file = fopen(fileName.c_str(), "rb")) == NULL)
+		throw FileError(fileName);
+
+	char magic[sizeof(kMagic)];
+	if (fread(magic, sizeof(magic), 1, file) != 1 ||
+	    memcmp(magic, kMagic, sizeof(kMagic)) != 0)
+	{
+		fclose(file);
+		throw InvalidFileFormatError(fileName, "Invalid snapshot file");
+	}
+
+	Word version;
+	try {
+		version = U32();
+	} catch (...) {
+		fclose(file);
+		throw;
+	}
+	if (version != SnapshotWriter::kVersion) {
+		fclose(file);
+		throw InvalidFileFormatError(fileName,
+		                             str(boost::format("Unsupported snapshot version %u")
+		                                 % version));
+	}
+}
+
+SnapshotReader::~SnapshotReader()
+{
+	fclose(file);
+}
+
+void SnapshotReader::Section(const char* tag)
+{
+	char t[4];
+	get(t, sizeof(t));
+	if (memcmp(t, tag, sizeof(t)) != 0)
+		Fail(str(boost::format("Snapshot section `%.4s' expected") % tag));
+}
+
+uint8_t SnapshotReader::U8()
+{
+	uint8_t value;
+	get(&value, 1);
+	return value;
+}
+
+uint32_t SnapshotReader::U32()
+{
+	uint8_t b[4];
+	get(b, sizeof(b));
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+uint64_t SnapshotReader::U64()
+{
+	uint64_t lo = U32();
+	return lo | ((uint64_t) U32() << 32);
+}
+
+// This method reads count words at once, straight into place
+void SnapshotReader::Words(Word* data, size_t count)
+{
+	get(data, count * WORDLEN);
+#ifdef WORDS_BIGENDIAN
+	for (size_t i = 0; i < count; i++)
+		data[i] = toLittleEndian(data[i]);
+#endif
+}
+
+void SnapshotReader::Bytes(void* data, size_t size)
+{
+	get(data, size);
+}
+
+std::string SnapshotReader::String()
+{
+	uint32_t size = U32();
+	std::string s;
+	while (size > 0) {
+		char buf[256];
+		size_t n = std::min<size_t>(size, sizeof(buf));
+		get(buf, n);
+		s.append(buf, n);
+		size -= n;
+	}
+	return s;
+}
+
+void SnapshotReader::Fail(const std::string& what) const
+{
+	throw InvalidFileFormatError(fileName, what);
+}
+
+void SnapshotReader::get(void* data, size_t size)
+{
+	if (size > 0 && fread(data, size, 1, file) != 1)
+		Fail("Truncated snapshot file");
+}
@@ -0,0 +1,117 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_SNAPSHOT_H
+#define UMPS_SNAPSHOT_H
+
+#include <stdio.h>
+#include <string>
+
+#include "base/lang.h"
+#include "umps/types.h"
+
+// Machine snapshots are binary files made of a header followed by a
+// sequence of sections, each one opened by a four character tag and
+// holding the state of a single machine component. All values are
+// stored little-endian, whatever the host byte order; the header
+// carries a format version, and files with a different version are
+// refused instead of being misread.
+
+// This class writes a snapshot file: each component saves its own
+// state thru it, opening its section first
+
+class SnapshotWriter {
+public:
+	static const Word kVersion = 1;
+
+// This method creates the file and writes the snapshot header; it
+// throws FileError if the file cannot be created
+	explicit SnapshotWriter(const std::string& fileName);
+	~SnapshotWriter();
+
+	void Section(const char* tag);
+
+	void U8(uint8_t value);
+	void U32(uint32_t value);
+	void U64(uint64_t value);
+	void Bool(bool value) {
+		U8(value ? 1 : 0);
+	}
+	void Words(const Word* data, size_t count);
+	void Bytes(const void* data, size_t size);
+	void String(const std::string& s);
+
+// This method flushes and closes the file; it throws FileError if any
+// write failed
+	void Close();
+
+private:
+	void put(const void* data, size_t size);
+
+	const std::string fileName;
+	FILE* file;
+	bool failed;
+
+	DISABLE_COPY_AND_ASSIGNMENT(SnapshotWriter);
+};
+
+
+// This class reads back a snapshot file, in the same order it was
+// written. Any mismatch (bad header, unexpected section, truncated
+// file) throws InvalidFileFormatError
+
+class SnapshotReader {
+public:
+// This method opens the file and checks the snapshot header; it throws
+// FileError if the file cannot be opened
+	explicit SnapshotReader(const std::string& fileName);
+	~SnapshotReader();
+
+	void Section(const char* tag);
+
+	uint8_t U8();
+	uint32_t U32();
+	uint64_t U64();
+	bool Bool() {
+		return U8() != 0;
+	}
+	void Words(Word* data, size_t count);
+	void Bytes(void* data, size_t size);
+	std::string String();
+
+// This method throws InvalidFileFormatError with the given reason,
+// for components that find invalid values in their section
+	void Fail(const std::string& what) const;
+
+// This method checks that a value read from the file is below limit
+	uint32_t Check(uint32_t value, uint32_t limit) const {
+		if (value >= limit)
+			Fail("Snapshot value out of range");
+		return value;
+	}
+
+private:
+	void get(void* data, size_t size);
+
+	const std::string fileName;
+	FILE* file;
+
+	DISABLE_COPY_AND_ASSIGNMENT(SnapshotReader);
+};
+
+#endif // UMPS_SNAPSHOT_H
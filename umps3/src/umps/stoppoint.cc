@@ -20,16 +20,254 @@
 
 #include "umps/stoppoint.h"
 
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
 #include <algorithm>
+#include <memory>
+#include <utility>
 #include <boost/format.hpp>
 
+#include "umps/const.h"
+#include "umps/disassemble.h"
+#include "umps/processor.h"
+#include "umps/systembus.h"
+
+// A StoppointCondition parser: conditions are short, and the grammar
+// (see stoppoint.h) needs a single token of lookahead
+class ConditionParser {
+public:
+	explicit ConditionParser(const std::string& text)
+		: p(text.c_str())
+	{}
+
+	void skipSpace() {
+		while (isspace((unsigned char) *p))
+			p++;
+	}
+	bool atEnd() {
+		skipSpace();
+		return *p == '\0';
+	}
+	bool accept(const char* token) {
+		skipSpace();
+		const size_t n = strlen(token);
+		if (strncmp(p, token, n) != 0)
+			return false;
+		p += n;
+		return true;
+	}
+	bool number(Word* value) {
+		skipSpace();
+		const bool negative = (*p == '-');
+		const char* start = negative ? p + 1 : p;
+		if (!isdigit((unsigned char) *start))
+			return false;
+		char* end;
+		const unsigned long long v = strtoull(start, &end, 0);
+		if (v > MAXWORDVAL || isalnum((unsigned char) *end) || *end == '_')
+			return false;
+		*value = negative ? -(Word) v : (Word) v;
+		p = end;
+		return true;
+	}
+	std::string name() {
+		skipSpace();
+		const char* start = p;
+		if (*p == '$')
+			p++;
+		while (isalnum((unsigned char) *p) || *p == '_')
+			p++;
+		return std::string(start, p);
+	}
+
+private:
+	const char* p;
+};
+
+StoppointCondition* StoppointCondition::Compile(const std::string& text, std::string& error)
+{
+	static const struct {
+		const char* token;
+		Comparison comparison;
+	} comparisons[] = {
+		// longest first
+		{ "==", CMP_EQ }, { "!=", CMP_NE }, { "<=", CMP_LE },
+		{ ">=", CMP_GE }, { "<", CMP_LT }, { ">", CMP_GT }
+	};
+
+	ConditionParser parser(text);
+	std::unique_ptr<StoppointCondition> condition(new StoppointCondition);
+	condition->text = text;
+
+	do {
+		Term t;
+
+		if (parser.accept("[")) {
+			t.kind = OK_MEMORY;
+			if (!parser.number(&t.operand) || !parser.accept("]")) {
+				error = "physical address expected in brackets";
+				return NULL;
+			}
+			if (t.operand & (WORDLEN - 1)) {
+				error = "unaligned memory word";
+				return NULL;
+			}
+		} else {
+			const std::string name = parser.name();
+			const char* n = name.c_str();
+			const bool dollar = (*n == '$');
+			if (dollar)
+				n++;
+
+			char* end;
+			unsigned long num = strtoul(n, &end, 10);
+			if (dollar && isdigit((unsigned char) *n) && *end == '\0') {
+				if (num >= CPUREGNUM - 2) {
+					error = "no register `" + name + "'";
+					return NULL;
+				}
+				t.kind = OK_GPR;
+				t.operand = num;
+			} else if (!dollar && !strcasecmp(n, "pc")) {
+				t.kind = OK_PC;
+			} else if (!dollar && !strcasecmp(n, "asid")) {
+				t.kind = OK_ASID;
+			} else if (!dollar && !strcasecmp(n, "cpu")) {
+				t.kind = OK_CPU;
+			} else {
+				if (!strcasecmp(n, "zero"))
+					n = RegName(0);
+				for (num = 0; num < CPUREGNUM && strcasecmp(n, RegName(num)); num++)
+					;
+				if (num < CPUREGNUM) {
+					t.kind = OK_GPR;
+				} else {
+					for (num = 0; num < CP0REGNUM && strcasecmp(n, CP0RegName(num)); num++)
+						;
+					if (dollar || num == CP0REGNUM) {
+						error = name.empty() ? std::string("operand expected") :
+						                       "unknown operand `" + name + "'";
+						return NULL;
+					}
+					t.kind = OK_CP0;
+				}
+				t.operand = num;
+			}
+		}
+
+		t.mask = MAXWORDVAL;
+		if (!parser.accept("&&") && parser.accept("&")) {
+			if (!parser.number(&t.mask)) {
+				error = "mask expected after `&'";
+				return NULL;
+			}
+		}
+
+		size_t i;
+		for (i = 0; i < sizeof(comparisons) / sizeof(comparisons[0]); i++)
+			if (parser.accept(comparisons[i].token))
+				break;
+		if (i == sizeof(comparisons) / sizeof(comparisons[0])) {
+			error = "comparison operator expected";
+			return NULL;
+		}
+		t.comparison = comparisons[i].comparison;
+		if (!parser.number(&t.value)) {
+			error = "number expected";
+			return NULL;
+		}
+
+		condition->terms.push_back(t);
+	} while (parser.accept("&&"));
+
+	if (!parser.atEnd()) {
+		error = "`&&' expected";
+		return NULL;
+	}
+	return condition.release();
+}
+
+bool StoppointCondition::Eval(const Processor* cpu, const SystemBus* bus) const
+{
+	for (const Term& t : terms) {
+		Word value;
+		if (t.kind == OK_MEMORY) {
+			if (bus == NULL || bus->PeekMemory(t.operand, &value))
+				return false;
+		} else if (cpu == NULL) {
+			return false;
+		} else {
+			switch (t.kind) {
+			case OK_GPR:
+				value = cpu->getGPR(t.operand);
+				break;
+			case OK_CP0:
+				value = cpu->getCP0Reg(t.operand);
+				break;
+			case OK_PC:
+				value = cpu->getPC();
+				break;
+			case OK_ASID:
+				value = cpu->getASID();
+				break;
+			default:
+				value = cpu->Id();
+				break;
+			}
+		}
+
+		value &= t.mask;
+		bool holds;
+		switch (t.comparison) {
+		case CMP_EQ:
+			holds = (value == t.value);
+			break;
+		case CMP_NE:
+			holds = (value != t.value);
+			break;
+		case CMP_LT:
+			holds = (value < t.value);
+			break;
+		case CMP_LE:
+			holds = (value <= t.value);
+			break;
+		case CMP_GT:
+			holds = (value > t.value);
+			break;
+		default:
+			holds = (value >= t.value);
+			break;
+		}
+		if (!holds)
+			return false;
+	}
+	return true;
+}
+
+bool Stoppoint::Hit(const Processor* cpu, const SystemBus* bus)
+{
+	if (condition && !condition->Eval(cpu, bus))
+		return false;
+	return hitCount.fetch_add(1, std::memory_order_relaxed) >= ignoreCount;
+}
+
 std::string Stoppoint::ToString() const
 {
-	static const char* fmtStr = "<Stoppoint id=%u enabled=%d, access_mode=%u, asid=0x%02x, range=[0x%08x,0x%08x]>";
-	return boost::str(boost::format(fmtStr)
-	                  %id %enabled
-	                  %accessMode
-	                  %range.getASID() %range.getStart() %range.getEnd());
+	static const char* fmtStr = "<Stoppoint id=%u enabled=%d, access_mode=%u, asid=0x%02x, range=[0x%08x,0x%08x]";
+	std::string result = boost::str(boost::format(fmtStr)
+	                                %id %enabled
+	                                %accessMode
+	                                %range.getASID() %range.getStart() %range.getEnd());
+	if (condition)
+		result += ", condition=\"" + condition->getText() + "\"";
+	if (ignoreCount > 0)
+		result += boost::str(boost::format(", ignore=%u") %ignoreCount);
+	if (getHitCount() > 0)
+		result += boost::str(boost::format(", hits=%u") %getHitCount());
+	return result + ">";
 }
 
 StoppointSet::~StoppointSet()
@@ -67,6 +305,7 @@ bool StoppointSet::Add(const AddressRange& range, AccessMode mode, unsigned int
 	p->SetEnabled(enabled);
 	points.push_back(Stoppoint::Ptr(p));
 	addressMap[p->getRange()] = p;
+	reindex();
 
 	SignalStoppointInserted();
 	return true;
@@ -83,6 +322,7 @@ void StoppointSet::Remove(size_t index)
 	addressMap.erase(it);
 
 	points.erase(points.begin() + index);
+	reindex();
 
 	SignalStoppointRemoved(index);
 }
@@ -91,6 +331,7 @@ void StoppointSet::Clear()
 {
 	addressMap.clear();
 	points.clear();
+	reindex();
 }
 
 void StoppointSet::SetEnabled(size_t index, bool setting)
@@ -102,27 +343,32 @@ void StoppointSet::SetEnabled(size_t index, bool setting)
 	}
 }
 
-Stoppoint* StoppointSet::Probe(Word asid, Word addr, AccessMode mode, const Processor* cpu) const
+Stoppoint* StoppointSet::Probe(Word asid, Word addr, AccessMode mode, const Processor* cpu,
+                               const SystemBus* bus) const
 {
-	if (IsEmpty())
+	if (asid >= pageBits.size() || pageBits[asid].empty())
+		return NULL;
+	const PageBitmap& bitmap = pageBits[asid][addr >> kRegionShift];
+	if (bitmap.empty())
+		return NULL;
+	const Word page = (addr >> kPageShift) & (kPagesPerRegion - 1);
+	if (!((bitmap[page / 64] >> (page % 64)) & 1))
 		return NULL;
 
-	AddressRange range(asid, addr, addr);
-	StoppointMap::const_iterator it = addressMap.lower_bound(range);
-	if (it == addressMap.end() ||
-	    (range < it->first && it != addressMap.begin()))
-	{
-		--it;
-	}
-	Stoppoint* p = it->second;
+	// The last range starting at or before addr
+	std::vector<Interval>::const_iterator it =
+		std::upper_bound(intervals.begin(), intervals.end(), std::make_pair(asid, addr),
+		                 [](const std::pair<Word, Word>& key, const Interval& i) {
+			                 return key.first < i.asid ||
+				                 (key.first == i.asid && key.second < i.start);
+		                 });
+	if (it == intervals.begin())
+		return NULL;
+	--it;
 
-	if (p->Matches(asid, addr, mode)) {
-		size_t index = 0;
-		for (index = 0; index < points.size(); ++index)
-			if (points[index].get() == p)
-				break;
-		assert(index < points.size());
-		SignalHit.emit(index, p, addr, cpu);
+	Stoppoint* p = points[it->index].get();
+	if (p->Matches(asid, addr, mode) && p->Hit(cpu, bus)) {
+		SignalHit.emit(it->index, p, addr, cpu);
 		return p;
 	} else {
 		return NULL;
@@ -154,6 +400,37 @@ std::string StoppointSet::ToString(bool sorted) const
 	return result.append("]");
 }
 
+// This method rebuilds the Probe() index from points
+void StoppointSet::reindex()
+{
+	pageBits.clear();
+	intervals.clear();
+
+	for (size_t i = 0; i < points.size(); i++) {
+		const AddressRange& r = points[i]->getRange();
+		Interval interval = { r.getASID(), r.getStart(), r.getEnd(), i };
+		intervals.push_back(interval);
+
+		if (r.getASID() >= pageBits.size())
+			pageBits.resize(r.getASID() + 1);
+		std::vector<PageBitmap>& regions = pageBits[r.getASID()];
+		if (regions.empty())
+			regions.resize(((Word) -1 >> kRegionShift) + 1);
+
+		for (uint64_t page = r.getStart() >> kPageShift; page <= r.getEnd() >> kPageShift; page++) {
+			PageBitmap& bitmap = regions[page / kPagesPerRegion];
+			if (bitmap.empty())
+				bitmap.resize(kPagesPerRegion / 64);
+			const unsigned int bit = page % kPagesPerRegion;
+			bitmap[bit / 64] |= UINT64_C(1) << (bit % 64);
+		}
+	}
+
+	std::sort(intervals.begin(), intervals.end(), [](const Interval& a, const Interval& b) {
+		return a.asid < b.asid || (a.asid == b.asid && a.start < b.start);
+	});
+}
+
 unsigned int StoppointSet::nextId() const
 {
 	unsigned int id = 0;
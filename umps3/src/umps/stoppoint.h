@@ -21,6 +21,7 @@
 #ifndef UMPS_STOPPOINT_H
 #define UMPS_STOPPOINT_H
 
+#include <atomic>
 #include <vector>
 #include <map>
 #include <string>
@@ -32,6 +33,7 @@
 #include "base/lang.h"
 
 class Processor;
+class SystemBus;
 
 enum AccessMode {
 	AM_EXEC       = 1 << 0,
@@ -84,6 +86,70 @@ private:
 	Word asid, start, end;
 };
 
+// A StoppointCondition is what an access to the range of a stoppoint
+// must also satisfy to hit it. It is compiled from a conjunction of
+// comparisons, like
+//
+//   a0 == 3 && [0x20001000] & 0xff != 0 && asid == 2
+//
+// where each operand is a processor register (a GPR by name or number,
+// as in $a0, a0 or $4, hi, lo, or a CP0 register by name, as Status), pc,
+// asid, cpu (the processor number), or the memory word at a physical
+// address in brackets, optionally masked with & MASK; operators are ==,
+// !=, <, <=, > and >=, and compare unsigned words. Accesses made by
+// devices (with no processor) only satisfy memory comparisons, and
+// memory outside RAM and ROM never satisfies any.
+
+class StoppointCondition {
+public:
+	typedef shared_ptr<const StoppointCondition> Ptr;
+
+// This method compiles text; it returns NULL, with a description in
+// error, if text is not a valid condition
+	static StoppointCondition* Compile(const std::string& text, std::string& error);
+
+// This method tells whether the condition holds now for an access made
+// by cpu (NULL for devices), reading memory thru bus
+	bool Eval(const Processor* cpu, const SystemBus* bus) const;
+
+	const std::string& getText() const {
+		return text;
+	}
+
+private:
+	enum OperandKind {
+		OK_GPR,
+		OK_CP0,
+		OK_PC,
+		OK_ASID,
+		OK_CPU,
+		OK_MEMORY
+	};
+
+	enum Comparison {
+		CMP_EQ,
+		CMP_NE,
+		CMP_LT,
+		CMP_LE,
+		CMP_GT,
+		CMP_GE
+	};
+
+	struct Term {
+		OperandKind kind;
+		Comparison comparison;
+		// register number or physical address
+		Word operand;
+		Word mask;
+		Word value;
+	};
+
+	StoppointCondition() {}
+
+	std::vector<Term> terms;
+	std::string text;
+};
+
 class Stoppoint: public enable_shared_from_this<Stoppoint> {
 public:
 	typedef shared_ptr<Stoppoint> Ptr;
@@ -93,7 +159,9 @@ public:
 		: id(id),
 		enabled(true),
 		range(range),
-		accessMode(mode)
+		accessMode(mode),
+		ignoreCount(0),
+		hitCount(0)
 	{
 	}
 
@@ -126,6 +194,35 @@ public:
 		        (accessMode & mode));
 	}
 
+// A stoppoint is only hit by the matching accesses which satisfy its
+// condition, if any, and then stops the machine only once it has been
+// hit more than its ignore count times. Conditions and counts are
+// checked inside the emulation loop, at full speed
+	void setCondition(const StoppointCondition::Ptr& condition) {
+		this->condition = condition;
+	}
+	const StoppointCondition::Ptr& getCondition() const {
+		return condition;
+	}
+
+	void setIgnoreCount(uint64_t count) {
+		ignoreCount = count;
+	}
+	uint64_t getIgnoreCount() const {
+		return ignoreCount;
+	}
+
+	uint64_t getHitCount() const {
+		return hitCount.load(std::memory_order_relaxed);
+	}
+	void ResetHitCount() {
+		hitCount.store(0, std::memory_order_relaxed);
+	}
+
+// This method is called on an access which Matches(): it counts a hit
+// if the condition holds, and returns TRUE if the stoppoint fires
+	bool Hit(const Processor* cpu, const SystemBus* bus);
+
 	std::string ToString() const;
 
 private:
@@ -133,6 +230,11 @@ private:
 	bool enabled;
 	AddressRange range;
 	AccessMode accessMode;
+
+	StoppointCondition::Ptr condition;
+	uint64_t ignoreCount;
+	// processors running in parallel may hit the same stoppoint
+	std::atomic<uint64_t> hitCount;
 };
 
 
@@ -160,7 +262,10 @@ public:
 
 	void SetEnabled(size_t index, bool setting);
 
-	Stoppoint* Probe(Word asid, Word addr, AccessMode mode, const Processor* cpu) const;
+// This method returns the stoppoint which an access by cpu fires, if
+// any (see Stoppoint::Hit()); conditions read memory thru bus, if given
+	Stoppoint* Probe(Word asid, Word addr, AccessMode mode, const Processor* cpu,
+	                 const SystemBus* bus = NULL) const;
 
 	template<typename OutputIterator>
 	void GetStoppointsInRange(Word asid, Word start, Word end, OutputIterator out);
@@ -174,6 +279,7 @@ public:
 
 private:
 	unsigned int nextId() const;
+	void reindex();
 
 	typedef std::vector<Stoppoint::Ptr> StoppointVector;
 	StoppointVector points;
@@ -181,6 +287,28 @@ private:
 	typedef std::map<AddressRange, Stoppoint*> StoppointMap;
 	StoppointMap addressMap;
 
+	// Probe() index, rebuilt whenever stoppoints are added or removed.
+	// Most accesses hit no stoppoint, and are told apart by a bitmap
+	// of the pages covered by some stoppoint, by ASID and 4 MB region:
+	// an ASID without stoppoints has no regions, and a region without
+	// stoppoints no bitmap. Accesses to a covered page then look up the
+	// stoppoint ranges, sorted by ASID and start address, each with the
+	// index of its stoppoint in points
+	static const unsigned int kPageShift = 12;
+	static const unsigned int kRegionShift = 22;
+	static const unsigned int kPagesPerRegion = 1U << (kRegionShift - kPageShift);
+
+	typedef std::vector<uint64_t> PageBitmap;
+	std::vector<std::vector<PageBitmap>> pageBits;
+
+	struct Interval {
+		Word asid;
+		Word start;
+		Word end;
+		size_t index;
+	};
+	std::vector<Interval> intervals;
+
 public:
 	typedef StoppointVector::const_iterator const_iterator;
 	typedef const_iterator iterator;
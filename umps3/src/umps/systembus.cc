@@ -46,6 +46,8 @@
 
 #include <assert.h>
 
+#include <boost/bind.hpp>
+
 #include "umps/const.h"
 #include "umps/blockdev_params.h"
 #include "umps/utility.h"
@@ -62,10 +64,15 @@
 #include "umps/memspace.h"
 #include "umps/event.h"
 #include "umps/mpic.h"
+#include "umps/decode_cache.h"
+#include "umps/snapshot.h"
 
 // This macro converts a byte address into a word address (minus offset)
 #define CONVERT(ad, bs) ((ad - bs) >> WORDSHIFT)
 
+// processor run by the current host thread in parallel mode
+HIDDEN thread_local Word threadCpuId = MAXWORDVAL;
+
 class DeviceAreaAddress {
 public:
 DeviceAreaAddress(Word paddr)
@@ -110,11 +117,14 @@ SystemBus::SystemBus(const MachineConfig* conf, Machine* machine)
 	: config(conf),
 	machine(machine),
 	pic(new InterruptController(conf, this)),
-	mpController(new MPController(conf, machine))
+	mpController(new MPController(conf, machine)),
+	decodeCache(conf->isParallelSMP() ? NULL : new DecodeCache()),
+	parallel(false)
 {
 	tod = UINT64_C(0);
-	timer = MAXWORDVAL;
+	watchClock = false;
 	eventQ = new EventQueue();
+	setTimer(MAXWORDVAL);
 
 	const char *coreFile = NULL;
 	if (config->isLoadCoreEnabled())
@@ -125,6 +135,15 @@ SystemBus::SystemBus(const MachineConfig* conf, Machine* machine)
 	bios = new BiosSpace(config->getROM(ROM_TYPE_BIOS).c_str());
 	boot = new BiosSpace(config->getROM(ROM_TYPE_BOOT).c_str());
 
+	// RAM and the BIOS data page are reached thru the page map
+	pageMapSize = (RAMBASE + ram->Size()) >> FRAMESHIFT;
+	pageMap.reset(new Word*[pageMapSize]);
+	for (Word frame = 0; frame < pageMapSize; frame++)
+		pageMap[frame] = NULL;
+	for (Word ofs = 0; ofs < ram->Size(); ofs += FRAMESIZE * WORDLEN)
+		pageMap[(RAMBASE + ofs) >> FRAMESHIFT] = ram->HostPtr(ofs >> WORDSHIFT);
+	pageMap[BIOSDATABASE >> FRAMESHIFT] = biosdata->HostPtr(0);
+
 	// Create devices and initialize registers used for interrupt
 	// handling.
 	intPendMask = 0UL;
@@ -153,33 +172,45 @@ SystemBus::~SystemBus()
 			delete devTable[intl][dnum];
 }
 
-// This method increments system clock and decrements interval timer;
-// on timer underflow (0 -> FFFFFFFF transition) a interrupt is
-// generated.  Event queue is checked against the current clock value
-// and device operations are completed if needed; all memory changes
-// are notified to Watch control object
-void SystemBus::ClockTick()
+// This method handles the clock ticks which need more than the clock
+// increment done by ClockTick(): on timer underflow (0 -> FFFFFFFF
+// transition) a interrupt is generated, and the event queue is checked
+// against the current clock value so that device operations are
+// completed if needed; all memory changes are notified to Watch control
+// object
+void SystemBus::clockEvents()
 {
-	tod++;
-
 	// both registers signal "change" because they are conceptually one
 	machine->HandleBusAccess(BUS_REG_TOD_HI, WRITE, NULL);
 	machine->HandleBusAccess(BUS_REG_TOD_LO, WRITE, NULL);
 
 	// Update interval timer
-	if (UnsSub(&timer, timer, 1))
+	if (tod >= timerUnderflow) {
+		timerUnderflow += UINT64_C(1) << 32;
 		pic->StartIRQ(IL_TIMER);
+	}
 	machine->HandleBusAccess(BUS_REG_TIMER, WRITE, NULL);
 
 	// Scan the event queue
-	while (!eventQ->IsEmpty() && eventQ->nextDeadline() <= tod) {
-		(eventQ->nextCallback())();
-		eventQ->RemoveHead();
-	}
+	while (!eventQ->IsEmpty() && eventQ->nextDeadline() <= tod)
+		eventQ->RunHead();
+
+	updateNextDeadline();
+}
+
+// This method recomputes the clock value at which ClockTick() has to
+// do more than incrementing the clock
+void SystemBus::updateNextDeadline()
+{
+	nextDeadline = timerUnderflow;
+	if (!eventQ->IsEmpty())
+		nextDeadline = std::min(nextDeadline, eventQ->nextDeadline());
 }
 
 uint32_t SystemBus::IdleCycles() const
 {
+	const Word timer = getTimer();
+
 	if (eventQ->IsEmpty())
 		return timer;
 
@@ -192,27 +223,36 @@ uint32_t SystemBus::IdleCycles() const
 
 void SystemBus::Skip(uint32_t cycles)
 {
+	// the timer follows the clock
 	tod += cycles;
 	machine->HandleBusAccess(BUS_REG_TOD_HI, WRITE, NULL);
 	machine->HandleBusAccess(BUS_REG_TOD_LO, WRITE, NULL);
-
-	timer -= cycles;
 	machine->HandleBusAccess(BUS_REG_TIMER, WRITE, NULL);
 }
 
+// Changing the clock must leave the interval timer alone
+
 void SystemBus::setToDHI(Word hi)
 {
+	Word timer = getTimer();
 	TimeStamp::setHi(tod, hi);
+	setTimer(timer);
 }
 
 void SystemBus::setToDLO(Word lo)
 {
+	Word timer = getTimer();
 	TimeStamp::setLo(tod, lo);
+	setTimer(timer);
 }
 
 void SystemBus::setTimer(Word time)
 {
-	timer = time;
+	std::unique_lock<std::mutex> lock(eventMutex, std::defer_lock);
+	if (parallel)
+		lock.lock();
+	timerUnderflow = tod + time + 1;
+	updateNextDeadline();
 }
 
 // This method reads a data word from memory at address addr, returning it
@@ -249,15 +289,31 @@ bool SystemBus::WatchWrite(Word addr, Word data)
 	return busWrite(addr, data, machine->getProcessor(0));
 }
 
+bool SystemBus::PeekMemory(Word addr, Word* datap) const
+{
+	Word* page = hostPage(addr);
+	if (page != NULL)
+		*datap = page[(addr >> WORDSHIFT) & (FRAMESIZE - 1)];
+	else if (INBOUNDS(addr, BIOSBASE, BIOSBASE + bios->Size()))
+		*datap = bios->MemRead(CONVERT(addr, BIOSBASE));
+	else if (INBOUNDS(addr, BOOTBASE, BOOTBASE + boot->Size()))
+		*datap = boot->MemRead(CONVERT(addr, BOOTBASE));
+	else
+		return true;
+	return false;
+}
+
 // This method writes the data word at physical addr in RAM memory or device
 // register area.  Writes to BIOS or BOOT areas cause a DBEXCEPTION (no
 // writes allowed). It returns TRUE if an exception was caused, FALSE
-// otherwise, and notifies access to Watch control object
+// otherwise, and notifies access to Watch control object once the word
+// is written, so that tracepoints see its new value
 bool SystemBus::DataWrite(Word addr, Word data, Processor* proc)
 {
+	const bool error = busWrite(addr, data, proc);
 	machine->HandleBusAccess(addr, WRITE, proc);
 
-	if (busWrite(addr, data, proc)) {
+	if (error) {
 		// data write is out of valid write bounds
 		proc->SignalExc(DBEXCEPTION);
 		return true;
@@ -269,8 +325,16 @@ bool SystemBus::CompareAndSet(Word addr, Word oldval, Word newval, bool* result,
 {
 	// The CAS read-modify-write operation, as specified by the uMPS
 	// ISA, is required to fail for I/O locations.
-	if (RAMBASE <= addr && addr < RAMBASE + ram->Size()) {
-		*result = ram->CompareAndSet((addr - RAMBASE) >> 2, oldval, newval);
+	Word* page = hostPage(addr);
+	if (RAMBASE <= addr && page != NULL) {
+		Word* word = &page[(addr >> WORDSHIFT) & (FRAMESIZE - 1)];
+		*result = __atomic_compare_exchange_n(word, &oldval, newval, false,
+		                                      __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		if (*result) {
+			if (decodeCache)
+				decodeCache->Invalidate(addr);
+			machine->HandleBusAccess(addr, WRITE, cpu);
+		}
 		return false;
 	} else if (MMIO_BASE <= addr && addr < MMIO_END) {
 		*result = false;
@@ -363,11 +427,207 @@ bool SystemBus::InstrRead(Word addr, Word* instrp, Processor* proc)
 	}
 }
 
+// This method reads a istruction from memory at address addr like
+// InstrRead() does, but returns its decoded form thru dip pointer.
+// Only memory locations are cached: instructions fetched from the
+// device register area, or when there is no cache (parallel SMP
+// configurations), are decoded again on every fetch
+bool SystemBus::InstrFetch(Word addr, DecodedInstr* dip, Processor* proc)
+{
+	machine->HandleBusAccess(addr, EXEC, proc);
+
+	if (decodeCache == NULL || INBOUNDS(addr, MMIO_BASE, MMIO_END)) {
+		Word instr;
+		if (busRead(addr, &instr)) {
+			// address invalid: signal exception to processor
+			proc->SignalExc(IBEXCEPTION);
+			return true;
+		}
+		Processor::Decode(dip, instr);
+		dip->paddr = addr;
+		return false;
+	}
+
+	const DecodedInstr* di = PeekInstr(addr);
+	if (di == NULL) {
+		// address invalid: signal exception to processor
+		proc->SignalExc(IBEXCEPTION);
+		return true;
+	}
+
+	*dip = *di;
+	return false;
+}
+
+// This method returns the decoded instructions cache entry for the
+// instruction at address addr, filling it if needed. It returns NULL if
+// addr is not a memory location
+const DecodedInstr* SystemBus::PeekInstr(Word addr)
+{
+	if (decodeCache == NULL || INBOUNDS(addr, MMIO_BASE, MMIO_END))
+		return NULL;
+
+	DecodedInstr* di = decodeCache->Lookup(addr);
+	if (di == NULL) {
+		Word instr;
+		if (busRead(addr, &instr))
+			return NULL;
+		di = decodeCache->Refill(addr);
+		Processor::Decode(di, instr);
+		di->paddr = addr;
+	}
+
+	return di;
+}
+
+bool SystemBus::CodeWritten(Word addr)
+{
+	if (!decodeCache || decodeCache->Lookup(addr) == NULL)
+		return false;
+	decodeCache->Invalidate(addr);
+	return true;
+}
+
 // This method inserts in the eventQ a event that must happen
-// at (current system time) + delay
-uint64_t SystemBus::scheduleEvent(uint64_t delay, Event::Callback callback)
+// at (current system time) + delay; the event handle is returned thru
+// handle pointer, if not NULL
+uint64_t SystemBus::scheduleEvent(uint64_t delay, const EventTag& tag, Event::Handle* handle)
+{
+	std::unique_lock<std::mutex> lock(eventMutex, std::defer_lock);
+	if (parallel)
+		lock.lock();
+	uint64_t deadline = eventQ->InsertQ(tod, delay, eventCallback(tag), tag, handle);
+	nextDeadline = std::min(nextDeadline, deadline);
+	return deadline;
+}
+
+// This method removes a pending event from the eventQ; it returns TRUE
+// if the event was still pending, FALSE otherwise
+bool SystemBus::cancelEvent(Event::Handle handle)
+{
+	std::unique_lock<std::mutex> lock(eventMutex, std::defer_lock);
+	if (parallel)
+		lock.lock();
+	bool cancelled = eventQ->Cancel(handle);
+	updateNextDeadline();
+	return cancelled;
+}
+
+// This method moves a pending event to (current system time) + delay;
+// it returns TRUE if the event was still pending, FALSE otherwise
+bool SystemBus::rescheduleEvent(Event::Handle handle, uint64_t delay)
+{
+	std::unique_lock<std::mutex> lock(eventMutex, std::defer_lock);
+	if (parallel)
+		lock.lock();
+	bool rescheduled = eventQ->Reschedule(handle, tod + delay);
+	updateNextDeadline();
+	return rescheduled;
+}
+
+// This method builds the callback which carries out the event
+// described by tag
+Event::Callback SystemBus::eventCallback(const EventTag& tag)
+{
+	switch (tag.kind) {
+	case EventTag::DEVICE_COMPLETION:
+		return boost::bind(&Device::CompleteDevOp, devTable[tag.args[0]][tag.args[1]]);
+	case EventTag::CPU_RESET:
+		return boost::bind(&Processor::Reset, machine->getProcessor(tag.args[0]),
+		                   tag.args[1], tag.args[2]);
+	case EventTag::CPU_HALT:
+		return boost::bind(&Processor::Halt, machine->getProcessor(tag.args[0]));
+	case EventTag::CPU_TIMER_UNDERFLOW:
+		return boost::bind(&Processor::TimerUnderflow, machine->getProcessor(tag.args[0]));
+	case EventTag::CPU_TIMER_CLEAR:
+		return boost::bind(&Processor::DeassertIRQ, machine->getProcessor(tag.args[0]),
+		                   IL_CPUTIMER);
+	case EventTag::MACHINE_HALT:
+		return boost::bind(&Machine::Halt, machine);
+	case EventTag::IPI_DELIVERY:
+		return boost::bind(&InterruptController::DeliverIPI, pic.get(),
+		                   tag.args[0], tag.args[1]);
+	default:
+		Panic("Unknown event kind in SystemBus::eventCallback()");
+		// never returns
+		return Event::Callback();
+	}
+}
+
+// This method checks a pending event read from a snapshot against the
+// machine configuration before building its callback; processor timer
+// events are handed back to their processor
+Event::Callback SystemBus::restoreEvent(SnapshotReader& reader, const EventTag& tag,
+                                        Event::Handle handle)
+{
+	const Word cpus = config->getNumProcessors();
+
+	switch (tag.kind) {
+	case EventTag::DEVICE_COMPLETION:
+		reader.Check(tag.args[0], DEVINTUSED);
+		reader.Check(tag.args[1], DEVPERINT);
+		if (devTable[tag.args[0]][tag.args[1]]->Type() == NULLDEV)
+			reader.Fail("Snapshot event for a device not installed");
+		break;
+	case EventTag::IPI_DELIVERY:
+		reader.Check(tag.args[0], cpus);
+		break;
+	case EventTag::MACHINE_HALT:
+		break;
+	default:
+		reader.Check(tag.args[0], cpus);
+		break;
+	}
+
+	if (tag.kind == EventTag::CPU_TIMER_UNDERFLOW || tag.kind == EventTag::CPU_TIMER_CLEAR)
+		machine->getProcessor(tag.args[0])->RestoreTimerEvent(handle);
+
+	return eventCallback(tag);
+}
+
+// This method saves the bus state and that of all memory, controllers
+// and devices to a snapshot; ROMs are not saved, since they are loaded
+// from the configuration
+void SystemBus::SaveState(SnapshotWriter& writer) const
+{
+	writer.Section("BUS ");
+	writer.U64(tod);
+	writer.U64(timerUnderflow);
+
+	ram->SaveState(writer);
+	biosdata->SaveState(writer);
+	pic->SaveState(writer);
+	mpController->SaveState(writer);
+	for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+		for (unsigned int devNo = 0; devNo < DEVPERINT; devNo++)
+			devTable[intl][devNo]->SaveState(writer);
+
+	eventQ->SaveState(writer);
+}
+
+// This method restores the state saved by SaveState(). Memory changes
+// bypass the decoded instructions cache, which is flushed
+void SystemBus::RestoreState(SnapshotReader& reader)
 {
-	return eventQ->InsertQ(tod, delay, callback);
+	reader.Section("BUS ");
+	tod = reader.U64();
+	timerUnderflow = reader.U64();
+
+	ram->RestoreState(reader);
+	biosdata->RestoreState(reader);
+	pic->RestoreState(reader);
+	mpController->RestoreState(reader);
+	for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
+		for (unsigned int devNo = 0; devNo < DEVPERINT; devNo++)
+			devTable[intl][devNo]->RestoreState(reader);
+
+	eventQ->RestoreState(reader, [this, &reader](const EventTag& tag, Event::Handle handle) {
+		return restoreEvent(reader, tag, handle);
+	});
+	updateNextDeadline();
+
+	if (decodeCache)
+		decodeCache->Flush();
 }
 
 void SystemBus::IntReq(unsigned int intl, unsigned int devNum)
@@ -388,12 +648,45 @@ Word SystemBus::getPendingInt(const Processor* cpu)
 
 void SystemBus::AssertIRQ(unsigned int il, unsigned int target)
 {
-	machine->getProcessor(target)->AssertIRQ(il);
+	if (parallel && target != threadCpuId) {
+		IRQChange change = { il, target, true };
+		std::lock_guard<std::mutex> lock(irqMutex);
+		deferredIRQs.push_back(change);
+	} else {
+		machine->getProcessor(target)->AssertIRQ(il);
+	}
 }
 
 void SystemBus::DeassertIRQ(unsigned int il, unsigned int target)
 {
-	machine->getProcessor(target)->DeassertIRQ(il);
+	if (parallel && target != threadCpuId) {
+		IRQChange change = { il, target, false };
+		std::lock_guard<std::mutex> lock(irqMutex);
+		deferredIRQs.push_back(change);
+	} else {
+		machine->getProcessor(target)->DeassertIRQ(il);
+	}
+}
+
+// This method turns parallel mode on or off; turning it off applies
+// the interrupt line changes deferred meanwhile, in order
+void SystemBus::setParallel(bool setting)
+{
+	parallel = setting;
+	if (!parallel) {
+		for (const IRQChange& c : deferredIRQs) {
+			if (c.asserted)
+				machine->getProcessor(c.target)->AssertIRQ(c.il);
+			else
+				machine->getProcessor(c.target)->DeassertIRQ(c.il);
+		}
+		deferredIRQs.clear();
+	}
+}
+
+void SystemBus::BindThreadToCpu(Word cpuId)
+{
+	threadCpuId = cpuId;
 }
 
 // This method returns the Device object with given "coordinates"
@@ -415,19 +708,22 @@ Device * SystemBus::getDev(unsigned int intL, unsigned int dNum)
 
 // This method reads the data at the address addr, and passes it back thru
 // the datap pointer. It also return FALSE if the addr is valid, and TRUE
-// otherwise
+// otherwise. RAM and BIOS data are read thru the page map
 bool SystemBus::busRead(Word addr, Word* datap, Processor* cpu)
 {
-	if (INBOUNDS(addr, RAMBASE, RAMBASE + ram->Size()))
-		*datap = ram->MemRead(CONVERT(addr, RAMBASE));
-	else if (INBOUNDS(addr, BIOSDATABASE, BIOSDATABASE + biosdata->Size()))
-		*datap = biosdata->MemRead(CONVERT(addr, BIOSDATABASE));
+	Word* page = hostPage(addr);
+	if (page != NULL)
+		*datap = page[(addr >> WORDSHIFT) & (FRAMESIZE - 1)];
 	else if (INBOUNDS(addr, BIOSBASE, BIOSBASE + bios->Size()))
 		*datap = bios->MemRead(CONVERT(addr,BIOSBASE));
 	else if (INBOUNDS(addr, BOOTBASE, BOOTBASE + boot->Size()))
 		*datap = boot->MemRead(CONVERT(addr, BOOTBASE));
-	else if (INBOUNDS(addr, MMIO_BASE, MMIO_END))
+	else if (INBOUNDS(addr, MMIO_BASE, MMIO_END)) {
+		std::unique_lock<std::mutex> lock(mmioMutex, std::defer_lock);
+		if (parallel)
+			lock.lock();
 		*datap = busRegRead(addr, cpu);
+	}
 	else {
 		// address invalid: data read is out of bounds
 		*datap = MAXWORDVAL;
@@ -474,7 +770,7 @@ Word SystemBus::busRegRead(Word addr, Processor* cpu)
 			data = getToDLO();
 			break;
 		case BUS_REG_TIMER:
-			data = timer;
+			data = getTimer();
 			break;
 		case BUS_REG_RAM_BASE:
 			data = RAMBASE;
@@ -547,14 +843,19 @@ Device* SystemBus::makeDev(unsigned int intl, unsigned int dnum)
 
 // This method writes the data at the physical address addr, and passes it
 // back thru the datap pointer. It also return FALSE if the addr is valid
-// and writable, and TRUE otherwise
+// and writable, and TRUE otherwise. RAM and BIOS data are written thru
+// the page map
 bool SystemBus::busWrite(Word addr, Word data, Processor* cpu)
 {
-	if (INBOUNDS(addr, RAMBASE, RAMBASE + ram->Size())) {
-		ram->MemWrite(CONVERT(addr, RAMBASE), data);
-	} else if (INBOUNDS(addr, BIOSDATABASE, BIOSDATABASE + biosdata->Size())) {
-		biosdata->MemWrite(CONVERT(addr, BIOSDATABASE), data);
+	Word* page = hostPage(addr);
+	if (page != NULL) {
+		page[(addr >> WORDSHIFT) & (FRAMESIZE - 1)] = data;
+		if (decodeCache)
+			decodeCache->Invalidate(addr);
 	} else if (INBOUNDS(addr, MMIO_BASE, MMIO_END)) {
+		std::unique_lock<std::mutex> lock(mmioMutex, std::defer_lock);
+		if (parallel)
+			lock.lock();
 		if (DEV_REG_START <= addr && addr < DEV_REG_END) {
 			DeviceAreaAddress dva(addr);
 			Device* device = devTable[dva.line()][dva.device()];
@@ -569,7 +870,7 @@ bool SystemBus::busWrite(Word addr, Word data, Processor* cpu)
 			// data write is in bus registers area
 			if (addr == BUS_REG_TIMER) {
 				// update the interval timer and reset its interrupt line
-				timer = data;
+				setTimer(data);
 				pic->EndIRQ(IL_TIMER);
 			}
 			// else data write is on a read only bus register, and
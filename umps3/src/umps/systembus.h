@@ -22,6 +22,9 @@
 #ifndef UMPS_SYSTEMBUS_H
 #define UMPS_SYSTEMBUS_H
 
+#include <mutex>
+#include <vector>
+
 #include "base/lang.h"
 #include "base/basic_types.h"
 #include "umps/event.h"
@@ -37,6 +40,10 @@ class BiosSpace;
 class Block;
 class MPController;
 class InterruptController;
+class DecodeCache;
+struct DecodedInstr;
+class SnapshotWriter;
+class SnapshotReader;
 
 class SystemBus {
 public:
@@ -47,13 +54,31 @@ public:
 // timer; on timer underflow (0 -> FFFFFFFF transition) a interrupt
 // is generated.  Event queue is checked against the current clock
 // value and device operations are completed if needed; all memory
-// changes are notified to Watch control object
-	void ClockTick();
+// changes are notified to Watch control object.
+// The interval timer is derived from the clock on demand, so nothing
+// but the clock itself is updated until the next timer underflow or
+// event deadline, unless Watch has to be notified
+	void ClockTick() {
+		if (++tod >= nextDeadline || watchClock)
+			clockEvents();
+	}
+
+// This method tells whether each clock tick must be notified to Watch
+	void setWatchClock(bool setting) {
+		watchClock = setting;
+	}
 
 	uint32_t IdleCycles() const;
 
 	void Skip(uint32_t cycles);
 
+// This method returns how many clock ticks may go by before one reaches
+// the next timer underflow or event deadline: until then, ClockTick()
+// does nothing but advancing the clock, unless Watch has to be notified
+	uint64_t QuietCycles() const {
+		return (nextDeadline > tod + 1) ? nextDeadline - tod - 1 : 0;
+	}
+
 // This method reads a data word from memory at physical address
 // addr, returning it thru datap pointer. It also returns TRUE if
 // the address was invalid and an exception was caused, FALSE
@@ -74,6 +99,33 @@ public:
 // and notifies Watch
 	bool InstrRead(Word addr, Word* instrp, Processor* proc);
 
+// This method reads a istruction from memory at physical address addr
+// like InstrRead() does, but returns its decoded form thru dip
+// pointer. Decoded instructions are cached by physical address, and
+// the cache is kept coherent with all writes to memory
+	bool InstrFetch(Word addr, DecodedInstr* dip, Processor* proc);
+
+// This method returns the decoded instructions cache entry holding the
+// instruction at physical address addr, without notifying Watch. It
+// returns NULL if addr is not a valid memory location (device registers
+// included). The entry may be reused by any later instruction fetch
+	const DecodedInstr* PeekInstr(Word addr);
+
+// These methods give native code (see Translator) direct access to
+// RAM, without notifying Watch: HostWord() returns the host location of
+// the word at physical address addr, or NULL if it is not in RAM, and
+// CodeWritten() must follow each write thru it, as busWrite() does. It
+// returns TRUE if an instruction cached from addr was dropped
+	Word* HostWord(Word addr) const {
+		Word* page = hostPage(addr);
+		return (page != NULL) ? &page[(addr >> WORDSHIFT) & (FRAMESIZE - 1)] : NULL;
+	}
+	bool CodeWritten(Word addr);
+
+	const DecodeCache* getDecodeCache() const {
+		return decodeCache.get();
+	}
+
 // This method transfers a block from or to memory, starting with
 // address startAddr; it returns TRUE is transfer was not successful
 // (non-existent memory, read-only memory, unaligned addresses),
@@ -88,7 +140,14 @@ public:
 // control object
 	bool DMAVarTransfer(Block * blk, Word startAddr, Word byteLength, bool toMemory);
 
-	uint64_t scheduleEvent(uint64_t delay, Event::Callback callback);
+// These methods schedule an event after delay clock ticks, and cancel
+// or reschedule it thru the handle returned by scheduleEvent(). The
+// tag tells what the event does (see EventTag). In parallel mode they
+// may be called by any processor thread, as local timers are
+// reprogrammed, and the queue is locked
+	uint64_t scheduleEvent(uint64_t delay, const EventTag& tag, Event::Handle* handle = NULL);
+	bool cancelEvent(Event::Handle handle);
+	bool rescheduleEvent(Event::Handle handle, uint64_t delay);
 
 // This method sets the appropriate bits into intCauseDev[] and
 // IntPendMask to signal device interrupt pending; it notifies
@@ -106,6 +165,17 @@ public:
 	void AssertIRQ(unsigned int il, unsigned int target);
 	void DeassertIRQ(unsigned int il, unsigned int target);
 
+// Parallel SMP support (see Machine::step()): while parallel mode is on,
+// accesses to the device register area are serialized, and interrupt
+// lines of processors other than the one run by the calling thread only
+// change when parallel mode is turned off. The changes are queued under
+// a lock of their own, as any thread may ask for them
+	void setParallel(bool setting);
+
+// This method tells SystemBus which processor the calling host thread
+// runs in parallel mode
+	static void BindThreadToCpu(Word cpuId);
+
 	Machine* getMachine() {
 		return machine;
 	}
@@ -122,8 +192,11 @@ public:
 	Word getToDHI() const {
 		return TimeStamp::getHi(tod);
 	}
+	uint64_t getToD() const {
+		return tod;
+	}
 	Word getTimer() const {
-		return timer;
+		return (Word) (timerUnderflow - tod - 1);
 	}
 
 	void setToDHI(Word hi);
@@ -137,6 +210,19 @@ public:
 	bool WatchRead(Word addr, Word * datap);
 	bool WatchWrite(Word addr, Word data);
 
+// This method reads the word at physical address addr from RAM or ROM
+// with no side effects, and without locking, so that it is safe to
+// call from anywhere in the emulation loop. It returns TRUE if addr is
+// not in RAM or ROM, and FALSE otherwise
+	bool PeekMemory(Word addr, Word* datap) const;
+
+// These methods save to a snapshot and restore the state of the bus
+// and of everything attached to it: clock and timer, memory,
+// controllers, devices and pending events. Processors must be restored
+// before the bus, since pending events refer to them
+	void SaveState(SnapshotWriter& writer) const;
+	void RestoreState(SnapshotReader& reader);
+
 private:
 	const MachineConfig* const config;
 
@@ -146,19 +232,56 @@ private:
 
 	scoped_ptr<MPController> mpController;
 
-// system clock & interval timer
+// decoded instructions cache
+	scoped_ptr<DecodeCache> decodeCache;
+
+// system clock, and clock value at which the interval timer next
+// underflows (the timer itself is computed from the two)
 	uint64_t tod;
-	Word timer;
+	uint64_t timerUnderflow;
+
+// earliest of the next timer underflow and the next event deadline,
+// and whether clock ticks are notified to Watch
+	uint64_t nextDeadline;
+	bool watchClock;
 
 // device events queue
 	EventQueue * eventQ;
 
+// parallel mode state: device register area lock, event queue and
+// deadline lock (taken after the former when both are needed), and
+// interrupt line changes to be applied when parallel mode ends, with
+// their lock
+	struct IRQChange {
+		unsigned int il;
+		unsigned int target;
+		bool asserted;
+	};
+	bool parallel;
+	std::mutex mmioMutex;
+	std::mutex eventMutex;
+	std::mutex irqMutex;
+	std::vector<IRQChange> deferredIRQs;
+
 // physical memory spaces
 	RamSpace * ram;
 	RamSpace * biosdata;
 	BiosSpace * bios;
 	BiosSpace * boot;
 
+// host memory backing each physical page frame of RAM and of the BIOS
+// data page, indexed by frame number up to the end of RAM: ROM, device
+// registers and unmapped frames are NULL and take the slow path
+	scoped_array<Word*> pageMap;
+	Word pageMapSize;
+
+// This method returns the host memory backing the page frame which
+// contains physical address addr, or NULL if there is none
+	Word* hostPage(Word addr) const {
+		Word frame = addr >> FRAMESHIFT;
+		return (frame < pageMapSize) ? pageMap[frame] : NULL;
+	}
+
 // device handling & interrupt generation tables
 	Device* devTable[DEVINTUSED][DEVPERINT];
 	Word instDevTable[DEVINTUSED];
@@ -181,6 +304,19 @@ private:
 // the addr is valid and writable, and TRUE otherwise
 	bool busWrite(Word addr, Word data, Processor* cpu = 0);
 
+// This method handles a clock tick which reaches nextDeadline or must
+// be notified to Watch
+	void clockEvents();
+
+// This method recomputes nextDeadline
+	void updateNextDeadline();
+
+// These methods build the callback of an event from its tag; when
+// restoring a snapshot, the tag is checked first
+	Event::Callback eventCallback(const EventTag& tag);
+	Event::Callback restoreEvent(SnapshotReader& reader, const EventTag& tag,
+	                             Event::Handle handle);
+
 // This method accesses the system configuration and constructs
 // the devices needed, linking them to SystemBus object
 	Device * makeDev(unsigned int intl, unsigned int dnum);
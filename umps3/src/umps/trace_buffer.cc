@@ -0,0 +1,242 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the TraceBuffer class, which logs the writes
+ * to a traced range, and the TraceWriter class, which streams trace
+ * buffers to a file.
+ *
+ ****************************************************************************/
+
+#include "umps/trace_buffer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+#include "umps/const.h"
+#include "umps/error.h"
+
+HIDDEN const char kMagic[8] = { 'u', 'M', 'P', 'S', '3', 'T', 'R', 'C' };
+
+// bytes taken by a record in a trace file
+HIDDEN const size_t kRecordSize = 29;
+
+// records copied out of a buffer at a time
+HIDDEN const size_t kChunkRecords = 4096;
+
+TraceBuffer::TraceBuffer(unsigned int tracepointId, Word start, Word end, size_t capacity)
+	: tracepointId(tracepointId),
+	start(start),
+	end(end),
+	head(0),
+	values(((end - start) >> 2) + 1, 0)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	mask = size - 1;
+	slots.reset(new Slot[size]);
+}
+
+void TraceBuffer::Record(uint64_t tod, unsigned int cpu, Word pc, Word addr, Word value)
+{
+	Word& last = values[(addr - start) >> 2];
+	const uint64_t serial = head.load(std::memory_order_relaxed);
+	Slot& slot = slots[serial & mask];
+
+	// A reader which sees any of the stores below must also see head
+	// at serial, and so know that the slot is being reused
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.w[0].store(tod, std::memory_order_relaxed);
+	slot.w[1].store(((uint64_t) pc << 32) | addr, std::memory_order_relaxed);
+	slot.w[2].store(((uint64_t) last << 32) | value, std::memory_order_relaxed);
+	slot.w[3].store(cpu, std::memory_order_relaxed);
+	head.store(serial + 1, std::memory_order_release);
+
+	last = value;
+}
+
+uint64_t TraceBuffer::Read(uint64_t first, size_t maxCount, std::vector<TraceRecord>* records) const
+{
+	const uint64_t capacity = mask + 1;
+
+	records->clear();
+	const uint64_t last = head.load(std::memory_order_acquire);
+	if (last > capacity)
+		first = std::max(first, last - capacity);
+	if (first >= last)
+		return first;
+
+	const size_t count = (size_t) std::min<uint64_t>(maxCount, last - first);
+	records->resize(count);
+	for (size_t i = 0; i < count; i++) {
+		const Slot& slot = slots[(first + i) & mask];
+		TraceRecord& r = (*records)[i];
+		r.tod = slot.w[0].load(std::memory_order_relaxed);
+		const uint64_t w1 = slot.w[1].load(std::memory_order_relaxed);
+		const uint64_t w2 = slot.w[2].load(std::memory_order_relaxed);
+		r.cpu = (unsigned int) slot.w[3].load(std::memory_order_relaxed);
+		r.pc = w1 >> 32;
+		r.addr = (Word) w1;
+		r.oldValue = w2 >> 32;
+		r.newValue = (Word) w2;
+	}
+
+	// Meanwhile the producer may have come round again: with head at
+	// now, it may be overwriting the record now - capacity, and has
+	// overwritten all those before it
+	std::atomic_thread_fence(std::memory_order_acquire);
+	const uint64_t now = head.load(std::memory_order_relaxed);
+	if (now + 1 > first + capacity) {
+		const size_t stale = (size_t) std::min<uint64_t>(count, now + 1 - capacity - first);
+		records->erase(records->begin(), records->begin() + stale);
+		first += stale;
+	}
+	return first;
+}
+
+HIDDEN uint8_t* putU32(uint8_t* p, uint32_t value)
+{
+	for (unsigned int i = 0; i < 4; i++)
+		*p++ = value >> (8 * i);
+	return p;
+}
+
+TraceWriter::TraceWriter(const std::string& fileName)
+	: fileName(fileName),
+	failed(false),
+	records(0),
+	lost(0),
+	stopping(false)
+{
+	if ((file = fopen(fileName.c_str(), "wb")) == NULL)
+		throw FileError(fileName);
+
+	uint8_t version[4];
+	putU32(version, kVersion);
+	put(kMagic, sizeof(kMagic));
+	put(version, sizeof(version));
+}
+
+TraceWriter::~TraceWriter()
+{
+	stop();
+	if (file != NULL)
+		fclose(file);
+}
+
+void TraceWriter::Add(const TraceBuffer::Ptr& buffer)
+{
+	assert(!thread.joinable());
+
+	Source s;
+	s.buffer = buffer;
+	const uint64_t head = buffer->getHead();
+	s.next = (head > buffer->getCapacity()) ? head - buffer->getCapacity() : 0;
+	sources.push_back(s);
+}
+
+// This method only writes the records which were logged when it was
+// called, so that a busy producer cannot keep it going forever
+void TraceWriter::Drain()
+{
+	std::vector<uint8_t> bytes;
+	for (Source& s : sources) {
+		const uint64_t end = s.buffer->getHead();
+		while (s.next < end) {
+			const size_t count = (size_t) std::min<uint64_t>(kChunkRecords, end - s.next);
+			const uint64_t first = s.buffer->Read(s.next, count, &chunk);
+			lost += first - s.next;
+			s.next = first + chunk.size();
+			if (chunk.empty())
+				break;
+
+			bytes.resize(chunk.size() * kRecordSize);
+			uint8_t* p = &bytes[0];
+			for (const TraceRecord& r : chunk) {
+				p = putU32(p, s.buffer->getTracepointId());
+				p = putU32(p, (uint32_t) r.tod);
+				p = putU32(p, (uint32_t) (r.tod >> 32));
+				*p++ = r.cpu;
+				p = putU32(p, r.pc);
+				p = putU32(p, r.addr);
+				p = putU32(p, r.oldValue);
+				p = putU32(p, r.newValue);
+			}
+			put(&bytes[0], bytes.size());
+			records += chunk.size();
+		}
+	}
+}
+
+void TraceWriter::Start(unsigned int interval)
+{
+	assert(!thread.joinable());
+	stopping = false;
+	thread = std::thread(&TraceWriter::run, this, interval);
+}
+
+void TraceWriter::Close()
+{
+	stop();
+
+	if (file == NULL)
+		return;
+	Drain();
+	const bool error = failed || ferror(file);
+	const bool closeError = fclose(file) != 0;
+	file = NULL;
+	if (error || closeError)
+		throw FileError(fileName);
+}
+
+void TraceWriter::stop()
+{
+	if (thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeUp.notify_one();
+		thread.join();
+	}
+}
+
+void TraceWriter::run(unsigned int interval)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	uint64_t drained = 0;
+	while (!stopping) {
+		// No pause while the buffers fill up faster than that
+		if (drained < kChunkRecords)
+			wakeUp.wait_for(lock, std::chrono::milliseconds(interval));
+		if (!stopping) {
+			const uint64_t before = records + lost;
+			Drain();
+			drained = records + lost - before;
+		}
+	}
+}
+
+void TraceWriter::put(const void* data, size_t size)
+{
+	if (!failed && fwrite(data, 1, size, file) != size)
+		failed = true;
+}
@@ -0,0 +1,179 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_TRACE_BUFFER_H
+#define UMPS_TRACE_BUFFER_H
+
+#include <stdio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/lang.h"
+#include "umps/types.h"
+
+// A write to a traced word: the time of day it happened at, the
+// processor (kNoCpu for devices and the clock) and the address of the
+// instruction which did it, and the value of the word before and after
+struct TraceRecord {
+	static const unsigned int kNoCpu = 0xFF;
+
+	uint64_t tod;
+	unsigned int cpu;
+	Word pc;
+	Word addr;
+	Word oldValue;
+	Word newValue;
+};
+
+// A TraceBuffer logs the writes to the physical address range of a
+// tracepoint, in a ring which holds the latest getCapacity() records:
+// older ones are overwritten. Each record gets a serial number, from
+// zero up, so that readers can tell which ones they have missed.
+//
+// The ring is lock-free: a single producer (the thread running the
+// machine) appends, and any number of readers copy records out
+// concurrently, never holding the producer back. A reader checks after
+// copying that the records it got were not overwritten meanwhile, and
+// drops those which may have been.
+//
+// Since a write is only notified once it is done, the buffer also keeps
+// the last known value of each word of the range, which the producer
+// must initialize, and which becomes the old value of the next record.
+
+class TraceBuffer {
+public:
+	typedef shared_ptr<TraceBuffer> Ptr;
+
+	static const size_t kDefaultCapacity = 1 << 16;
+
+// capacity is rounded up to a power of two
+	TraceBuffer(unsigned int tracepointId, Word start, Word end,
+	            size_t capacity = kDefaultCapacity);
+
+	unsigned int getTracepointId() const { return tracepointId; }
+	Word getStart() const { return start; }
+	Word getEnd() const { return end; }
+	size_t getCapacity() const { return mask + 1; }
+
+// These methods are for the producer only. Record() logs a write of
+// value to the word at addr, which must be in the range
+	void setValue(Word addr, Word value) {
+		values[(addr - start) >> 2] = value;
+	}
+	void Record(uint64_t tod, unsigned int cpu, Word pc, Word addr, Word value);
+
+// This method returns the serial number the next record will get, that
+// is the number of records logged so far
+	uint64_t getHead() const {
+		return head.load(std::memory_order_acquire);
+	}
+
+// This method copies to records up to maxCount records, from serial
+// number first on, or from the oldest one still held if first was
+// overwritten; it returns the serial number of the first record copied
+	uint64_t Read(uint64_t first, size_t maxCount, std::vector<TraceRecord>* records) const;
+
+private:
+// A record, packed in four words which can be accessed atomically
+	struct Slot {
+		std::atomic<uint64_t> w[4];
+	};
+
+	const unsigned int tracepointId;
+	const Word start;
+	const Word end;
+
+	uint64_t mask;
+	scoped_array<Slot> slots;
+	std::atomic<uint64_t> head;
+
+	std::vector<Word> values;
+
+	DISABLE_COPY_AND_ASSIGNMENT(TraceBuffer);
+};
+
+// A TraceWriter streams the records of trace buffers to a binary file.
+// The file starts with an eight byte magic string and a format version
+// (a 32 bit word); then come the records, 29 bytes each: tracepoint ID
+// (32 bits), time of day (64 bits), processor (8 bits), PC, address,
+// old and new value (32 bits each). All values are little-endian.
+//
+// Records of each tracepoint are in order, but those of different
+// tracepoints may not be in time order. Records overwritten before the
+// writer got to them are lost, and counted.
+
+class TraceWriter {
+public:
+	static const Word kVersion = 1;
+
+// This method creates the file and writes its header; it throws
+// FileError if the file cannot be created
+	explicit TraceWriter(const std::string& fileName);
+	~TraceWriter();
+
+// This method adds a buffer to those written, from its oldest record
+// on; it must not be called while the writer is running
+	void Add(const TraceBuffer::Ptr& buffer);
+
+// This method writes out the records logged since the last call
+	void Drain();
+
+// This method starts a thread which drains the buffers every interval
+// milliseconds, until Close()
+	void Start(unsigned int interval);
+
+// This method stops the thread, if any, drains the buffers one last
+// time and closes the file; it throws FileError if any write failed
+	void Close();
+
+	uint64_t getRecords() const { return records; }
+	uint64_t getLost() const { return lost; }
+
+private:
+	struct Source {
+		TraceBuffer::Ptr buffer;
+		uint64_t next;
+	};
+
+	void stop();
+	void run(unsigned int interval);
+	void put(const void* data, size_t size);
+
+	const std::string fileName;
+	FILE* file;
+	bool failed;
+
+	std::vector<Source> sources;
+	std::vector<TraceRecord> chunk;
+	uint64_t records;
+	uint64_t lost;
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	bool stopping;
+
+	DISABLE_COPY_AND_ASSIGNMENT(TraceWriter);
+};
+
+#endif // UMPS_TRACE_BUFFER_H
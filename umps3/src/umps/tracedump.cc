@@ -0,0 +1,135 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/****************************************************************************
+ *
+ * This is a stand-alone program which prints the instructions recorded
+ * in an instruction trace file (see umps/instr_trace.h) on the standard
+ * output, one per line, disassembled, with the register each one wrote
+ * and the memory address it accessed.
+ *
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <limits>
+
+#include <umps/const.h>
+#include "umps/types.h"
+#include "umps/error.h"
+#include "umps/disassemble.h"
+#include "umps/instr_trace.h"
+
+HIDDEN void showHelp(const char* prgName);
+HIDDEN bool parseNumber(const char* arg, uint64_t* value);
+HIDDEN void printEntry(const InstrTraceEntry& e, unsigned int cpu, uint64_t serial);
+
+// This function scans the line arguments and dumps the trace file, or
+// prints a help message.
+// Returns an EXIT_SUCCESS/FAILURE code
+int main(int argc, char* argv[])
+{
+	// by default, all instructions of all processors
+	bool allCpus = true;
+	uint64_t cpuId = 0;
+	uint64_t first = 0;
+	uint64_t count = std::numeric_limits<uint64_t>::max();
+	int i;
+
+	if (argc == 1) {
+		showHelp(argv[0]);
+		return EXIT_SUCCESS;
+	}
+
+	for (i = 1; i < argc - 1; i += 2) {
+		bool valid = false;
+		if (SAMESTRING("-c", argv[i])) {
+			allCpus = false;
+			valid = parseNumber(argv[i + 1], &cpuId);
+		} else if (SAMESTRING("-s", argv[i])) {
+			valid = parseNumber(argv[i + 1], &first);
+		} else if (SAMESTRING("-n", argv[i])) {
+			valid = parseNumber(argv[i + 1], &count);
+		}
+		if (!valid || i + 1 == argc - 1) {
+			fprintf(stderr, "%s : Unknown argument(s)\n", argv[0]);
+			showHelp(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (i != argc - 1) {
+		showHelp(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	try {
+		InstrTraceReader reader(argv[argc - 1]);
+		InstrTraceEntry e;
+		unsigned int cpu;
+		uint64_t serial;
+
+		while (count > 0 && reader.Next(&e, &cpu, &serial)) {
+			if ((!allCpus && cpu != cpuId) || serial < first)
+				continue;
+			printEntry(e, cpu, serial);
+			count--;
+		}
+	} catch (Error& e) {
+		fprintf(stderr, "%s : %s: %s\n", argv[0], argv[argc - 1], e.what());
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// This function prints a help message on standard error
+HIDDEN void showHelp(const char* prgName)
+{
+	fprintf(stderr, "%s syntax : %s [-c cpu] [-s serial] [-n count] <tracefile>\n\n", prgName, prgName);
+	fprintf(stderr, "where:\n\t-c cpu\t\tonly shows the instructions of processor cpu\n");
+	fprintf(stderr, "\t-s serial\tskips the instructions before number serial\n");
+	fprintf(stderr, "\t-n count\tshows at most count instructions\n\n");
+}
+
+// This function converts a decimal or hexadecimal (0x prefixed) number.
+// Returns TRUE if arg is a valid number, FALSE otherwise
+HIDDEN bool parseNumber(const char* arg, uint64_t* value)
+{
+	char* end;
+
+	*value = strtoull(arg, &end, 0);
+	return *arg != '\0' && *end == '\0';
+}
+
+// This function prints a trace entry: processor, serial number, ASID,
+// PC, instruction word and its disassembly, then the register written,
+// the memory address accessed and the exception, when there are any
+HIDDEN void printEntry(const InstrTraceEntry& e, unsigned int cpu, uint64_t serial)
+{
+	printf("%u %10" PRIu64 " %02x 0x%.8X: 0x%.8X  %-32s", cpu, serial, e.asid, e.pc, e.instr, StrInstr(e.instr));
+	if (e.destReg != 0)
+		printf(" %s=0x%.8X", RegName(e.destReg), e.destValue);
+	if (e.flags & InstrTraceEntry::ITE_MEMORY)
+		printf(" [0x%.8X]", e.memAddr);
+	if (e.flags & InstrTraceEntry::ITE_EXCEPTION)
+		printf(" exception");
+	putchar('\n');
+}
@@ -0,0 +1,864 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the Translator class, which turns the hot
+ * blocks of the threaded execution engine into x86-64 code.
+ *
+ * Native code follows the SysV calling convention: it gets the register
+ * file in rdi and the frame in rsi, which it keeps in rbx and r12, and
+ * returns the virtual address of the next instruction in eax. The value
+ * of a delayed load waits in r13 until the next instruction completes
+ * it; eax, ecx and edx are scratch registers, and a branch leaves the
+ * address of the instruction after its delay slot in r8d, and its
+ * target in r9d, until the delay slot is done.
+ *
+ ****************************************************************************/
+
+#include "umps/translator.h"
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include <sys/mman.h>
+
+#include "umps/const.h"
+#include "umps/decode_cache.h"
+#include "umps/processor.h"
+#include "umps/processor_defs.h"
+
+// Instructions native code is made of (see Translator::classify())
+enum NativeOp {
+	OP_NONE,
+
+	// ALU instructions
+	OP_NOP,
+	OP_ADDU,
+	OP_SUBU,
+	OP_AND,
+	OP_OR,
+	OP_XOR,
+	OP_NOR,
+	OP_SLT,
+	OP_SLTU,
+	OP_SLL,
+	OP_SRL,
+	OP_SRA,
+	OP_SLLV,
+	OP_SRLV,
+	OP_SRAV,
+	OP_MFHI,
+	OP_MFLO,
+	OP_ADDIU,
+	OP_ANDI,
+	OP_ORI,
+	OP_XORI,
+	OP_SLTI,
+	OP_SLTIU,
+	OP_LUI,
+
+	// data accesses
+	OP_LW,
+	OP_SW,
+
+	// branches and jumps
+	OP_BEQ,
+	OP_BNE,
+	OP_BLEZ,
+	OP_BGTZ,
+	OP_BLTZ,
+	OP_BGEZ,
+	OP_BLTZAL,
+	OP_BGEZAL,
+	OP_J,
+	OP_JAL,
+	OP_JR,
+	OP_JALR
+};
+
+HIDDEN bool isAlu(unsigned int op)
+{
+	return OP_NOP <= op && op <= OP_LUI;
+}
+
+HIDDEN bool isBranch(unsigned int op)
+{
+	return OP_BEQ <= op && op <= OP_JALR;
+}
+
+// multiplier registers, which follow the GPRs in the register file
+HIDDEN const unsigned int kRegHI = CPUREGNUM - 2;
+HIDDEN const unsigned int kRegLO = CPUREGNUM - 1;
+
+// x86-64 registers, and condition codes
+enum HostReg {
+	EAX = 0,
+	ECX = 1,
+	EDX = 2,
+	EBX = 3,
+	ESI = 6,
+	R8 = 8,
+	R9 = 9,
+	R13 = 13
+};
+
+enum HostCond {
+	CC_B = 0x2,
+	CC_E = 0x4,
+	CC_NE = 0x5,
+	CC_A = 0x7,
+	CC_S = 0x8,
+	CC_NS = 0x9,
+	CC_L = 0xC,
+	CC_GE = 0xD,
+	CC_LE = 0xE,
+	CC_G = 0xF
+};
+
+// This class writes x86-64 instructions to a code buffer; the caller
+// makes sure there is enough room
+class CodeEmitter {
+public:
+	explicit CodeEmitter(unsigned char* start)
+		: p(start)
+	{}
+
+	unsigned char* Pos() const { return p; }
+
+	void Byte(unsigned int b) { *p++ = (unsigned char) b; }
+
+	void Word32(uint32_t w) {
+		std::memcpy(p, &w, sizeof(w));
+		p += sizeof(w);
+	}
+
+	void Word64(uint64_t w) {
+		std::memcpy(p, &w, sizeof(w));
+		p += sizeof(w);
+	}
+
+	// push rbx; push r12; push r13; mov rbx, rdi; mov r12, rsi
+	void Prologue() {
+		Byte(0x53);
+		Byte(0x41); Byte(0x54);
+		Byte(0x41); Byte(0x55);
+		Byte(0x48); Byte(0x89); Byte(0xFB);
+		Byte(0x49); Byte(0x89); Byte(0xF4);
+	}
+
+	// pop r13; pop r12; pop rbx; ret
+	void Epilogue() {
+		Byte(0x41); Byte(0x5D);
+		Byte(0x41); Byte(0x5C);
+		Byte(0x5B);
+		Byte(0xC3);
+	}
+
+	// mov reg, [rbx + 4 * r]
+	void LoadGPR(unsigned int reg, unsigned int r) {
+		gprOp(0x8B, reg, r);
+	}
+
+	// mov [rbx + 4 * r], reg
+	void StoreGPR(unsigned int r, unsigned int reg) {
+		gprOp(0x89, reg, r);
+	}
+
+	// mov dword [rbx + 4 * r], imm
+	void StoreGPRImm(unsigned int r, Word imm) {
+		gprOp(0xC7, 0, r);
+		Word32(imm);
+	}
+
+	// mov reg, imm
+	void MovImm(unsigned int reg, Word imm) {
+		if (reg >= 8)
+			Byte(0x41);
+		Byte(0xB8 + (reg & 7));
+		Word32(imm);
+	}
+
+	// op eax, ecx
+	void AluRR(unsigned int opcode) {
+		Byte(opcode);
+		Byte(0xC8);
+	}
+
+	// op eax, imm
+	void AluImm(unsigned int opcode, Word imm) {
+		Byte(opcode);
+		Word32(imm);
+	}
+
+	// not eax
+	void Not() {
+		Byte(0xF7); Byte(0xD0);
+	}
+
+	// shl/shr/sar eax, sa
+	void ShiftImm(unsigned int ext, unsigned int sa) {
+		Byte(0xC1); Byte(0xC0 | ext << 3);
+		Byte(sa);
+	}
+
+	// shl/shr/sar eax, cl
+	void ShiftCL(unsigned int ext) {
+		Byte(0xD3); Byte(0xC0 | ext << 3);
+	}
+
+	// xor edx, edx
+	void ClearEDX() {
+		Byte(0x31); Byte(0xD2);
+	}
+
+	// cmp eax, ecx
+	void CmpRR() {
+		Byte(0x39); Byte(0xC8);
+	}
+
+	// cmp eax, imm
+	void CmpImm(Word imm) {
+		Byte(0x3D);
+		Word32(imm);
+	}
+
+	// test eax, eax
+	void Test() {
+		Byte(0x85); Byte(0xC0);
+	}
+
+	// setcc dl
+	void SetCC(unsigned int cc) {
+		Byte(0x0F); Byte(0x90 + cc); Byte(0xC2);
+	}
+
+	// cmovcc r8d, r9d
+	void Cmov(unsigned int cc) {
+		Byte(0x45); Byte(0x0F); Byte(0x40 + cc); Byte(0xC1);
+	}
+
+	// cmp r8d, imm
+	void CmpR8(Word imm) {
+		Byte(0x41); Byte(0x81); Byte(0xF8);
+		Word32(imm);
+	}
+
+	// mov eax, r8d
+	void MovEAXR8() {
+		Byte(0x44); Byte(0x89); Byte(0xC0);
+	}
+
+	// mov r13d, eax
+	void MovR13EAX() {
+		Byte(0x41); Byte(0x89); Byte(0xC5);
+	}
+
+	// add esi, imm
+	void AddESI(Word imm) {
+		Byte(0x81); Byte(0xC6);
+		Word32(imm);
+	}
+
+	// mov rdi, r12; mov rax, fn; call rax
+	void Call(const void* fn) {
+		Byte(0x4C); Byte(0x89); Byte(0xE7);
+		Byte(0x48); Byte(0xB8);
+		Word64((uint64_t) fn);
+		Byte(0xFF); Byte(0xD0);
+	}
+
+	// mov rcx, rax; shr rcx, 32
+	void HighHalf() {
+		Byte(0x48); Byte(0x89); Byte(0xC1);
+		Byte(0x48); Byte(0xC1); Byte(0xE9); Byte(32);
+	}
+
+	// cmp eax, imm8
+	void CmpEAX8(unsigned int imm) {
+		Byte(0x83); Byte(0xF8); Byte(imm);
+	}
+
+	// op dword [r12 + offset], imm, where op is sub, add or cmp
+	void SubBudget(unsigned int n) {
+		frameOp(0x81, 5, offsetof(NativeFrame, budget));
+		Word32(n);
+	}
+	void AddBudget(unsigned int n) {
+		frameOp(0x81, 0, offsetof(NativeFrame, budget));
+		Word32(n);
+	}
+	void CmpBudget(unsigned int n) {
+		frameOp(0x81, 7, offsetof(NativeFrame, budget));
+		Word32(n);
+	}
+
+	// mov dword [r12 + offset], imm for the last instruction fields
+	void SetLast(Word pc, Word instr) {
+		frameOp(0xC7, 0, offsetof(NativeFrame, lastPC));
+		Word32(pc);
+		frameOp(0xC7, 0, offsetof(NativeFrame, lastInstr));
+		Word32(instr);
+	}
+
+	// These methods emit jumps with a 32-bit displacement, and return
+	// where it is, to be bound to the target with Bind()
+	unsigned char* Jcc(unsigned int cc) {
+		Byte(0x0F); Byte(0x80 + cc);
+		return rel32();
+	}
+	unsigned char* Jmp() {
+		Byte(0xE9);
+		return rel32();
+	}
+
+	static void Bind(unsigned char* rel, const unsigned char* target) {
+		int32_t disp = (int32_t) (target - (rel + 4));
+		std::memcpy(rel, &disp, sizeof(disp));
+	}
+
+private:
+	void gprOp(unsigned int opcode, unsigned int reg, unsigned int r) {
+		const unsigned int disp = r * WORDLEN;
+		if (reg >= 8)
+			Byte(0x44);
+		Byte(opcode);
+		if (disp < 0x80) {
+			Byte(0x40 | (reg & 7) << 3 | EBX);
+			Byte(disp);
+		} else {
+			Byte(0x80 | (reg & 7) << 3 | EBX);
+			Word32(disp);
+		}
+	}
+
+	void frameOp(unsigned int opcode, unsigned int ext, size_t offset) {
+		assert(offset < 0x80);
+		Byte(0x41); Byte(opcode); Byte(0x44 | ext << 3); Byte(0x24);
+		Byte(offset);
+	}
+
+	unsigned char* rel32() {
+		unsigned char* rel = p;
+		Word32(0);
+		return rel;
+	}
+
+	unsigned char* p;
+};
+
+// A way out of a block before its end: where the jump to it is, the
+// next instruction, the number of instructions of the block which were
+// not completed, and the last one which was, if any
+struct NativeExit {
+	unsigned char* jump;
+	Word next;
+	unsigned int refund;
+	bool hasLast;
+	Word lastPC;
+	Word lastInstr;
+};
+
+// This function completes the delayed load waiting in r13, if any
+HIDDEN void completeLoad(CodeEmitter& as, unsigned int* pending)
+{
+	if (*pending != 0) {
+		as.StoreGPR(*pending, R13);
+		*pending = 0;
+	}
+}
+
+// This function emits the ALU instruction di: as Processor::retireResult()
+// does, the result is computed first, then the delayed load is
+// completed, then the result is written
+HIDDEN void emitAlu(CodeEmitter& as, unsigned int op, const DecodedInstr* di, unsigned int* pending)
+{
+	unsigned int dest = di->rd;
+	unsigned int res = EAX;
+
+	switch (op) {
+	case OP_NOP:
+		completeLoad(as, pending);
+		return;
+
+	case OP_ADDU:
+	case OP_SUBU:
+	case OP_AND:
+	case OP_OR:
+	case OP_XOR:
+	case OP_NOR:
+		as.LoadGPR(EAX, di->rs);
+		as.LoadGPR(ECX, di->rt);
+		switch (op) {
+		case OP_ADDU:
+			as.AluRR(0x01);
+			break;
+		case OP_SUBU:
+			as.AluRR(0x29);
+			break;
+		case OP_AND:
+			as.AluRR(0x21);
+			break;
+		case OP_XOR:
+			as.AluRR(0x31);
+			break;
+		default:
+			as.AluRR(0x09);
+			if (op == OP_NOR)
+				as.Not();
+			break;
+		}
+		break;
+
+	case OP_SLT:
+	case OP_SLTU:
+		as.ClearEDX();
+		as.LoadGPR(EAX, di->rs);
+		as.LoadGPR(ECX, di->rt);
+		as.CmpRR();
+		as.SetCC(op == OP_SLT ? CC_L : CC_B);
+		res = EDX;
+		break;
+
+	case OP_SLL:
+	case OP_SRL:
+	case OP_SRA:
+		as.LoadGPR(EAX, di->rt);
+		as.ShiftImm(op == OP_SLL ? 4 : (op == OP_SRL ? 5 : 7), di->shamt);
+		break;
+
+	case OP_SLLV:
+	case OP_SRLV:
+	case OP_SRAV:
+		// x86 shifts take the low 5 bits of the amount, as REGSHAMT()
+		as.LoadGPR(EAX, di->rt);
+		as.LoadGPR(ECX, di->rs);
+		as.ShiftCL(op == OP_SLLV ? 4 : (op == OP_SRLV ? 5 : 7));
+		break;
+
+	case OP_MFHI:
+	case OP_MFLO:
+		as.LoadGPR(EAX, op == OP_MFHI ? kRegHI : kRegLO);
+		break;
+
+	case OP_ADDIU:
+	case OP_ANDI:
+	case OP_ORI:
+	case OP_XORI:
+		dest = di->rt;
+		as.LoadGPR(EAX, di->rs);
+		switch (op) {
+		case OP_ADDIU:
+			as.AluImm(0x05, di->imm);
+			break;
+		case OP_ANDI:
+			as.AluImm(0x25, di->imm);
+			break;
+		case OP_ORI:
+			as.AluImm(0x0D, di->imm);
+			break;
+		default:
+			as.AluImm(0x35, di->imm);
+			break;
+		}
+		break;
+
+	case OP_SLTI:
+	case OP_SLTIU:
+		dest = di->rt;
+		as.ClearEDX();
+		as.LoadGPR(EAX, di->rs);
+		as.CmpImm(di->imm);
+		as.SetCC(op == OP_SLTI ? CC_L : CC_B);
+		res = EDX;
+		break;
+
+	case OP_LUI:
+		completeLoad(as, pending);
+		as.StoreGPRImm(di->rt, di->imm);
+		return;
+
+	default:
+		assert(false);
+		return;
+	}
+
+	completeLoad(as, pending);
+	as.StoreGPR(dest, res);
+}
+
+// This function emits the branch di at virtual address pc, leaving its
+// outcome in r8d; the order in which the link register, the delayed
+// load and the test are done follows the Processor handlers
+HIDDEN void emitBranch(CodeEmitter& as, unsigned int op, const DecodedInstr* di, Word pc,
+                       unsigned int* pending)
+{
+	const Word link = pc + 2 * WORDLEN;
+	const Word target = pc + WORDLEN + ((Word) di->imm << WORDSHIFT);
+
+	switch (op) {
+	case OP_BEQ:
+	case OP_BNE:
+		as.MovImm(R8, link);
+		as.MovImm(R9, target);
+		as.LoadGPR(EAX, di->rs);
+		as.LoadGPR(ECX, di->rt);
+		as.CmpRR();
+		as.Cmov(op == OP_BEQ ? CC_E : CC_NE);
+		break;
+
+	case OP_BLTZAL:
+	case OP_BGEZAL:
+		as.StoreGPRImm(LINKREG, link);
+		// fall thru
+	case OP_BLEZ:
+	case OP_BGTZ:
+	case OP_BLTZ:
+	case OP_BGEZ:
+		as.MovImm(R8, link);
+		as.MovImm(R9, target);
+		as.LoadGPR(EAX, di->rs);
+		as.Test();
+		switch (op) {
+		case OP_BLEZ:
+			as.Cmov(CC_LE);
+			break;
+		case OP_BGTZ:
+			as.Cmov(CC_G);
+			break;
+		case OP_BLTZ:
+		case OP_BLTZAL:
+			as.Cmov(CC_S);
+			break;
+		default:
+			as.Cmov(CC_NS);
+			break;
+		}
+		break;
+
+	case OP_JAL:
+		as.StoreGPRImm(LINKREG, link);
+		// fall thru
+	case OP_J:
+		as.MovImm(R8, JUMPTO((pc + WORDLEN), di->instr));
+		break;
+
+	case OP_JR:
+		as.LoadGPR(R8, di->rs);
+		break;
+
+	case OP_JALR:
+		as.LoadGPR(R8, di->rs);
+		completeLoad(as, pending);
+		if (di->rd)
+			as.StoreGPRImm(di->rd, link);
+		return;
+
+	default:
+		assert(false);
+		return;
+	}
+
+	completeLoad(as, pending);
+}
+
+bool Translator::IsAvailable()
+{
+#if defined(__x86_64__) && !defined(_WIN32)
+	return true;
+#else
+	return false;
+#endif
+}
+
+Translator::Translator()
+	: buffer(NULL),
+	  used(0),
+	  cache(new Entry[kCacheSize])
+{
+	void* p = mmap(NULL, kBufferSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+	               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	// without a code buffer, no block is ever translated
+	if (p != MAP_FAILED)
+		buffer = (unsigned char*) p;
+	flush();
+}
+
+Translator::~Translator()
+{
+	if (buffer != NULL)
+		munmap(buffer, kBufferSize);
+}
+
+Translator::NativeCode Translator::Lookup(const BasicBlock* blk, Word vaddr, unsigned int* length)
+{
+	Entry* e = &cache[(blk->paddr >> WORDSHIFT) & (kCacheSize - 1)];
+
+	if (e->paddr != blk->paddr || e->vaddr != vaddr) {
+		e->paddr = blk->paddr;
+		e->vaddr = vaddr;
+		e->epoch = blk->epoch;
+		e->hits = 0;
+		e->code = NULL;
+	} else if (e->epoch != blk->epoch) {
+		// a block rebuilt after its page epoch moved on keeps its code,
+		// and how hot it is, as long as the instructions are the same:
+		// evictions from the decoded instructions cache and stores of
+		// the same word do not change them. One which could not be
+		// translated is tried again
+		if (e->code != NULL ? !sameWords(e, blk) : e->hits >= kHotThreshold) {
+			e->hits = 0;
+			e->code = NULL;
+		}
+		e->epoch = blk->epoch;
+	}
+
+	if (e->code == NULL) {
+		// blocks which cannot be translated are counted past the
+		// threshold, so that they are not tried again meanwhile
+		if (buffer == NULL || e->hits >= kHotThreshold || ++e->hits < kHotThreshold)
+			return NULL;
+		if (!translate(e, blk)) {
+			e->hits = kHotThreshold;
+			return NULL;
+		}
+	}
+
+	*length = e->length;
+	return e->code;
+}
+
+// This method returns TRUE if blk starts with the instructions e was
+// translated from
+bool Translator::sameWords(const Entry* e, const BasicBlock* blk)
+{
+	if (blk->length < e->length)
+		return false;
+	for (unsigned int i = 0; i < e->length; i++)
+		if (blk->instrs[i].instr != e->words[i])
+			return false;
+	return true;
+}
+
+// This method drops all native code
+void Translator::flush()
+{
+	used = 0;
+	for (unsigned int i = 0; i < kCacheSize; i++) {
+		cache[i].paddr = MAXWORDVAL;
+		cache[i].code = NULL;
+	}
+}
+
+// This method returns the NativeOp which implements di, thru the
+// Processor handler Decode() chose for it
+unsigned int Translator::classify(const DecodedInstr* di)
+{
+	static const struct {
+		DecodedInstr::Handler handler;
+		NativeOp op;
+	} ops[] = {
+		{ &Processor::execNop, OP_NOP },
+		{ &Processor::execAddu, OP_ADDU },
+		{ &Processor::execSubu, OP_SUBU },
+		{ &Processor::execAnd, OP_AND },
+		{ &Processor::execOr, OP_OR },
+		{ &Processor::execXor, OP_XOR },
+		{ &Processor::execNor, OP_NOR },
+		{ &Processor::execSlt, OP_SLT },
+		{ &Processor::execSltu, OP_SLTU },
+		{ &Processor::execSll, OP_SLL },
+		{ &Processor::execSrl, OP_SRL },
+		{ &Processor::execSra, OP_SRA },
+		{ &Processor::execSllv, OP_SLLV },
+		{ &Processor::execSrlv, OP_SRLV },
+		{ &Processor::execSrav, OP_SRAV },
+		{ &Processor::execMfhi, OP_MFHI },
+		{ &Processor::execMflo, OP_MFLO },
+		{ &Processor::execAddiu, OP_ADDIU },
+		{ &Processor::execAndi, OP_ANDI },
+		{ &Processor::execOri, OP_ORI },
+		{ &Processor::execXori, OP_XORI },
+		{ &Processor::execSlti, OP_SLTI },
+		{ &Processor::execSltiu, OP_SLTIU },
+		{ &Processor::execLui, OP_LUI },
+		{ &Processor::execLw, OP_LW },
+		{ &Processor::execSw, OP_SW },
+		{ &Processor::execBeq, OP_BEQ },
+		{ &Processor::execBne, OP_BNE },
+		{ &Processor::execBlez, OP_BLEZ },
+		{ &Processor::execBgtz, OP_BGTZ },
+		{ &Processor::execBltz, OP_BLTZ },
+		{ &Processor::execBgez, OP_BGEZ },
+		{ &Processor::execBltzal, OP_BLTZAL },
+		{ &Processor::execBgezal, OP_BGEZAL },
+		{ &Processor::execJ, OP_J },
+		{ &Processor::execJal, OP_JAL },
+		{ &Processor::execJr, OP_JR },
+		{ &Processor::execJalr, OP_JALR }
+	};
+
+	for (unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+		if (di->handler == ops[i].handler)
+			return ops[i].op;
+	return OP_NONE;
+}
+
+// This method translates the longest prefix of blk which can be run
+// natively, as entered at e->vaddr, and sets e->code and e->length. A
+// branch is only taken in together with its delay slot, which must be
+// an ALU instruction, and ends the block; a load may not be the last
+// instruction of a block, so that no delayed load is left pending. It
+// returns FALSE if no prefix is long enough to be worth translating
+bool Translator::translate(Entry* e, const BasicBlock* blk)
+{
+	const DecodedInstr* const instrs = blk->instrs;
+	const Word vaddr = e->vaddr;
+
+	unsigned int n = 0;
+	bool branch = false;
+	while (n < blk->length) {
+		const unsigned int op = classify(&instrs[n]);
+		if (isAlu(op) || op == OP_LW || op == OP_SW) {
+			n++;
+			continue;
+		}
+		if (isBranch(op) && n + 1 < blk->length && isAlu(classify(&instrs[n + 1]))) {
+			n += 2;
+			branch = true;
+		}
+		break;
+	}
+	while (!branch && n > 0 && classify(&instrs[n - 1]) == OP_LW)
+		n--;
+	if (n < kMinLength)
+		return false;
+
+	// no instruction and its exit stubs take more than this, and the
+	// raw instruction words are kept after the code
+	const size_t maxSize = 128 * (n + 1) + (n + 1) * WORDLEN;
+	if (kBufferSize - used < maxSize) {
+		const Entry saved = *e;
+		flush();
+		*e = saved;
+	}
+
+	CodeEmitter as(buffer + used);
+	unsigned char* const start = as.Pos();
+	as.Prologue();
+	unsigned char* const top = as.Pos();
+	as.SubBudget(n);
+
+	std::vector<NativeExit> exits;
+	unsigned int pending = 0;
+	for (unsigned int j = 0; j < n; j++) {
+		const DecodedInstr* di = &instrs[j];
+		const unsigned int op = classify(di);
+		const Word pc = vaddr + j * WORDLEN;
+
+		// an access which is not done natively leaves the block right
+		// before the instruction, once the delayed load is completed
+		NativeExit before;
+		before.next = pc;
+		before.refund = n - j;
+		before.hasLast = (j > 0);
+		before.lastPC = pc - WORDLEN;
+		before.lastInstr = (j > 0) ? instrs[j - 1].instr : 0;
+
+		if (isAlu(op)) {
+			emitAlu(as, op, di, &pending);
+		} else if (isBranch(op)) {
+			emitBranch(as, op, di, pc, &pending);
+		} else if (op == OP_LW) {
+			completeLoad(as, &pending);
+			as.LoadGPR(ESI, di->rs);
+			if (di->imm != 0)
+				as.AddESI(di->imm);
+			as.Call((const void*) &Processor::nativeLoad);
+			as.HighHalf();
+			before.jump = as.Jcc(CC_NE);
+			exits.push_back(before);
+			if (di->rt != 0) {
+				as.MovR13EAX();
+				pending = di->rt;
+			}
+		} else {
+			completeLoad(as, &pending);
+			as.LoadGPR(ESI, di->rs);
+			if (di->imm != 0)
+				as.AddESI(di->imm);
+			as.LoadGPR(EDX, di->rt);
+			as.Call((const void*) &Processor::nativeStore);
+			as.CmpEAX8(NATIVE_STORE_REFUSED);
+			before.jump = as.Jcc(CC_E);
+			exits.push_back(before);
+
+			// code was written: the rest of the block may be stale
+			NativeExit after;
+			after.jump = as.Jcc(CC_A);
+			after.next = pc + WORDLEN;
+			after.refund = n - j - 1;
+			after.hasLast = true;
+			after.lastPC = pc;
+			after.lastInstr = di->instr;
+			exits.push_back(after);
+		}
+	}
+	assert(pending == 0);
+
+	as.SetLast(vaddr + (n - 1) * WORDLEN, instrs[n - 1].instr);
+	if (branch) {
+		// a branch back to the block takes another pass, as long as
+		// the budget allows for a whole one
+		as.CmpR8(vaddr);
+		unsigned char* out = as.Jcc(CC_NE);
+		as.CmpBudget(n);
+		unsigned char* low = as.Jcc(CC_B);
+		CodeEmitter::Bind(as.Jmp(), top);
+		CodeEmitter::Bind(out, as.Pos());
+		CodeEmitter::Bind(low, as.Pos());
+		as.MovEAXR8();
+	} else {
+		as.MovImm(EAX, vaddr + n * WORDLEN);
+	}
+	unsigned char* const epilogue = as.Pos();
+	as.Epilogue();
+
+	for (const NativeExit& x : exits) {
+		CodeEmitter::Bind(x.jump, as.Pos());
+		if (x.refund != 0)
+			as.AddBudget(x.refund);
+		if (x.hasLast)
+			as.SetLast(x.lastPC, x.lastInstr);
+		as.MovImm(EAX, x.next);
+		CodeEmitter::Bind(as.Jmp(), epilogue);
+	}
+
+	Word* const words = (Word*) (as.Pos() + (-(uintptr_t) as.Pos() & (WORDLEN - 1)));
+	for (unsigned int j = 0; j < n; j++)
+		words[j] = instrs[j].instr;
+
+	assert((size_t) ((unsigned char*) (words + n) - start) <= maxSize);
+	used += (unsigned char*) (words + n) - start;
+
+	e->code = (NativeCode) start;
+	e->words = words;
+	e->length = n;
+	return true;
+}
@@ -0,0 +1,132 @@
+/*
+ * uMPS - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef UMPS_TRANSLATOR_H
+#define UMPS_TRANSLATOR_H
+
+#include <stddef.h>
+
+#include "base/lang.h"
+#include "umps/types.h"
+
+class Processor;
+struct BasicBlock;
+struct DecodedInstr;
+
+// A NativeFrame is the state native code shares with the processor
+// running it (see Processor::runNative()), besides the register file
+struct NativeFrame {
+// processor running the code, for data accesses
+	Processor* cpu;
+
+// cycles left: each pass thru a block takes its length off, and the
+// instructions it did not complete are given back when it is left
+// early
+	uint32_t budget;
+
+// virtual address and raw word of the last instruction completed
+	Word lastPC;
+	Word lastInstr;
+};
+
+// Results of Processor::nativeStore(): the store was done, it was not
+// (and must be made thru the full path), or it was done but overwrote
+// a cached instruction, so native code must be left right after it
+enum NativeStoreResult {
+	NATIVE_STORE_DONE,
+	NATIVE_STORE_REFUSED,
+	NATIVE_STORE_CODE_WRITTEN
+};
+
+
+// This class implements the native code tier of the threaded execution
+// engine: blocks which are entered often enough are translated into
+// x86-64 code, which the processor runs in place of the interpreter as
+// long as nothing but itself can change the machine state.
+//
+// Only instructions which cannot raise exceptions are translated: the
+// ALU instructions without overflow checks, the branches and jumps
+// (with their delay slot) and the LW and SW instructions, whose data
+// accesses go thru Processor::nativeLoad() and nativeStore() and fall
+// back to the interpreter for anything but RAM reached thru KSEG0 or
+// the data micro-TLB. A block is cut before the first instruction
+// which is not translated, so that COP0 instructions, traps, syscalls
+// and all other exception sources are always interpreted.
+//
+// A native block is valid for the virtual address it was translated
+// at, as branch targets and link addresses depend on it, and for the
+// DecodeCache page epoch of the block it comes from, so that any write
+// to its instructions makes it stale; when the epoch moves on, the code
+// is kept if the block still holds the same instruction words, which
+// are saved with it. A pass thru a block which ends
+// with a branch back to the block itself is repeated within native
+// code, while the cycles budget lasts.
+
+class Translator {
+public:
+	typedef Word (*NativeCode)(SWord* gpr, NativeFrame* frame);
+
+// This method returns TRUE if native code can run on this host
+	static bool IsAvailable();
+
+	Translator();
+	~Translator();
+
+// This method returns the native code for blk, entered at virtual
+// address vaddr, and thru length the number of instructions a pass
+// thru it takes at most. It returns NULL if the block is not hot yet,
+// or cannot be translated. The code returns the virtual address of
+// the next instruction to execute
+	NativeCode Lookup(const BasicBlock* blk, Word vaddr, unsigned int* length);
+
+private:
+	struct Entry {
+		Word paddr;
+		Word vaddr;
+		uint32_t epoch;
+		unsigned int hits;
+		unsigned int length;
+		NativeCode code;
+		// raw words of the instructions translated
+		const Word* words;
+	};
+
+	static const unsigned int kCacheSize = 4096;
+
+	// number of lookups after which a block is translated
+	static const unsigned int kHotThreshold = 32;
+
+	static const size_t kBufferSize = 4U << 20;
+
+	// shortest block worth translating
+	static const unsigned int kMinLength = 2;
+
+	static unsigned int classify(const DecodedInstr* di);
+	static bool sameWords(const Entry* e, const BasicBlock* blk);
+	bool translate(Entry* e, const BasicBlock* blk);
+	void flush();
+
+	unsigned char* buffer;
+	size_t used;
+
+	scoped_array<Entry> cache;
+
+	DISABLE_COPY_AND_ASSIGNMENT(Translator);
+};
+
+#endif // UMPS_TRANSLATOR_H
@@ -36,6 +36,8 @@
 #include <sys/uio.h>
 #include <sys/poll.h>
 
+#include <mutex>
+
 #include "umps/const.h"
 #include "umps/types.h"
 #include "umps/blockdev_params.h"
@@ -60,8 +62,9 @@ struct request_v3 {
 #define MAXPACKETLEN 1536
 
 HIDDEN struct vdepluglib vdepluglib;
-HIDDEN char strbuf[STRBUFLEN];
-HIDDEN char packbuf[MAXPACKETLEN];
+HIDDEN std::once_flag vdepluglibOnce;
+HIDDEN thread_local char strbuf[STRBUFLEN];
+HIDDEN thread_local char packbuf[MAXPACKETLEN];
 
 
 class netblock {
@@ -97,8 +100,7 @@ unsigned int testnetinterface(const char *name)
 	char name2[1024];
 	int size;
 
-	if (!vdepluglib.dl_handle)
-		libvdeplug_dynopen(vdepluglib);
+	std::call_once(vdepluglibOnce, [] { libvdeplug_dynopen(vdepluglib); });
 	/* vde lib does not exist */
 	if (vdepluglib.dl_handle == NULL)
 		return 0;